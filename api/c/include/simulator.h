@@ -69,6 +69,33 @@ typedef enum TurnDirection {
   TurnDirectionRight
 } TurnDirection;
 
+/** Represents the kinds of actions that an agent
+ *  can take in a single time step. */
+typedef enum ActionType {
+  ActionTypeMove = 0,
+  ActionTypeTurn,
+  ActionTypeNoOp
+} ActionType;
+
+/** A single agent action, as submitted to `simulatorActBatch`.
+ *  `moveDirection` and `numSteps` are only used by moves, and
+ *  `turnDirection` is only used by turns. */
+typedef struct AgentAction {
+  ActionType type;
+  Direction moveDirection;
+  TurnDirection turnDirection;
+  unsigned int numSteps;
+} AgentAction;
+
+/** Conditions under which an action plan, submitted with
+ *  `simulatorSubmitPlan`, stops before all of its actions
+ *  are taken. These are flags, which may be combined. */
+typedef enum PlanAbortCondition {
+  PlanAbortNever = 0,
+  PlanAbortItemVisible = 1,
+  PlanAbortBlocked = 2
+} PlanAbortCondition;
+
 typedef enum MovementConflictPolicy {
   MovementConflictPolicyNoCollisions = 0,
   MovementConflictPolicyFirstComeFirstServe,
@@ -167,6 +194,16 @@ typedef struct SimulatorConfig {
   float scentDecay;
   float scentDiffusion;
   unsigned int removedItemLifetime;
+
+  /* The number of most recent observations kept for each agent (see
+     `simulatorPinObservationHistories`). This must be at least 1. */
+  unsigned int historyLength;
+
+  /* Reward Schema (see `simulatorGetRewards`). `rewardItemDeltas`
+     has one element per item type, and may be NULL. */
+  float* rewardItemDeltas;
+  float rewardPerStep;
+  float rewardPerDistance;
 } SimulatorConfig;
 
 typedef struct SimulatorInfo {
@@ -253,6 +290,59 @@ void simulatorSave(
   const char* filePath,
   JBW_Status* status);
 
+/** Creates a snapshot of the current state of the given local simulator,
+ *  to which it can later be reset with `simulatorRestore`. The snapshot
+ *  shares the patches of the world copy-on-write, so this is much cheaper
+ *  than saving the simulator. The returned handle must be freed with
+ *  `simulatorDelete`. */
+void* simulatorSnapshot(
+  void* simulatorHandle,
+  JBW_Status* status);
+
+/** Resets the given local simulator to the state of `snapshotHandle`,
+ *  which was created by `simulatorSnapshot` from this simulator. The
+ *  snapshot is unchanged, so the simulator can be restored from it
+ *  repeatedly. If the restore fails, the simulator is unchanged. */
+void simulatorRestore(
+  void* simulatorHandle,
+  void* snapshotHandle,
+  JBW_Status* status);
+
+/** Creates a batch of `numWorlds` independent local simulators with the
+ *  given configuration, each containing a single agent, which are stepped
+ *  together by `simulatorBatchStep`. World `i` is seeded with
+ *  `config->randomSeed + i`. If `itemRewards` is not NULL, it contains the
+ *  reward for collecting one item of each type, which replaces
+ *  `config->rewardItemDeltas`. The returned handle must be freed with
+ *  `simulatorBatchDelete`. */
+void* simulatorBatchCreate(
+  const SimulatorConfig* config,
+  unsigned int numWorlds,
+  const float* itemRewards,
+  JBW_Status* status);
+
+void simulatorBatchDelete(
+  void* batchHandle);
+
+/** Submits `actions[i]` for the agent in world `i`, for every world in
+ *  the batch, and advances the worlds in parallel. The status of each
+ *  action is written to `results`. Then, the position and direction of
+ *  the agent in each world `i` are written to `positions[i]` and
+ *  `directions[i]`, its scent and visual field are written to
+ *  `scents + i*scentDimension` and `visions + i*visionSize` (where
+ *  `visionSize` is `(2*visionRange + 1)^2 * colorDimension`), and its
+ *  reward in this step is written to `rewards[i]`. */
+void simulatorBatchStep(
+  void* batchHandle,
+  const AgentAction* actions,
+  JBW_Status* results,
+  Position* positions,
+  Direction* directions,
+  float* scents,
+  float* visions,
+  float* rewards,
+  JBW_Status* status);
+
 void simulatorSetStepCallbackData(
   void* simulatorHandle,
   const void* callbackData);
@@ -311,6 +401,59 @@ void simulatorNoOpAgent(
   uint64_t agentId,
   JBW_Status* status);
 
+void simulatorActBatch(
+  void* simulatorHandle,
+  void* clientHandle,
+  const uint64_t* agentIds,
+  const AgentAction* actions,
+  unsigned int numActions,
+  JBW_Status* results,
+  JBW_Status* status);
+
+void simulatorSubmitPlan(
+  void* simulatorHandle,
+  void* clientHandle,
+  uint64_t agentId,
+  const AgentAction* actions,
+  unsigned int numActions,
+  unsigned int abortConditions,
+  JBW_Status* status);
+
+/** Copies the rewards of the given agents in the last time step, which
+ *  the simulator evaluates from the reward schema in its configuration,
+ *  into `rewards`. This is only supported for local simulators, so
+ *  `clientHandle` must be NULL. */
+void simulatorGetRewards(
+  void* simulatorHandle,
+  void* clientHandle,
+  const uint64_t* agentIds,
+  unsigned int numAgents,
+  float* rewards,
+  JBW_Status* status);
+
+/** Locates the last `historyLength` observations of each of the given
+ *  agents in the observation slab of the simulator, without copying them,
+ *  and returns the slab. The history of agent `i` consists of
+ *  `historyLength` observations, oldest first, starting at
+ *  `slab + offsets[i]`, each of which is the scent followed by the visual
+ *  field, starting `*stride` floats apart. The slab is not freed until
+ *  `simulatorUnpinObservationHistories` is called once for every call to
+ *  this function, but the simulator writes the observations in place, so
+ *  the offsets are only valid until the next simulation step, or until
+ *  agents are added or removed. This is only supported for local
+ *  simulators, so `clientHandle` must be NULL. */
+const float* simulatorPinObservationHistories(
+  void* simulatorHandle,
+  void* clientHandle,
+  const uint64_t* agentIds,
+  unsigned int numAgents,
+  uint64_t* offsets,
+  uint64_t* stride,
+  JBW_Status* status);
+
+void simulatorUnpinObservationHistories(
+  void* simulatorHandle);
+
 void simulatorSetActive(
   void* simulatorHandle,
   void* clientHandle,
@@ -25,6 +25,7 @@
 #include "gibbs_field.h"
 #include "mpi.h"
 #include "simulator.h"
+#include "simulator_batch.h"
 #include "status.h"
 
 using namespace core;
@@ -93,6 +94,17 @@ inline direction to_direction(TurnDirection dir) {
 }
 
 
+inline action to_action(const AgentAction& a) {
+  switch (a.type) {
+  case ActionTypeMove: return {action_type::MOVE, to_direction(a.moveDirection), a.numSteps};
+  case ActionTypeTurn: return {action_type::TURN, to_direction(a.turnDirection), 0};
+  case ActionTypeNoOp: return {action_type::DO_NOTHING, direction::UP, 0};
+  }
+  fprintf(stderr, "to_action ERROR: Unrecognized ActionType.\n");
+  exit(EXIT_FAILURE);
+}
+
+
 inline MovementConflictPolicy to_MovementConflictPolicy(movement_conflict_policy policy) {
   switch (policy) {
   case movement_conflict_policy::NO_COLLISIONS:
@@ -524,6 +536,19 @@ inline void init(simulator_config& config, const SimulatorConfig& src, JBW_Statu
   config.decay_param = src.scentDecay;
   config.diffusion_param = src.scentDiffusion;
   config.deleted_item_lifetime = src.removedItemLifetime;
+  config.history_length = src.historyLength;
+
+  config.reward_per_step = src.rewardPerStep;
+  config.reward_per_distance = src.rewardPerDistance;
+  if (src.rewardItemDeltas != nullptr) {
+    config.reward_item_deltas = (float*) malloc(sizeof(float) * max(1u, src.numItemTypes));
+    if (config.reward_item_deltas == nullptr) {
+      status->code = JBW_OUT_OF_MEMORY;
+      return;
+    }
+    for (unsigned int i = 0; i < src.numItemTypes; i++)
+      config.reward_item_deltas[i] = src.rewardItemDeltas[i];
+  }
 }
 
 
@@ -575,6 +600,20 @@ inline void init(
   config.scentDecay = src.decay_param;
   config.scentDiffusion = src.diffusion_param;
   config.removedItemLifetime = src.deleted_item_lifetime;
+  config.historyLength = src.history_length;
+
+  config.rewardPerStep = src.reward_per_step;
+  config.rewardPerDistance = src.reward_per_distance;
+  config.rewardItemDeltas = nullptr;
+  if (src.reward_item_deltas != nullptr) {
+    config.rewardItemDeltas = (float*) malloc(sizeof(float) * max((size_t) 1, src.item_types.length));
+    if (config.rewardItemDeltas == nullptr) {
+      status->code = JBW_OUT_OF_MEMORY;
+      return;
+    }
+    for (unsigned int i = 0; i < src.item_types.length; i++)
+      config.rewardItemDeltas[i] = src.reward_item_deltas[i];
+  }
 }
 
 
@@ -732,6 +771,35 @@ inline bool init(simulator_data& data, const simulator_data& src) {
 }
 
 
+/**
+ * The additional state of each world in a batch created by
+ * `simulatorBatchCreate`. The worlds are only stepped by
+ * `simulatorBatchStep`, which returns the observations directly, so no
+ * callback is invoked.
+ */
+struct batch_data {
+  static inline void free(batch_data& data) { }
+};
+
+inline bool init(batch_data& data, const batch_data& src) {
+  return true;
+}
+
+
+/**
+ * A batch of worlds created by `simulatorBatchCreate`, along with buffers
+ * for converting the actions, results, and agent positions and directions
+ * of each step, so that `simulatorBatchStep` does not allocate memory.
+ */
+struct batch_handle {
+  simulator_batch<batch_data> batch;
+  action* actions;
+  jbw::status* results;
+  position* positions;
+  direction* directions;
+};
+
+
 /**
  * A struct containing additional state information for the client. This
  * information includes responses from the server, pointers to callback
@@ -751,6 +819,12 @@ struct client_data {
     size_t length;
   };
 
+  struct action_result_array {
+    uint64_t* ids;
+    status* results;
+    size_t length;
+  };
+
   /* storing the server responses */
   status server_response;
   union response_data {
@@ -761,6 +835,7 @@ struct client_data {
     pair<uint64_t*, size_t> agent_ids;
     agent_state_array agent_states;
     semaphore_array semaphores;
+    action_result_array action_results;
   } response_data;
 
   /* for synchronization */
@@ -841,6 +916,17 @@ void on_step(
 }
 
 
+/**
+ * The worlds in a batch invoke this function after each step, but the
+ * observations are returned by `simulatorBatchStep` instead.
+ */
+void on_step(
+  simulator<batch_data>* sim,
+  const hash_map<uint64_t, agent_state*>& agents,
+  uint64_t time
+) { }
+
+
 /**
  * Client callback functions.
  */
@@ -1057,6 +1143,76 @@ void on_do_nothing(client<client_data>& c, uint64_t agent_id, status response) {
 }
 
 
+/**
+ * The callback invoked when the client receives an act_batch response from
+ * the server. This function moves the result into
+ * `c.data.response_data.action_results` and wakes up the parent thread (which
+ * should be waiting in the `simulatorActBatch` function) so that it can return
+ * the response.
+ *
+ * \param   c         The client that received the response.
+ * \param   response  The response from the server, containing information
+ *                    about any errors.
+ * \param   agent_ids The IDs of the agents in the batch.
+ * \param   results   The result of each action in the batch.
+ * \param   count     The length of `agent_ids` and `results`.
+ */
+void on_act_batch(client<client_data>& c, status response,
+  uint64_t* agent_ids, status* results, size_t count)
+{
+  std::unique_lock<std::mutex> lck(c.data.lock);
+  c.data.waiting_for_server = false;
+  c.data.response_data.action_results.ids = agent_ids;
+  c.data.response_data.action_results.results = results;
+  c.data.response_data.action_results.length = count;
+  c.data.server_response = response;
+  c.data.cv.notify_one();
+}
+
+
+/**
+ * The callback invoked when the client receives a submit_plan response from
+ * the server. This function copies the result into `c.data.server_response`
+ * and wakes up the parent thread (which should be waiting in the
+ * `simulatorSubmitPlan` function) so that it can return the response.
+ *
+ * \param   c               The client that received the response.
+ * \param   agent_id        The ID of the agent that submitted the plan.
+ * \param   response        The response from the server, containing
+ *                          information about any errors.
+ */
+void on_submit_plan(client<client_data>& c, uint64_t agent_id, status response) {
+  std::unique_lock<std::mutex> lck(c.data.lock);
+  c.data.waiting_for_server = false;
+  c.data.server_response = response;
+  c.data.cv.notify_one();
+}
+
+
+/**
+ * The callback invoked when the action plans of any agents of this client
+ * end. The step callback is invoked again once the plans of all agents of
+ * this client have ended, so this function only frees the arrays.
+ */
+void on_plan_ended(client<client_data>& c, uint64_t* agent_ids,
+  plan_status* results, unsigned int* action_counts, size_t count)
+{
+  if (agent_ids != nullptr) free(agent_ids);
+  if (results != nullptr) free(results);
+  if (action_counts != nullptr) free(action_counts);
+}
+
+
+/**
+ * The callback invoked when the client receives a get_stats response from the
+ * server. The C API does not request step profiles, so this function should
+ * not be called.
+ */
+void on_get_stats(client<client_data>& c, status response, const step_profile& profile) {
+  fprintf(stderr, "WARNING: `on_get_stats` should not be called.\n");
+}
+
+
 /**
  * The callback invoked when the client receives a get_map response from the
  * server. This function moves the result into `c.data.response_data.map` and
@@ -1384,12 +1540,129 @@ SimulatorInfo simulatorLoad(
 }
 
 
+void* simulatorSnapshot(void* simulatorHandle, JBW_Status* status) {
+  simulator<simulator_data>* sim = (simulator<simulator_data>*) simulatorHandle;
+  simulator<simulator_data>* snapshot = (simulator<simulator_data>*) malloc(
+    sizeof(simulator<simulator_data>));
+  if (snapshot == nullptr) {
+    status->code = JBW_OUT_OF_MEMORY;
+    return nullptr;
+  }
+  auto result = sim->snapshot(*snapshot);
+  if (result != status::OK) {
+    JBW_SetJBWStatusFromStatus(status, result);
+    free(snapshot);
+    return nullptr;
+  }
+  return (void*) snapshot;
+}
+
+
+void simulatorRestore(void* simulatorHandle, void* snapshotHandle, JBW_Status* status) {
+  simulator<simulator_data>* sim = (simulator<simulator_data>*) simulatorHandle;
+  simulator<simulator_data>* snapshot = (simulator<simulator_data>*) snapshotHandle;
+
+  /* the simulator keeps its own data, so we copy the IDs of the agents and
+     semaphores that it owns from the snapshot */
+  simulator_data& data = sim->get_data();
+  const simulator_data& snapshot_data = snapshot->get_data();
+  if (!data.agent_ids.ensure_capacity(snapshot_data.agent_ids.length)
+   || !data.semaphore_ids.ensure_capacity(snapshot_data.semaphore_ids.length))
+  {
+    status->code = JBW_OUT_OF_MEMORY;
+    return;
+  }
+
+  auto result = sim->restore(*snapshot);
+  if (result != status::OK) {
+    JBW_SetJBWStatusFromStatus(status, result);
+    return;
+  }
+  data.agent_ids.clear();
+  data.agent_ids.append(snapshot_data.agent_ids.data, snapshot_data.agent_ids.length);
+  data.semaphore_ids.clear();
+  data.semaphore_ids.append(snapshot_data.semaphore_ids.data, snapshot_data.semaphore_ids.length);
+}
+
+
 void simulatorDelete(void* simulatorHandle) {
   simulator<simulator_data>* sim = (simulator<simulator_data>*) simulatorHandle;
   free(*sim);
   free(sim);
 }
 
+void* simulatorBatchCreate(
+  const SimulatorConfig* config,
+  unsigned int numWorlds,
+  const float* itemRewards,
+  JBW_Status* status
+) {
+  simulator_config sim_config;
+  init(sim_config, *config, status);
+  if (status->code != JBW_OK) return nullptr;
+  batch_handle* handle = (batch_handle*) malloc(sizeof(batch_handle));
+  if (handle == nullptr) {
+    status->code = JBW_OUT_OF_MEMORY;
+    return nullptr;
+  }
+  handle->actions = (action*) malloc(sizeof(action) * max(1u, numWorlds));
+  handle->results = (jbw::status*) malloc(sizeof(jbw::status) * max(1u, numWorlds));
+  handle->positions = (position*) malloc(sizeof(position) * max(1u, numWorlds));
+  handle->directions = (direction*) malloc(sizeof(direction) * max(1u, numWorlds));
+  if (handle->actions == nullptr || handle->results == nullptr
+   || handle->positions == nullptr || handle->directions == nullptr
+   || !init(handle->batch, sim_config, batch_data(), numWorlds, itemRewards, config->randomSeed, std::thread::hardware_concurrency()))
+  {
+    if (handle->actions != nullptr) free(handle->actions);
+    if (handle->results != nullptr) free(handle->results);
+    if (handle->positions != nullptr) free(handle->positions);
+    if (handle->directions != nullptr) free(handle->directions);
+    free(handle);
+    status->code = JBW_OUT_OF_MEMORY;
+    return nullptr;
+  }
+  return (void*) handle;
+}
+
+
+void simulatorBatchDelete(void* batchHandle) {
+  batch_handle* handle = (batch_handle*) batchHandle;
+  free(handle->batch);
+  free(handle->actions);
+  free(handle->results);
+  free(handle->positions);
+  free(handle->directions);
+  free(handle);
+}
+
+
+void simulatorBatchStep(
+  void* batchHandle,
+  const AgentAction* actions,
+  JBW_Status* results,
+  Position* positions,
+  Direction* directions,
+  float* scents,
+  float* visions,
+  float* rewards,
+  JBW_Status* status
+) {
+  batch_handle* handle = (batch_handle*) batchHandle;
+  unsigned int world_count = handle->batch.world_count;
+  for (unsigned int i = 0; i < world_count; i++)
+    handle->actions[i] = to_action(actions[i]);
+
+  handle->batch.step(handle->actions, handle->results,
+      handle->positions, handle->directions, scents, visions, rewards);
+
+  for (unsigned int i = 0; i < world_count; i++) {
+    JBW_SetJBWStatusFromStatus(&results[i], handle->results[i]);
+    positions[i].x = handle->positions[i].x;
+    positions[i].y = handle->positions[i].y;
+    directions[i] = to_Direction(handle->directions[i]);
+  }
+}
+
 void simulatorSetStepCallbackData(void* simulatorHandle, const void* callbackData) {
   simulator<simulator_data>* sim = (simulator<simulator_data>*) simulatorHandle;
   simulator_data& sim_data = sim->get_data();
@@ -1797,6 +2070,198 @@ void simulatorNoOpAgent(
 }
 
 
+void simulatorActBatch(
+  void* simulatorHandle,
+  void* clientHandle,
+  const uint64_t* agentIds,
+  const AgentAction* actions,
+  unsigned int numActions,
+  JBW_Status* results,
+  JBW_Status* status
+) {
+  action* batch = (action*) malloc(max((size_t) 1, sizeof(action) * numActions));
+  if (batch == nullptr) {
+    status->code = JBW_OUT_OF_MEMORY;
+    return;
+  }
+  for (unsigned int i = 0; i < numActions; i++)
+    batch[i] = to_action(actions[i]);
+
+  if (clientHandle == nullptr) {
+    /* the simulation is local, so call act directly */
+    simulator<simulator_data>* sim_handle = (simulator<simulator_data>*) simulatorHandle;
+    jbw::status* batch_results = (jbw::status*) malloc(max((size_t) 1, sizeof(jbw::status) * numActions));
+    if (batch_results == nullptr) {
+      status->code = JBW_OUT_OF_MEMORY;
+      free(batch); return;
+    }
+    sim_handle->act(agentIds, batch, numActions, batch_results);
+    for (unsigned int i = 0; i < numActions; i++)
+      JBW_SetJBWStatusFromStatus(&results[i], batch_results[i]);
+    free(batch); free(batch_results);
+  } else {
+    /* this is a client, so send an act_batch message to the server */
+    client<client_data>* client_handle = (client<client_data>*) clientHandle;
+    if (!client_handle->client_running) {
+      status->code = JBW_LOST_CONNECTION;
+      free(batch); return;
+    }
+
+    client_handle->data.waiting_for_server = true;
+    if (!send_act_batch(*client_handle, agentIds, batch, numActions)) {
+      status->code = JBW_MPI_ERROR;
+      free(batch); return;
+    }
+    free(batch);
+
+    /* wait for response from server */
+    wait_for_server(*client_handle);
+
+    if (client_handle->data.server_response != status::OK) {
+      JBW_SetJBWStatusFromStatus(status, client_handle->data.server_response);
+      return;
+    }
+
+    /* the server returns the results in the same order as the submitted batch */
+    client_data::action_result_array& response = client_handle->data.response_data.action_results;
+    for (unsigned int i = 0; i < numActions; i++) {
+      if (i < response.length && response.ids[i] == agentIds[i])
+        JBW_SetJBWStatusFromStatus(&results[i], response.results[i]);
+      else results[i].code = JBW_CLIENT_PARSE_MESSAGE_ERROR;
+    }
+    free(response.ids); free(response.results);
+  }
+}
+
+
+void simulatorSubmitPlan(
+  void* simulatorHandle,
+  void* clientHandle,
+  uint64_t agentId,
+  const AgentAction* actions,
+  unsigned int numActions,
+  unsigned int abortConditions,
+  JBW_Status* status
+) {
+  action* plan = (action*) malloc(max((size_t) 1, sizeof(action) * numActions));
+  if (plan == nullptr) {
+    status->code = JBW_OUT_OF_MEMORY;
+    return;
+  }
+  for (unsigned int i = 0; i < numActions; i++)
+    plan[i] = to_action(actions[i]);
+
+  if (clientHandle == nullptr) {
+    /* the simulation is local, so call submit_plan directly */
+    simulator<simulator_data>* sim_handle = (simulator<simulator_data>*) simulatorHandle;
+    auto result = sim_handle->submit_plan(agentId, plan, numActions, (uint8_t) abortConditions);
+    free(plan);
+    if (result != status::OK) {
+      JBW_SetJBWStatusFromStatus(status, result);
+      return;
+    }
+  } else {
+    /* this is a client, so send a submit_plan message to the server */
+    client<client_data>* client_handle = (client<client_data>*) clientHandle;
+    if (!client_handle->client_running) {
+      status->code = JBW_LOST_CONNECTION;
+      free(plan); return;
+    }
+
+    client_handle->data.waiting_for_server = true;
+    if (!send_submit_plan(*client_handle, agentId, plan, numActions, (uint8_t) abortConditions)) {
+      status->code = JBW_MPI_ERROR;
+      free(plan); return;
+    }
+    free(plan);
+
+    /* wait for response from server */
+    wait_for_server(*client_handle);
+
+    if (client_handle->data.server_response != status::OK) {
+      JBW_SetJBWStatusFromStatus(status, client_handle->data.server_response);
+      return;
+    }
+  }
+}
+
+
+void simulatorGetRewards(
+  void* simulatorHandle,
+  void* clientHandle,
+  const uint64_t* agentIds,
+  unsigned int numAgents,
+  float* rewards,
+  JBW_Status* status
+) {
+  if (clientHandle != nullptr) {
+    /* rewards are only available for local simulators */
+    status->code = JBW_MPI_ERROR;
+    return;
+  }
+
+  simulator<simulator_data>* sim_handle = (simulator<simulator_data>*) simulatorHandle;
+  jbw::status* results = (jbw::status*) malloc(max((size_t) 1, sizeof(jbw::status) * numAgents));
+  if (results == nullptr) {
+    status->code = JBW_OUT_OF_MEMORY;
+    return;
+  }
+  sim_handle->get_rewards(agentIds, numAgents, rewards, results);
+  for (unsigned int i = 0; i < numAgents; i++) {
+    if (results[i] != status::OK) {
+      JBW_SetJBWStatusFromStatus(status, results[i]);
+      break;
+    }
+  }
+  free(results);
+}
+
+
+const float* simulatorPinObservationHistories(
+  void* simulatorHandle,
+  void* clientHandle,
+  const uint64_t* agentIds,
+  unsigned int numAgents,
+  uint64_t* offsets,
+  uint64_t* stride,
+  JBW_Status* status
+) {
+  if (clientHandle != nullptr) {
+    /* observation histories are only available for local simulators */
+    status->code = JBW_MPI_ERROR;
+    return nullptr;
+  }
+
+  simulator<simulator_data>* sim_handle = (simulator<simulator_data>*) simulatorHandle;
+  size_t* slab_offsets = (size_t*) malloc(max((size_t) 1, sizeof(size_t) * numAgents));
+  jbw::status* results = (jbw::status*) malloc(max((size_t) 1, sizeof(jbw::status) * numAgents));
+  if (slab_offsets == nullptr || results == nullptr) {
+    if (slab_offsets != nullptr) free(slab_offsets);
+    status->code = JBW_OUT_OF_MEMORY;
+    return nullptr;
+  }
+  const float* slab = sim_handle->pin_observations(agentIds, numAgents, slab_offsets, results);
+  for (unsigned int i = 0; i < numAgents; i++) {
+    if (results[i] != status::OK) {
+      JBW_SetJBWStatusFromStatus(status, results[i]);
+      sim_handle->unpin_observations();
+      free(slab_offsets); free(results);
+      return nullptr;
+    }
+    offsets[i] = slab_offsets[i];
+  }
+  *stride = observation_stride(sim_handle->get_config());
+  free(slab_offsets); free(results);
+  return slab;
+}
+
+
+void simulatorUnpinObservationHistories(void* simulatorHandle) {
+  simulator<simulator_data>* sim_handle = (simulator<simulator_data>*) simulatorHandle;
+  sim_handle->unpin_observations();
+}
+
+
 void simulatorSetActive(
   void* simulatorHandle,
   void* clientHandle,
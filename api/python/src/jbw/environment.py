@@ -80,7 +80,7 @@ else:
       """
 
       def __init__(
-          self, sim_config, reward_fn, render=False):
+          self, sim_config, reward_fn=None, render=False):
         """Creates a new JBW environment for OpenAI gym.
 
         Arguments:
@@ -91,7 +91,11 @@ else:
                                       items and the current 
                                       collected items as inputs
                                       and returns a reward 
-                                      value.
+                                      value. If `None`, the 
+                                      reward is the one that 
+                                      the simulator evaluates 
+                                      from the reward schema 
+                                      in `sim_config`.
           render(bool)                Boolean value indicating 
                                       whether or not to support 
                                       rendering the 
@@ -99,6 +103,7 @@ else:
         """
         self.sim_config = sim_config
         self._sim = None
+        self._snapshot = None
         self._painter = None
         self._reward_fn = reward_fn
         self._render = render
@@ -168,8 +173,11 @@ else:
         self._agent.do_next_action()
 
         position = self._agent.position()
-        items = self._agent.collected_items()
-        reward = self._reward_fn(prev_items, items)
+        if self._reward_fn is None:
+          reward = float(self._sim.rewards([self._agent])[0])
+        else:
+          items = self._agent.collected_items()
+          reward = self._reward_fn(prev_items, items)
         done = False
 
         self.state = {
@@ -180,15 +188,25 @@ else:
         return self.state, reward, done, {}
 
       def reset(self):
-        """Resets this environment to its initial state."""
-        del self._sim
-        self._sim = Simulator(sim_config=self.sim_config)
-        self._agent = _JBWEnvAgent(self._sim)
-        if self._render:
-          del self._painter
-          self._painter = MapVisualizer(
-            self._sim, self.sim_config, 
-            bottom_left=(-70, -70), top_right=(70, 70))
+        """Resets this environment to its initial state.
+
+        The simulator is only constructed on the first reset 
+        (and after `seed`), when a snapshot of its initial 
+        state is taken. Later resets restore that snapshot, 
+        which does not regenerate the world.
+        """
+        if self._snapshot is not None:
+          self._sim.restore(self._snapshot)
+        else:
+          del self._sim
+          self._sim = Simulator(sim_config=self.sim_config)
+          self._agent = _JBWEnvAgent(self._sim)
+          self._snapshot = self._sim.snapshot()
+          if self._render:
+            del self._painter
+            self._painter = MapVisualizer(
+              self._sim, self.sim_config, 
+              bottom_left=(-70, -70), top_right=(70, 70))
         self.state = {
           'scent': self._agent.scent(), 
           'vision': self._agent.vision(), 
@@ -220,11 +238,13 @@ else:
         """Deletes the underlying simulator and deallocates 
         all associated memory. This environment cannot be used
         again after it's been closed."""
+        self._snapshot = None
         del self._sim
         return
 
       def seed(self, seed=None):
         self.sim_config.seed = seed
+        self._snapshot = None
         self.reset()
         return
 
@@ -68,21 +68,19 @@ def make_config():
 		allowed_movement_directions=[ActionPolicy.ALLOWED, ActionPolicy.DISALLOWED, ActionPolicy.DISALLOWED, ActionPolicy.DISALLOWED],
 		allowed_turn_directions=[ActionPolicy.DISALLOWED, ActionPolicy.DISALLOWED, ActionPolicy.ALLOWED, ActionPolicy.ALLOWED],
 		no_op_allowed=False, patch_size=32, mcmc_num_iter=4000, items=items, agent_color=[0.0, 0.0, 1.0], agent_field_of_view=2*pi,
-    collision_policy=MovementConflictPolicy.FIRST_COME_FIRST_SERVED, decay_param=0.4, diffusion_param=0.14, deleted_item_lifetime=2000)
+    collision_policy=MovementConflictPolicy.FIRST_COME_FIRST_SERVED, decay_param=0.4, diffusion_param=0.14, deleted_item_lifetime=2000,
+    reward_item_deltas=[1.0 for _ in items])
 
 if modules_loaded:
-  # Construct the simulator configuration.
+  # Construct the simulator configuration, whose reward
+  # schema gives a reward of 1 for every collected item.
   sim_config = make_config()
 
-  # Create a reward function.
-  reward_fn = lambda prev_items, items: len(items) - len(prev_items)
-
   register(
       id='JBW-v0',
       entry_point='jbw.environment:JBWEnv',
       kwargs={
         'sim_config': sim_config,
-        'reward_fn': reward_fn,
         'render': False})
 
   register(
@@ -90,5 +88,4 @@ if modules_loaded:
       entry_point='jbw.environment:JBWEnv',
       kwargs={
         'sim_config': sim_config,
-        'reward_fn': reward_fn,
         'render': True})
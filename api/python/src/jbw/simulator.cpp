@@ -22,6 +22,7 @@
 #include "gibbs_field.h"
 #include "mpi.h"
 #include "simulator.h"
+#include "simulator_batch.h"
 
 namespace jbw {
 
@@ -131,6 +132,12 @@ struct py_client_data {
         size_t length;
     };
 
+    struct action_result_array {
+        uint64_t* ids;
+        status* results;
+        size_t length;
+    };
+
     /* storing the server responses */
     status server_response;
     union response_data {
@@ -141,6 +148,7 @@ struct py_client_data {
         pair<uint64_t*, size_t> agent_ids;
         agent_state_array agent_states;
         semaphore_array semaphores;
+        action_result_array action_results;
     } response_data;
 
     /* for synchronization */
@@ -349,6 +357,39 @@ void on_step(simulator<py_simulator_data>* sim,
 }
 
 
+/**
+ * The additional state of each world in a batch created by `batch_new`. The
+ * worlds are only stepped by `batch_step`, which returns the observations
+ * directly, so no Python callback is invoked.
+ */
+struct py_batch_data {
+    static inline void free(py_batch_data& data) { }
+};
+
+inline bool init(py_batch_data& data, const py_batch_data& src) {
+    return true;
+}
+
+/**
+ * The worlds in a batch invoke this function after each step, but the
+ * observations are returned by `batch_step` instead.
+ */
+void on_step(simulator<py_batch_data>* sim,
+        const hash_map<uint64_t, agent_state*>& agents, uint64_t time)
+{ }
+
+/**
+ * A batch of worlds created by `batch_new`, along with buffers for the
+ * actions, results, and agent directions of each step, so that `batch_step`
+ * only allocates the returned numpy arrays.
+ */
+struct py_batch {
+    simulator_batch<py_batch_data> batch;
+    action* actions;
+    status* results;
+    direction* directions;
+};
+
 /**
  * Client callback functions.
  */
@@ -597,6 +638,75 @@ void on_do_nothing(client<py_client_data>& c, uint64_t agent_id, status response
     c.data.cv.notify_one();
 }
 
+/**
+ * The callback invoked when the client receives an act_batch response from
+ * the server. This function moves the result into
+ * `c.data.response_data.action_results` and wakes up the Python thread (which
+ * should be waiting in the `simulator_act_batch` function) so that it can
+ * return the response back to Python.
+ *
+ * \param   c          The client that received the response.
+ * \param   response   The response from the server, containing information
+ *                     about any errors.
+ * \param   agent_ids  The IDs of the agents in the batch.
+ * \param   results    The result of each action in the batch.
+ * \param   count      The length of `agent_ids` and `results`.
+ */
+void on_act_batch(client<py_client_data>& c, status response,
+        uint64_t* agent_ids, status* results, size_t count)
+{
+    check_response(response, "act_batch: ");
+    std::unique_lock<std::mutex> lck(c.data.lock);
+    c.data.waiting_for_server = false;
+    c.data.response_data.action_results.ids = agent_ids;
+    c.data.response_data.action_results.results = results;
+    c.data.response_data.action_results.length = count;
+    c.data.server_response = response;
+    c.data.cv.notify_one();
+}
+
+/**
+ * The callback invoked when the client receives a submit_plan response from
+ * the server. This function copies the result into `c.data.server_response`
+ * and wakes up the Python thread (which should be waiting in the
+ * `simulator_submit_plan` function) so that it can return the response back
+ * to Python.
+ *
+ * \param   c          The client that received the response.
+ * \param   agent_id   The ID of the agent that submitted the plan.
+ * \param   response   The response from the server, containing information
+ *                     about any errors.
+ */
+void on_submit_plan(client<py_client_data>& c, uint64_t agent_id, status response) {
+    check_response(response, "submit_plan: ");
+    std::unique_lock<std::mutex> lck(c.data.lock);
+    c.data.waiting_for_server = false;
+    c.data.server_response = response;
+    c.data.cv.notify_one();
+}
+
+/**
+ * The callback invoked when the action plans of any agents of this client
+ * end. The step callback is invoked again once the plans of all agents of
+ * this client have ended, so this function only frees the arrays.
+ */
+void on_plan_ended(client<py_client_data>& c, uint64_t* agent_ids,
+        plan_status* results, unsigned int* action_counts, size_t count)
+{
+    if (agent_ids != nullptr) free(agent_ids);
+    if (results != nullptr) free(results);
+    if (action_counts != nullptr) free(action_counts);
+}
+
+/**
+ * The callback invoked when the client receives a get_stats response from the
+ * server. The Python API does not request step profiles, so this function
+ * should not be called.
+ */
+void on_get_stats(client<py_client_data>& c, status response, const step_profile& profile) {
+    fprintf(stderr, "WARNING: `on_get_stats` should not be called.\n");
+}
+
 /**
  * The callback invoked when the client receives a get_map response from the
  * server. This function moves the result into `c.data.response_data.map` and
@@ -815,103 +925,51 @@ static inline void import_errors() {
 }
 
 /**
- * Creates a new simulator and returns a handle to it.
- *
- * \param   self    Pointer to the Python object calling this method.
- * \param   args    A Python tuple containing the arguments to this function:
- *                  - (int) The seed for the pseudorandom number generator.
- *                  - (int) The maximum movement distance per turn for all
- *                  agents.
- *                  - (list of ints) The ActionPolicy for each possible movement.
- *                  - (list of ints) The ActionPolicy for each possible turn.
- *                  - (bool) Whether or not the no-op action is allowed.
- *                  - (int) The scent dimension.
- *                  - (int) The color dimension for visual perception.
- *                  - (int) The range of vision for all agents.
- *                  - (int) The patch size.
- *                  - (int) The number of Gibbs sampling iterations when
- *                    initializing items in new patches.
- *                  - (list) A list of the item types.
- *                  - (list of floats) The color of all agents.
- *                  - (int) The movement conflict resolution policy.
- *                  - (float) The field of view angle for all agents.
- *                  - (float) The scent decay parameter.
- *                  - (float) The scent diffusion parameter.
- *                  - (int) The duration of time for which removed items are
- *                    remembered by the simulation in order to compute their
- *                    scent contribution.
- *                  - (function) The function to invoke when the simulator
- *                    advances time.
- *
- *                  The list of item types must contain tuples containing:
- *                  - (string) The name.
- *                  - (list of floats) The item scent.
- *                  - (list of floats) The item color.
- *                  - (list of ints) The number of items of each type that is
- *                    required to automatically collect items of this type.
- *                  - (list of ints) The number of items of each type that is
- *                    removed from the agent's inventory whenever an item of
- *                    this type is collected.
- *                  - (bool) Whether this item type blocks agent movement.
- *                  - (int) The ID of the intensity function.
- *                  - (list of floats) The arguments to the intensity function.
- *                  - (list of list of floats) The list of interaction
- *                    functions, where the first element in each sublist is the
- *                    ID of the interaction function, and the remaining
- *                    elements are its arguments.
- * \returns Pointer to the new simulator.
+ * Validates the Python arguments describing a simulator configuration, and
+ * stores them in `config`. The remaining fields of `config` must already be
+ * parsed by the caller. If the arguments are invalid, a Python exception is
+ * set and `false` is returned.
  */
-static PyObject* simulator_new(PyObject *self, PyObject *args)
+static bool parse_config(simulator_config& config,
+        PyObject* py_allowed_movement_directions, PyObject* py_allowed_turn_directions,
+        PyObject* py_no_op_allowed, PyObject* py_items, PyObject* py_agent_color,
+        unsigned int collision_policy, PyObject* py_reward_item_deltas)
 {
-    simulator_config config;
-    PyObject* py_allowed_movement_directions;
-    PyObject* py_allowed_turn_directions;
-    PyObject* py_no_op_allowed;
-    PyObject* py_items;
-    PyObject* py_agent_color;
-    unsigned int seed;
-    unsigned int collision_policy;
-    PyObject* py_callback;
-    if (!PyArg_ParseTuple(
-      args, "IIOOOIIIIIOOIfffIO", &seed, &config.max_steps_per_movement,
-      &py_allowed_movement_directions, &py_allowed_turn_directions, &py_no_op_allowed,
-      &config.scent_dimension, &config.color_dimension, &config.vision_range,
-      &config.patch_size, &config.mcmc_iterations, &py_items, &py_agent_color,
-      &collision_policy, &config.agent_field_of_view, &config.decay_param,
-      &config.diffusion_param, &config.deleted_item_lifetime, &py_callback)) {
-        fprintf(stderr, "Invalid argument types in the call to 'simulator_c.new'.\n");
-        return NULL;
-    }
-
-    if (!PyCallable_Check(py_callback)) {
-        PyErr_SetString(PyExc_TypeError, "Callback must be callable.\n");
-        return NULL;
+    if (config.history_length == 0) {
+        PyErr_SetString(PyExc_ValueError, "'history_length' must be at least 1.\n");
+        return false;
     } else if (!PyList_Check(py_items)) {
         PyErr_SetString(PyExc_TypeError, "'items' must be a list.\n");
-        return NULL;
+        return false;
+    } else if (py_reward_item_deltas != Py_None
+            && (!PyList_Check(py_reward_item_deltas) || PyList_Size(py_reward_item_deltas) != PyList_Size(py_items)))
+    {
+        PyErr_SetString(PyExc_TypeError, "'reward_item_deltas' must be None"
+            " or a list with length equal to the number of item types.\n");
+        return false;
     } else if (!PyList_Check(py_allowed_movement_directions)
             || PyList_Size(py_allowed_movement_directions) != (size_t) direction::COUNT)
     {
         PyErr_SetString(PyExc_TypeError, "'allowed_movement_directions' must"
             " be a list with length equal to the number of possible movement directions.\n");
-        return NULL;
+        return false;
     } else if (!PyList_Check(py_allowed_turn_directions)
             || PyList_Size(py_allowed_turn_directions) != (size_t) direction::COUNT)
     {
         PyErr_SetString(PyExc_TypeError, "'allowed_turn_directions' must be a"
             " list with length equal to the number of possible movement directions.\n");
-        return NULL;
+        return false;
     }
 
     PyObject *py_items_iter = PyObject_GetIter(py_items);
     if (!py_items_iter) {
         PyErr_SetString(PyExc_ValueError, "Invalid argument types in the call to 'simulator_c.new'.");
-        return NULL;
+        return false;
     }
     Py_ssize_t item_type_count = PyList_Size(py_items);
     if (!config.item_types.ensure_capacity(max((Py_ssize_t) 1, item_type_count))) {
         PyErr_NoMemory();
-        return NULL;
+        return false;
     }
     while (true) {
         PyObject *next_py_item = PyIter_Next(py_items_iter);
@@ -930,12 +988,12 @@ static PyObject* simulator_new(PyObject *self, PyObject *args)
         if (!PyArg_ParseTuple(next_py_item, "sOOOOOfIOO", &name, &py_scent, &py_color, &py_required_item_counts,
           &py_required_item_costs, &blocks_movement, &visual_occlusion, &py_intensity_fn, &py_intensity_fn_args, &py_interaction_fn_args)) {
             fprintf(stderr, "Invalid argument types for item property in call to 'simulator_c.new'.\n");
-            return NULL;
+            return false;
         }
 
         if (!PyList_Check(py_intensity_fn_args) || !PyList_Check(py_interaction_fn_args)) {
             PyErr_SetString(PyExc_TypeError, "'intensity_fn_args' and 'interaction_fn_args' must be lists.\n");
-            return NULL;
+            return false;
         }
 
         item_properties& new_item = config.item_types[config.item_types.length];
@@ -957,7 +1015,7 @@ static PyObject* simulator_new(PyObject *self, PyObject *args)
         if (new_item.intensity_fn.fn == NULL) {
             PyErr_SetString(PyExc_ValueError, "Invalid intensity"
                     " function arguments in the call to 'simulator_c.new'.");
-            return NULL;
+            return false;
         }
         new_item.intensity_fn.args = intensity_fn_args.key;
         new_item.intensity_fn.arg_count = (unsigned int) intensity_fn_args.value;
@@ -975,7 +1033,7 @@ static PyObject* simulator_new(PyObject *self, PyObject *args)
             if (new_item.interaction_fns[i].fn == NULL) {
                 PyErr_SetString(PyExc_ValueError, "Invalid interaction"
                         " function arguments in the call to 'simulator_c.new'.");
-                return NULL;
+                return false;
             }
         }
         config.item_types.length += 1;
@@ -989,6 +1047,100 @@ static PyObject* simulator_new(PyObject *self, PyObject *args)
 
     config.agent_color = PyArg_ParseFloatList(py_agent_color).key;
     config.collision_policy = (movement_conflict_policy) collision_policy;
+    if (py_reward_item_deltas != Py_None)
+        config.reward_item_deltas = PyArg_ParseFloatList(py_reward_item_deltas).key;
+    return true;
+}
+
+/**
+ * Creates a new simulator and returns a handle to it.
+ *
+ * \param   self    Pointer to the Python object calling this method.
+ * \param   args    A Python tuple containing the arguments to this function:
+ *                  - (int) The seed for the pseudorandom number generator.
+ *                  - (int) The maximum movement distance per turn for all
+ *                  agents.
+ *                  - (list of ints) The ActionPolicy for each possible movement.
+ *                  - (list of ints) The ActionPolicy for each possible turn.
+ *                  - (bool) Whether or not the no-op action is allowed.
+ *                  - (int) The scent dimension.
+ *                  - (int) The color dimension for visual perception.
+ *                  - (int) The range of vision for all agents.
+ *                  - (int) The patch size.
+ *                  - (int) The number of Gibbs sampling iterations when
+ *                    initializing items in new patches.
+ *                  - (list) A list of the item types.
+ *                  - (list of floats) The color of all agents.
+ *                  - (int) The movement conflict resolution policy.
+ *                  - (float) The field of view angle for all agents.
+ *                  - (float) The scent decay parameter.
+ *                  - (float) The scent diffusion parameter.
+ *                  - (int) The duration of time for which removed items are
+ *                    remembered by the simulation in order to compute their
+ *                    scent contribution.
+ *                  - (function) The function to invoke when the simulator
+ *                    advances time.
+ *                  - (int, optional) The number of most recent observations
+ *                    kept for each agent. The default is 1.
+ *                  - (list of floats or None, optional) The reward of
+ *                    collecting an item of each type (see
+ *                    `simulator_rewards`). The default is None, in which
+ *                    case items do not contribute to the reward.
+ *                  - (float, optional) The reward of every time step. The
+ *                    default is 0.
+ *                  - (float, optional) The reward per cell that an agent
+ *                    moves. The default is 0.
+ *
+ *                  The list of item types must contain tuples containing:
+ *                  - (string) The name.
+ *                  - (list of floats) The item scent.
+ *                  - (list of floats) The item color.
+ *                  - (list of ints) The number of items of each type that is
+ *                    required to automatically collect items of this type.
+ *                  - (list of ints) The number of items of each type that is
+ *                    removed from the agent's inventory whenever an item of
+ *                    this type is collected.
+ *                  - (bool) Whether this item type blocks agent movement.
+ *                  - (int) The ID of the intensity function.
+ *                  - (list of floats) The arguments to the intensity function.
+ *                  - (list of list of floats) The list of interaction
+ *                    functions, where the first element in each sublist is the
+ *                    ID of the interaction function, and the remaining
+ *                    elements are its arguments.
+ * \returns Pointer to the new simulator.
+ */
+static PyObject* simulator_new(PyObject *self, PyObject *args)
+{
+    simulator_config config;
+    PyObject* py_allowed_movement_directions;
+    PyObject* py_allowed_turn_directions;
+    PyObject* py_no_op_allowed;
+    PyObject* py_items;
+    PyObject* py_agent_color;
+    unsigned int seed;
+    unsigned int collision_policy;
+    PyObject* py_callback;
+    PyObject* py_reward_item_deltas = Py_None;
+    if (!PyArg_ParseTuple(
+      args, "IIOOOIIIIIOOIfffIO|IOff", &seed, &config.max_steps_per_movement,
+      &py_allowed_movement_directions, &py_allowed_turn_directions, &py_no_op_allowed,
+      &config.scent_dimension, &config.color_dimension, &config.vision_range,
+      &config.patch_size, &config.mcmc_iterations, &py_items, &py_agent_color,
+      &collision_policy, &config.agent_field_of_view, &config.decay_param,
+      &config.diffusion_param, &config.deleted_item_lifetime, &py_callback, &config.history_length,
+      &py_reward_item_deltas, &config.reward_per_step, &config.reward_per_distance)) {
+        fprintf(stderr, "Invalid argument types in the call to 'simulator_c.new'.\n");
+        return NULL;
+    }
+
+    if (!PyCallable_Check(py_callback)) {
+        PyErr_SetString(PyExc_TypeError, "Callback must be callable.\n");
+        return NULL;
+    } else if (!parse_config(config, py_allowed_movement_directions, py_allowed_turn_directions,
+            py_no_op_allowed, py_items, py_agent_color, collision_policy, py_reward_item_deltas))
+    {
+        return NULL;
+    }
 
     py_simulator_data data(py_callback);
 
@@ -1005,6 +1157,184 @@ static PyObject* simulator_new(PyObject *self, PyObject *args)
     return PyLong_FromVoidPtr(sim);
 }
 
+/**
+ * Creates a batch of independent simulators ("worlds") with the same
+ * configuration, each containing a single agent, which are stepped together
+ * by `batch_step` with a single call per step.
+ *
+ * \param   self    Pointer to the Python object calling this method.
+ * \param   args    Arguments:
+ *                  - (int) The number of worlds in the batch.
+ *                  - (int) The seed of the first world. World `i` is seeded
+ *                    with this seed plus `i`.
+ *                  - The remaining arguments are the same as those of
+ *                    `simulator_new`, following its seed, except that there
+ *                    is no callback. The rewards returned by `batch_step` are
+ *                    evaluated from the reward schema in this configuration.
+ * \returns Pointer to the new batch.
+ */
+static PyObject* simulator_batch_new(PyObject *self, PyObject *args)
+{
+    simulator_config config;
+    PyObject* py_allowed_movement_directions;
+    PyObject* py_allowed_turn_directions;
+    PyObject* py_no_op_allowed;
+    PyObject* py_items;
+    PyObject* py_agent_color;
+    unsigned int world_count;
+    unsigned int seed;
+    unsigned int collision_policy;
+    PyObject* py_reward_item_deltas = Py_None;
+    if (!PyArg_ParseTuple(
+      args, "IIIOOOIIIIIOOIfffI|IOff", &world_count, &seed, &config.max_steps_per_movement,
+      &py_allowed_movement_directions, &py_allowed_turn_directions, &py_no_op_allowed,
+      &config.scent_dimension, &config.color_dimension, &config.vision_range,
+      &config.patch_size, &config.mcmc_iterations, &py_items, &py_agent_color,
+      &collision_policy, &config.agent_field_of_view, &config.decay_param,
+      &config.diffusion_param, &config.deleted_item_lifetime, &config.history_length,
+      &py_reward_item_deltas, &config.reward_per_step, &config.reward_per_distance)) {
+        fprintf(stderr, "Invalid argument types in the call to 'simulator_c.batch_new'.\n");
+        return NULL;
+    }
+
+    if (!parse_config(config, py_allowed_movement_directions, py_allowed_turn_directions,
+            py_no_op_allowed, py_items, py_agent_color, collision_policy, py_reward_item_deltas))
+    {
+        return NULL;
+    }
+
+    py_batch* handle = (py_batch*) malloc(sizeof(py_batch));
+    if (handle == NULL)
+        return PyErr_NoMemory();
+    handle->actions = (action*) malloc(sizeof(action) * max(1u, world_count));
+    handle->results = (status*) malloc(sizeof(status) * max(1u, world_count));
+    handle->directions = (direction*) malloc(sizeof(direction) * max(1u, world_count));
+    if (handle->actions == NULL || handle->results == NULL || handle->directions == NULL) {
+        if (handle->actions != NULL) free(handle->actions);
+        if (handle->results != NULL) free(handle->results);
+        if (handle->directions != NULL) free(handle->directions);
+        free(handle);
+        return PyErr_NoMemory();
+    } else if (!init(handle->batch, config, py_batch_data(), world_count, NULL, seed, std::thread::hardware_concurrency())) {
+        free(handle->actions); free(handle->results);
+        free(handle->directions); free(handle);
+        PyErr_SetString(PyExc_RuntimeError, "Failed to initialize simulator batch.");
+        return NULL;
+    }
+    return PyLong_FromVoidPtr(handle);
+}
+
+/**
+ * Deletes a batch created by `batch_new` and frees all of its worlds.
+ *
+ * \param   self    Pointer to the Python object calling this method.
+ * \param   args    Arguments:
+ *                  - Handle to the native batch object as a PyLong.
+ */
+static PyObject* simulator_batch_delete(PyObject *self, PyObject *args)
+{
+    PyObject* py_batch_handle;
+    if (!PyArg_ParseTuple(args, "O", &py_batch_handle)) {
+        fprintf(stderr, "Invalid batch handle argument in the call to 'simulator_c.batch_delete'.\n");
+        return NULL;
+    }
+    py_batch* handle = (py_batch*) PyLong_AsVoidPtr(py_batch_handle);
+    free(handle->batch);
+    free(handle->actions);
+    free(handle->results);
+    free(handle->directions);
+    free(handle);
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/**
+ * Submits an action for the agent in every world of a batch created by
+ * `batch_new`, and advances the worlds in parallel, without holding the
+ * global interpreter lock.
+ *
+ * \param   self    Pointer to the Python object calling this method.
+ * \param   args    Arguments:
+ *                  - Handle to the native batch object as a PyLong.
+ *                  - List of tuples, one per world, each containing the
+ *                    action type (MOVE = 0, TURN = 1, NO_OP = 2), the
+ *                    direction encoded as an integer, and the number of
+ *                    steps.
+ * \returns A tuple containing the list of whether each action succeeded,
+ *          followed by numpy arrays of the agent positions with shape
+ *          `(world_count, 2)`, their directions with shape `(world_count,)`,
+ *          their scents with shape `(world_count, scent_dimension)`, their
+ *          visual fields with shape `(world_count, 2*vision_range + 1,
+ *          2*vision_range + 1, color_dimension)`, and their rewards in this
+ *          step with shape `(world_count,)`. If an action failed, its world
+ *          did not advance, and its reward is 0.
+ */
+static PyObject* simulator_batch_step(PyObject *self, PyObject *args)
+{
+    PyObject* py_batch_handle;
+    PyObject* py_actions;
+    if (!PyArg_ParseTuple(args, "OO", &py_batch_handle, &py_actions))
+        return NULL;
+    py_batch* handle = (py_batch*) PyLong_AsVoidPtr(py_batch_handle);
+    simulator_batch<py_batch_data>& batch = handle->batch;
+    if (!PyList_Check(py_actions) || PyList_Size(py_actions) != (Py_ssize_t) batch.world_count) {
+        PyErr_SetString(PyExc_TypeError, "'actions' must be a list with one action per world.");
+        return NULL;
+    }
+    for (unsigned int i = 0; i < batch.world_count; i++) {
+        unsigned int type, dir, num_steps;
+        if (!PyArg_ParseTuple(PyList_GetItem(py_actions, (Py_ssize_t) i), "III", &type, &dir, &num_steps)) {
+            return NULL;
+        } else if (type > (unsigned int) action_type::DO_NOTHING || dir >= (unsigned int) direction::COUNT) {
+            PyErr_SetString(PyExc_ValueError, "Invalid action type or direction.");
+            return NULL;
+        }
+        handle->actions[i] = {(action_type) type, (direction) dir, num_steps};
+    }
+
+    const simulator_config& config = batch.get_world(0).get_config();
+    npy_intp position_dims[] = {(npy_intp) batch.world_count, 2};
+    npy_intp world_dims[] = {(npy_intp) batch.world_count};
+    npy_intp scent_dims[] = {(npy_intp) batch.world_count, (npy_intp) batch.scent_size};
+    npy_intp vision_dims[] = {
+            (npy_intp) batch.world_count,
+            2 * (npy_intp) config.vision_range + 1,
+            2 * (npy_intp) config.vision_range + 1,
+            (npy_intp) config.color_dimension};
+    PyArrayObject* py_positions = (PyArrayObject*) PyArray_SimpleNew(2, position_dims, NPY_INT64);
+    PyArrayObject* py_directions = (PyArrayObject*) PyArray_SimpleNew(1, world_dims, NPY_UINT8);
+    PyArrayObject* py_scents = (PyArrayObject*) PyArray_SimpleNew(2, scent_dims, NPY_FLOAT);
+    PyArrayObject* py_visions = (PyArrayObject*) PyArray_SimpleNew(4, vision_dims, NPY_FLOAT);
+    PyArrayObject* py_rewards = (PyArrayObject*) PyArray_SimpleNew(1, world_dims, NPY_FLOAT);
+    PyObject* py_results = PyList_New(batch.world_count);
+    if (py_positions == NULL || py_directions == NULL || py_scents == NULL
+     || py_visions == NULL || py_rewards == NULL || py_results == NULL)
+    {
+        Py_XDECREF(py_positions); Py_XDECREF(py_directions); Py_XDECREF(py_scents);
+        Py_XDECREF(py_visions); Py_XDECREF(py_rewards); Py_XDECREF(py_results);
+        return NULL;
+    }
+
+    /* release the global interpreter lock */
+    PyThreadState* python_thread = PyEval_SaveThread();
+    batch.step(handle->actions, handle->results,
+            (position*) PyArray_DATA(py_positions), handle->directions,
+            (float*) PyArray_DATA(py_scents), (float*) PyArray_DATA(py_visions),
+            (float*) PyArray_DATA(py_rewards));
+
+    /* re-acquire the global interpreter lock */
+    PyEval_RestoreThread(python_thread);
+
+    uint8_t* directions = (uint8_t*) PyArray_DATA(py_directions);
+    for (unsigned int i = 0; i < batch.world_count; i++) {
+        directions[i] = (uint8_t) handle->directions[i];
+        PyObject* result = (handle->results[i] == status::OK ? Py_True : Py_False);
+        Py_INCREF(result);
+        PyList_SET_ITEM(py_results, i, result);
+    }
+    return Py_BuildValue("NNNNNN", py_results, py_positions, py_directions, py_scents, py_visions, py_rewards);
+}
+
 /**
  * Saves a simulator to file.
  *
@@ -1117,47 +1447,129 @@ static PyObject* simulator_load(PyObject *self, PyObject *args)
     agent_state** agent_states = (agent_state**) malloc(sizeof(agent_state*) * agent_id_count);
     if (agent_states == NULL) {
         PyErr_NoMemory();
-        free(*sim); free(sim); fclose(file); return NULL;
-    }
-
-    sim->get_agent_states(agent_states, sim_data.agent_ids.data, (unsigned int) agent_id_count);
-
-    const simulator_config& config = sim->get_config();
-    PyObject* py_states = PyList_New((Py_ssize_t) agent_id_count);
-    if (py_states == NULL) {
-        free(agent_states); free(*sim);
-        free(sim); fclose(file); return NULL;
+        free(*sim); free(sim); fclose(file); return NULL;
+    }
+
+    sim->get_agent_states(agent_states, sim_data.agent_ids.data, (unsigned int) agent_id_count);
+
+    const simulator_config& config = sim->get_config();
+    PyObject* py_states = PyList_New((Py_ssize_t) agent_id_count);
+    if (py_states == NULL) {
+        free(agent_states); free(*sim);
+        free(sim); fclose(file); return NULL;
+    }
+    for (size_t i = 0; i < agent_id_count; i++) {
+        PyList_SetItem(py_states, (Py_ssize_t) i, build_py_agent(*agent_states[i], config, sim_data.agent_ids[i]));
+        agent_states[i]->lock.unlock();
+    }
+    free(agent_states);
+
+    import_errors();
+    PyObject* py_sim = PyLong_FromVoidPtr(sim);
+    PyObject* to_return = Py_BuildValue("(KOO)", sim->time, py_sim, py_states);
+    Py_DECREF(py_sim); Py_DECREF(py_states);
+    return to_return;
+}
+
+/**
+ * Deletes a simulator and frees all memory allocated for that simulator.
+ *
+ * \param   self    Pointer to the Python object calling this method.
+ * \param   args    Arguments:
+ *                  - Handle to the native simulator object as a PyLong.
+ * \returns None.
+ */  
+static PyObject* simulator_delete(PyObject *self, PyObject *args) {
+    PyObject* py_sim_handle;
+    if (!PyArg_ParseTuple(args, "O", &py_sim_handle)) {
+        fprintf(stderr, "Invalid simulator handle argument in the call to 'simulator_c.delete'.\n");
+        return NULL;
+    }
+    simulator<py_simulator_data>* sim_handle =
+            (simulator<py_simulator_data>*) PyLong_AsVoidPtr(py_sim_handle);
+    free(*sim_handle); free(sim_handle);
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/**
+ * Creates a snapshot of the current state of a local simulator, to which it
+ * can later be reset with `simulator_restore`. The snapshot shares the
+ * patches of the world copy-on-write, and must be freed with
+ * `simulator_delete`.
+ *
+ * \param   self    Pointer to the Python object calling this method.
+ * \param   args    Arguments:
+ *                  - Handle to the native simulator object as a PyLong.
+ * \returns Handle to the snapshot, which is itself a native simulator object.
+ */
+static PyObject* simulator_snapshot(PyObject *self, PyObject *args) {
+    PyObject* py_sim_handle;
+    if (!PyArg_ParseTuple(args, "O", &py_sim_handle)) {
+        fprintf(stderr, "Invalid simulator handle argument in the call to 'simulator_c.snapshot'.\n");
+        return NULL;
+    }
+    simulator<py_simulator_data>* sim_handle =
+            (simulator<py_simulator_data>*) PyLong_AsVoidPtr(py_sim_handle);
+    simulator<py_simulator_data>* snapshot =
+            (simulator<py_simulator_data>*) malloc(sizeof(simulator<py_simulator_data>));
+    if (snapshot == NULL) {
+        PyErr_NoMemory();
+        return NULL;
     }
-    for (size_t i = 0; i < agent_id_count; i++) {
-        PyList_SetItem(py_states, (Py_ssize_t) i, build_py_agent(*agent_states[i], config, sim_data.agent_ids[i]));
-        agent_states[i]->lock.unlock();
+    status result = sim_handle->snapshot(*snapshot);
+    if (result != status::OK) {
+        free(snapshot);
+        PyErr_SetString(PyExc_RuntimeError, "Failed to create a snapshot of the simulator.");
+        return NULL;
     }
-    free(agent_states);
-
-    import_errors();
-    PyObject* py_sim = PyLong_FromVoidPtr(sim);
-    PyObject* to_return = Py_BuildValue("(KOO)", sim->time, py_sim, py_states);
-    Py_DECREF(py_sim); Py_DECREF(py_states);
-    return to_return;
+    return PyLong_FromVoidPtr(snapshot);
 }
 
 /**
- * Deletes a simulator and frees all memory allocated for that simulator.
+ * Resets a local simulator to the state of a snapshot created by
+ * `simulator_snapshot`. The snapshot is unchanged, so the simulator can be
+ * restored from it repeatedly. If the restore fails, the simulator is
+ * unchanged.
  *
  * \param   self    Pointer to the Python object calling this method.
  * \param   args    Arguments:
  *                  - Handle to the native simulator object as a PyLong.
+ *                  - Handle to the snapshot as a PyLong.
  * \returns None.
- */  
-static PyObject* simulator_delete(PyObject *self, PyObject *args) {
+ */
+static PyObject* simulator_restore(PyObject *self, PyObject *args) {
     PyObject* py_sim_handle;
-    if (!PyArg_ParseTuple(args, "O", &py_sim_handle)) {
-        fprintf(stderr, "Invalid simulator handle argument in the call to 'simulator_c.delete'.\n");
+    PyObject* py_snapshot_handle;
+    if (!PyArg_ParseTuple(args, "OO", &py_sim_handle, &py_snapshot_handle)) {
+        fprintf(stderr, "Invalid argument types in the call to 'simulator_c.restore'.\n");
         return NULL;
     }
     simulator<py_simulator_data>* sim_handle =
             (simulator<py_simulator_data>*) PyLong_AsVoidPtr(py_sim_handle);
-    free(*sim_handle); free(sim_handle);
+    simulator<py_simulator_data>* snapshot =
+            (simulator<py_simulator_data>*) PyLong_AsVoidPtr(py_snapshot_handle);
+
+    /* the simulator keeps its own data, so we copy the IDs of the agents and
+       semaphores that it owns from the snapshot */
+    py_simulator_data& data = sim_handle->get_data();
+    const py_simulator_data& snapshot_data = snapshot->get_data();
+    if (!data.agent_ids.ensure_capacity(snapshot_data.agent_ids.length)
+     || !data.semaphore_ids.ensure_capacity(snapshot_data.semaphore_ids.length))
+    {
+        PyErr_NoMemory();
+        return NULL;
+    }
+
+    status result = sim_handle->restore(*snapshot);
+    if (result != status::OK) {
+        PyErr_SetString(PyExc_RuntimeError, "Failed to restore the simulator from the snapshot.");
+        return NULL;
+    }
+    data.agent_ids.clear();
+    data.agent_ids.append(snapshot_data.agent_ids.data, snapshot_data.agent_ids.length);
+    data.semaphore_ids.clear();
+    data.semaphore_ids.append(snapshot_data.semaphore_ids.data, snapshot_data.semaphore_ids.length);
     Py_INCREF(Py_None);
     return Py_None;
 }
@@ -2088,6 +2500,212 @@ static PyObject* simulator_no_op(PyObject *self, PyObject *args) {
     }
 }
 
+/**
+ * Attempt to submit a batch of actions for agents in the simulation
+ * environment. If an agent already has an action queued for this turn, its
+ * action in the batch will fail.
+ *
+ * \param   self    Pointer to the Python object calling this method.
+ * \param   args    Arguments:
+ *                  - Handle to the native simulator object as a PyLong.
+ *                  - Handle to the native client object as a PyLong. If this
+ *                    is None, `act` is directly invoked on the simulator
+ *                    object. Otherwise, the client sends an act_batch message
+ *                    to the server and waits for its response.
+ *                  - List of tuples, each containing the agent ID, the action
+ *                    type (MOVE = 0, TURN = 1, NO_OP = 2), the direction
+ *                    encoded as an integer, and the number of steps.
+ * \returns A list containing, for each action, `True` if the action is
+ *          successfully queued, and `False` otherwise.
+ */
+static PyObject* simulator_act_batch(PyObject *self, PyObject *args) {
+    PyObject* py_sim_handle;
+    PyObject* py_client_handle;
+    PyObject* py_actions;
+    if (!PyArg_ParseTuple(args, "OOO", &py_sim_handle, &py_client_handle, &py_actions))
+        return NULL;
+    if (!PyList_Check(py_actions)) {
+        PyErr_SetString(PyExc_TypeError, "'actions' must be a list.");
+        return NULL;
+    }
+
+    size_t action_count = (size_t) PyList_Size(py_actions);
+    uint64_t* agent_ids = (uint64_t*) malloc(max((size_t) 1, sizeof(uint64_t) * action_count));
+    action* actions = (action*) malloc(max((size_t) 1, sizeof(action) * action_count));
+    status* results = (status*) malloc(max((size_t) 1, sizeof(status) * action_count));
+    if (agent_ids == NULL || actions == NULL || results == NULL) {
+        if (agent_ids != NULL) free(agent_ids);
+        if (actions != NULL) free(actions);
+        if (results != NULL) free(results);
+        return PyErr_NoMemory();
+    }
+    for (size_t i = 0; i < action_count; i++) {
+        unsigned long long agent_id;
+        unsigned int type, dir, num_steps;
+        if (!PyArg_ParseTuple(PyList_GetItem(py_actions, (Py_ssize_t) i), "KIII", &agent_id, &type, &dir, &num_steps)) {
+            free(agent_ids); free(actions); free(results);
+            return NULL;
+        } else if (type > (unsigned int) action_type::DO_NOTHING || dir >= (unsigned int) direction::COUNT) {
+            PyErr_SetString(PyExc_ValueError, "Invalid action type or direction.");
+            free(agent_ids); free(actions); free(results);
+            return NULL;
+        }
+        agent_ids[i] = agent_id;
+        actions[i] = {(action_type) type, (direction) dir, num_steps};
+    }
+
+    if (py_client_handle == Py_None) {
+        /* the simulation is local, so call act directly */
+        simulator<py_simulator_data>* sim_handle =
+                (simulator<py_simulator_data>*) PyLong_AsVoidPtr(py_sim_handle);
+
+        /* release the global interpreter lock */
+        PyThreadState* python_thread = PyEval_SaveThread();
+        sim_handle->act(agent_ids, actions, action_count, results);
+
+        /* re-acquire the global interpreter lock */
+        PyEval_RestoreThread(python_thread);
+    } else {
+        /* this is a client, so send an act_batch message to the server */
+        client<py_client_data>* client_handle =
+                (client<py_client_data>*) PyLong_AsVoidPtr(py_client_handle);
+        if (!client_handle->client_running) {
+            PyErr_SetString(mpi_error, "Connection to the server was lost.");
+            free(agent_ids); free(actions); free(results);
+            return NULL;
+        }
+
+        client_handle->data.waiting_for_server = true;
+        if (!send_act_batch(*client_handle, agent_ids, actions, action_count)) {
+            PyErr_SetString(PyExc_RuntimeError, "Unable to send act_batch request.");
+            free(agent_ids); free(actions); free(results);
+            return NULL;
+        }
+
+        /* wait for response from server */
+        wait_for_server(*client_handle);
+
+        if (client_handle->data.server_response != status::OK) {
+            free(agent_ids); free(actions); free(results);
+            return NULL;
+        }
+
+        /* the server returns the results in the same order as the submitted batch */
+        py_client_data::action_result_array& response = client_handle->data.response_data.action_results;
+        for (size_t i = 0; i < action_count; i++) {
+            if (i < response.length && response.ids[i] == agent_ids[i])
+                results[i] = response.results[i];
+            else results[i] = status::CLIENT_PARSE_MESSAGE_ERROR;
+        }
+        free(response.ids); free(response.results);
+    }
+
+    PyObject* py_results = PyList_New((Py_ssize_t) action_count);
+    if (py_results == NULL) {
+        free(agent_ids); free(actions); free(results);
+        return NULL;
+    }
+    for (size_t i = 0; i < action_count; i++) {
+        PyObject* py_result = ((results[i] == status::OK) ? Py_True : Py_False);
+        Py_INCREF(py_result);
+        PyList_SET_ITEM(py_results, (Py_ssize_t) i, py_result);
+    }
+    free(agent_ids); free(actions); free(results);
+    return py_results;
+}
+
+/**
+ * Attempt to submit a plan of actions for an agent in the simulation
+ * environment, which the simulator takes on behalf of the agent, one per time
+ * step.
+ *
+ * \param   self    Pointer to the Python object calling this method.
+ * \param   args    Arguments:
+ *                  - Handle to the native simulator object as a PyLong.
+ *                  - Handle to the native client object as a PyLong. If this
+ *                    is None, `submit_plan` is directly invoked on the
+ *                    simulator object. Otherwise, the client sends a
+ *                    submit_plan message to the server and waits for its
+ *                    response.
+ *                  - The ID of the agent, as a PyLong.
+ *                  - List of tuples, each containing the action type
+ *                    (MOVE = 0, TURN = 1, NO_OP = 2), the direction encoded
+ *                    as an integer, and the number of steps.
+ *                  - The abort conditions of the plan, as a combination of
+ *                    `plan_abort_condition` flags.
+ * \returns `True` if the plan is successfully submitted, and `False`
+ *          otherwise.
+ */
+static PyObject* simulator_submit_plan(PyObject *self, PyObject *args) {
+    PyObject* py_sim_handle;
+    PyObject* py_client_handle;
+    unsigned long long agent_id;
+    PyObject* py_actions;
+    unsigned int abort_conditions;
+    if (!PyArg_ParseTuple(args, "OOKOI", &py_sim_handle, &py_client_handle, &agent_id, &py_actions, &abort_conditions))
+        return NULL;
+    if (!PyList_Check(py_actions)) {
+        PyErr_SetString(PyExc_TypeError, "'actions' must be a list.");
+        return NULL;
+    }
+
+    unsigned int action_count = (unsigned int) PyList_Size(py_actions);
+    action* actions = (action*) malloc(max((size_t) 1, sizeof(action) * action_count));
+    if (actions == NULL)
+        return PyErr_NoMemory();
+    for (unsigned int i = 0; i < action_count; i++) {
+        unsigned int type, dir, num_steps;
+        if (!PyArg_ParseTuple(PyList_GetItem(py_actions, (Py_ssize_t) i), "III", &type, &dir, &num_steps)) {
+            free(actions);
+            return NULL;
+        } else if (type > (unsigned int) action_type::DO_NOTHING || dir >= (unsigned int) direction::COUNT) {
+            PyErr_SetString(PyExc_ValueError, "Invalid action type or direction.");
+            free(actions);
+            return NULL;
+        }
+        actions[i] = {(action_type) type, (direction) dir, num_steps};
+    }
+
+    status result;
+    if (py_client_handle == Py_None) {
+        /* the simulation is local, so call submit_plan directly */
+        simulator<py_simulator_data>* sim_handle =
+                (simulator<py_simulator_data>*) PyLong_AsVoidPtr(py_sim_handle);
+
+        /* release the global interpreter lock */
+        PyThreadState* python_thread = PyEval_SaveThread();
+        result = sim_handle->submit_plan(agent_id, actions, action_count, (uint8_t) abort_conditions);
+
+        /* re-acquire the global interpreter lock */
+        PyEval_RestoreThread(python_thread);
+    } else {
+        /* this is a client, so send a submit_plan message to the server */
+        client<py_client_data>* client_handle =
+                (client<py_client_data>*) PyLong_AsVoidPtr(py_client_handle);
+        if (!client_handle->client_running) {
+            PyErr_SetString(mpi_error, "Connection to the server was lost.");
+            free(actions);
+            return NULL;
+        }
+
+        client_handle->data.waiting_for_server = true;
+        if (!send_submit_plan(*client_handle, agent_id, actions, action_count, (uint8_t) abort_conditions)) {
+            PyErr_SetString(PyExc_RuntimeError, "Unable to send submit_plan request.");
+            free(actions);
+            return NULL;
+        }
+
+        /* wait for response from server */
+        wait_for_server(*client_handle);
+        result = client_handle->data.server_response;
+    }
+    free(actions);
+
+    PyObject* py_result = ((result == status::OK) ? Py_True : Py_False);
+    Py_INCREF(py_result);
+    return py_result;
+}
+
 /**
  * Constructs a Python list containing tuples, where each tuple contains the
  * state information of a patch in the given hash_map of patches.
@@ -2468,6 +3086,292 @@ static PyObject* simulator_agent_states(PyObject *self, PyObject *args) {
     }
 }
 
+/**
+ * Retrieves the last `history_length` observations of each of the given
+ * agents, oldest first, as a single numpy array of shape
+ * `(agent count, history_length, scent size + vision size)`. The histories
+ * are copied from the simulator in one block per agent, and the returned
+ * array is a strided view of that copy, which skips the padding between
+ * observations, so stacking frames requires no further copies. This is only
+ * supported for local simulators.
+ *
+ * \param   self    Pointer to the Python object calling this method.
+ * \param   args    Arguments:
+ *                  - Handle to the native simulator object as a PyLong.
+ *                  - Handle to the native client object as a PyLong. This
+ *                    must be None.
+ *                  - (list of ints) A list of agent IDs whose observation
+ *                    histories to query.
+ * \returns The numpy array of observation histories.
+ */
+static PyObject* simulator_observation_history(PyObject *self, PyObject *args) {
+    PyObject* py_sim_handle;
+    PyObject* py_client_handle;
+    PyObject* py_agent_ids;
+    if (!PyArg_ParseTuple(args, "OOO", &py_sim_handle, &py_client_handle, &py_agent_ids))
+        return NULL;
+    if (!PyList_Check(py_agent_ids)) {
+        PyErr_SetString(PyExc_TypeError, "'agent_ids' must be a list.\n");
+        return NULL;
+    } else if (py_client_handle != Py_None) {
+        PyErr_SetString(PyExc_RuntimeError, "Observation histories are only available for local simulators.");
+        return NULL;
+    }
+
+    size_t agent_count = (size_t) PyList_Size(py_agent_ids);
+    uint64_t* agent_ids = (uint64_t*) malloc(max((size_t) 1, sizeof(uint64_t) * agent_count));
+    status* results = (status*) malloc(max((size_t) 1, sizeof(status) * agent_count));
+    if (agent_ids == nullptr || results == nullptr) {
+        if (agent_ids != nullptr) free(agent_ids);
+        PyErr_NoMemory();
+        return NULL;
+    }
+    for (size_t i = 0; i < agent_count; i++)
+        agent_ids[i] = PyLong_AsUnsignedLongLong(PyList_GetItem(py_agent_ids, i));
+
+    simulator<py_simulator_data>* sim_handle =
+            (simulator<py_simulator_data>*) PyLong_AsVoidPtr(py_sim_handle);
+    const simulator_config& config = sim_handle->get_config();
+    const size_t stride = observation_stride(config);
+    const size_t vision_size = (size_t) (2*config.vision_range + 1)
+            * (2*config.vision_range + 1) * config.color_dimension;
+    float* histories = (float*) malloc(max((size_t) 1, sizeof(float) * agent_count * config.history_length * stride));
+    if (histories == nullptr) {
+        free(agent_ids); free(results);
+        PyErr_NoMemory();
+        return NULL;
+    }
+    sim_handle->get_observation_histories(agent_ids, (unsigned int) agent_count, histories, results);
+    for (size_t i = 0; i < agent_count; i++) {
+        if (results[i] != status::OK) {
+            PyErr_SetString(PyExc_ValueError, "Invalid agent ID in the call to 'simulator_c.observation_history'.");
+            free(agent_ids); free(results); free(histories);
+            return NULL;
+        }
+    }
+    free(agent_ids); free(results);
+
+    npy_intp dims[] = {
+            (npy_intp) agent_count,
+            (npy_intp) config.history_length,
+            (npy_intp) (config.scent_dimension + vision_size)};
+    npy_intp strides[] = {
+            (npy_intp) (sizeof(float) * config.history_length * stride),
+            (npy_intp) (sizeof(float) * stride),
+            (npy_intp) sizeof(float)};
+    PyArrayObject* py_histories = (PyArrayObject*) PyArray_New(&PyArray_Type,
+            3, dims, NPY_FLOAT, strides, histories, 0, NPY_ARRAY_ALIGNED | NPY_ARRAY_WRITEABLE, NULL);
+    if (py_histories == NULL) {
+        free(histories);
+        return NULL;
+    }
+    PyArray_ENABLEFLAGS(py_histories, NPY_ARRAY_OWNDATA);
+    return (PyObject*) py_histories;
+}
+
+/**
+ * The base object of the numpy arrays returned by
+ * `simulator_observation_history_views`, which keeps the observation slab
+ * pinned, and the Python object that owns the simulator alive, until all of
+ * the arrays are freed.
+ */
+struct py_observation_pin {
+    simulator<py_simulator_data>* sim;
+    PyObject* owner;
+};
+
+static void observation_pin_destructor(PyObject* py_pin) {
+    py_observation_pin* pin = (py_observation_pin*) PyCapsule_GetPointer(py_pin, "jbw.observation_pin");
+    /* release the GIL, since the simulator may hold its lock while it waits for the GIL in `on_step` */
+    PyThreadState* thread_state = PyEval_SaveThread();
+    pin->sim->unpin_observations();
+    PyEval_RestoreThread(thread_state);
+    Py_DECREF(pin->owner);
+    free(pin);
+}
+
+/**
+ * Retrieves the last `history_length` observations of each of the given
+ * agents, oldest first, as read-only numpy arrays of shape
+ * `(history_length, scent size + vision size)` that are strided views of
+ * the observation slab of the simulator, so nothing is copied. The slab,
+ * and the Python object `owner`, are kept alive until all of the arrays are
+ * freed. Since the simulator writes the observations in place, the arrays
+ * only hold the histories until the next time step, or until agents are
+ * added or removed. This is only supported for local simulators.
+ *
+ * \param   self    Pointer to the Python object calling this method.
+ * \param   args    Arguments:
+ *                  - Handle to the native simulator object as a PyLong.
+ *                  - Handle to the native client object as a PyLong. This
+ *                    must be None.
+ *                  - (list of ints) A list of agent IDs whose observation
+ *                    histories to query.
+ *                  - The Python object that owns the simulator.
+ * 
+eturns The list of numpy arrays of observation histories.
+ */
+static PyObject* simulator_observation_history_views(PyObject *self, PyObject *args) {
+    PyObject* py_sim_handle;
+    PyObject* py_client_handle;
+    PyObject* py_agent_ids;
+    PyObject* py_owner;
+    if (!PyArg_ParseTuple(args, "OOOO", &py_sim_handle, &py_client_handle, &py_agent_ids, &py_owner))
+        return NULL;
+    if (!PyList_Check(py_agent_ids)) {
+        PyErr_SetString(PyExc_TypeError, "'agent_ids' must be a list.\n");
+        return NULL;
+    } else if (py_client_handle != Py_None) {
+        PyErr_SetString(PyExc_RuntimeError, "Observation histories are only available for local simulators.");
+        return NULL;
+    }
+
+    size_t agent_count = (size_t) PyList_Size(py_agent_ids);
+    uint64_t* agent_ids = (uint64_t*) malloc(max((size_t) 1, sizeof(uint64_t) * agent_count));
+    size_t* offsets = (size_t*) malloc(max((size_t) 1, sizeof(size_t) * agent_count));
+    status* results = (status*) malloc(max((size_t) 1, sizeof(status) * agent_count));
+    py_observation_pin* pin = (py_observation_pin*) malloc(sizeof(py_observation_pin));
+    if (agent_ids == nullptr || offsets == nullptr || results == nullptr || pin == nullptr) {
+        if (agent_ids != nullptr) free(agent_ids);
+        if (offsets != nullptr) free(offsets);
+        if (results != nullptr) free(results);
+        if (pin != nullptr) free(pin);
+        PyErr_NoMemory();
+        return NULL;
+    }
+    for (size_t i = 0; i < agent_count; i++)
+        agent_ids[i] = PyLong_AsUnsignedLongLong(PyList_GetItem(py_agent_ids, i));
+
+    simulator<py_simulator_data>* sim_handle =
+            (simulator<py_simulator_data>*) PyLong_AsVoidPtr(py_sim_handle);
+    PyThreadState* thread_state = PyEval_SaveThread();
+    const float* slab = sim_handle->pin_observations(agent_ids, (unsigned int) agent_count, offsets, results);
+    PyEval_RestoreThread(thread_state);
+    free(agent_ids);
+
+    /* from here on, the capsule unpins the slab when it is freed */
+    pin->sim = sim_handle;
+    pin->owner = py_owner;
+    Py_INCREF(py_owner);
+    PyObject* py_pin = PyCapsule_New(pin, "jbw.observation_pin", observation_pin_destructor);
+    if (py_pin == NULL) {
+        thread_state = PyEval_SaveThread();
+        sim_handle->unpin_observations();
+        PyEval_RestoreThread(thread_state);
+        Py_DECREF(py_owner);
+        free(offsets); free(results); free(pin);
+        return NULL;
+    }
+    for (size_t i = 0; i < agent_count; i++) {
+        if (results[i] != status::OK) {
+            PyErr_SetString(PyExc_ValueError, "Invalid agent ID in the call to 'simulator_c.observation_history_views'.");
+            free(offsets); free(results);
+            Py_DECREF(py_pin);
+            return NULL;
+        }
+    }
+    free(results);
+
+    const simulator_config& config = sim_handle->get_config();
+    const size_t vision_size = (size_t) (2*config.vision_range + 1)
+            * (2*config.vision_range + 1) * config.color_dimension;
+    npy_intp dims[] = {
+            (npy_intp) config.history_length,
+            (npy_intp) (config.scent_dimension + vision_size)};
+    npy_intp strides[] = {
+            (npy_intp) (sizeof(float) * observation_stride(config)),
+            (npy_intp) sizeof(float)};
+    PyObject* py_views = PyList_New(agent_count);
+    if (py_views == NULL) {
+        free(offsets);
+        Py_DECREF(py_pin);
+        return NULL;
+    }
+    for (size_t i = 0; i < agent_count; i++) {
+        PyArrayObject* py_view = (PyArrayObject*) PyArray_New(&PyArray_Type,
+                2, dims, NPY_FLOAT, strides, (void*) (slab + offsets[i]), 0, NPY_ARRAY_ALIGNED, NULL);
+        if (py_view == NULL) {
+            free(offsets);
+            Py_DECREF(py_views); Py_DECREF(py_pin);
+            return NULL;
+        }
+        Py_INCREF(py_pin);
+        if (PyArray_SetBaseObject(py_view, py_pin) != 0) {
+            free(offsets);
+            Py_DECREF(py_view); Py_DECREF(py_views); Py_DECREF(py_pin);
+            return NULL;
+        }
+        PyList_SET_ITEM(py_views, i, (PyObject*) py_view);
+    }
+    free(offsets);
+    Py_DECREF(py_pin);
+    return py_views;
+}
+
+/**
+ * Retrieves the rewards of the given agents in the last time step, which the
+ * simulator evaluates from the reward schema in its configuration, as a numpy
+ * array. This is only supported for local simulators.
+ *
+ * \param   self    Pointer to the Python object calling this method.
+ * \param   args    Arguments:
+ *                  - Handle to the native simulator object as a PyLong.
+ *                  - Handle to the native client object as a PyLong. This
+ *                    must be None.
+ *                  - (list of ints) A list of agent IDs whose rewards to
+ *                    query.
+ * \returns The numpy array of rewards.
+ */
+static PyObject* simulator_rewards(PyObject *self, PyObject *args) {
+    PyObject* py_sim_handle;
+    PyObject* py_client_handle;
+    PyObject* py_agent_ids;
+    if (!PyArg_ParseTuple(args, "OOO", &py_sim_handle, &py_client_handle, &py_agent_ids))
+        return NULL;
+    if (!PyList_Check(py_agent_ids)) {
+        PyErr_SetString(PyExc_TypeError, "'agent_ids' must be a list.\n");
+        return NULL;
+    } else if (py_client_handle != Py_None) {
+        PyErr_SetString(PyExc_RuntimeError, "Rewards are only available for local simulators.");
+        return NULL;
+    }
+
+    size_t agent_count = (size_t) PyList_Size(py_agent_ids);
+    uint64_t* agent_ids = (uint64_t*) malloc(max((size_t) 1, sizeof(uint64_t) * agent_count));
+    status* results = (status*) malloc(max((size_t) 1, sizeof(status) * agent_count));
+    float* rewards = (float*) malloc(max((size_t) 1, sizeof(float) * agent_count));
+    if (agent_ids == nullptr || results == nullptr || rewards == nullptr) {
+        if (agent_ids != nullptr) free(agent_ids);
+        if (results != nullptr) free(results);
+        if (rewards != nullptr) free(rewards);
+        PyErr_NoMemory();
+        return NULL;
+    }
+    for (size_t i = 0; i < agent_count; i++)
+        agent_ids[i] = PyLong_AsUnsignedLongLong(PyList_GetItem(py_agent_ids, i));
+
+    simulator<py_simulator_data>* sim_handle =
+            (simulator<py_simulator_data>*) PyLong_AsVoidPtr(py_sim_handle);
+    sim_handle->get_rewards(agent_ids, (unsigned int) agent_count, rewards, results);
+    for (size_t i = 0; i < agent_count; i++) {
+        if (results[i] != status::OK) {
+            PyErr_SetString(PyExc_ValueError, "Invalid agent ID in the call to 'simulator_c.rewards'.");
+            free(agent_ids); free(results); free(rewards);
+            return NULL;
+        }
+    }
+    free(agent_ids); free(results);
+
+    npy_intp dims[] = {(npy_intp) agent_count};
+    PyArrayObject* py_rewards = (PyArrayObject*) PyArray_SimpleNewFromData(1, dims, NPY_FLOAT, rewards);
+    if (py_rewards == NULL) {
+        free(rewards);
+        return NULL;
+    }
+    PyArray_ENABLEFLAGS(py_rewards, NPY_ARRAY_OWNDATA);
+    return (PyObject*) py_rewards;
+}
+
 /**
  * Sets whether the agent is active or inactive.
  *
@@ -2607,6 +3511,8 @@ static PyMethodDef SimulatorMethods[] = {
     {"save",  jbw::simulator_save, METH_VARARGS, "Saves a simulator to file."},
     {"load",  jbw::simulator_load, METH_VARARGS, "Loads a simulator from file and returns its pointer."},
     {"delete",  jbw::simulator_delete, METH_VARARGS, "Deletes an existing simulator."},
+    {"snapshot",  jbw::simulator_snapshot, METH_VARARGS, "Creates a snapshot of a local simulator and returns its pointer."},
+    {"restore",  jbw::simulator_restore, METH_VARARGS, "Resets a local simulator to the state of a snapshot."},
     {"start_server",  jbw::simulator_start_server, METH_VARARGS, "Starts the simulator server."},
     {"stop_server",  jbw::simulator_stop_server, METH_VARARGS, "Stops the simulator server."},
     {"connect_client",  jbw::simulator_connect_client, METH_VARARGS, "Connects a new simulator client to a server."},
@@ -2624,9 +3530,17 @@ static PyMethodDef SimulatorMethods[] = {
     {"move",  jbw::simulator_move, METH_VARARGS, "Attempts to move the agent in the simulation environment."},
     {"turn",  jbw::simulator_turn, METH_VARARGS, "Attempts to turn the agent in the simulation environment."},
     {"no_op",  jbw::simulator_no_op, METH_VARARGS, "Attempts to instruct the agent to do nothing (a no-op) in the simulation environment."},
+    {"act_batch",  jbw::simulator_act_batch, METH_VARARGS, "Attempts to submit a batch of actions for agents in the simulation environment."},
+    {"submit_plan",  jbw::simulator_submit_plan, METH_VARARGS, "Attempts to submit a plan of actions for an agent in the simulation environment."},
     {"map",  jbw::simulator_map, METH_VARARGS, "Returns a list of patches within a given bounding box."},
     {"agent_ids",  jbw::simulator_agent_ids, METH_VARARGS, "Returns a list of the IDs of all agents in the simulation environment."},
     {"agent_states",  jbw::simulator_agent_states, METH_VARARGS, "Returns a list of the agent states with the specified IDs in the simulation environment."},
+    {"observation_history",  jbw::simulator_observation_history, METH_VARARGS, "Returns the recent observations of the agents with the specified IDs as a strided numpy array."},
+    {"observation_history_views",  jbw::simulator_observation_history_views, METH_VARARGS, "Returns read-only views of the recent observations of the agents with the specified IDs, without copying them."},
+    {"rewards",  jbw::simulator_rewards, METH_VARARGS, "Returns the rewards of the agents with the specified IDs in the last time step as a numpy array."},
+    {"batch_new",  jbw::simulator_batch_new, METH_VARARGS, "Creates a batch of single-agent simulators and returns its pointer."},
+    {"batch_delete",  jbw::simulator_batch_delete, METH_VARARGS, "Deletes an existing batch of simulators."},
+    {"batch_step",  jbw::simulator_batch_step, METH_VARARGS, "Steps every simulator in a batch and returns the observations and rewards of their agents as numpy arrays."},
     {"set_active",  jbw::simulator_set_active, METH_VARARGS, "Sets whether the agent is active or inactive."},
     {"is_active",  jbw::simulator_is_active, METH_VARARGS, "Gets whether the agent is active or inactive."},
     {NULL, NULL, 0, NULL}        /* Sentinel */
@@ -23,7 +23,7 @@ import os
 
 from .item import IntensityFunction, InteractionFunction
 
-__all__ = ['MPIError', 'MovementConflictPolicy', 'ActionPolicy', 'SimulatorConfig', 'Simulator']
+__all__ = ['MPIError', 'MovementConflictPolicy', 'ActionPolicy', 'ActionType', 'PlanAbortCondition', 'SimulatorConfig', 'SimulatorSnapshot', 'Simulator', 'SimulatorBatch']
 
 
 class MPIError(Exception):
@@ -48,13 +48,29 @@ class ActionPolicy(Enum):
   DISALLOWED = 0
   IGNORED = 0
 
+class ActionType(Enum):
+  """Kind of action submitted in a batch to `Simulator.act_batch`."""
+
+  MOVE = 0
+  TURN = 1
+  NO_OP = 2
+
+class PlanAbortCondition(Enum):
+  """Condition under which an action plan, submitted with
+     `Simulator.submit_plan`, stops before all of its actions are taken."""
+
+  ITEM_VISIBLE = 1
+  BLOCKED = 2
+
 class SimulatorConfig(object):
   """Represents a configuration for a simulator."""
 
   def __init__(self, max_steps_per_movement, allowed_movement_directions,
       allowed_turn_directions, no_op_allowed, vision_range, patch_size,
       mcmc_num_iter, items, agent_color, collision_policy, agent_field_of_view,
-      decay_param, diffusion_param, deleted_item_lifetime, seed=0):
+      decay_param, diffusion_param, deleted_item_lifetime, seed=0,
+      history_length=1, reward_item_deltas=None, reward_per_step=0.0,
+      reward_per_distance=0.0):
     """Creates a new simulator configuration.
 
     Arguments:
@@ -91,8 +107,23 @@ class SimulatorConfig(object):
                                    after they have been removed from the world.
       seed:                        The initial seed for the pseudorandom number
                                    generator.
+      history_length:              The number of most recent observations
+                                   kept for each agent, which are returned by
+                                   `Simulator.observation_history`.
+      reward_item_deltas:          The reward of collecting an item of each
+                                   type, as a list with one element per item
+                                   type, or None if items do not contribute
+                                   to the reward.
+      reward_per_step:             The reward of every time step.
+      reward_per_distance:         The reward per cell that an agent moves.
+                                   The simulator evaluates the reward of
+                                   every agent in each time step from these
+                                   three terms, which are returned by
+                                   `Simulator.rewards`.
     """
     assert len(items) > 0, 'A non-empty list of items must be provided.'
+    assert history_length >= 1, '`history_length` must be at least 1.'
+    assert reward_item_deltas is None or len(reward_item_deltas) == len(items), 'The `reward_item_deltas` field must be the same dimension as `items`'
     self.max_steps_per_movement = max_steps_per_movement
     self.allowed_movement_directions = allowed_movement_directions
     self.allowed_turn_directions = allowed_turn_directions
@@ -116,6 +147,28 @@ class SimulatorConfig(object):
     self.deleted_item_lifetime = deleted_item_lifetime
     self.agent_field_of_view = agent_field_of_view
     self.seed = seed
+    self.history_length = history_length
+    self.reward_item_deltas = reward_item_deltas
+    self.reward_per_step = reward_per_step
+    self.reward_per_distance = reward_per_distance
+
+
+class SimulatorSnapshot(object):
+  """Snapshot of the state of a local simulator, created by
+  `Simulator.snapshot`, to which the simulator can be reset with
+  `Simulator.restore`. The snapshot shares the patches of the world with the
+  simulator copy-on-write, so it is much cheaper than saving the simulator."""
+
+  def __init__(self, handle, time, agents, agent_states):
+    self._handle = handle
+    self._time = time
+    self._agents = agents
+    self._agent_states = agent_states
+
+  def __del__(self):
+    """Deletes this snapshot and deallocates all associated memory."""
+    if self._handle != None:
+      simulator_c.delete(self._handle)
 
 
 class Simulator(object):
@@ -240,7 +293,9 @@ class Simulator(object):
         sim_config.color_num_dims, sim_config.vision_range, sim_config.patch_size, sim_config.mcmc_num_iter,
         [(i.name, i.scent, i.color, i.required_item_counts, i.required_item_costs, i.blocks_movement, i.visual_occlusion, i.intensity_fn, i.intensity_fn_args, i.interaction_fns) for i in sim_config.items],
         sim_config.agent_color, sim_config.collision_policy.value, sim_config.agent_field_of_view,
-        sim_config.decay_param, sim_config.diffusion_param, sim_config.deleted_item_lifetime, self._step_callback)
+        sim_config.decay_param, sim_config.diffusion_param, sim_config.deleted_item_lifetime, self._step_callback,
+        sim_config.history_length, sim_config.reward_item_deltas, sim_config.reward_per_step,
+        sim_config.reward_per_distance)
       if is_server:
         self._server_handle = simulator_c.start_server(
           self._handle, port, conn_queue_capacity, num_workers, default_client_permissions)
@@ -364,6 +419,54 @@ class Simulator(object):
     """
     return simulator_c.no_op(self._handle, self._client_handle, agent._id)
 
+  def act_batch(self, actions):
+    """Submits a batch of actions for the agents in the simulated environment.
+
+    This is equivalent to calling `move`, `turn`, or `no_op` for each agent,
+    but the whole batch is submitted with a single call into the simulator
+    (or a single message to the server), and the simulator advances by at
+    most one time step once the batch is submitted.
+
+    Arguments:
+      actions: List of tuples `(agent, action_type, direction, num_steps)`,
+               where `action_type` is an ActionType, `direction` is the
+               RelativeDirection to move or turn (ignored for no-ops), and
+               `num_steps` is the number of steps to move (ignored for turns
+               and no-ops).
+
+    Returns:
+      List containing, for each action, `True` if successful, and `False`
+      otherwise.
+    """
+    return simulator_c.act_batch(self._handle, self._client_handle,
+      [(agent._id, action_type.value, (0 if direction is None else direction.value), num_steps)
+       for (agent, action_type, direction, num_steps) in actions])
+
+  def submit_plan(self, agent, actions, abort_conditions=[]):
+    """Submits a plan of actions for the specified agent, which the simulator
+    takes on behalf of the agent, one per time step, so that the agent does
+    not need to act again until the plan ends. This replaces any previous
+    plan of the agent, and an empty plan cancels it.
+
+    When connected to a server, the client is not sent step responses while
+    all of its agents are executing plans, and so `do_next_action` is not
+    called until one of the plans ends.
+
+    Arguments:
+      agent:            The agent taking the actions.
+      actions:          List of tuples `(action_type, direction, num_steps)`,
+                        as in `act_batch`.
+      abort_conditions: List of PlanAbortCondition, under which the plan
+                        stops before all of its actions are taken.
+
+    Returns:
+      `True`, if successful; `False`, otherwise.
+    """
+    return simulator_c.submit_plan(self._handle, self._client_handle, agent._id,
+      [(action_type.value, (0 if direction is None else direction.value), num_steps)
+       for (action_type, direction, num_steps) in actions],
+      sum(condition.value for condition in set(abort_conditions)))
+
   def get_agents(self):
     """Retrieves a list of the agents governed by this Simulator. This does not
     include the agents governed by other clients."""
@@ -441,6 +544,89 @@ class Simulator(object):
     """
     return simulator_c.is_active(self._handle, self._client_handle, agent._id)
 
+  def observation_history(self, agents):
+    """Returns the last `history_length` observations (see `SimulatorConfig`)
+    of the given agents, oldest first. This is only supported for local
+    simulators.
+
+    Arguments:
+      agents: The agents whose observations to return.
+
+    Returns:
+      A numpy array of shape `(len(agents), history_length, scent_num_dims +
+      vision_size)`, where each observation is the scent followed by the
+      flattened visual field. The array is a strided view of a single copy of
+      the histories kept by the simulator, so stacking frames requires no
+      further copies.
+    """
+    return simulator_c.observation_history(self._handle, self._client_handle, [agent._id for agent in agents])
+
+  def observation_history_views(self, agents):
+    """Returns the last `history_length` observations (see `SimulatorConfig`)
+    of the given agents, oldest first, without copying them. Unlike
+    `observation_history`, the returned arrays are read-only views of the
+    observations kept by the simulator, which is kept alive for as long as
+    any of them is. Since the simulator overwrites its observations in place,
+    the views only hold these histories until the next time step, or until
+    agents are added or removed. This is only supported for local
+    simulators.
+
+    Arguments:
+      agents: The agents whose observations to return.
+
+    Returns:
+      A list with one numpy array per agent, of shape `(history_length,
+      scent_num_dims + vision_size)`, where each observation is the scent
+      followed by the flattened visual field.
+    """
+    return simulator_c.observation_history_views(self._handle, self._client_handle, [agent._id for agent in agents], self)
+
+  def rewards(self, agents):
+    """Returns the rewards of the given agents in the last time step, which
+    the simulator evaluates from the reward schema in its configuration (see
+    `SimulatorConfig`). This is only supported for local simulators.
+
+    Arguments:
+      agents: The agents whose rewards to return.
+
+    Returns:
+      A numpy array of shape `(len(agents),)`.
+    """
+    return simulator_c.rewards(self._handle, self._client_handle, [agent._id for agent in agents])
+
+  def snapshot(self):
+    """Returns a snapshot of the current state of this simulator and its
+    agents, to which this simulator can later be reset with `restore`. This
+    is only supported for local simulators.
+
+    Returns:
+      A `SimulatorSnapshot`.
+    """
+    if self._client_handle != None or self._server_handle != None:
+      raise RuntimeError("`snapshot` requires that the Simulator be local.")
+    agent_states = {id: (agent._position, agent._direction, agent._scent, agent._vision, agent._items)
+                    for (id, agent) in self.agents.items()}
+    return SimulatorSnapshot(simulator_c.snapshot(self._handle), self._time, dict(self.agents), agent_states)
+
+  def restore(self, snapshot):
+    """Resets this simulator and its agents to the state of the given
+    snapshot, which was created by `snapshot` from this simulator. The
+    snapshot is unchanged, so this simulator can be restored from it
+    repeatedly. Unlike constructing a new simulator, this does not
+    regenerate the world around the agents. Agents that were added after
+    the snapshot was created are removed from this simulator.
+
+    Arguments:
+      snapshot: The `SimulatorSnapshot` to which to reset this simulator.
+    """
+    if self._client_handle != None or self._server_handle != None:
+      raise RuntimeError("`restore` requires that the Simulator be local.")
+    simulator_c.restore(self._handle, snapshot._handle)
+    self._time = snapshot._time
+    self.agents = dict(snapshot._agents)
+    for (id, agent) in self.agents.items():
+      (agent._position, agent._direction, agent._scent, agent._vision, agent._items) = snapshot._agent_states[id]
+
   def _agent_ids(self):
     """Retrieves a list of the IDs of *all* agents in the simulation environment."""
     return simulator_c.agent_ids(self._handle, self._client_handle)
@@ -469,3 +655,61 @@ class Simulator(object):
         agent_type = type(agent)
         line = str(agent_id) + ' ' + agent_type.__module__ + '.' + agent_type.__name__ + '\n'
         fout.write(line.encode('utf-8'))
+
+
+class SimulatorBatch(object):
+  """Batch of independent local simulators ("worlds") with the same
+  configuration, each containing a single agent, which are stepped together.
+
+  Each call to `step` submits one action per world, advances the worlds in
+  parallel in native threads, and returns the observations and rewards of all
+  agents as numpy arrays, so training with many environments requires a
+  single call into the simulator per step, rather than one per agent.
+  """
+
+  def __init__(self, sim_config, num_worlds):
+    """Creates a new batch of simulators.
+
+    Arguments:
+      sim_config: Configuration of every world. World `i` is seeded with
+                  `sim_config.seed + i`, and the rewards returned by `step`
+                  are evaluated from the reward schema in this configuration.
+      num_worlds: The number of worlds in the batch.
+    """
+    self._handle = None
+    self.num_worlds = num_worlds
+    self._handle = simulator_c.batch_new(num_worlds, sim_config.seed,
+      sim_config.max_steps_per_movement, [d.value for d in sim_config.allowed_movement_directions],
+      [d.value for d in sim_config.allowed_turn_directions], sim_config.no_op_allowed, sim_config.scent_num_dims,
+      sim_config.color_num_dims, sim_config.vision_range, sim_config.patch_size, sim_config.mcmc_num_iter,
+      [(i.name, i.scent, i.color, i.required_item_counts, i.required_item_costs, i.blocks_movement, i.visual_occlusion, i.intensity_fn, i.intensity_fn_args, i.interaction_fns) for i in sim_config.items],
+      sim_config.agent_color, sim_config.collision_policy.value, sim_config.agent_field_of_view,
+      sim_config.decay_param, sim_config.diffusion_param, sim_config.deleted_item_lifetime,
+      sim_config.history_length, sim_config.reward_item_deltas, sim_config.reward_per_step,
+      sim_config.reward_per_distance)
+
+  def __del__(self):
+    """Deletes this batch and deallocates all associated memory."""
+    if self._handle != None:
+      simulator_c.batch_delete(self._handle)
+
+  def step(self, actions):
+    """Submits an action for the agent in every world and advances the
+    worlds by one time step.
+
+    Arguments:
+      actions: List of tuples `(action_type, direction, num_steps)`, as in
+               `Simulator.act_batch`, with one element per world.
+
+    Returns:
+      A tuple `(results, positions, directions, scents, visions, rewards)`,
+      where `results` is a list containing, for each world, `True` if its
+      action was successful, and `False` otherwise, and the remaining
+      elements are numpy arrays of shape `(num_worlds, 2)`, `(num_worlds,)`,
+      `(num_worlds, scent_num_dims)`, `(num_worlds, 2*vision_range + 1,
+      2*vision_range + 1, color_num_dims)`, and `(num_worlds,)`. If an action
+      fails, its world does not advance, and its reward is 0.
+    """
+    return simulator_c.batch_step(self._handle,
+      [(action_type.value, (0 if direction is None else direction.value), num_steps)
+       for (action_type, direction, num_steps) in actions])
@@ -114,6 +114,12 @@ internal extension Simulator.Configuration {
     self.scentDecay = value.scentDecay
     self.scentDiffusion = value.scentDiffusion
     self.removedItemLifetime = value.removedItemLifetime
+    self.historyLength = value.historyLength
+    self.rewardItemDeltas = value.rewardItemDeltas.map {
+      [Float](UnsafeBufferPointer(start: $0, count: Int(value.numItemTypes)))
+    }
+    self.rewardPerStep = value.rewardPerStep
+    self.rewardPerDistance = value.rewardPerDistance
   }
 
   @inlinable
@@ -130,6 +136,11 @@ internal extension Simulator.Configuration {
     let cColor = UnsafeMutablePointer<Float>.allocate(capacity: color.count)
     cItems.initialize(from: items, count: items.count)
     cColor.initialize(from: color, count: color.count)
+    let cRewardItemDeltas = rewardItemDeltas.map { deltas -> UnsafeMutablePointer<Float> in
+      let cDeltas = UnsafeMutablePointer<Float>.allocate(capacity: deltas.count)
+      cDeltas.initialize(from: deltas, count: deltas.count)
+      return cDeltas
+    }
     return (
       configuration: SimulatorConfig(
         randomSeed: randomSeed,
@@ -157,10 +168,15 @@ internal extension Simulator.Configuration {
         movementConflictPolicy: moveConflictPolicy.toC(),
         scentDecay: scentDecay,
         scentDiffusion: scentDiffusion,
-        removedItemLifetime: removedItemLifetime),
+        removedItemLifetime: removedItemLifetime,
+        historyLength: historyLength,
+        rewardItemDeltas: cRewardItemDeltas,
+        rewardPerStep: rewardPerStep,
+        rewardPerDistance: rewardPerDistance),
       deallocate: { () in
         cItems.deallocate()
         cColor.deallocate()
+        cRewardItemDeltas?.deallocate()
         for deallocate in itemDeallocators {
           deallocate()
         }
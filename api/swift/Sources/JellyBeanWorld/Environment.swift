@@ -47,7 +47,8 @@ public struct Environment: ReinforcementLearning.Environment {
         serverConfiguration: configuration.serverConfiguration)
       let agent = Agent()
       try simulator.add(agent: agent)
-      return State(simulator: simulator, agent: agent)
+      let snapshot = configuration.serverConfiguration == nil ? try simulator.snapshot() : nil
+      return State(simulator: simulator, agent: agent, snapshot: snapshot)
     }
     let observation = Observation.stack(zip(configurations, states).map { (configuration, state) in
       let agentState = state.simulator.agentStates.values.first!
@@ -109,21 +110,34 @@ public struct Environment: ReinforcementLearning.Environment {
       scent: Tensor<Float>(agentState.scent),
       moved: Tensor<Float>(agentState.position != previousAgentState.position ? 1 : 0),
       rewardFunction: rewardFunction)
-    let reward = Tensor<Float>(rewardFunction(for: AgentTransition(
-      previousState: previousAgentState,
-      currentState: agentState)))
+    let reward: Tensor<Float>
+    if configurations[batchIndex].usesNativeReward {
+      let agentID = states[batchIndex].simulator.agentStates.keys.first!
+      reward = Tensor<Float>(
+        try states[batchIndex].simulator.rewards(forAgentsWithIDs: [agentID])[0])
+    } else {
+      reward = Tensor<Float>(rewardFunction(for: AgentTransition(
+        previousState: previousAgentState,
+        currentState: agentState)))
+    }
     return Step(kind: StepKind.transition(), observation: observation, reward: reward)
   }
 
-  /// Resets the environment.
+  /// Resets the environment. Simulators that are not servers are restored from the snapshot of
+  /// their initial state, which does not regenerate their worlds.
   @inlinable
   @discardableResult
   public mutating func reset() throws -> Step<Observation, Tensor<Float>> {
-    states = try configurations.map { configuration -> State in
+    states = try zip(configurations, states).map { (configuration, state) -> State in
+      if let snapshot = state.snapshot {
+        try state.simulator.restore(from: snapshot)
+        state.agent.nextAction = nil
+        return state
+      }
       let simulator = try Simulator(using: configuration.simulatorConfiguration)
       let agent = Agent()
       try simulator.add(agent: agent)
-      return State(simulator: simulator, agent: agent)
+      return State(simulator: simulator, agent: agent, snapshot: nil)
     }
     let observation = Observation.stack(zip(configurations, states).map { (configuration, state) in
       let agentState = state.simulator.agentStates.values.first!
@@ -154,13 +168,28 @@ extension Environment {
     public let rewardSchedule: RewardSchedule
     public let serverConfiguration: Simulator.ServerConfiguration?
 
+    /// Indicates whether the rewards are computed by the simulator, using the reward schema in
+    /// `simulatorConfiguration`. This is the case for fixed reward schedules whose reward
+    /// function has a native schema (see `Reward.nativeSchema(for:)`).
+    public let usesNativeReward: Bool
+
     @inlinable
     public init(
       simulatorConfiguration: Simulator.Configuration,
       rewardSchedule: RewardSchedule,
       serverConfiguration: Simulator.ServerConfiguration? = nil
     ) {
-      self.simulatorConfiguration = simulatorConfiguration
+      if let schedule = rewardSchedule as? FixedReward,
+         let schema = schedule.reward.nativeSchema(for: simulatorConfiguration.items) {
+        self.simulatorConfiguration = simulatorConfiguration.withRewardSchema(
+          itemDeltas: schema.itemDeltas,
+          perStep: schema.perStep,
+          perDistance: 0)
+        self.usesNativeReward = true
+      } else {
+        self.simulatorConfiguration = simulatorConfiguration
+        self.usesNativeReward = false
+      }
       self.rewardSchedule = rewardSchedule
       self.serverConfiguration = serverConfiguration
     }
@@ -194,10 +223,15 @@ extension Environment {
     @usableFromInline internal let simulator: Simulator
     @usableFromInline internal var agent: Agent
 
+    /// Snapshot of the initial state of `simulator`, which is restored when the environment is
+    /// reset. This is `nil` for simulation servers.
+    @usableFromInline internal let snapshot: Simulator.Snapshot?
+
     @inlinable
-    internal init(simulator: Simulator, agent: Agent) {
+    internal init(simulator: Simulator, agent: Agent, snapshot: Simulator.Snapshot?) {
       self.simulator = simulator
       self.agent = agent
+      self.snapshot = snapshot
     }
   }
 }
@@ -76,6 +76,39 @@ public enum Reward: Equatable {
   }
 }
 
+extension Reward {
+  /// Returns the reward schema that the simulator can evaluate natively in every step, and which
+  /// is equivalent to this reward function, or `nil` if there is no such schema. The schema
+  /// consists of the reward of collecting an item of each of the provided `items`, and the reward
+  /// of every step (see `Simulator.Configuration.rewardItemDeltas`). `explore` rewards depend on
+  /// the distance of the agent from the origin, which the schema does not support.
+  ///
+  /// - Parameter items: Items of the simulator configuration.
+  @inlinable
+  public func nativeSchema(for items: [Item]) -> (itemDeltas: [Float], perStep: Float)? {
+    switch self {
+    case .zero:
+      return (itemDeltas: [Float](repeating: 0, count: items.count), perStep: 0)
+    case let .action(value):
+      return (itemDeltas: [Float](repeating: 0, count: items.count), perStep: value)
+    case let .collect(item, value), let .avoid(item, value):
+      var itemDeltas = [Float](repeating: 0, count: items.count)
+      if let index = items.firstIndex(of: item) {
+        if case .collect = self { itemDeltas[index] = value } else { itemDeltas[index] = -value }
+      }
+      return (itemDeltas: itemDeltas, perStep: 0)
+    case .explore:
+      return nil
+    case let .combined(reward1, reward2):
+      guard let schema1 = reward1.nativeSchema(for: items),
+            let schema2 = reward2.nativeSchema(for: items) else { return nil }
+      return (
+        itemDeltas: zip(schema1.itemDeltas, schema2.itemDeltas).map { $0 + $1 },
+        perStep: schema1.perStep + schema2.perStep)
+    }
+  }
+}
+
 extension Reward: CustomStringConvertible {
   public var description: String {
     switch self {
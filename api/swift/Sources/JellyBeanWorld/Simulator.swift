@@ -312,6 +312,70 @@ public final class Simulator {
     try checkStatus(status)
   }
 
+  /// Returns a snapshot of the current state of this simulator and its agents, to which this
+  /// simulator can later be reset using `restore(from:)`. The snapshot shares the patches of the
+  /// world with this simulator copy-on-write, and so it is much cheaper than saving this
+  /// simulator. This is only supported for local simulators.
+  @inlinable
+  public func snapshot() throws -> Snapshot {
+    var status = JBW_Status(code: JBW_OK)
+    let snapshotHandle = simulatorSnapshot(handle, &status)
+    try checkStatus(status)
+    return Snapshot(handle: snapshotHandle!, time: time, agents: agents, agentStates: agentStates)
+  }
+
+  /// Resets this simulator and its agents to the state of the provided snapshot, which was
+  /// created by `snapshot()` from this simulator. The snapshot is unchanged, and so this simulator
+  /// can be restored from it repeatedly. Unlike creating a new simulator, this does not regenerate
+  /// the world around the agents. If the restore fails, this simulator is unchanged.
+  ///
+  /// - Parameter snapshot: Snapshot to which to reset this simulator.
+  public func restore(from snapshot: Snapshot) throws {
+    var status = JBW_Status(code: JBW_OK)
+    simulatorRestore(handle, snapshot.handle, &status)
+    try checkStatus(status)
+    time = snapshot.time
+    agents = snapshot.agents
+    agentStates = snapshot.agentStates
+  }
+
+  /// Returns the rewards of the agents with the provided IDs in the last simulation step, which
+  /// the simulator evaluates from the reward schema in its configuration. This is only supported
+  /// for local simulators.
+  ///
+  /// - Parameter ids: IDs of the agents whose rewards to return.
+  @inlinable
+  public func rewards(forAgentsWithIDs ids: [UInt64]) throws -> [Float] {
+    var status = JBW_Status(code: JBW_OK)
+    var rewards = [Float](repeating: 0, count: ids.count)
+    simulatorGetRewards(handle, clientHandle, ids, UInt32(ids.count), &rewards, &status)
+    try checkStatus(status)
+    return rewards
+  }
+
+  /// Returns views of the last `configuration.historyLength` observations of the agents with the
+  /// provided IDs, which read the observations in place in the simulator, rather than copying
+  /// them. Since the simulator overwrites its observations in place, the views only hold these
+  /// histories until the next simulation step, or until agents are added or removed, but their
+  /// memory remains valid for as long as they are alive. This is only supported for local
+  /// simulators.
+  ///
+  /// - Parameter ids: IDs of the agents whose observation histories to return.
+  @inlinable
+  public func observationHistories(forAgentsWithIDs ids: [UInt64]) throws -> ObservationHistories {
+    var status = JBW_Status(code: JBW_OK)
+    var offsets = [UInt64](repeating: 0, count: ids.count)
+    var stride: UInt64 = 0
+    let slab = simulatorPinObservationHistories(
+      handle, clientHandle, ids, UInt32(ids.count), &offsets, &stride, &status)
+    try checkStatus(status)
+    return ObservationHistories(
+      simulator: self,
+      slab: slab!,
+      offsets: offsets.map { Int($0) },
+      stride: Int(stride))
+  }
+
   /// Performs a simulation step.
   ///
   /// - Note: This function will block until all the agents managed by this simulator has acted.
@@ -418,6 +482,92 @@ public final class Simulator {
    }
 }
 
+extension Simulator {
+  /// Snapshot of the state of a local simulator and its agents (see `Simulator.snapshot()`).
+  public final class Snapshot {
+    /// Pointer to the underlying C API simulator instance that holds the snapshot.
+    @usableFromInline internal let handle: UnsafeMutableRawPointer
+
+    /// Simulation time when the snapshot was created.
+    public let time: UInt64
+
+    /// Agents interacting with the simulator when the snapshot was created.
+    @usableFromInline internal let agents: [UInt64: Agent]
+
+    /// States of the agents when the snapshot was created.
+    @usableFromInline internal let agentStates: [UInt64: AgentState]
+
+    @inlinable
+    internal init(
+      handle: UnsafeMutableRawPointer,
+      time: UInt64,
+      agents: [UInt64: Agent],
+      agentStates: [UInt64: AgentState]
+    ) {
+      self.handle = handle
+      self.time = time
+      self.agents = agents
+      self.agentStates = agentStates
+    }
+
+    deinit {
+      simulatorDelete(handle)
+    }
+  }
+}
+
+extension Simulator {
+  /// Observation histories of a set of agents that are read in place in the simulator (see
+  /// `Simulator.observationHistories(forAgentsWithIDs:)`).
+  public final class ObservationHistories {
+    /// Simulator that owns the observations, which is kept alive by these views.
+    public let simulator: Simulator
+
+    /// Pointer to the observation slab of the simulator, which is pinned while this instance is
+    /// alive.
+    @usableFromInline internal let slab: UnsafePointer<Float>
+
+    /// Offsets of the oldest observation of each agent in `slab`.
+    @usableFromInline internal let offsets: [Int]
+
+    /// Distance between the starts of consecutive observations in `slab`.
+    @usableFromInline internal let stride: Int
+
+    /// Number of floats in each observation (i.e., the scent followed by the visual field).
+    public let observationSize: Int
+
+    @inlinable
+    internal init(simulator: Simulator, slab: UnsafePointer<Float>, offsets: [Int], stride: Int) {
+      self.simulator = simulator
+      self.slab = slab
+      self.offsets = offsets
+      self.stride = stride
+      let configuration = simulator.configuration
+      let visionSize = Int(2 * configuration.visionRange + 1)
+      self.observationSize = Int(configuration.scentDimensionality)
+        + visionSize * visionSize * Int(configuration.colorDimensionality)
+    }
+
+    deinit {
+      simulatorUnpinObservationHistories(simulator.handle)
+    }
+
+    /// Number of agents whose histories are viewed.
+    @inlinable
+    public var count: Int { offsets.count }
+
+    /// Returns the observation at `index` in the history of the agent at `agentIndex`, where
+    /// index `0` is the oldest observation and index `historyLength - 1` is the current one.
+    @inlinable
+    public subscript(agentIndex: Int, index: Int) -> UnsafeBufferPointer<Float> {
+      precondition(index >= 0 && index < Int(simulator.configuration.historyLength))
+      return UnsafeBufferPointer(
+        start: slab + offsets[agentIndex] + index * stride,
+        count: observationSize)
+    }
+  }
+}
+
 extension Simulator {
   /// Simulator configuration.
   public struct Configuration: Equatable, Hashable {
@@ -475,6 +625,22 @@ extension Simulator {
     /// Lifetime of removed items (used by the scent simulation algorithm).
     public let removedItemLifetime: UInt32
 
+    /// Number of most recent observations that the simulator keeps for each agent (see
+    /// `Simulator.observationHistories(forAgentsWithIDs:)`). This must be at least 1.
+    public let historyLength: UInt32
+
+    /// Reward of collecting an item of each type in `items`, or `nil` if the collected items do
+    /// not contribute to the reward. Together with `rewardPerStep` and `rewardPerDistance`, this
+    /// is the reward schema that the simulator evaluates for each agent in every step (see
+    /// `Simulator.rewards(forAgentsWithIDs:)`).
+    public let rewardItemDeltas: [Float]?
+
+    /// Reward of every simulation step.
+    public let rewardPerStep: Float
+
+    /// Reward per cell that an agent moves.
+    public let rewardPerDistance: Float
+
     public init(
       randomSeed: UInt32,
       maxStepsPerMove: UInt32,
@@ -492,7 +658,11 @@ extension Simulator {
       moveConflictPolicy: MoveConflictPolicy,
       scentDecay: Float,
       scentDiffusion: Float,
-      removedItemLifetime: UInt32
+      removedItemLifetime: UInt32,
+      historyLength: UInt32 = 1,
+      rewardItemDeltas: [Float]? = nil,
+      rewardPerStep: Float = 0,
+      rewardPerDistance: Float = 0
     ) {
       self.randomSeed = randomSeed
       self.maxStepsPerMove = maxStepsPerMove
@@ -511,6 +681,41 @@ extension Simulator {
       self.scentDecay = scentDecay
       self.scentDiffusion = scentDiffusion
       self.removedItemLifetime = removedItemLifetime
+      self.historyLength = historyLength
+      self.rewardItemDeltas = rewardItemDeltas
+      self.rewardPerStep = rewardPerStep
+      self.rewardPerDistance = rewardPerDistance
+    }
+
+    /// Returns a copy of this configuration with the provided reward schema.
+    @inlinable
+    public func withRewardSchema(
+      itemDeltas: [Float]?,
+      perStep: Float,
+      perDistance: Float
+    ) -> Configuration {
+      Configuration(
+        randomSeed: randomSeed,
+        maxStepsPerMove: maxStepsPerMove,
+        scentDimensionality: scentDimensionality,
+        colorDimensionality: colorDimensionality,
+        visionRange: visionRange,
+        movePolicies: movePolicies,
+        turnPolicies: turnPolicies,
+        noOpAllowed: noOpAllowed,
+        patchSize: patchSize,
+        mcmcIterations: mcmcIterations,
+        items: items,
+        agentColor: agentColor,
+        agentFieldOfView: agentFieldOfView,
+        moveConflictPolicy: moveConflictPolicy,
+        scentDecay: scentDecay,
+        scentDiffusion: scentDiffusion,
+        removedItemLifetime: removedItemLifetime,
+        historyLength: historyLength,
+        rewardItemDeltas: itemDeltas,
+        rewardPerStep: perStep,
+        rewardPerDistance: perDistance)
     }
   }
 }
@@ -18,7 +18,9 @@
 #define JBW_MAP_H_
 
 #include <core/map.h>
+#include <atomic>
 #include "gibbs_field.h"
+#include "profiler.h"
 
 namespace jbw {
 
@@ -73,14 +75,57 @@ struct patch
 
 	Data data;
 
+	/**
+	 * The number of patches that share the memory of `items`, or `NULL` if
+	 * it is owned only by this patch. Patches in forked maps share their
+	 * items copy-on-write, so `unshare_items` must be called before
+	 * modifying `items`.
+	 */
+	std::atomic<unsigned int>* item_references;
+
+	/**
+	 * Ensures that `items` is owned only by this patch, copying it if it is
+	 * shared with other patches.
+	 */
+	inline bool unshare_items() {
+		if (item_references == NULL) {
+			return true;
+		} else if (*item_references == 1) {
+			/* the other patches have since copied or freed the items */
+			core::free(item_references);
+			item_references = NULL;
+			return true;
+		}
+
+		item* copy = (item*) malloc(sizeof(item) * items.capacity);
+		if (copy == NULL) {
+			fprintf(stderr, "patch.unshare_items ERROR: Insufficient memory for items.\n");
+			return false;
+		}
+		memcpy(copy, items.data, sizeof(item) * items.length);
+		if (--(*item_references) == 0) {
+			core::free(items.data);
+			core::free(item_references);
+		}
+		items.data = copy;
+		item_references = NULL;
+		return true;
+	}
+
 	static inline void move(const patch& src, patch& dst) {
 		core::move(src.items, dst.items);
 		core::move(src.data, dst.data);
 		dst.fixed = src.fixed;
+		dst.item_references = src.item_references;
 	}
 
 	static inline void free(patch& p) {
-		core::free(p.items);
+		if (p.item_references == NULL) {
+			core::free(p.items);
+		} else if (--(*p.item_references) == 0) {
+			core::free(p.items);
+			core::free(p.item_references);
+		}
 		core::free(p.data);
 	}
 };
@@ -88,6 +133,7 @@ struct patch
 template<typename Data>
 inline bool init(patch<Data>& new_patch) {
 	new_patch.fixed = false;
+	new_patch.item_references = NULL;
 	if (!init(new_patch.data)) {
 		return false;
 	} else if (!array_init(new_patch.items, 8)) {
@@ -103,6 +149,7 @@ inline bool init(patch<Data>& new_patch,
 		const position item_position_offset)
 {
 	new_patch.fixed = false;
+	new_patch.item_references = NULL;
 	if (!init(new_patch.data)) {
 		return false;
 	} else if (!array_init(new_patch.items, src_items.capacity)) {
@@ -119,8 +166,38 @@ inline bool init(patch<Data>& new_patch,
 	return true;
 }
 
+/**
+ * Initializes the given patch `new_patch` as a fork of `src`, which shares
+ * the items of `src` until either patch calls `unshare_items`. The data of
+ * the patch is initialized by calling
+ * `bool init(Data&, const Data&, DataForker&&...)`.
+ */
+template<typename Data, typename... DataForker>
+inline bool init(patch<Data>& new_patch, patch<Data>& src, DataForker&&... forker)
+{
+	if (src.item_references == NULL) {
+		src.item_references = (std::atomic<unsigned int>*) malloc(sizeof(std::atomic<unsigned int>));
+		if (src.item_references == NULL) {
+			fprintf(stderr, "init ERROR: Insufficient memory for patch.item_references.\n");
+			return false;
+		}
+		new (src.item_references) std::atomic<unsigned int>(1);
+	}
+	if (!init(new_patch.data, src.data, std::forward<DataForker>(forker)...))
+		return false;
+
+	(*src.item_references)++;
+	new_patch.items.data = src.items.data;
+	new_patch.items.length = src.items.length;
+	new_patch.items.capacity = src.items.capacity;
+	new_patch.item_references = src.item_references;
+	new_patch.fixed = src.fixed;
+	return true;
+}
+
 template<typename Data, typename Stream, typename... DataReader>
 bool read(patch<Data>& p, Stream& in, DataReader&&... reader) {
+	p.item_references = NULL;
 	if (!read(p.fixed, in) || !read(p.items, in)) {
 		return false;
 	} else if (!read(p.data, in, std::forward<DataReader>(reader)...)) {
@@ -232,14 +309,48 @@ struct map
 
 	std::minstd_rand rng;
 	uint_fast32_t initial_seed;
-	gibbs_field_cache<ItemType> cache;
+
+	/**
+	 * The number of times patches were generated or sampled. If this is
+	 * unchanged, no patches were added, and the items of the patches that
+	 * are not fixed are unchanged.
+	 */
+	uint64_t generation_count;
+
+	/**
+	 * The precomputed intensities and interactions of the item types. This is
+	 * either owned by this map, or shared with other maps with the same item
+	 * types (in which case `owns_cache` is false). Since the Gibbs sampler
+	 * shuffles the cached position lists when
+	 * `SAMPLING_METHOD == GIBBS_SAMPLING`, a shared cache must not be used
+	 * by multiple maps concurrently in that mode.
+	 */
+	gibbs_field_cache<ItemType>* cache;
+	bool owns_cache;
 
 	typedef patch<PerPatchData> patch_type;
 	typedef ItemType item_type;
 
 public:
 	map(unsigned int n, unsigned int mcmc_iterations, const ItemType* item_types, unsigned int item_type_count, uint_fast32_t seed) :
-		patches(32), n(n), mcmc_iterations(mcmc_iterations), rng(seed), initial_seed(seed), cache(item_types, item_type_count, n)
+		patches(32), n(n), mcmc_iterations(mcmc_iterations), rng(seed), initial_seed(seed), generation_count(0), owns_cache(true)
+	{
+		cache = (gibbs_field_cache<ItemType>*) malloc(sizeof(gibbs_field_cache<ItemType>));
+		if (cache == NULL) {
+			fprintf(stderr, "map ERROR: Insufficient memory for cache.\n");
+			exit(EXIT_FAILURE);
+		} else if (!init(*cache, item_types, item_type_count, n)) {
+			core::free(cache);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/**
+	 * Constructs a map that uses the given `shared_cache`, which is not
+	 * freed with this map, and must outlive it.
+	 */
+	map(unsigned int n, unsigned int mcmc_iterations, gibbs_field_cache<ItemType>& shared_cache, uint_fast32_t seed) :
+		patches(32), n(n), mcmc_iterations(mcmc_iterations), rng(seed), initial_seed(seed), generation_count(0), cache(&shared_cache), owns_cache(false)
 	{ }
 
 	map(unsigned int n, unsigned int mcmc_iterations, const ItemType* item_types, unsigned int item_type_count) :
@@ -250,7 +361,7 @@ public:
 			(uint_fast32_t) milliseconds()) { }
 #endif
 
-	~map() { free_helper(); }
+	~map() { free_helper(); free_cache(); }
 
 	inline patch_type& get_existing_patch(const position& patch_position)
 	{
@@ -270,6 +381,23 @@ public:
 		return row.values[i];
 	}
 
+	/**
+	 * Returns the patch at `patch_position`, or `NULL` if it does not exist.
+	 * This function does not create any patches.
+	 */
+	inline patch_type* get_patch_if_exists(const position& patch_position)
+	{
+		unsigned int i = (unsigned int) binary_search(patches, patch_position.y);
+		if (i == patches.size || patches.keys[i] != patch_position.y)
+			return NULL;
+
+		array_map<int64_t, patch_type>& row = patches.values[i];
+		i = (unsigned int) binary_search(row, patch_position.x);
+		if (i == row.size || row.keys[i] != patch_position.x)
+			return NULL;
+		return &row.values[i];
+	}
+
 	/**
 	 * Returns the patches in the world that intersect with a bounding box of
 	 * size n centered at `world_position`. This function will create any
@@ -528,6 +656,7 @@ public:
 			return index;
 		}
 
+		generation_count++;
 		bool first = (patches.size == 0);
 		row_index = get_or_init_contiguous(patches, row_index, start_y, row_count,
 			[](array_map<int64_t, patch_type>& row, int64_t y) { return array_map_init(row, 4); });
@@ -580,7 +709,8 @@ public:
 		i = row_index;
 		for (uint_fast8_t u = 0; u < 4; u++) {
 			for (uint_fast8_t v = 0; v < column_counts[u]; v++) {
-				if (patches.values[i].values[column_indices[u] + v].fixed) continue;
+				patch_type& current = patches.values[i].values[column_indices[u] + v];
+				if (current.fixed || !current.unshare_items()) continue;
 				position patch_position = position(patches.values[i].keys[column_indices[u] + v], patches.keys[i]);
 				patch_positions[num_patches_to_sample] = patch_position;
 				get_neighborhood(patch_position, i, column_indices[u] + v, neighborhoods[num_patches_to_sample++]);
@@ -589,10 +719,13 @@ public:
 		}
 
 		/* construct the Gibbs field and sample the patches at positions_to_sample */
+		JBW_PROFILE_PHASE(mcmc_timer, step_phase::MCMC);
+		JBW_PROFILE_COUNT(step_phase::MCMC, num_patches_to_sample);
 		gibbs_field<map<PerPatchData, ItemType>> field(
-				cache, patch_positions, neighborhoods, num_patches_to_sample, n);
+				*cache, patch_positions, neighborhoods, num_patches_to_sample, n);
 		for (unsigned int i = 0; i < mcmc_iterations; i++)
 			field.sample(rng);
+		JBW_PROFILE_STOP(mcmc_timer);
 
 		/* set the core four patches to fixed */
 		i = row_index;
@@ -611,6 +744,60 @@ public:
 		return index;
 	}
 
+	/**
+	 * Returns the patches in the world that intersect with a bounding box of
+	 * size `2*radius + 1` centered at `world_position`, which may be larger
+	 * than the four patches returned by the above function. The patches are
+	 * appended to `neighborhood`, from the bottom row to the top row, and
+	 * from left to right within each row. This function will create any
+	 * missing patches and ensure that the returned patches are 'fixed'.
+	 */
+	bool get_fixed_neighborhood(
+			position world_position, unsigned int radius,
+			array<patch_type*>& neighborhood)
+	{
+		position bottom_left_patch, top_right_patch;
+		world_to_patch_coordinates(world_position - position(radius, radius), bottom_left_patch);
+		world_to_patch_coordinates(world_position + position(radius, radius), top_right_patch);
+		unsigned int width = (unsigned int) (top_right_patch.x - bottom_left_patch.x + 1);
+		unsigned int height = (unsigned int) (top_right_patch.y - bottom_left_patch.y + 1);
+		if (!neighborhood.ensure_capacity(neighborhood.length + width * height))
+			return false;
+
+		/* in the common case, all the patches already exist and are fixed */
+		size_t old_length = neighborhood.length;
+		bool* fixed = (bool*) alloca(sizeof(bool) * width * height);
+		for (unsigned int i = 0; i < width * height; i++)
+			fixed[i] = false;
+		auto collect = [&]() {
+			return apply_contiguous(patches, bottom_left_patch.y, height,
+				[&](const array_map<int64_t, patch_type>& row, int64_t y)
+			{
+				return apply_contiguous(row, bottom_left_patch.x, width, [&](patch_type& p, int64_t x) {
+					fixed[(y - bottom_left_patch.y) * width + (x - bottom_left_patch.x)] = p.fixed;
+					neighborhood[neighborhood.length++] = &p;
+					return true;
+				});
+			});
+		};
+		collect();
+		bool complete = true;
+		for (unsigned int i = 0; i < width * height; i++)
+			if (!fixed[i]) complete = false;
+		if (complete) return true;
+
+		/* create and fix the missing patches, and collect the patches again */
+		patch_type* patch_neighborhood[4]; position patch_positions[4];
+		for (unsigned int i = 0; i < width * height; i++) {
+			if (fixed[i]) continue;
+			position patch_position = bottom_left_patch + position(i % width, i / width);
+			get_fixed_neighborhood(patch_position * n + position(n / 2, n / 2), patch_neighborhood, patch_positions);
+		}
+		neighborhood.length = old_length;
+		collect();
+		return true;
+	}
+
 	/**
 	 * Returns the patches in the world that intersect with a bounding box of
 	 * size n centered at `world_position`. This function will not create any
@@ -658,10 +845,21 @@ public:
 		position_within_patch = {x_quotient.rem, y_quotient.rem};
 	}
 
+	static inline void move(const map& src, map& dst) {
+		core::move(src.patches, dst.patches);
+		dst.n = src.n;
+		dst.mcmc_iterations = src.mcmc_iterations;
+		new (&dst.rng) std::minstd_rand(src.rng);
+		dst.initial_seed = src.initial_seed;
+		dst.generation_count = src.generation_count;
+		dst.cache = src.cache;
+		dst.owns_cache = src.owns_cache;
+	}
+
 	static inline void free(map& world) {
 		world.free_helper();
 		core::free(world.patches);
-		core::free(world.cache);
+		world.free_cache();
 		world.rng.~linear_congruential_engine();
 	}
 
@@ -811,6 +1009,12 @@ private:
 		}
 	}
 
+	inline void free_cache() {
+		if (!owns_cache) return;
+		core::free(*cache);
+		core::free(cache);
+	}
+
 	bool is_valid() {
 		if (!is_sorted_and_distinct(patches.keys, patches.size)) {
 			fprintf(stderr, "map.is_valid WARNING: Patch rows are not sorted or distinct.\n");
@@ -836,15 +1040,103 @@ inline bool init(map<PerPatchData, ItemType>& world, unsigned int n,
 	world.n = n;
 	world.mcmc_iterations = mcmc_iterations;
 	world.initial_seed = seed;
-	if (!init(world.cache, item_types, item_type_count, n)) {
+	world.generation_count = 0;
+	world.owns_cache = true;
+	world.cache = (gibbs_field_cache<ItemType>*) malloc(sizeof(gibbs_field_cache<ItemType>));
+	if (world.cache == NULL) {
+		fprintf(stderr, "init ERROR: Insufficient memory for map.cache.\n");
 		free(world.patches);
 		return false;
+	} else if (!init(*world.cache, item_types, item_type_count, n)) {
+		free(world.cache); free(world.patches);
+		return false;
 	}
 
 	new (&world.rng) std::minstd_rand(seed);
 	return true;
 }
 
+/**
+ * Initializes the given map `world`, which uses the given `shared_cache`.
+ * The cache is not freed with `world`, and must outlive it.
+ */
+template<typename PerPatchData, typename ItemType>
+inline bool init(map<PerPatchData, ItemType>& world, unsigned int n,
+		unsigned int mcmc_iterations, gibbs_field_cache<ItemType>& shared_cache,
+		uint_fast32_t seed)
+{
+	if (!array_map_init(world.patches, 32))
+		return false;
+	world.n = n;
+	world.mcmc_iterations = mcmc_iterations;
+	world.initial_seed = seed;
+	world.generation_count = 0;
+	world.owns_cache = false;
+	world.cache = &shared_cache;
+
+	new (&world.rng) std::minstd_rand(seed);
+	return true;
+}
+
+/**
+ * Initializes the given map `world` as a fork of `src`, with the same
+ * patches and random number generator state, which uses the cache of `src`.
+ * Rather than being copied, the items of each patch are shared with `src`
+ * until they are modified (see `patch::unshare_items`), so forking is
+ * proportional to the number of patches, rather than the number of items.
+ * The data of each patch is initialized by calling
+ * `bool init(PerPatchData&, const PerPatchData&, DataForker&&...)`.
+ *
+ * The cache of `src` is not freed with `world`, and must outlive it. `src`
+ * must not be modified during this call.
+ */
+template<typename PerPatchData, typename ItemType, typename... DataForker>
+bool init(map<PerPatchData, ItemType>& world,
+		map<PerPatchData, ItemType>& src, DataForker&&... forker)
+{
+	if (!array_map_init(world.patches, ((size_t) 1) << (core::log2(src.patches.size == 0 ? 1 : src.patches.size) + 1)))
+		return false;
+	for (size_t i = 0; i < src.patches.size; i++) {
+		array_map<int64_t, patch<PerPatchData>>& src_row = src.patches.values[i];
+		array_map<int64_t, patch<PerPatchData>>& row = world.patches.values[i];
+		if (!array_map_init(row, ((size_t) 1) << (core::log2(src_row.size == 0 ? 1 : src_row.size) + 1))) {
+			for (auto row : world.patches) {
+				for (auto entry : row.value)
+					free(entry.value);
+				free(row.value);
+			}
+			free(world.patches);
+			return false;
+		}
+		world.patches.keys[i] = src.patches.keys[i];
+		world.patches.size++;
+
+		for (size_t j = 0; j < src_row.size; j++) {
+			if (!init(row.values[j], src_row.values[j], std::forward<DataForker>(forker)...)) {
+				for (auto row : world.patches) {
+					for (auto entry : row.value)
+						free(entry.value);
+					free(row.value);
+				}
+				free(world.patches);
+				return false;
+			}
+			row.keys[j] = src_row.keys[j];
+			row.size++;
+		}
+	}
+
+	world.n = src.n;
+	world.mcmc_iterations = src.mcmc_iterations;
+	world.initial_seed = src.initial_seed;
+	world.generation_count = src.generation_count;
+	world.owns_cache = false;
+	world.cache = src.cache;
+
+	new (&world.rng) std::minstd_rand(src.rng);
+	return true;
+}
+
 template<typename PerPatchData, typename ItemType>
 inline bool init(map<PerPatchData, ItemType>& world, unsigned int n,
 		unsigned int mcmc_iterations, const ItemType* item_types,
@@ -858,10 +1150,12 @@ inline bool init(map<PerPatchData, ItemType>& world, unsigned int n,
 	return init(world, n, mcmc_iterations, item_types, item_type_count, seed);
 }
 
+/**
+ * Reads the state and patches of the given map `world` from `in`, without
+ * initializing its cache.
+ */
 template<typename PerPatchData, typename ItemType, typename Stream, typename PatchReader>
-bool read(map<PerPatchData, ItemType>& world, Stream& in,
-		const ItemType* item_types, unsigned int item_type_count,
-		PatchReader& patch_reader = default_scribe())
+bool read_patches(map<PerPatchData, ItemType>& world, Stream& in, PatchReader& patch_reader)
 {
 	/* read PRNG state into a char* buffer */
 	size_t length;
@@ -872,6 +1166,7 @@ bool read(map<PerPatchData, ItemType>& world, Stream& in,
 
 	std::stringstream buffer(std::string(state, length));
 	buffer >> world.rng;
+	world.generation_count = 0;
 
 	size_t row_count;
 	if (!read(world.n, in)
@@ -924,7 +1219,23 @@ bool read(map<PerPatchData, ItemType>& world, Stream& in,
 		}
 	}
 
-	if (!init(world.cache, item_types, item_type_count, world.n)) {
+	return true;
+}
+
+template<typename PerPatchData, typename ItemType, typename Stream, typename PatchReader>
+bool read(map<PerPatchData, ItemType>& world, Stream& in,
+		const ItemType* item_types, unsigned int item_type_count,
+		PatchReader& patch_reader = default_scribe())
+{
+	if (!read_patches(world, in, patch_reader))
+		return false;
+
+	world.owns_cache = true;
+	world.cache = (gibbs_field_cache<ItemType>*) malloc(sizeof(gibbs_field_cache<ItemType>));
+	if (world.cache == NULL || !init(*world.cache, item_types, item_type_count, world.n)) {
+		if (world.cache == NULL)
+			fprintf(stderr, "read ERROR: Insufficient memory for map.cache.\n");
+		else free(world.cache);
 		for (auto row : world.patches) {
 			for (auto entry : row.value)
 				free(entry.value);
@@ -936,6 +1247,21 @@ bool read(map<PerPatchData, ItemType>& world, Stream& in,
 	return true;
 }
 
+/**
+ * Reads the given map `world` from `in`, which uses the given `shared_cache`.
+ * The cache is not freed with `world`, and must outlive it.
+ */
+template<typename PerPatchData, typename ItemType, typename Stream, typename PatchReader>
+bool read(map<PerPatchData, ItemType>& world, Stream& in,
+		gibbs_field_cache<ItemType>& shared_cache, PatchReader& patch_reader)
+{
+	if (!read_patches(world, in, patch_reader))
+		return false;
+	world.owns_cache = false;
+	world.cache = &shared_cache;
+	return true;
+}
+
 /* NOTE: this function assumes the variables in the map are not modified during writing */
 template<typename PerPatchData, typename ItemType, typename Stream, typename PatchWriter>
 bool write(const map<PerPatchData, ItemType>& world, Stream& out,
@@ -58,7 +58,16 @@ enum class message_type : uint64_t {
 	SET_ACTIVE_RESPONSE,
 	IS_ACTIVE,
 	IS_ACTIVE_RESPONSE,
-	STEP_RESPONSE
+	STEP_RESPONSE,
+	ACT_BATCH,
+	ACT_BATCH_RESPONSE,
+	SUBMIT_PLAN,
+	SUBMIT_PLAN_RESPONSE,
+	PLAN_ENDED,
+	GET_STATS,
+	GET_STATS_RESPONSE,
+	GET_MAP_DELTA,
+	GET_MAP_DELTA_RESPONSE
 };
 
 /**
@@ -101,6 +110,10 @@ inline bool print(const message_type& type, Stream& out) {
 	case message_type::GET_AGENT_STATES: return core::print("GET_AGENT_STATES", out);
 	case message_type::SET_ACTIVE:       return core::print("SET_ACTIVE", out);
 	case message_type::IS_ACTIVE:        return core::print("IS_ACTIVE", out);
+	case message_type::ACT_BATCH:        return core::print("ACT_BATCH", out);
+	case message_type::SUBMIT_PLAN:      return core::print("SUBMIT_PLAN", out);
+	case message_type::GET_STATS:        return core::print("GET_STATS", out);
+	case message_type::GET_MAP_DELTA:    return core::print("GET_MAP_DELTA", out);
 
 	case message_type::ADD_AGENT_RESPONSE:        return core::print("ADD_AGENT_RESPONSE", out);
 	case message_type::REMOVE_AGENT_RESPONSE:     return core::print("REMOVE_AGENT_RESPONSE", out);
@@ -117,6 +130,11 @@ inline bool print(const message_type& type, Stream& out) {
 	case message_type::SET_ACTIVE_RESPONSE:       return core::print("SET_ACTIVE_RESPONSE", out);
 	case message_type::IS_ACTIVE_RESPONSE:        return core::print("IS_ACTIVE_RESPONSE", out);
 	case message_type::STEP_RESPONSE:             return core::print("STEP_RESPONSE", out);
+	case message_type::ACT_BATCH_RESPONSE:        return core::print("ACT_BATCH_RESPONSE", out);
+	case message_type::SUBMIT_PLAN_RESPONSE:      return core::print("SUBMIT_PLAN_RESPONSE", out);
+	case message_type::PLAN_ENDED:                return core::print("PLAN_ENDED", out);
+	case message_type::GET_STATS_RESPONSE:        return core::print("GET_STATS_RESPONSE", out);
+	case message_type::GET_MAP_DELTA_RESPONSE:    return core::print("GET_MAP_DELTA_RESPONSE", out);
 	}
 	fprintf(stderr, "print ERROR: Unrecognized message_type.\n");
 	return false;
@@ -1055,6 +1073,237 @@ inline bool receive_do_nothing(
 
 /* Precondition: `state.client_states_lock` must be held by the calling thread. */
 template<typename Stream, typename SimulatorData>
+inline bool receive_act_batch(
+		Stream& in, socket_type& connection,
+		server_state& state, uint64_t client_id,
+		simulator<SimulatorData>& sim)
+{
+	bool contains;
+	client_state* cstate = state.client_states.get(client_id, contains);
+	if (!contains) {
+		state.client_states_lock.unlock();
+		return true; /* the client was already destroyed */
+	}
+	cstate->lock.lock();
+	state.client_states_lock.unlock();
+
+	status response;
+	uint64_t* agent_ids = nullptr;
+	uint64_t* submitted_ids = nullptr;
+	action* actions = nullptr;
+	status* results = nullptr;
+	size_t agent_count = 0;
+	bool success = true;
+	if (!read(agent_count, in)) {
+		response = status::SERVER_PARSE_MESSAGE_ERROR;
+		success = false;
+	} else {
+		agent_ids = (uint64_t*) malloc(max((size_t) 1, sizeof(uint64_t) * agent_count));
+		submitted_ids = (uint64_t*) malloc(max((size_t) 1, sizeof(uint64_t) * agent_count));
+		actions = (action*) malloc(max((size_t) 1, sizeof(action) * agent_count));
+		results = (status*) malloc(max((size_t) 1, sizeof(status) * agent_count));
+		if (agent_ids == nullptr || submitted_ids == nullptr || actions == nullptr || results == nullptr) {
+			if (agent_ids != nullptr) free(agent_ids);
+			if (submitted_ids != nullptr) free(submitted_ids);
+			if (actions != nullptr) free(actions);
+			if (results != nullptr) free(results);
+			agent_ids = nullptr; results = nullptr;
+			response = status::SERVER_OUT_OF_MEMORY;
+			success = false;
+		} else if (!read(agent_ids, in, agent_count) || !read(actions, in, agent_count)) {
+			free(agent_ids); free(submitted_ids);
+			free(actions); free(results);
+			agent_ids = nullptr; results = nullptr;
+			response = status::SERVER_PARSE_MESSAGE_ERROR;
+			success = false;
+		} else {
+			/* agents that don't belong to this client are given the invalid ID 0 */
+			for (size_t i = 0; i < agent_count; i++) {
+				if (cstate->agent_ids.contains(agent_ids[i]))
+					submitted_ids[i] = agent_ids[i];
+				else submitted_ids[i] = 0;
+			}
+
+			/* We have to unlock this to avoid deadlock since other simulator
+			   functions (i.e. `move`, `turn`, `do_nothing`) can cause the
+			   simulator to step. This calls `send_step_response` which needs the
+			   client_state locks. */
+			cstate->lock.unlock();
+			cstate = nullptr;
+
+			sim.act(submitted_ids, actions, agent_count, results);
+			for (size_t i = 0; i < agent_count; i++)
+				if (submitted_ids[i] == 0) results[i] = status::INVALID_AGENT_ID;
+			free(submitted_ids); free(actions);
+			response = status::OK;
+		}
+	}
+
+	memory_stream mem_stream = memory_stream(sizeof(message_type) + sizeof(response) + sizeof(agent_count)
+			+ (response == status::OK ? (sizeof(uint64_t) + sizeof(status)) * agent_count : 0));
+	fixed_width_stream<memory_stream> out(mem_stream);
+
+	success &= write(message_type::ACT_BATCH_RESPONSE, out)
+			&& write(response, out)
+			&& (response != status::OK || (write(agent_count, out)
+				&& write(agent_ids, out, agent_count)
+				&& write(results, out, agent_count)));
+	if (agent_ids != nullptr) free(agent_ids);
+	if (results != nullptr) free(results);
+	if (!success) {
+		if (cstate != nullptr)
+			cstate->lock.unlock();
+		return false;
+	}
+
+	if (cstate == nullptr) {
+		cstate = acquire_client_lock(state, client_id);
+		if (cstate == nullptr)
+			/* the client was destroyed while we didn't have the client lock */
+			return true;
+	}
+	success = send_message(connection, mem_stream.buffer, mem_stream.position);
+	cstate->lock.unlock();
+	return success;
+}
+
+/* Precondition: `state.client_states_lock` must be held by the calling thread. */
+template<typename Stream, typename SimulatorData>
+inline bool receive_submit_plan(
+		Stream& in, socket_type& connection,
+		server_state& state, uint64_t client_id,
+		simulator<SimulatorData>& sim)
+{
+	bool contains;
+	client_state* cstate = state.client_states.get(client_id, contains);
+	if (!contains) {
+		state.client_states_lock.unlock();
+		return true; /* the client was already destroyed */
+	}
+	cstate->lock.lock();
+	state.client_states_lock.unlock();
+
+	uint64_t agent_id = UINT64_MAX;
+	uint8_t abort_conditions;
+	unsigned int action_count;
+	status response;
+	bool success = true;
+	if (!read(agent_id, in) || !read(abort_conditions, in) || !read(action_count, in)) {
+		response = status::SERVER_PARSE_MESSAGE_ERROR;
+		success = false;
+	} else {
+		action* actions = (action*) malloc(max((size_t) 1, sizeof(action) * action_count));
+		if (actions == nullptr) {
+			response = status::SERVER_OUT_OF_MEMORY;
+			success = false;
+		} else if (!read(actions, in, action_count)) {
+			response = status::SERVER_PARSE_MESSAGE_ERROR;
+			success = false;
+		} else if (agent_id == 0 || !cstate->agent_ids.contains(agent_id)) {
+			response = status::INVALID_AGENT_ID;
+		} else {
+			/* We have to unlock this to avoid deadlock since other simulator
+			   functions (i.e. `move`, `turn`, `do_nothing`) can cause the
+			   simulator to step. This calls `send_step_response` which needs the
+			   client_state locks. */
+			cstate->lock.unlock();
+			cstate = nullptr;
+
+			response = sim.submit_plan(agent_id, actions, action_count, abort_conditions);
+			if (response == status::OUT_OF_MEMORY)
+				response = status::SERVER_OUT_OF_MEMORY;
+		}
+		if (actions != nullptr) free(actions);
+	}
+
+	memory_stream mem_stream = memory_stream(sizeof(message_type) + sizeof(agent_id) + sizeof(response));
+	fixed_width_stream<memory_stream> out(mem_stream);
+
+	success &= write(message_type::SUBMIT_PLAN_RESPONSE, out)
+			&& write(agent_id, out) && write(response, out);
+	if (!success) {
+		if (cstate != nullptr)
+			cstate->lock.unlock();
+		return false;
+	}
+
+	if (cstate == nullptr) {
+		cstate = acquire_client_lock(state, client_id);
+		if (cstate == nullptr)
+			/* the client was destroyed while we didn't have the client lock */
+			return true;
+	}
+	success = send_message(connection, mem_stream.buffer, mem_stream.position);
+	cstate->lock.unlock();
+	return success;
+}
+
+/**
+ * Reads `count` patch positions followed by the version of each patch, as
+ * sent by `send_get_map_delta`, from `in` into `known_versions`.
+ */
+template<typename Stream>
+inline bool read_known_versions(
+		hash_map<position, uint64_t>& known_versions,
+		Stream& in, size_t count)
+{
+	if (count == 0) return true;
+	position* positions = (position*) malloc(sizeof(position) * count);
+	uint64_t* versions = (uint64_t*) malloc(sizeof(uint64_t) * count);
+	if (positions == nullptr || versions == nullptr) {
+		fprintf(stderr, "read_known_versions ERROR: Out of memory.\n");
+		if (positions != nullptr) free(positions);
+		if (versions != nullptr) free(versions);
+		return false;
+	} else if (!read(positions, in, count) || !read(versions, in, count)) {
+		free(positions); free(versions);
+		return false;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		if (!known_versions.check_size()) {
+			free(positions); free(versions);
+			return false;
+		}
+		known_versions.put(positions[i], versions[i]);
+	}
+	free(positions); free(versions);
+	return true;
+}
+
+/**
+ * Writes the `patch_state::version` of each patch in `patches`, in order,
+ * which follows the patches in a `GET_MAP_DELTA_RESPONSE` message.
+ */
+template<typename Stream>
+inline bool write_versions(const array<array<patch_state>>& patches, Stream& out) {
+	for (const array<patch_state>& row : patches)
+		for (const patch_state& patch : row)
+			if (!write(patch.version, out)) return false;
+	return true;
+}
+
+/**
+ * Reads the `patch_state::version` of each patch in `patches`, as written
+ * by `write_versions`.
+ */
+template<typename Stream>
+inline bool read_versions(array<array<patch_state>>& patches, Stream& in) {
+	for (array<patch_state>& row : patches)
+		for (patch_state& patch : row)
+			if (!read(patch.version, in)) return false;
+	return true;
+}
+
+/**
+ * Handles both `GET_MAP` and `GET_MAP_DELTA` messages. If `Delta` is true,
+ * the request also contains the versions of the patches that the client
+ * already has, which are omitted from the response if they are unchanged,
+ * and the response contains the version of each patch.
+ *
+ * Precondition: `state.client_states_lock` must be held by the calling thread.
+ */
+template<bool Delta, typename Stream, typename SimulatorData>
 inline bool receive_get_map(
 		Stream& in, socket_type& connection,
 		server_state& state, uint64_t client_id,
@@ -1071,10 +1320,15 @@ inline bool receive_get_map(
 
 	position bottom_left, top_right;
 	bool get_scent_map, get_vision_map;
+	size_t known_count = 0;
 	status response;
 	array<array<patch_state>> patches(32);
+	hash_map<position, uint64_t> known_versions(Delta ? 16 : 1, alloc_position_keys);
+	const hash_map<position, uint64_t>* known = (Delta ? &known_versions : nullptr);
 	bool success = true;
-	if (!read(bottom_left, in) || !read(top_right, in) || !read(get_scent_map, in) || !read(get_vision_map, in)) {
+	if (!read(bottom_left, in) || !read(top_right, in) || !read(get_scent_map, in) || !read(get_vision_map, in)
+	 || (Delta && (!read(known_count, in) || !read_known_versions(known_versions, in, known_count))))
+	{
 		response = status::SERVER_PARSE_MESSAGE_ERROR;
 		success = false;
 	} else if (!cstate->perms.get_map) {
@@ -1090,15 +1344,15 @@ inline bool receive_get_map(
 
 		if (get_scent_map) {
 			if (get_vision_map) {
-				response = sim.template get_map<true, true>(bottom_left, top_right, patches);
+				response = sim.template get_map<true, true>(bottom_left, top_right, patches, known);
 			} else {
-				response = sim.template get_map<true, false>(bottom_left, top_right, patches);
+				response = sim.template get_map<true, false>(bottom_left, top_right, patches, known);
 			}
 		} else {
 			if (get_vision_map) {
-				response = sim.template get_map<false, true>(bottom_left, top_right, patches);
+				response = sim.template get_map<false, true>(bottom_left, top_right, patches, known);
 			} else {
-				response = sim.template get_map<false, false>(bottom_left, top_right, patches);
+				response = sim.template get_map<false, false>(bottom_left, top_right, patches, known);
 			}
 		}
 		if (response != status::OK) {
@@ -1114,8 +1368,8 @@ inline bool receive_get_map(
 
 	memory_stream mem_stream = memory_stream(sizeof(message_type) + sizeof(response) + sizeof(hash_map<position, patch_state>));
 	fixed_width_stream<memory_stream> out(mem_stream);
-	success &= write(message_type::GET_MAP_RESPONSE, out) && write(response, out)
-			&& (response != status::OK || write(patches, out, sim.get_config()));
+	success &= write(Delta ? message_type::GET_MAP_DELTA_RESPONSE : message_type::GET_MAP_RESPONSE, out) && write(response, out)
+			&& (response != status::OK || (write(patches, out, sim.get_config()) && (!Delta || write_versions(patches, out))));
 	if (!success) {
 		if (cstate != nullptr)
 			cstate->lock.unlock();
@@ -1200,6 +1454,65 @@ inline bool receive_get_agent_ids(
 	return success;
 }
 
+template<typename Stream, typename SimulatorData>
+inline bool receive_get_stats(
+		Stream& in, socket_type& connection,
+		server_state& state, uint64_t client_id,
+		simulator<SimulatorData>& sim)
+{
+	bool contains;
+	client_state* cstate = state.client_states.get(client_id, contains);
+	if (!contains) {
+		state.client_states_lock.unlock();
+		return true; /* the client was already destroyed */
+	}
+	cstate->lock.lock();
+	state.client_states_lock.unlock();
+
+	step_profile profile;
+	unsigned int max_recent_steps = 0;
+	bool success = true;
+	status response;
+	if (!read(max_recent_steps, in)) {
+		init(profile);
+		response = status::SERVER_PARSE_MESSAGE_ERROR;
+		success = false;
+	} else {
+		/* the profiler is read without locking, so we don't need to hold the
+		   client lock (see the comment in `receive_get_agent_ids`) */
+		cstate->lock.unlock();
+		cstate = nullptr;
+
+		response = sim.get_step_profile(profile, max_recent_steps);
+		if (response == status::OUT_OF_MEMORY) {
+			init(profile);
+			response = status::SERVER_OUT_OF_MEMORY;
+		}
+	}
+
+	memory_stream mem_stream = memory_stream((unsigned int) (sizeof(message_type) + sizeof(response)
+			+ sizeof(step_profile) + sizeof(step_profile_record) * profile.recent_step_count));
+	fixed_width_stream<memory_stream> out(mem_stream);
+	success &= write(message_type::GET_STATS_RESPONSE, out) && write(response, out)
+			&& (response != status::OK || write(profile, out));
+	core::free(profile);
+	if (!success) {
+		if (cstate != nullptr)
+			cstate->lock.unlock();
+		return false;
+	}
+
+	if (cstate == nullptr) {
+		cstate = acquire_client_lock(state, client_id);
+		if (cstate == nullptr)
+			/* the client was destroyed while we didn't have the client lock */
+			return true;
+	}
+	success = send_message(connection, mem_stream.buffer, mem_stream.position);
+	cstate->lock.unlock();
+	return success;
+}
+
 template<typename Stream>
 inline bool send_agent_states(
 	Stream& out, uint64_t* agent_ids,
@@ -1484,7 +1797,7 @@ void server_process_message(socket_type& connection,
 		case message_type::DO_NOTHING:
 			receive_do_nothing(in, connection, state, client_id, sim); return;
 		case message_type::GET_MAP:
-			receive_get_map(in, connection, state, client_id, sim); return;
+			receive_get_map<false>(in, connection, state, client_id, sim); return;
 		case message_type::GET_AGENT_IDS:
 			receive_get_agent_ids(in, connection, state, client_id, sim); return;
 		case message_type::GET_AGENT_STATES:
@@ -1493,6 +1806,14 @@ void server_process_message(socket_type& connection,
 			receive_set_active(in, connection, state, client_id, sim); return;
 		case message_type::IS_ACTIVE:
 			receive_is_active(in, connection, state, client_id, sim); return;
+		case message_type::ACT_BATCH:
+			receive_act_batch(in, connection, state, client_id, sim); return;
+		case message_type::SUBMIT_PLAN:
+			receive_submit_plan(in, connection, state, client_id, sim); return;
+		case message_type::GET_STATS:
+			receive_get_stats(in, connection, state, client_id, sim); return;
+		case message_type::GET_MAP_DELTA:
+			receive_get_map<true>(in, connection, state, client_id, sim); return;
 
 		case message_type::ADD_AGENT_RESPONSE:
 		case message_type::REMOVE_AGENT_RESPONSE:
@@ -1509,6 +1830,11 @@ void server_process_message(socket_type& connection,
 		case message_type::SET_ACTIVE_RESPONSE:
 		case message_type::IS_ACTIVE_RESPONSE:
 		case message_type::STEP_RESPONSE:
+		case message_type::ACT_BATCH_RESPONSE:
+		case message_type::SUBMIT_PLAN_RESPONSE:
+		case message_type::PLAN_ENDED:
+		case message_type::GET_STATS_RESPONSE:
+		case message_type::GET_MAP_DELTA_RESPONSE:
 			break;
 	}
 	state.client_states_lock.unlock();
@@ -1630,9 +1956,40 @@ inline bool write_extra_data(Stream& out,
 	return write(data, out) && write_extra_data(out, std::forward<ExtraData>(extra_data)...);
 }
 
+/**
+ * Sends a `plan_ended` message on the given `connection` for the agents in
+ * `agent_states` whose action plans ended in the current time step, if any.
+ */
+inline bool send_plan_ended(socket_type& connection,
+		const array<pair<uint64_t, const agent_state*>>& agent_states)
+{
+	size_t ended_count = 0;
+	for (const auto& entry : agent_states)
+		if (entry.value->plan_state != plan_status::NONE
+		 && entry.value->plan_state != plan_status::RUNNING) ended_count++;
+	if (ended_count == 0) return true;
+
+	memory_stream mem_stream = memory_stream(sizeof(message_type) + sizeof(ended_count)
+			+ (sizeof(uint64_t) + sizeof(plan_status) + sizeof(unsigned int)) * ended_count);
+	fixed_width_stream<memory_stream> out(mem_stream);
+	if (!write(message_type::PLAN_ENDED, out) || !write(ended_count, out))
+		return false;
+	for (const auto& entry : agent_states) {
+		const agent_state& agent = *entry.value;
+		if (agent.plan_state == plan_status::NONE || agent.plan_state == plan_status::RUNNING)
+			continue;
+		if (!write(entry.key, out) || !write(agent.plan_state, out) || !write(agent.plan_position, out))
+			return false;
+	}
+	return send_message(connection, mem_stream.buffer, mem_stream.position);
+}
+
 /**
  * Sends a step response to every client connected to the given `server`. This
- * function should be called whenever the simulator advances time.
+ * function should be called whenever the simulator advances time. Clients
+ * are first sent a `plan_ended` message for any of their agents whose action
+ * plans ended in this time step, and clients whose agents are all executing
+ * action plans (and which have no semaphores) are not sent a step response.
  *
  * \param extra_data Any additional state to be sent to every client at the end
  * 		of the step response. For each argument of type `T`, a function
@@ -1646,6 +2003,7 @@ inline bool send_step_response(
 		const simulator_config& config,
 		ExtraData&&... extra_data)
 {
+	JBW_PROFILE_PHASE(network_timer, step_phase::NETWORK);
 	std::unique_lock<std::mutex> lock(server.connection_set_lock);
 	bool success = true;
 	for (const auto& client_connection : server.client_connections) {
@@ -1677,6 +2035,19 @@ inline bool send_step_response(
 			agent_states[agent_states.length++] = {agent_id, agent_ptr};
 		}
 
+		/* report the plans that ended in this step, and skip the step response
+		   while every agent of this client is executing a plan */
+		unsigned int running_plan_count = 0;
+		for (const auto& entry : agent_states)
+			if (entry.value->plan_state == plan_status::RUNNING) running_plan_count++;
+		success &= send_plan_ended(client_connection.key, agent_states);
+		if (running_plan_count > 0 && running_plan_count == agent_states.length
+		 && cstate->semaphore_ids.length == 0)
+		{
+			cstate->lock.unlock();
+			continue;
+		}
+
 		bool client_success = true;
 		if (!write(agent_states.length, out)) {
 			client_success = false;
@@ -1696,6 +2067,7 @@ inline bool send_step_response(
 			continue;
 		}
 		success &= send_message(client_connection.key, mem_stream.buffer, mem_stream.position);
+		JBW_PROFILE_COUNT(step_phase::NETWORK, 1);
 	}
 	return success;
 }
@@ -1999,6 +2371,62 @@ bool send_do_nothing(ClientType& c, uint64_t agent_id) {
 		&& send_message(c.connection, mem_stream.buffer, mem_stream.position);
 }
 
+/**
+ * Sends an `act_batch` message to the server from the client `c`, which
+ * submits the action `actions[i]` for the agent with ID `agent_ids[i]`, for
+ * each `i` in `[0, agent_count)`. Once the server responds, the function
+ * `on_act_batch(ClientType&, status, uint64_t*, status*, size_t)` will be
+ * invoked, where the first argument is `c`, the second is the response (OK if
+ * the batch was processed, and a different value if an error occurred), the
+ * third is the array of agent IDs, the fourth is the array containing the
+ * result of each action, and the fifth is the number of agents in the batch.
+ *
+ * \returns `true` if the sending is successful; `false` otherwise.
+ */
+template<typename ClientType>
+bool send_act_batch(ClientType& c, const uint64_t* agent_ids, const action* actions, size_t agent_count) {
+	memory_stream mem_stream = memory_stream(sizeof(message_type) + sizeof(agent_count)
+			+ (sizeof(uint64_t) + sizeof(action)) * agent_count);
+	fixed_width_stream<memory_stream> out(mem_stream);
+	return write(message_type::ACT_BATCH, out)
+		&& write(agent_count, out)
+		&& write(agent_ids, out, agent_count)
+		&& write(actions, out, agent_count)
+		&& send_message(c.connection, mem_stream.buffer, mem_stream.position);
+}
+
+/**
+ * Sends a `submit_plan` message to the server from the client `c`, which
+ * submits the plan of `action_count` actions in `actions` for the agent with
+ * ID `agent_id` (see `simulator::submit_plan`). Once the server responds, the
+ * function `on_submit_plan(ClientType&, uint64_t, status)` will be invoked,
+ * where the first argument is `c`, the second is `agent_id`, and the third is
+ * the response (OK if successful, and a different value if an error
+ * occurred). Once the plan ends, the function
+ * `on_plan_ended(ClientType&, uint64_t*, plan_status*, unsigned int*, size_t)`
+ * will be invoked (see `receive_plan_ended`). Until then, the client is not
+ * sent step responses, unless it has other agents without plans, or any
+ * semaphores.
+ *
+ * \param abort_conditions A combination of `plan_abort_condition` flags.
+ * \returns `true` if the sending is successful; `false` otherwise.
+ */
+template<typename ClientType>
+bool send_submit_plan(ClientType& c, uint64_t agent_id,
+		const action* actions, unsigned int action_count,
+		uint8_t abort_conditions)
+{
+	memory_stream mem_stream = memory_stream(sizeof(message_type) + sizeof(agent_id)
+			+ sizeof(abort_conditions) + sizeof(action_count) + sizeof(action) * action_count);
+	fixed_width_stream<memory_stream> out(mem_stream);
+	return write(message_type::SUBMIT_PLAN, out)
+		&& write(agent_id, out)
+		&& write(abort_conditions, out)
+		&& write(action_count, out)
+		&& write(actions, out, action_count)
+		&& send_message(c.connection, mem_stream.buffer, mem_stream.position);
+}
+
 /**
  * Sends a `get_map` message to the server from the client `c`. Once the server
  * responds, the function
@@ -2031,6 +2459,46 @@ bool send_get_map(ClientType& c, position bottom_left, position top_right, bool
 		&& send_message(c.connection, mem_stream.buffer, mem_stream.position);
 }
 
+/**
+ * Sends a `get_map_delta` message to the server from the client `c`, which
+ * is the same as a `get_map` message, except that the patches that the
+ * client already has are omitted from the response if they are unchanged,
+ * and the `patch_state::version` of each returned patch is set, so that it
+ * can be passed to the next call. Once the server responds, the function
+ * `on_get_map` will be invoked as with `send_get_map`.
+ *
+ * \param bottom_left The bottom-left corner of the bounding box containing the
+ * 		patches we wish to retrieve.
+ * \param top_right The top-right corner of the bounding box containing the
+ * 		patches we wish to retrieve.
+ * \param get_scent_map Whether we want to also retrieve the array of scent
+ * 		values at every cell in each patch.
+ * \param get_vision_map Whether we want to also retrieve the array of vision
+ * 		values at every cell in each patch.
+ * \param known_positions The positions of the patches that the client
+ * 		already has.
+ * \param known_versions The `patch_state::version` of each patch in
+ * 		`known_positions`.
+ * \param known_count The length of `known_positions` and `known_versions`.
+ * \returns `true` if the sending is successful; `false` otherwise.
+ */
+template<typename ClientType>
+bool send_get_map_delta(ClientType& c, position bottom_left, position top_right,
+		bool get_scent_map, bool get_vision_map, const position* known_positions,
+		const uint64_t* known_versions, size_t known_count)
+{
+	memory_stream mem_stream = memory_stream(sizeof(message_type) + 2 * sizeof(position) + sizeof(get_scent_map) + sizeof(get_vision_map)
+			+ sizeof(known_count) + known_count * (sizeof(position) + sizeof(uint64_t)));
+	fixed_width_stream<memory_stream> out(mem_stream);
+	return write(message_type::GET_MAP_DELTA, out)
+		&& write(bottom_left, out) && write(top_right, out)
+		&& write(get_scent_map, out) && write(get_vision_map, out)
+		&& write(known_count, out)
+		&& (known_count == 0 || write(known_positions, out, known_count))
+		&& (known_count == 0 || write(known_versions, out, known_count))
+		&& send_message(c.connection, mem_stream.buffer, mem_stream.position);
+}
+
 /**
  * Sends an `get_agent_ids` message to the server from the client `c`. Once the
  * server responds, the function
@@ -2049,6 +2517,27 @@ bool send_get_agent_ids(ClientType& c) {
 		&& send_message(c.connection, mem_stream.buffer, mem_stream.position);
 }
 
+/**
+ * Sends a `get_stats` message to the server from the client `c`, requesting
+ * the step profile of the simulator along with the records of at most
+ * `max_recent_steps` of the most recent time steps. Once the server responds,
+ * the function `on_get_stats(ClientType&, status, const step_profile&)` will
+ * be invoked, where the first argument is `c`, the second is the response (OK
+ * if successful, and a different value if an error occurred), and the third
+ * is the step profile. The profile is not `enabled` unless the server was
+ * compiled with `JBW_PROFILE`.
+ *
+ * \returns `true` if the sending is successful; `false` otherwise.
+ */
+template<typename ClientType>
+bool send_get_stats(ClientType& c, unsigned int max_recent_steps = 64) {
+	memory_stream mem_stream = memory_stream(sizeof(message_type) + sizeof(max_recent_steps));
+	fixed_width_stream<memory_stream> out(mem_stream);
+	return write(message_type::GET_STATS, out)
+		&& write(max_recent_steps, out)
+		&& send_message(c.connection, mem_stream.buffer, mem_stream.position);
+}
+
 /**
  * Sends an `get_agent_states` message to the server from the client `c`. Once
  * the server responds, the function
@@ -2262,6 +2751,108 @@ inline bool receive_do_nothing_response(ClientType& c) {
 }
 
 template<typename ClientType>
+inline bool receive_act_batch_response(ClientType& c) {
+	status response;
+	bool success = true;
+	size_t agent_count = 0;
+	uint64_t* agent_ids = nullptr;
+	status* results = nullptr;
+	fixed_width_stream<socket_type> in(c.connection);
+	if (!read(response, in)) {
+		response = status::CLIENT_PARSE_MESSAGE_ERROR;
+		success = false;
+	} else if (response == status::OK) {
+		if (!read(agent_count, in)) {
+			response = status::CLIENT_PARSE_MESSAGE_ERROR;
+			success = false;
+		} else {
+			agent_ids = (uint64_t*) malloc(max((size_t) 1, sizeof(uint64_t) * agent_count));
+			results = (status*) malloc(max((size_t) 1, sizeof(status) * agent_count));
+			if (agent_ids == nullptr || results == nullptr) {
+				fprintf(stderr, "receive_act_batch_response ERROR: Out of memory.\n");
+				if (agent_ids != nullptr) free(agent_ids);
+				if (results != nullptr) free(results);
+				agent_ids = nullptr; results = nullptr; agent_count = 0;
+				response = status::CLIENT_OUT_OF_MEMORY;
+				success = false;
+			} else if (!read(agent_ids, in, agent_count) || !read(results, in, agent_count)) {
+				free(agent_ids); free(results);
+				agent_ids = nullptr; results = nullptr; agent_count = 0;
+				response = status::CLIENT_PARSE_MESSAGE_ERROR;
+				success = false;
+			}
+		}
+	}
+	/* ownership of `agent_ids` and `results` is passed to the callee */
+	on_act_batch(c, response, agent_ids, results, agent_count);
+	return success;
+}
+
+template<typename ClientType>
+inline bool receive_submit_plan_response(ClientType& c) {
+	status response;
+	uint64_t agent_id = 0;
+	bool success = true;
+	fixed_width_stream<socket_type> in(c.connection);
+	if (!read(agent_id, in) || !read(response, in)) {
+		response = status::CLIENT_PARSE_MESSAGE_ERROR;
+		success = false;
+	}
+	on_submit_plan(c, agent_id, response);
+	return success;
+}
+
+/**
+ * Receives a `plan_ended` message, and invokes
+ * `on_plan_ended(ClientType&, uint64_t*, plan_status*, unsigned int*, size_t)`,
+ * where the arguments are `c`, the IDs of the agents whose plans ended, how
+ * each plan ended, the number of actions of each plan that were taken, and
+ * the number of agents. Ownership of the arrays is passed to the callee. If
+ * the message could not be read, the count is 0 and the arrays are null.
+ */
+template<typename ClientType>
+inline bool receive_plan_ended(ClientType& c) {
+	bool success = true;
+	size_t agent_count = 0;
+	uint64_t* agent_ids = nullptr;
+	plan_status* results = nullptr;
+	unsigned int* action_counts = nullptr;
+	fixed_width_stream<socket_type> in(c.connection);
+	if (!read(agent_count, in)) {
+		success = false;
+	} else {
+		agent_ids = (uint64_t*) malloc(max((size_t) 1, sizeof(uint64_t) * agent_count));
+		results = (plan_status*) malloc(max((size_t) 1, sizeof(plan_status) * agent_count));
+		action_counts = (unsigned int*) malloc(max((size_t) 1, sizeof(unsigned int) * agent_count));
+		if (agent_ids == nullptr || results == nullptr || action_counts == nullptr) {
+			fprintf(stderr, "receive_plan_ended ERROR: Out of memory.\n");
+			success = false;
+		} else {
+			for (size_t i = 0; i < agent_count; i++) {
+				if (!read(agent_ids[i], in) || !read(results[i], in) || !read(action_counts[i], in)) {
+					success = false;
+					break;
+				}
+			}
+		}
+	}
+	if (!success) {
+		if (agent_ids != nullptr) free(agent_ids);
+		if (results != nullptr) free(results);
+		if (action_counts != nullptr) free(action_counts);
+		agent_ids = nullptr; results = nullptr;
+		action_counts = nullptr; agent_count = 0;
+	}
+	/* ownership of `agent_ids`, `results`, and `action_counts` is passed to the callee */
+	on_plan_ended(c, agent_ids, results, action_counts, agent_count);
+	return success;
+}
+
+/**
+ * Handles both `GET_MAP_RESPONSE` and `GET_MAP_DELTA_RESPONSE` messages,
+ * where the latter also contains the version of each patch.
+ */
+template<bool Delta, typename ClientType>
 inline bool receive_get_map_response(ClientType& c) {
 	status response;
 	bool success = true;
@@ -2279,6 +2870,14 @@ inline bool receive_get_map_response(ClientType& c) {
 		} else if (!read(*patches, in, c.config)) {
 			response = status::CLIENT_PARSE_MESSAGE_ERROR;
 			free(patches); success = false;
+		} else if (Delta && !read_versions(*patches, in)) {
+			for (array<patch_state>& row : *patches) {
+				for (patch_state& patch : row) free(patch);
+				free(row);
+			}
+			free(*patches); free(patches);
+			response = status::CLIENT_PARSE_MESSAGE_ERROR;
+			success = false;
 		}
 	}
 	/* ownership of `patches` is passed to the callee */
@@ -2312,6 +2911,28 @@ inline bool receive_get_agent_ids_response(ClientType& c) {
 	return success;
 }
 
+template<typename ClientType>
+inline bool receive_get_stats_response(ClientType& c) {
+	status response;
+	step_profile profile;
+	bool success = true;
+	fixed_width_stream<socket_type> in(c.connection);
+	if (!read(response, in)) {
+		init(profile);
+		response = status::CLIENT_PARSE_MESSAGE_ERROR;
+		success = false;
+	} else if (response != status::OK) {
+		init(profile);
+	} else if (!read(profile, in)) {
+		init(profile);
+		response = status::CLIENT_PARSE_MESSAGE_ERROR;
+		success = false;
+	}
+	on_get_stats(c, response, (const step_profile&) profile);
+	core::free(profile);
+	return success;
+}
+
 template<typename Stream>
 inline status read_agent_states(
 		Stream& in,
@@ -2487,7 +3108,7 @@ void run_response_listener(ClientType& c) {
 		case message_type::DO_NOTHING_RESPONSE:
 			receive_do_nothing_response(c); continue;
 		case message_type::GET_MAP_RESPONSE:
-			receive_get_map_response(c); continue;
+			receive_get_map_response<false>(c); continue;
 		case message_type::GET_AGENT_IDS_RESPONSE:
 			receive_get_agent_ids_response(c); continue;
 		case message_type::GET_AGENT_STATES_RESPONSE:
@@ -2498,6 +3119,16 @@ void run_response_listener(ClientType& c) {
 			receive_is_active_response(c); continue;
 		case message_type::STEP_RESPONSE:
 			receive_step_response(c); continue;
+		case message_type::ACT_BATCH_RESPONSE:
+			receive_act_batch_response(c); continue;
+		case message_type::SUBMIT_PLAN_RESPONSE:
+			receive_submit_plan_response(c); continue;
+		case message_type::PLAN_ENDED:
+			receive_plan_ended(c); continue;
+		case message_type::GET_STATS_RESPONSE:
+			receive_get_stats_response(c); continue;
+		case message_type::GET_MAP_DELTA_RESPONSE:
+			receive_get_map_response<true>(c); continue;
 
 		case message_type::ADD_AGENT:
 		case message_type::REMOVE_AGENT:
@@ -2514,6 +3145,10 @@ void run_response_listener(ClientType& c) {
 		case message_type::GET_AGENT_STATES:
 		case message_type::SET_ACTIVE:
 		case message_type::IS_ACTIVE:
+		case message_type::ACT_BATCH:
+		case message_type::SUBMIT_PLAN:
+		case message_type::GET_STATS:
+		case message_type::GET_MAP_DELTA:
 			break;
 		}
 		fprintf(stderr, "run_response_listener ERROR: Received invalid message type from server %" PRId64 ".\n", (uint64_t) type);
@@ -0,0 +1,460 @@
+/**
+ * Copyright 2019, The Jelly Bean World Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+#ifndef JBW_PROFILER_H_
+#define JBW_PROFILER_H_
+
+#include <core/io.h>
+#include <core/utility.h>
+#include <atomic>
+#include <chrono>
+
+#if defined(_WIN32)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * The step profiler is only compiled in when `JBW_PROFILE` is defined.
+ * Otherwise, the macros below expand to nothing, and the simulator contains
+ * no profiler, so profiling has no overhead.
+ */
+#if defined(JBW_PROFILE)
+#define JBW_PROFILE_BIND(profiler) jbw::scoped_profiler_binding jbw_profiler_binding(profiler)
+#define JBW_PROFILE_PHASE(timer, phase) jbw::scoped_phase_timer timer(phase)
+#define JBW_PROFILE_STOP(timer) timer.stop()
+#define JBW_PROFILE_COUNT(phase, n) jbw::add_step_count(phase, n)
+#else
+#define JBW_PROFILE_BIND(profiler)
+#define JBW_PROFILE_PHASE(timer, phase)
+#define JBW_PROFILE_STOP(timer)
+#define JBW_PROFILE_COUNT(phase, n)
+#endif
+
+namespace jbw {
+
+using namespace core;
+
+/**
+ * The phases of a simulation time step that are timed by the step_profiler.
+ * Some phases contain others: `MCMC` is part of `PATCH_GENERATION` (or of
+ * whichever phase generated the patches), `NETWORK` is part of `ON_STEP`,
+ * and every phase is part of `TOTAL`. `SCENT` and `VISION` are summed over
+ * the threads that compute the observations, so they may exceed `TOTAL`.
+ */
+enum class step_phase : uint8_t {
+	/* grouping the requested moves by target, and resolving conflicts (counts targets) */
+	COLLISIONS = 0,
+	/* applying the actions, and collecting items (counts collected items) */
+	ITEM_PICKUP,
+	/* generating the patches around targets and agents (counts neighborhoods) */
+	PATCH_GENERATION,
+	/* sampling the items of new patches (counts sampled patches) */
+	MCMC,
+	/* adding the scent and color of nearby items and agents (counts observations) */
+	SCENT,
+	/* occluding the visual field (counts recomputed visual fields) */
+	VISION,
+	/* the `on_step` callback */
+	ON_STEP,
+	/* sending step responses to clients (counts messages) */
+	NETWORK,
+	/* the entire time step */
+	TOTAL,
+	COUNT
+};
+
+constexpr unsigned int STEP_PHASE_COUNT = (unsigned int) step_phase::COUNT;
+
+/* The number of buckets in the histogram of the duration of each phase (see `step_profile`). */
+constexpr unsigned int STEP_PROFILE_HISTOGRAM_BUCKETS = 40;
+
+/**
+ * Prints the given step_phase `phase` to the stream `out`.
+ */
+template<typename Stream>
+inline bool print(const step_phase& phase, Stream& out) {
+	switch (phase) {
+	case step_phase::COLLISIONS:       return core::print("COLLISIONS", out);
+	case step_phase::ITEM_PICKUP:      return core::print("ITEM_PICKUP", out);
+	case step_phase::PATCH_GENERATION: return core::print("PATCH_GENERATION", out);
+	case step_phase::MCMC:             return core::print("MCMC", out);
+	case step_phase::SCENT:            return core::print("SCENT", out);
+	case step_phase::VISION:           return core::print("VISION", out);
+	case step_phase::ON_STEP:          return core::print("ON_STEP", out);
+	case step_phase::NETWORK:          return core::print("NETWORK", out);
+	case step_phase::TOTAL:            return core::print("TOTAL", out);
+	case step_phase::COUNT:            break;
+	}
+	fprintf(stderr, "print ERROR: Unrecognized step_phase.\n");
+	return false;
+}
+
+/**
+ * Returns the current value of the timestamp counter or, on platforms
+ * without one, of a monotonic clock in nanoseconds.
+ */
+inline uint64_t read_tsc() {
+#if defined(_WIN32) || defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/**
+ * The ticks spent in, and the counters of, each step_phase during a single
+ * time step.
+ */
+struct step_profile_record {
+	/* the simulation time at the end of the step */
+	uint64_t time;
+	uint64_t ticks[STEP_PHASE_COUNT];
+	uint64_t counts[STEP_PHASE_COUNT];
+};
+
+template<typename Stream>
+inline bool read(step_profile_record& record, Stream& in) {
+	return read(record.time, in)
+		&& read(record.ticks, in, STEP_PHASE_COUNT)
+		&& read(record.counts, in, STEP_PHASE_COUNT);
+}
+
+template<typename Stream>
+inline bool write(const step_profile_record& record, Stream& out) {
+	return write(record.time, out)
+		&& write(record.ticks, out, STEP_PHASE_COUNT)
+		&& write(record.counts, out, STEP_PHASE_COUNT);
+}
+
+/**
+ * A summary of the time steps recorded by a step_profiler, returned by
+ * `simulator::get_step_profile`.
+ */
+struct step_profile {
+	/* whether the simulator was compiled with `JBW_PROFILE` */
+	bool enabled;
+
+	/* the number of time steps recorded so far */
+	uint64_t step_count;
+
+	/* the estimated frequency of `read_tsc` */
+	double ticks_per_second;
+
+	/* the ticks spent in, and the counters of, each phase over all steps */
+	uint64_t total_ticks[STEP_PHASE_COUNT];
+	uint64_t total_counts[STEP_PHASE_COUNT];
+
+	/**
+	 * `histograms[p][0]` is the number of steps that spent no ticks in
+	 * phase `p`, and `histograms[p][b]` for `b > 0` is the number of steps
+	 * that spent between `2^(b-1)` and `2^b - 1` ticks in it. The last
+	 * bucket also contains all longer steps.
+	 */
+	uint64_t histograms[STEP_PHASE_COUNT][STEP_PROFILE_HISTOGRAM_BUCKETS];
+
+	/* the records of the most recent steps, oldest first */
+	step_profile_record* recent_steps;
+	unsigned int recent_step_count;
+
+	static inline void free(step_profile& profile) {
+		if (profile.recent_steps != nullptr)
+			core::free(profile.recent_steps);
+	}
+};
+
+/**
+ * Initializes the given step_profile `profile` as an empty profile, which
+ * is not `enabled`.
+ */
+inline void init(step_profile& profile) {
+	profile.enabled = false;
+	profile.step_count = 0;
+	profile.ticks_per_second = 0.0;
+	for (unsigned int p = 0; p < STEP_PHASE_COUNT; p++) {
+		profile.total_ticks[p] = 0;
+		profile.total_counts[p] = 0;
+		for (unsigned int b = 0; b < STEP_PROFILE_HISTOGRAM_BUCKETS; b++)
+			profile.histograms[p][b] = 0;
+	}
+	profile.recent_steps = nullptr;
+	profile.recent_step_count = 0;
+}
+
+/**
+ * Reads the given step_profile `profile` from the stream `in`.
+ */
+template<typename Stream>
+bool read(step_profile& profile, Stream& in) {
+	if (!read(profile.enabled, in)
+	 || !read(profile.step_count, in)
+	 || !read(profile.ticks_per_second, in)
+	 || !read(profile.total_ticks, in, STEP_PHASE_COUNT)
+	 || !read(profile.total_counts, in, STEP_PHASE_COUNT))
+		return false;
+	for (unsigned int p = 0; p < STEP_PHASE_COUNT; p++)
+		if (!read(profile.histograms[p], in, STEP_PROFILE_HISTOGRAM_BUCKETS)) return false;
+	if (!read(profile.recent_step_count, in))
+		return false;
+	profile.recent_steps = (step_profile_record*) malloc(sizeof(step_profile_record) * max(1u, profile.recent_step_count));
+	if (profile.recent_steps == nullptr) {
+		fprintf(stderr, "read ERROR: Insufficient memory for step_profile.recent_steps.\n");
+		return false;
+	}
+	for (unsigned int i = 0; i < profile.recent_step_count; i++) {
+		if (!read(profile.recent_steps[i], in)) {
+			core::free(profile.recent_steps);
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Writes the given step_profile `profile` to the stream `out`.
+ */
+template<typename Stream>
+bool write(const step_profile& profile, Stream& out) {
+	if (!write(profile.enabled, out)
+	 || !write(profile.step_count, out)
+	 || !write(profile.ticks_per_second, out)
+	 || !write(profile.total_ticks, out, STEP_PHASE_COUNT)
+	 || !write(profile.total_counts, out, STEP_PHASE_COUNT))
+		return false;
+	for (unsigned int p = 0; p < STEP_PHASE_COUNT; p++)
+		if (!write(profile.histograms[p], out, STEP_PROFILE_HISTOGRAM_BUCKETS)) return false;
+	if (!write(profile.recent_step_count, out))
+		return false;
+	for (unsigned int i = 0; i < profile.recent_step_count; i++)
+		if (!write(profile.recent_steps[i], out)) return false;
+	return true;
+}
+
+/**
+ * Accumulates the ticks and counters of each step_phase during the current
+ * time step, which may be updated concurrently by any thread, and records
+ * them in a ring of the most recent `RING_SIZE` steps at the end of each
+ * step. The ring has a single writer (the thread that advances the
+ * simulation), and readers copy its records without locking: each slot has
+ * a sequence number that is odd while the slot is being written, so readers
+ * discard any record that was overwritten while they copied it.
+ */
+struct step_profiler {
+	static constexpr unsigned int RING_SIZE = 256;
+
+	struct ring_slot {
+		std::atomic<uint64_t> sequence;
+		step_profile_record record;
+	};
+
+	/* The ticks and counters of each phase in the current time step. */
+	std::atomic<uint64_t> current_ticks[STEP_PHASE_COUNT];
+	std::atomic<uint64_t> current_counts[STEP_PHASE_COUNT];
+
+	/* The record of step `n` is stored in `ring[n % RING_SIZE]`. */
+	ring_slot ring[RING_SIZE];
+
+	/* The number of steps recorded so far. */
+	std::atomic<uint64_t> step_count;
+
+	/* The totals and histograms over all recorded steps (see `step_profile`). */
+	std::atomic<uint64_t> total_ticks[STEP_PHASE_COUNT];
+	std::atomic<uint64_t> total_counts[STEP_PHASE_COUNT];
+	std::atomic<uint64_t> histograms[STEP_PHASE_COUNT][STEP_PROFILE_HISTOGRAM_BUCKETS];
+
+	/* Used to estimate the frequency of `read_tsc`. */
+	uint64_t start_ticks;
+	std::chrono::steady_clock::time_point start_time;
+
+	step_profiler() { init_helper(); }
+
+	inline void add_ticks(step_phase phase, uint64_t ticks) {
+		current_ticks[(size_t) phase].fetch_add(ticks, std::memory_order_relaxed);
+	}
+
+	inline void add_count(step_phase phase, uint64_t count) {
+		current_counts[(size_t) phase].fetch_add(count, std::memory_order_relaxed);
+	}
+
+	/**
+	 * Records the ticks and counters accumulated since the previous call, as
+	 * the step that ended at the given simulation `time`. This must only be
+	 * called by one thread at a time.
+	 */
+	inline void end_step(uint64_t time) {
+		uint64_t n = step_count.load(std::memory_order_relaxed);
+		ring_slot& slot = ring[n % RING_SIZE];
+		slot.sequence.store(2 * n + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		slot.record.time = time;
+		for (unsigned int p = 0; p < STEP_PHASE_COUNT; p++) {
+			uint64_t ticks = current_ticks[p].exchange(0, std::memory_order_relaxed);
+			uint64_t count = current_counts[p].exchange(0, std::memory_order_relaxed);
+			slot.record.ticks[p] = ticks;
+			slot.record.counts[p] = count;
+			total_ticks[p].fetch_add(ticks, std::memory_order_relaxed);
+			total_counts[p].fetch_add(count, std::memory_order_relaxed);
+			histograms[p][histogram_bucket(ticks)].fetch_add(1, std::memory_order_relaxed);
+		}
+
+		slot.sequence.store(2 * n + 2, std::memory_order_release);
+		step_count.store(n + 1, std::memory_order_release);
+	}
+
+	/**
+	 * Initializes the uninitialized step_profile `profile` with the totals
+	 * and histograms of the steps recorded so far, along with the records of
+	 * up to `max_recent_steps` of the most recent steps. This may be called
+	 * concurrently with `end_step`. Returns `false` if there is insufficient
+	 * memory.
+	 */
+	inline bool get_profile(step_profile& profile, unsigned int max_recent_steps) const {
+		init(profile);
+		profile.enabled = true;
+		uint64_t n = step_count.load(std::memory_order_acquire);
+		uint64_t recent_count = (max_recent_steps < RING_SIZE) ? max_recent_steps : RING_SIZE;
+		if (recent_count > n) recent_count = n;
+		profile.recent_steps = (step_profile_record*) malloc(sizeof(step_profile_record) * max((uint64_t) 1, recent_count));
+		if (profile.recent_steps == nullptr) {
+			fprintf(stderr, "step_profiler.get_profile ERROR: Insufficient memory for step_profile.recent_steps.\n");
+			return false;
+		}
+		for (uint64_t s = n - recent_count; s < n; s++) {
+			const ring_slot& slot = ring[s % RING_SIZE];
+			uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+			if (sequence != 2 * s + 2) continue; /* this record was already overwritten */
+			step_profile_record record = slot.record;
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (slot.sequence.load(std::memory_order_relaxed) != sequence) continue;
+			profile.recent_steps[profile.recent_step_count++] = record;
+		}
+
+		profile.step_count = n;
+		for (unsigned int p = 0; p < STEP_PHASE_COUNT; p++) {
+			profile.total_ticks[p] = total_ticks[p].load(std::memory_order_relaxed);
+			profile.total_counts[p] = total_counts[p].load(std::memory_order_relaxed);
+			for (unsigned int b = 0; b < STEP_PROFILE_HISTOGRAM_BUCKETS; b++)
+				profile.histograms[p][b] = histograms[p][b].load(std::memory_order_relaxed);
+		}
+
+		double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+		profile.ticks_per_second = (elapsed > 0.0) ? ((double) (read_tsc() - start_ticks) / elapsed) : 0.0;
+		return true;
+	}
+
+private:
+	inline void init_helper() {
+		for (unsigned int i = 0; i < RING_SIZE; i++)
+			ring[i].sequence = 0;
+		for (unsigned int p = 0; p < STEP_PHASE_COUNT; p++) {
+			current_ticks[p] = 0;
+			current_counts[p] = 0;
+			total_ticks[p] = 0;
+			total_counts[p] = 0;
+			for (unsigned int b = 0; b < STEP_PROFILE_HISTOGRAM_BUCKETS; b++)
+				histograms[p][b] = 0;
+		}
+		step_count = 0;
+		start_ticks = read_tsc();
+		start_time = std::chrono::steady_clock::now();
+	}
+
+	/* Returns the histogram bucket of a phase that took the given number of `ticks`. */
+	static inline unsigned int histogram_bucket(uint64_t ticks) {
+		unsigned int bucket = 0;
+		while (ticks > 0 && bucket + 1 < STEP_PROFILE_HISTOGRAM_BUCKETS) {
+			ticks >>= 1;
+			bucket++;
+		}
+		return bucket;
+	}
+
+	friend void init(step_profiler&);
+};
+
+/**
+ * Initializes the given step_profiler `profiler`, which has not recorded
+ * any steps.
+ */
+inline void init(step_profiler& profiler) {
+	profiler.init_helper();
+}
+
+/**
+ * Returns the profiler of the time step being computed by the calling
+ * thread, or `nullptr` if the thread is not computing a profiled time step.
+ * This is set by `scoped_profiler_binding`, so that code outside the
+ * simulator (such as `map` and `send_step_response`) can be profiled.
+ */
+inline step_profiler*& current_step_profiler() {
+	static thread_local step_profiler* profiler = nullptr;
+	return profiler;
+}
+
+/**
+ * Sets the `current_step_profiler` of the calling thread for the lifetime
+ * of this object.
+ */
+struct scoped_profiler_binding {
+	step_profiler* previous;
+
+	scoped_profiler_binding(step_profiler* profiler) : previous(current_step_profiler()) {
+		current_step_profiler() = profiler;
+	}
+
+	~scoped_profiler_binding() {
+		current_step_profiler() = previous;
+	}
+};
+
+/**
+ * Adds the ticks from its construction until `stop` is called (or it is
+ * destroyed, whichever comes first) to the given phase of the
+ * `current_step_profiler`, if any.
+ */
+struct scoped_phase_timer {
+	step_profiler* profiler;
+	step_phase phase;
+	uint64_t start;
+
+	scoped_phase_timer(step_phase phase) :
+		profiler(current_step_profiler()), phase(phase), start(read_tsc()) { }
+
+	~scoped_phase_timer() { stop(); }
+
+	inline void stop() {
+		if (profiler == nullptr) return;
+		profiler->add_ticks(phase, read_tsc() - start);
+		profiler = nullptr;
+	}
+};
+
+/**
+ * Adds `count` to the counter of the given phase of the
+ * `current_step_profiler`, if any.
+ */
+inline void add_step_count(step_phase phase, uint64_t count) {
+	step_profiler* profiler = current_step_profiler();
+	if (profiler != nullptr)
+		profiler->add_count(phase, count);
+}
+
+} /* namespace jbw */
+
+#endif /* JBW_PROFILER_H_ */
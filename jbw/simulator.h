@@ -27,6 +27,8 @@
 #include "map.h"
 #include "diffusion.h"
 #include "status.h"
+#include "thread_pool.h"
+#include "profiler.h"
 
 namespace jbw {
 
@@ -103,6 +105,38 @@ inline bool write(const movement_conflict_policy& policy, Stream& out) {
     return write((uint8_t) policy, out);
 }
 
+/**
+ * An enum representing the method used by the simulator to compute the
+ * occlusion of the agents' visual fields by items. Both methods produce the
+ * same visual fields from the same sparse table of shadows (see
+ * `vision_tables`), but `SHADOW_CASTING` is faster for large vision ranges.
+ */
+enum class occlusion_method : uint8_t {
+    /* for each cell, sum the occlusion due to every visible item */
+    PER_CELL = 0,
+    /* for each visible item, cast its shadow onto the cells behind it */
+    SHADOW_CASTING = 1
+};
+
+/**
+ * Reads the given occlusion_method `method` from the stream `in`.
+ */
+template<typename Stream>
+inline bool read(occlusion_method& method, Stream& in) {
+    uint8_t c;
+    if (!read(c, in)) return false;
+    method = (occlusion_method) c;
+    return true;
+}
+
+/**
+ * Writes the given occlusion_method `method` to the stream `out`.
+ */
+template<typename Stream>
+inline bool write(const occlusion_method& method, Stream& out) {
+    return write((uint8_t) method, out);
+}
+
 template<typename FunctionType>
 struct energy_function {
     FunctionType fn;
@@ -425,6 +459,86 @@ inline bool write(const action_policy& type, Stream& out) {
     return write((action_policy_type) type, out);
 }
 
+/** The kinds of actions that an agent can take in a single time step. */
+enum class action_type : uint8_t { MOVE = 0, TURN = 1, DO_NOTHING = 2 };
+
+/**
+ * A single agent action, as submitted to `simulator::act`. The direction
+ * `dir` is *relative* to the agent's current direction, and is ignored by
+ * `action_type::DO_NOTHING`. `num_steps` is only used by `action_type::MOVE`.
+ */
+struct action {
+    action_type type;
+    direction dir;
+    unsigned int num_steps;
+};
+
+/**
+ * Reads the given action `a` from the input stream `in`.
+ */
+template<typename Stream>
+inline bool read(action& a, Stream& in) {
+    uint8_t type;
+    if (!read(type, in)
+     || !read(a.dir, in)
+     || !read(a.num_steps, in))
+        return false;
+    a.type = (action_type) type;
+    return true;
+}
+
+/**
+ * Writes the given action `a` to the output stream `out`.
+ */
+template<typename Stream>
+inline bool write(const action& a, Stream& out) {
+    return write((uint8_t) a.type, out)
+        && write(a.dir, out)
+        && write(a.num_steps, out);
+}
+
+/**
+ * Conditions under which an action plan, submitted with
+ * `simulator::submit_plan`, is aborted before all of its actions are taken.
+ * These are flags, which may be combined.
+ */
+enum plan_abort_condition : uint8_t {
+    /* the plan is only stopped once all of its actions are taken */
+    PLAN_ABORT_NEVER = 0,
+    /* stop when the number of items in the agent's field of view increases */
+    PLAN_ABORT_ITEM_VISIBLE = 1,
+    /* stop when the agent fails to move to the position it requested */
+    PLAN_ABORT_BLOCKED = 2
+};
+
+/** The state of an agent's action plan. */
+enum class plan_status : uint8_t {
+    NONE = 0,
+    RUNNING = 1,
+    COMPLETED = 2,
+    ABORTED_ITEM_VISIBLE = 3,
+    ABORTED_BLOCKED = 4
+};
+
+/**
+ * Reads a plan_status from `in` and stores the result in `s`.
+ */
+template<typename Stream>
+inline bool read(plan_status& s, Stream& in) {
+    uint8_t v;
+    if (!read(v, in)) return false;
+    s = (plan_status) v;
+    return true;
+}
+
+/**
+ * Writes the given plan_status `s` to the stream `out`.
+ */
+template<typename Stream>
+inline bool write(const plan_status& s, Stream& out) {
+    return write((uint8_t) s, out);
+}
+
 /**
  * Represents the configuration of a simulator. 
  */
@@ -435,6 +549,7 @@ struct simulator_config {
     unsigned int color_dimension;
     unsigned int vision_range;
     float agent_field_of_view;
+    occlusion_method occlusion;
     action_policy allowed_movement_directions[(size_t) direction::COUNT];
     action_policy allowed_rotations[(size_t) direction::COUNT];
     bool no_op_allowed;
@@ -450,7 +565,40 @@ struct simulator_config {
     float decay_param, diffusion_param;
     unsigned int deleted_item_lifetime;
 
-    simulator_config() : item_types(8), agent_color(NULL) { }
+    /**
+     * Parameters for resampling the fixed patches near agents in the
+     * background (see `patch_resampler`): every `resample_interval` time
+     * steps, the fixed patches within `resample_radius` patches of each agent
+     * are resampled with `resample_iterations` MCMC iterations. A
+     * `resample_interval` of 0 disables resampling.
+     */
+    unsigned int resample_interval;
+    unsigned int resample_radius;
+    unsigned int resample_iterations;
+
+    /**
+     * The number of most recent observations kept for each agent (see
+     * `agent_state::get_observation_history`). This must be at least 1.
+     */
+    unsigned int history_length;
+
+    /**
+     * The reward schema, which the simulator evaluates for every agent at
+     * the end of each time step (see `simulator::get_rewards`). The reward
+     * of an agent in a time step is the sum of `reward_per_step`,
+     * `reward_per_distance` times the number of cells (in L1 distance) that
+     * the agent moved, and `reward_item_deltas[i]` times the change in the
+     * number of items of type `i` that the agent has collected.
+     * `reward_item_deltas` has one element per item type, and may be NULL,
+     * in which case the items do not contribute to the reward.
+     */
+    float* reward_item_deltas;
+    float reward_per_step;
+    float reward_per_distance;
+
+    simulator_config() : occlusion(occlusion_method::PER_CELL), item_types(8), agent_color(NULL),
+        resample_interval(0), resample_radius(1), resample_iterations(1000), history_length(1),
+        reward_item_deltas(NULL), reward_per_step(0.0f), reward_per_distance(0.0f) { }
 
     simulator_config(const simulator_config& src) : item_types(src.item_types.length) {
         if (!init_helper(src))
@@ -474,10 +622,18 @@ struct simulator_config {
         core::swap(first.item_types, second.item_types);
         core::swap(first.agent_color, second.agent_color);
         core::swap(first.agent_field_of_view, second.agent_field_of_view);
+        core::swap(first.occlusion, second.occlusion);
         core::swap(first.collision_policy, second.collision_policy);
         core::swap(first.decay_param, second.decay_param);
         core::swap(first.diffusion_param, second.diffusion_param);
         core::swap(first.deleted_item_lifetime, second.deleted_item_lifetime);
+        core::swap(first.resample_interval, second.resample_interval);
+        core::swap(first.resample_radius, second.resample_radius);
+        core::swap(first.resample_iterations, second.resample_iterations);
+        core::swap(first.history_length, second.history_length);
+        core::swap(first.reward_item_deltas, second.reward_item_deltas);
+        core::swap(first.reward_per_step, second.reward_per_step);
+        core::swap(first.reward_per_distance, second.reward_per_distance);
     }
 
     static inline void free(simulator_config& config) {
@@ -493,6 +649,16 @@ private:
             fprintf(stderr, "simulator_config.init_helper ERROR: Insufficient memory for agent_color.\n");
             return false;
         }
+        reward_item_deltas = NULL;
+        if (src.reward_item_deltas != NULL) {
+            reward_item_deltas = (float*) malloc(sizeof(float) * max((size_t) 1, src.item_types.length));
+            if (reward_item_deltas == NULL) {
+                fprintf(stderr, "simulator_config.init_helper ERROR: Insufficient memory for reward_item_deltas.\n");
+                core::free(agent_color); return false;
+            }
+            for (unsigned int i = 0; i < src.item_types.length; i++)
+                reward_item_deltas[i] = src.reward_item_deltas[i];
+        }
 
         for (unsigned int i = 0; i < (size_t) direction::COUNT; i++)
             allowed_movement_directions[i] = src.allowed_movement_directions[i];
@@ -506,6 +672,7 @@ private:
             if (!init(item_types[i], src.item_types[i], src.scent_dimension, src.color_dimension, (unsigned int) src.item_types.length)) {
                 for (unsigned int j = 0; j < i; j++)
                     core::free(item_types[i], (unsigned int) src.item_types.length);
+                if (reward_item_deltas != NULL) core::free(reward_item_deltas);
                 core::free(agent_color); return false;
             }
         }
@@ -518,10 +685,17 @@ private:
         patch_size = src.patch_size;
         mcmc_iterations = src.mcmc_iterations;
         agent_field_of_view = src.agent_field_of_view;
+        occlusion = src.occlusion;
         collision_policy = src.collision_policy;
         decay_param = src.decay_param;
         diffusion_param = src.diffusion_param;
         deleted_item_lifetime = src.deleted_item_lifetime;
+        resample_interval = src.resample_interval;
+        resample_radius = src.resample_radius;
+        resample_iterations = src.resample_iterations;
+        history_length = src.history_length;
+        reward_per_step = src.reward_per_step;
+        reward_per_distance = src.reward_per_distance;
         return true;
     }
 
@@ -530,6 +704,8 @@ private:
             core::free(properties, (unsigned int) item_types.length);
         if (agent_color != NULL)
             core::free(agent_color);
+        if (reward_item_deltas != NULL)
+            core::free(reward_item_deltas);
     }
 
     friend bool init(simulator_config&, const simulator_config&);
@@ -537,11 +713,21 @@ private:
 
 /**
  * Initializes the given simulator_config with a NULL `agent_color`,
- * `intensity_fn_args`, `interaction_fn_args`, and an empty `item_types`. This
- * function does not initialize any other fields.
+ * `intensity_fn_args`, `interaction_fn_args`, an empty `item_types`, the
+ * `PER_CELL` occlusion method, no background resampling,
+ * a history of one observation, and a reward schema that is always zero.
+ * This function does not initialize any other fields.
  */
 inline bool init(simulator_config& config) {
     config.agent_color = NULL;
+    config.occlusion = occlusion_method::PER_CELL;
+    config.resample_interval = 0;
+    config.resample_radius = 1;
+    config.resample_iterations = 1000;
+    config.history_length = 1;
+    config.reward_item_deltas = NULL;
+    config.reward_per_step = 0.0f;
+    config.reward_per_distance = 0.0f;
     return array_init(config.item_types, 8);
 }
 
@@ -559,12 +745,82 @@ inline bool init(simulator_config& config, const simulator_config& src)
 }
 
 /**
- * Reads the given simulator_config `config` from the input stream `in`.
+ * Returns `true` if the reward schema of the given `config` is not always
+ * zero, in which case the simulator evaluates it in every time step.
+ */
+inline bool has_reward_schema(const simulator_config& config) {
+    if (config.reward_per_step != 0.0f || config.reward_per_distance != 0.0f)
+        return true;
+    if (config.reward_item_deltas != NULL) {
+        for (unsigned int i = 0; i < config.item_types.length; i++)
+            if (config.reward_item_deltas[i] != 0.0f) return true;
+    }
+    return false;
+}
+
+/**
+ * Returns `true` if the parameters of the given simulator_config `config`
+ * are within their valid ranges, and prints an error otherwise.
+ */
+inline bool is_valid(const simulator_config& config) {
+    if (config.history_length == 0) {
+        fprintf(stderr, "simulator_config ERROR: `history_length` must be at least 1.\n");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * The first value written by `write(const simulator_config&, Stream&)`,
+ * followed by `SIMULATOR_FORMAT_VERSION`. Streams in the original format
+ * have no header, and begin with `max_steps_per_movement` instead.
+ */
+constexpr uint32_t SIMULATOR_FORMAT_MAGIC = 0x4a425743;
+
+/**
+ * The version of the format in which simulator_config and simulator are
+ * written, so that streams in older formats can still be read:
+ *  0. The original format, without a header, in which the simulator_config
+ *     ends with `deleted_item_lifetime`.
+ *  1. The simulator_config also contains `occlusion`, `thread_count`, the
+ *     resampling parameters, `history_length`, and the reward schema, which
+ *     have their default values (see `init(simulator_config&)`) in version 0.
+ *  2. The simulator also contains the regions that are being resampled in
+ *     the background (see `patch_resampler`), which are empty in older
+ *     versions.
+ *  3. The simulator_config no longer contains `thread_count`, which is
+ *     given when the simulator is constructed or read, since it does not
+ *     affect the simulation. It is skipped in versions 1 and 2.
+ */
+constexpr uint32_t SIMULATOR_FORMAT_VERSION = 3;
+
+/**
+ * Reads the given simulator_config `config` from the input stream `in`,
+ * which may be in any version of the format up to
+ * `SIMULATOR_FORMAT_VERSION`. Upon success, `version` contains the version
+ * of the stream.
  */
 template<typename Stream>
-bool read(simulator_config& config, Stream& in) {
-    if (!read(config.max_steps_per_movement, in)
-     || !read(config.scent_dimension, in)
+bool read(simulator_config& config, Stream& in, uint32_t& version) {
+    unsigned int header;
+    if (!read(header, in)) {
+        return false;
+    } else if (header == SIMULATOR_FORMAT_MAGIC) {
+        if (!read(version, in)) {
+            return false;
+        } else if (version == 0 || version > SIMULATOR_FORMAT_VERSION) {
+            fprintf(stderr, "read ERROR: Unsupported simulator_config format version %u.\n", version);
+            return false;
+        } else if (!read(config.max_steps_per_movement, in)) {
+            return false;
+        }
+    } else {
+        /* the original format has no header */
+        version = 0;
+        config.max_steps_per_movement = header;
+    }
+
+    if (!read(config.scent_dimension, in)
      || !read(config.color_dimension, in)
      || !read(config.vision_range, in)
      || !read(config.allowed_movement_directions, in)
@@ -590,25 +846,76 @@ bool read(simulator_config& config, Stream& in) {
         free(config.item_types); return false;
     }
 
+    /* the fields added since the original format have their default values */
+    config.occlusion = occlusion_method::PER_CELL;
+    config.resample_interval = 0;
+    config.resample_radius = 1;
+    config.resample_iterations = 1000;
+    config.history_length = 1;
+    config.reward_per_step = 0.0f;
+    config.reward_per_distance = 0.0f;
+    bool has_item_deltas = false;
+    unsigned int thread_count; /* only in versions 1 and 2, and ignored */
     if (!read(config.agent_color, in, config.color_dimension)
      || !read(config.agent_field_of_view, in)
      || !read(config.collision_policy, in)
      || !read(config.decay_param, in)
      || !read(config.diffusion_param, in)
-     || !read(config.deleted_item_lifetime, in)) {
+     || !read(config.deleted_item_lifetime, in)
+     || (version >= 1
+      && (!read(config.occlusion, in)
+       || (version < 3 && !read(thread_count, in))
+       || !read(config.resample_interval, in)
+       || !read(config.resample_radius, in)
+       || !read(config.resample_iterations, in)
+       || !read(config.history_length, in)
+       || !read(config.reward_per_step, in)
+       || !read(config.reward_per_distance, in)
+       || !read(has_item_deltas, in)))) {
         for (item_properties& properties : config.item_types)
             free(properties, (unsigned int) config.item_types.length);
         free(config.agent_color); free(config.item_types); return false;
     }
+
+    config.reward_item_deltas = NULL;
+    if (has_item_deltas) {
+        config.reward_item_deltas = (float*) malloc(sizeof(float) * max((size_t) 1, config.item_types.length));
+        if (config.reward_item_deltas == NULL
+         || !read(config.reward_item_deltas, in, config.item_types.length)) {
+            if (config.reward_item_deltas == NULL)
+                fprintf(stderr, "read ERROR: Insufficient memory for simulator_config.reward_item_deltas.\n");
+            else free(config.reward_item_deltas);
+            for (item_properties& properties : config.item_types)
+                free(properties, (unsigned int) config.item_types.length);
+            free(config.agent_color); free(config.item_types); return false;
+        }
+    }
+
+    if (!is_valid(config)) {
+        free(config);
+        return false;
+    }
     return true;
 }
 
 /**
- * Writes the given simulator_config `config` to the output stream `out`.
+ * Reads the given simulator_config `config` from the input stream `in`.
+ */
+template<typename Stream>
+inline bool read(simulator_config& config, Stream& in) {
+    uint32_t version;
+    return read(config, in, version);
+}
+
+/**
+ * Writes the given simulator_config `config` to the output stream `out`, in
+ * the format with version `SIMULATOR_FORMAT_VERSION`.
  */
 template<typename Stream>
 bool write(const simulator_config& config, Stream& out) {
-    return write(config.max_steps_per_movement, out)
+    return write(SIMULATOR_FORMAT_MAGIC, out)
+        && write(SIMULATOR_FORMAT_VERSION, out)
+        && write(config.max_steps_per_movement, out)
         && write(config.scent_dimension, out)
         && write(config.color_dimension, out)
         && write(config.vision_range, out)
@@ -624,7 +931,16 @@ bool write(const simulator_config& config, Stream& out) {
         && write(config.collision_policy, out)
         && write(config.decay_param, out)
         && write(config.diffusion_param, out)
-        && write(config.deleted_item_lifetime, out);
+        && write(config.deleted_item_lifetime, out)
+        && write(config.occlusion, out)
+        && write(config.resample_interval, out)
+        && write(config.resample_radius, out)
+        && write(config.resample_iterations, out)
+        && write(config.history_length, out)
+        && write(config.reward_per_step, out)
+        && write(config.reward_per_distance, out)
+        && write(config.reward_item_deltas != NULL, out)
+        && (config.reward_item_deltas == NULL || write(config.reward_item_deltas, out, config.item_types.length));
 }
 
 /**
@@ -636,8 +952,17 @@ struct patch_data {
     std::mutex patch_lock;
     array<agent_state*> agents;
 
+    /**
+     * Incremented whenever the patch changes in a way that may affect the
+     * visual field of nearby agents: when items are collected or expire, and
+     * when agents enter, leave, move, or turn within the patch. This is not
+     * serialized.
+     */
+    uint64_t version;
+
     static inline void move(const patch_data& src, patch_data& dst) {
         core::move(src.agents, dst.agents);
+        dst.version = src.version;
         src.patch_lock.~mutex();
         new (&dst.patch_lock) std::mutex();
     }
@@ -654,6 +979,24 @@ struct patch_data {
 inline bool init(patch_data& data) {
     if (!array_init(data.agents, 4))
         return false;
+    data.version = 0;
+    new (&data.patch_lock) std::mutex();
+    return true;
+}
+
+/**
+ * Initializes the given patch_data `data` as a copy of `src`, for a fork of
+ * the simulator containing `src`, where each agent in `src` is replaced by
+ * its copy in `forked_agents`.
+ */
+inline bool init(patch_data& data, const patch_data& src,
+        const hash_map<const agent_state*, agent_state*>& forked_agents)
+{
+    if (!array_init(data.agents, max((size_t) 4, src.agents.length)))
+        return false;
+    for (const agent_state* agent : src.agents)
+        data.agents[data.agents.length++] = forked_agents.get(agent);
+    data.version = src.version;
     new (&data.patch_lock) std::mutex();
     return true;
 }
@@ -677,6 +1020,7 @@ bool read(patch_data& data, Stream& in,
         data.agents[i] = agents.get(id);
     }
     data.agents.length = agent_count;
+    data.version = 0;
     new (&data.patch_lock) std::mutex();
     return true;
 }
@@ -695,6 +1039,34 @@ bool write(const patch_data& data, Stream& out,
     return true;
 }
 
+/**
+ * Retrieves the patches containing the items and agents that may be perceived
+ * by an agent at `agent_position`, and appends them to `neighborhood`. If the
+ * vision range is at most half the patch size, these are the four patches
+ * returned by `map::get_fixed_neighborhood`, which cover both the vision
+ * range and the scent range. Otherwise, the neighborhood contains every
+ * patch within the larger of the two ranges of the agent.
+ */
+inline bool get_perception_neighborhood(
+        map<patch_data, item_properties>& world,
+        const position& agent_position,
+        const simulator_config& config,
+        array<patch<patch_data>*>& neighborhood)
+{
+    if (config.vision_range <= config.patch_size / 2) {
+        if (!neighborhood.ensure_capacity(neighborhood.length + 4))
+            return false;
+        position patch_positions[4];
+        world.get_fixed_neighborhood(agent_position, neighborhood.data + neighborhood.length, patch_positions);
+        neighborhood.length += 4;
+        return true;
+    }
+
+    /* the scent of an item reaches fewer than `patch_size / 2 + 1` cells (see `diffusion::radius`) */
+    const unsigned int scent_range = config.patch_size / 2;
+    return world.get_fixed_neighborhood(agent_position, max(config.vision_range, scent_range), neighborhood);
+}
+
 inline void add_scent(float* dst, const float* scent, unsigned int scent_dimension, float value) {
     for (unsigned int i = 0; i < scent_dimension; i++)
         dst[i] += scent[i] * value;
@@ -720,1538 +1092,6054 @@ void compute_scent_contribution(
                 (float) scent_model.get_value(creation_t, (int) relative_position.x, (int) relative_position.y));
 
         if (item.deletion_time > 0) {
-            unsigned int deletion_t = (unsigned int) (current_time - item.deletion_time);
+            /* the simulator removes expired items once per time step, so an
+               expired item may remain until then, in which case this clamped
+               value cancels its scent above */
+            unsigned int deletion_t = (unsigned int) min((uint64_t) config.deleted_item_lifetime - 1, current_time - item.deletion_time);
             add_scent(dst, config.item_types[item.item_type].scent, config.scent_dimension,
                 (float) -scent_model.get_value(deletion_t, (int) relative_position.x, (int) relative_position.y));
         }
     }
 }
 
-/** Represents the state of an agent in the simulator. */
-struct agent_state {
-    /* Current position of the agent. */
-    position current_position;
+/**
+ * Returns the angular overlap of the two (counter-clockwise) angle intervals
+ * `[ar, al]` and `[br, bl]`, where angles are given in radians and may wrap
+ * around zero.
+ */
+inline float angle_overlap(float al, float ar, float bl, float br) {
+    al = al < 0 ? 2 * (float) M_PI + al : al;
+    ar = ar < 0 ? 2 * (float) M_PI + ar : ar;
+    bl = bl < 0 ? 2 * (float) M_PI + bl : bl;
+    br = br < 0 ? 2 * (float) M_PI + br : br;
+    if (al < ar) {
+        return angle_overlap(al, 0.0f, bl, br) + angle_overlap(2 * (float) M_PI, ar, bl, br);
+    } else if (bl < br) {
+        return angle_overlap(al, ar, bl, 0.0f) + angle_overlap(al, ar, 2 * (float) M_PI, br);
+    } else {
+        if (al > bl) {
+            if (ar > bl) return 0.0f;
+            else if (ar > br) return bl - ar;
+            else return bl - br;
+        } else {
+            if (br > al) return 0.0f;
+            else if (br > ar) return al - br;
+            else return al - ar;
+        }
+    }
+}
 
-    /* Current direction of the agent. */
-    direction current_direction;
+/**
+ * Computes the angles of the two tangent lines from the origin to the circle
+ * of diameter 1 centered at `(x, y)`.
+ */
+inline void circle_tangent_angles(float x, float y, float& left_angle, float& right_angle) {
+    const float dd = sqrt(x * x + y * y);
+    const float a = asin(0.5f / dd);
+    const float b = atan2(y, x);
+    left_angle = b + a;
+    right_angle = b - a;
+}
 
-    /* Scent at the current position. */
-    float* current_scent;
+/**
+ * Computes the left and right boundary angles of the field of view of an
+ * agent facing in direction `dir`.
+ */
+inline void field_of_view_angles(direction dir, float agent_field_of_view,
+        float& fov_left_angle, float& fov_right_angle)
+{
+    switch (dir) {
+    case direction::UP:
+        fov_left_angle = ((float) M_PI + agent_field_of_view) / 2;
+        fov_right_angle = ((float) M_PI - agent_field_of_view) / 2;
+        return;
+    case direction::DOWN:
+        fov_left_angle = -((float) M_PI - agent_field_of_view) / 2;
+        fov_right_angle = -((float) M_PI + agent_field_of_view) / 2;
+        return;
+    case direction::LEFT:
+        fov_left_angle = -((float) M_PI) + agent_field_of_view / 2;
+        fov_right_angle = (float) M_PI - agent_field_of_view / 2;
+        return;
+    case direction::RIGHT:
+        fov_left_angle = agent_field_of_view / 2;
+        fov_right_angle = -agent_field_of_view / 2;
+        return;
+    case direction::COUNT: break;
+    }
+    fov_left_angle = 0.0f;
+    fov_right_angle = 0.0f;
+}
 
-    /**
-     * Visual field at the current position. Consists of 'pixels'
-     * in row-major order, where each pixel is a contiguous chunk
-     * of D floats (where D is the color dimension).
-     */
-    float* current_vision;
+/**
+ * Precomputed geometry of the visual field, which depends only on the vision
+ * range and the field of view of the agents, and so is shared by all agents
+ * in a simulator. Cells of the visual field are indexed in (unrotated) world
+ * coordinates relative to the agent, where the cell at relative position
+ * `(x, y)` has index `(x + V)*(2*V + 1) + (y + V)` and `V` is the vision
+ * range.
+ */
+struct vision_tables {
+    unsigned int vision_range;
+    occlusion_method method;
 
-    /**
-     * If this is `true`, the simulator will wait for this agent
-     * to act before advancing the simulation.
-     */
-    bool agent_active;
+    /* The number of cells in the visual field, `(2*V + 1)^2`. */
+    unsigned int cell_count;
+
+    /* Whether the field of view is narrower than a full circle. */
+    bool limited_field_of_view;
 
     /**
-     * `true` if the agent has already acted (i.e., moved) in the
-     * current turn.
+     * The index of the pixel in the agent's (rotated) visual field that
+     * corresponds to each cell, for each direction. The entry for direction
+     * `d` and cell `c` is at index `d*cell_count + c`.
      */
-    bool agent_acted;
+    unsigned int* pixels;
+
+    /* The tangent angles of each cell, and the angle it subtends. */
+    float* cell_left_angles;
+    float* cell_right_angles;
+    float* cell_angles;
 
     /**
-     * The position which the agent requested to move this turn.
+     * The occlusion of each cell due to the agent's field of view, for each
+     * direction. The entry for direction `d` and cell `c` is at index
+     * `d*cell_count + c`.
      */
-    position requested_position;
+    float* fov_occlusion;
 
     /**
-     * The direction which the agent requested to rotate to this turn.
+     * The shadow of each occluder, which contains the cells that an item in
+     * the occluder's cell occludes (see `occluded_fraction`). The shadow of
+     * occluder `o` consists of the cells `shadow_cells[k]`, in increasing
+     * order, each occluded by the fraction `shadow_fractions[k]`, for `k`
+     * from `shadow_offsets[o]` to `shadow_offsets[o + 1] - 1`. Since a
+     * shadow only contains the cells within the occluder's angular extent,
+     * these tables hold O(V^3) entries, rather than the `cell_count^2` of a
+     * dense table.
      */
-    direction requested_direction;
+    unsigned int* shadow_offsets;
+    unsigned int* shadow_cells;
+    float* shadow_fractions;
 
-    /** Number of items of each type in the agent's storage. */
-    unsigned int* collected_items;
+    ~vision_tables() { free_helper(); }
+
+    inline unsigned int index_of(const position& relative_position) const {
+        return (unsigned int) ((relative_position.x + vision_range) * (2*vision_range + 1)
+                + (relative_position.y + vision_range));
+    }
 
     /**
-     * Lock used by the simulator to prevent simultaneous updates
-     * to an agent's state.
+     * Returns the fraction of `cell` occluded by an item in `occluder`, by
+     * a binary search of the shadow of `occluder`. This is used by the
+     * `PER_CELL` occlusion method.
      */
-    std::mutex lock;
-
-    inline void add_color(
-            position relative_position, unsigned int vision_range,
-            const float* color, unsigned int color_dimension)
-    {
-        switch (current_direction) {
-        case direction::UP: break;
-        case direction::DOWN:
-            relative_position.x *= -1;
-            relative_position.y *= -1;
-            break;
-        case direction::LEFT:
-            core::swap(relative_position.x, relative_position.y);
-            relative_position.y *= -1; break;
-        case direction::RIGHT:
-            core::swap(relative_position.x, relative_position.y);
-            relative_position.x *= -1; break;
-        case direction::COUNT: break;
-        }
-        unsigned int x = (unsigned int) (relative_position.x + vision_range);
-        unsigned int y = (unsigned int) (relative_position.y + vision_range);
-        unsigned int offset = (x*(2*vision_range + 1) + y) * color_dimension;
-        for (unsigned int i = 0; i < color_dimension; i++)
-            current_vision[offset + i] += color[i];
+    inline float shadow_fraction(unsigned int occluder, unsigned int cell) const {
+        unsigned int begin = shadow_offsets[occluder];
+        unsigned int end = shadow_offsets[occluder + 1];
+        while (begin < end) {
+            unsigned int mid = begin + (end - begin) / 2;
+            if (shadow_cells[mid] < cell) begin = mid + 1;
+            else end = mid;
+        }
+        if (begin < shadow_offsets[occluder + 1] && shadow_cells[begin] == cell)
+            return shadow_fractions[begin];
+        return 0.0f;
     }
 
-    inline void occlude_color(
-            position relative_position, unsigned int vision_range,
-            unsigned int color_dimension, const float occlusion)
-    {
-        switch (current_direction) {
-        case direction::UP: break;
-        case direction::DOWN:
-            relative_position.x *= -1;
-            relative_position.y *= -1;
-            break;
-        case direction::LEFT:
-            core::swap(relative_position.x, relative_position.y);
-            relative_position.y *= -1; break;
-        case direction::RIGHT:
-            core::swap(relative_position.x, relative_position.y);
-            relative_position.x *= -1; break;
-        case direction::COUNT: break;
-        }
-        unsigned int x = (unsigned int) (relative_position.x + vision_range);
-        unsigned int y = (unsigned int) (relative_position.y + vision_range);
-        unsigned int offset = (x*(2*vision_range + 1) + y) * color_dimension;
-        for (unsigned int i = 0; i < color_dimension; i++)
-            current_vision[offset + i] = current_vision[offset + i] * (1.0f - occlusion);
+    static inline void free(vision_tables& tables) {
+        tables.free_helper();
     }
 
-    template<typename T>
-    inline void update_state(
-            patch<patch_data>* neighborhood[4],
-            const diffusion<T>& scent_model,
-            const simulator_config& config,
-            uint64_t current_time)
-    {
-        /* first zero out both current scent and vision */
-        for (unsigned int i = 0; i < config.scent_dimension; i++)
-            current_scent[i] = 0.0f;
-        for (unsigned int i = 0; i < (2*config.vision_range + 1) * (2*config.vision_range + 1) * config.color_dimension; i++)
-            current_vision[i] = 0.0f;
+private:
+    inline void free_helper() {
+        core::free(pixels);
+        core::free(cell_left_angles);
+        core::free(cell_right_angles);
+        core::free(cell_angles);
+        core::free(fov_occlusion);
+        core::free(shadow_offsets);
+        core::free(shadow_cells);
+        core::free(shadow_fractions);
+    }
+};
 
-        array<item> visual_field_items(16);
+/**
+ * Computes the fraction of the cell at `cell_position` that is occluded by an
+ * item at `occluder_position`, clamped to [0, 1], using the angles in the
+ * given vision_tables `tables`.
+ */
+inline float occluded_fraction(const vision_tables& tables,
+        const position& cell_position, const position& occluder_position)
+{
+    if ((cell_position.x == 0 && cell_position.y == 0)
+     || (occluder_position.x == 0 && occluder_position.y == 0))
+        return 0.0f;
+    const float distance = (float) cell_position.squared_length();
+    float occluder_distance = (float) occluder_position.squared_length();
+    if (occluder_distance + 1.0f > distance) return 0.0f;
+
+    const unsigned int cell = tables.index_of(cell_position);
+    const unsigned int occluder = tables.index_of(occluder_position);
+    float overlap = angle_overlap(
+        tables.cell_left_angles[occluder], tables.cell_right_angles[occluder],
+        tables.cell_left_angles[cell], tables.cell_right_angles[cell]);
+    return max(0.0f, min(1.0f, overlap / tables.cell_angles[cell]));
+}
 
-        for (unsigned int i = 0; i < 4; i++) {
-            /* iterate over neighboring items, and add their contributions to scent and vision */
-            for (unsigned int j = 0; j < neighborhood[i]->items.length; j++) {
-                const item& item = neighborhood[i]->items[j];
+/**
+ * Initializes the given vision_tables `tables` for the given vision range,
+ * field of view, and occlusion method.
+ */
+inline bool init(vision_tables& tables, unsigned int vision_range,
+        float agent_field_of_view, occlusion_method method)
+{
+    const int64_t V = (int64_t) vision_range;
+    const unsigned int cell_count = (2*vision_range + 1) * (2*vision_range + 1);
+    tables.vision_range = vision_range;
+    tables.method = method;
+    tables.cell_count = cell_count;
+    tables.limited_field_of_view = (agent_field_of_view < 2 * M_PI - 1e-3f);
+
+    tables.pixels = (unsigned int*) malloc(sizeof(unsigned int) * (size_t) direction::COUNT * cell_count);
+    if (tables.pixels == NULL) {
+        fprintf(stderr, "init ERROR: Insufficient memory for vision_tables.pixels.\n");
+        return false;
+    }
+    tables.cell_left_angles = (float*) malloc(sizeof(float) * cell_count);
+    if (tables.cell_left_angles == NULL) {
+        fprintf(stderr, "init ERROR: Insufficient memory for vision_tables.cell_left_angles.\n");
+        free(tables.pixels); return false;
+    }
+    tables.cell_right_angles = (float*) malloc(sizeof(float) * cell_count);
+    if (tables.cell_right_angles == NULL) {
+        fprintf(stderr, "init ERROR: Insufficient memory for vision_tables.cell_right_angles.\n");
+        free(tables.pixels); free(tables.cell_left_angles);
+        return false;
+    }
+    tables.cell_angles = (float*) malloc(sizeof(float) * cell_count);
+    if (tables.cell_angles == NULL) {
+        fprintf(stderr, "init ERROR: Insufficient memory for vision_tables.cell_angles.\n");
+        free(tables.pixels); free(tables.cell_left_angles); free(tables.cell_right_angles);
+        return false;
+    }
+    tables.fov_occlusion = (float*) calloc((size_t) direction::COUNT * cell_count, sizeof(float));
+    if (tables.fov_occlusion == NULL) {
+        fprintf(stderr, "init ERROR: Insufficient memory for vision_tables.fov_occlusion.\n");
+        free(tables.pixels); free(tables.cell_left_angles); free(tables.cell_right_angles);
+        free(tables.cell_angles); return false;
+    }
 
-                /* check if the item is too old; if so, delete it */
-                if (item.deletion_time > 0 && current_time >= item.deletion_time + config.deleted_item_lifetime) {
-                    neighborhood[i]->items.remove(j); j--; continue;
+    /* compute the pixel corresponding to each cell, for each direction */
+    for (unsigned int d = 0; d < (unsigned int) direction::COUNT; d++) {
+        for (int64_t i = -V; i <= V; i++) {
+            for (int64_t j = -V; j <= V; j++) {
+                position rotated = { i, j };
+                switch ((direction) d) {
+                case direction::UP: break;
+                case direction::DOWN:
+                    rotated.x *= -1;
+                    rotated.y *= -1;
+                    break;
+                case direction::LEFT:
+                    core::swap(rotated.x, rotated.y);
+                    rotated.y *= -1; break;
+                case direction::RIGHT:
+                    core::swap(rotated.x, rotated.y);
+                    rotated.x *= -1; break;
+                case direction::COUNT: break;
                 }
-
-                compute_scent_contribution(scent_model, item, current_position, current_time, config, current_scent);
-
-                /* if the item is in the visual field, add its color to the appropriate pixel */
-                position relative_position = item.location - current_position;
-                if (item.deletion_time == 0
-                 && (unsigned int) abs(relative_position.x) <= config.vision_range
-                 && (unsigned int) abs(relative_position.y) <= config.vision_range) {
-                    visual_field_items.add(item);
-                    add_color(
-                        relative_position, config.vision_range,
-                        config.item_types[item.item_type].color,
-                        config.color_dimension);
-                 }
+                tables.pixels[(size_t) d * cell_count + tables.index_of({i, j})] = tables.index_of(rotated);
             }
+        }
+    }
 
-            /* iterate over neighboring agents, and add their contributions to scent and vision */
-            for (agent_state* agent : neighborhood[i]->data.agents) {
-                /* compute neighbor position in agent coordinates */
-                position relative_position = agent->current_position - current_position;
-
-                /* if the neighbor is in the visual field, add its color to the appropriate pixel */
-                if ((unsigned int) abs(relative_position.x) <= config.vision_range
-                 && (unsigned int) abs(relative_position.y) <= config.vision_range) {
-                    add_color(
-                        relative_position, config.vision_range,
-                        config.agent_color, config.color_dimension);
-                }
+    /* compute the angular extent of each cell */
+    const unsigned int origin = tables.index_of({0, 0});
+    for (int64_t i = -V; i <= V; i++) {
+        for (int64_t j = -V; j <= V; j++) {
+            const unsigned int cell = tables.index_of({i, j});
+            if (cell == origin) {
+                tables.cell_left_angles[cell] = 0.0f;
+                tables.cell_right_angles[cell] = 0.0f;
+                tables.cell_angles[cell] = 0.0f;
+                continue;
             }
+            circle_tangent_angles((float) i, (float) j,
+                tables.cell_left_angles[cell], tables.cell_right_angles[cell]);
+            tables.cell_angles[cell] = abs(tables.cell_left_angles[cell] - tables.cell_right_angles[cell]);
         }
+    }
 
-        /* Compute the agent's field of view. */
-        float fov_left_angle = 0.0f;
-        float fov_right_angle = 0.0f;
-        switch (current_direction) {
-        case direction::UP:
-            fov_left_angle = ((float) M_PI + config.agent_field_of_view) / 2;
-            fov_right_angle = ((float) M_PI - config.agent_field_of_view) / 2;
-            break;
-        case direction::DOWN:
-            fov_left_angle = -((float) M_PI - config.agent_field_of_view) / 2;
-            fov_right_angle = -((float) M_PI + config.agent_field_of_view) / 2;
-            break;
-        case direction::LEFT:
-            fov_left_angle = -((float) M_PI) + config.agent_field_of_view / 2;
-            fov_right_angle = (float) M_PI - config.agent_field_of_view / 2;
-            break;
-        case direction::RIGHT:
-            fov_left_angle = config.agent_field_of_view / 2;
-            fov_right_angle = -config.agent_field_of_view / 2;
-            break;
-        case direction::COUNT: return;
-        }
-
-        auto circle_tangent_angles = [](float x, float y, float& left_angle, float& right_angle) {
-            const float dd = sqrt(x * x + y * y);
-            const float a = asin(0.5f / dd);
-            const float b = atan2(y, x);
-            left_angle = b + a;
-            right_angle = b - a;
-        };
-
-        /* Apply visual occlusion. */
-        int64_t V = (int64_t) config.vision_range;
-        for (int64_t i = -V; i <= V; i++) {
-            const float cell_x = (float) i;
-            for (int64_t j = -V; j <= V; j++) {
-                if (i == 0 && j == 0) continue;
-                const float cell_y = (float) j;
-                const position relative_position = { i, j };
-                const float distance = (float) relative_position.squared_length();
-                float cell_left_angle, cell_right_angle;
-                circle_tangent_angles(cell_x, cell_y, cell_left_angle, cell_right_angle);
-                const float cell_angle = abs(cell_left_angle - cell_right_angle);
+    /* compute the occlusion due to the field of view in each direction */
+    if (tables.limited_field_of_view) {
+        for (unsigned int d = 0; d < (unsigned int) direction::COUNT; d++) {
+            float fov_left_angle, fov_right_angle;
+            field_of_view_angles((direction) d, agent_field_of_view, fov_left_angle, fov_right_angle);
+            float* fov_occlusion = tables.fov_occlusion + (size_t) d * cell_count;
+            for (unsigned int cell = 0; cell < cell_count; cell++) {
+                if (cell == origin) continue;
+                float overlap = angle_overlap(
+                    fov_left_angle, fov_right_angle,
+                    tables.cell_left_angles[cell], tables.cell_right_angles[cell]);
+                fov_occlusion[cell] = 1.0f - min(1.0f, overlap / tables.cell_angles[cell]);
+            }
+        }
+    }
 
-                /* Check if this cell is outside the agent's field of view. */
-                if (config.agent_field_of_view < 2 * M_PI - 1e-3f) {
-                    float overlap = angle_overlap(
-                        fov_left_angle, fov_right_angle,
-                        cell_left_angle, cell_right_angle);
-                    const float occlusion = 1.0f - min(1.0f, overlap / cell_angle);
-                    occlude_color(
-                        relative_position, config.vision_range,
-                        config.color_dimension, occlusion);
-                    if (occlusion == 1.0f) continue;
-                }
+    tables.shadow_offsets = (unsigned int*) malloc(sizeof(unsigned int) * (cell_count + 1));
+    if (tables.shadow_offsets == NULL) {
+        fprintf(stderr, "init ERROR: Insufficient memory for vision_tables.shadow_offsets.\n");
+        free(tables.pixels); free(tables.cell_left_angles); free(tables.cell_right_angles);
+        free(tables.cell_angles); free(tables.fov_occlusion);
+        return false;
+    }
 
-                /* Check if this cell is occluded by any items. */
-                float occlusion = 0.0f;
-                for (item& item : visual_field_items) {
-                    const position relative_location = item.location - current_position;
-                    if (relative_location.x == 0 && relative_location.y == 0) continue;
-                    float item_distance = (float) relative_location.squared_length();
-                    if (item_distance + 1.0f > distance) continue;
-
-                    const float x = (float) relative_location.x;
-                    const float y = (float) relative_location.y;
-                    float left_angle, right_angle;
-                    circle_tangent_angles(x, y, left_angle, right_angle);
-
-                    float overlap = angle_overlap(
-                        left_angle, right_angle,
-                        cell_left_angle, cell_right_angle);
-                    const float scaling_factor = max(0.0f, min(1.0f, overlap / cell_angle));
-                    occlusion += config.item_types[item.item_type].visual_occlusion * scaling_factor;
+    /* compute the shadow of each occluder `o`. A cell `c` can only be in the
+       shadow if it is further from the agent than `o`, and if the angle
+       between them is less than the sum of their angular radii, which are
+       at most 30 degrees. Thus, `|o.x*c.y - o.y*c.x|`, which is `|o|` times
+       the distance of `c` from the line through `o`, is less than
+       `(|o| + |c|) / 2`, and so we only visit the cells in this band, of
+       which there are O(V^2 / |o|) */
+    array<unsigned int> shadow_cells(max(16u, cell_count));
+    array<float> shadow_fractions(max(16u, cell_count));
+    unsigned int shadow_size = 0;
+    const float max_cell_length = sqrt(2.0f) * V;
+    for (int64_t x = -V; x <= V; x++) {
+        for (int64_t y = -V; y <= V; y++) {
+            tables.shadow_offsets[tables.index_of({x, y})] = shadow_size;
+            if (x == 0 && y == 0) continue;
+            const float occluder_length = sqrt((float) (x * x + y * y));
+            const float band_width = 0.5f * (occluder_length + max_cell_length) + 1.0f;
+            for (int64_t i = -V; i <= V; i++) {
+                /* the cells in the band in this column, in increasing order */
+                int64_t min_j = -V, max_j = V;
+                if (x != 0) {
+                    float first = ((float) (y * i) - band_width) / x;
+                    float second = ((float) (y * i) + band_width) / x;
+                    min_j = max(-V, (int64_t) floor(min(first, second)));
+                    max_j = min(V, (int64_t) ceil(max(first, second)));
+                } else if (abs((float) (y * i)) > band_width) {
+                    continue;
                 }
-                if (occlusion > 0.0f) {
-                    occlude_color(
-                        relative_position, config.vision_range,
-                        config.color_dimension, min(1.0f, occlusion));
+                for (int64_t j = min_j; j <= max_j; j++) {
+                    const float cell_length = sqrt((float) (i * i + j * j));
+                    if (cell_length <= occluder_length || x * i + y * j <= 0
+                     || abs((float) (x * j - y * i)) > 0.5f * (occluder_length + cell_length) + 1.0f)
+                        continue;
+                    float fraction = occluded_fraction(tables, {i, j}, {x, y});
+                    if (fraction == 0.0f) continue;
+                    if (!shadow_cells.add(tables.index_of({i, j})) || !shadow_fractions.add(fraction)) {
+                        fprintf(stderr, "init ERROR: Insufficient memory for the shadows in vision_tables.\n");
+                        free(tables.pixels); free(tables.cell_left_angles); free(tables.cell_right_angles);
+                        free(tables.cell_angles); free(tables.fov_occlusion);
+                        free(tables.shadow_offsets); return false;
+                    }
+                    shadow_size++;
                 }
             }
         }
     }
-
-    /** Frees all allocated memory associated with this agent state. */
-    inline static void free(agent_state& agent) {
-        core::free(agent.current_scent);
-        core::free(agent.current_vision);
-        core::free(agent.collected_items);
-        agent.lock.~mutex();
-    }
-
-    /** Removes this agent from the world and frees all allocated memory. */
-    template<typename T>
-    inline static void free(agent_state& agent,
-            map<patch_data, item_properties>& world,
-            const diffusion<T>& scent_model,
-            const simulator_config& config,
-            uint64_t& current_time)
-    {
-        patch<patch_data>* neighborhood[4]; position patch_positions[4];
-        unsigned int index = world.get_fixed_neighborhood(agent.current_position, neighborhood, patch_positions);
-        neighborhood[index]->data.patch_lock.lock();
-        unsigned j = neighborhood[index]->data.agents.index_of(&agent);
-        neighborhood[index]->data.agents.remove(j);
-        neighborhood[index]->data.patch_lock.unlock();
-
-        /* update the scent and vision of nearby agents */
-        for (unsigned int i = 0; i < 4; i++) {
-            for (agent_state* neighbor : neighborhood[i]->data.agents) {
-                if (neighbor == &agent) continue;
-
-                patch<patch_data>* other_neighborhood[4];
-                world.get_fixed_neighborhood(neighbor->current_position, other_neighborhood, patch_positions);
-                neighbor->update_state(other_neighborhood, scent_model, config, current_time);
-            }
-        }
-
-        free(agent);
+    tables.shadow_offsets[cell_count] = shadow_size;
+
+    tables.shadow_cells = (unsigned int*) malloc(sizeof(unsigned int) * max(1u, shadow_size));
+    if (tables.shadow_cells == NULL) {
+        fprintf(stderr, "init ERROR: Insufficient memory for vision_tables.shadow_cells.\n");
+        free(tables.pixels); free(tables.cell_left_angles); free(tables.cell_right_angles);
+        free(tables.cell_angles); free(tables.fov_occlusion);
+        free(tables.shadow_offsets); return false;
     }
-
-private:
-    static inline float angle_overlap(float al, float ar, float bl, float br) {
-        al = al < 0 ? 2 * (float) M_PI + al : al;
-        ar = ar < 0 ? 2 * (float) M_PI + ar : ar;
-        bl = bl < 0 ? 2 * (float) M_PI + bl : bl;
-        br = br < 0 ? 2 * (float) M_PI + br : br;
-        if (al < ar) {
-            return angle_overlap(al, 0.0f, bl, br) + angle_overlap(2 * (float) M_PI, ar, bl, br);
-        } else if (bl < br) {
-            return angle_overlap(al, ar, bl, 0.0f) + angle_overlap(al, ar, 2 * (float) M_PI, br);
-        } else {
-            if (al > bl) {
-                if (ar > bl) return 0.0f;
-                else if (ar > br) return bl - ar;
-                else return bl - br;
-            } else {
-                if (br > al) return 0.0f;
-                else if (br > ar) return al - br;
-                else return al - ar;
-            }
-        }
+    tables.shadow_fractions = (float*) malloc(sizeof(float) * max(1u, shadow_size));
+    if (tables.shadow_fractions == NULL) {
+        fprintf(stderr, "init ERROR: Insufficient memory for vision_tables.shadow_fractions.\n");
+        free(tables.pixels); free(tables.cell_left_angles); free(tables.cell_right_angles);
+        free(tables.cell_angles); free(tables.fov_occlusion);
+        free(tables.shadow_offsets); free(tables.shadow_cells);
+        return false;
     }
-};
+    memcpy(tables.shadow_cells, shadow_cells.data, sizeof(unsigned int) * shadow_size);
+    memcpy(tables.shadow_fractions, shadow_fractions.data, sizeof(float) * shadow_size);
+    return true;
+}
 
 /**
- * Initializes an agent's state in the provided world.
- *
- * \param   agent_state     Agent state to initialize.
- * \param   world           Map of the world in which the agent is initialized.
- * \param   scent_model     The scent diffusion model.
- * \param   config          The configuration for this simulation.
- * \param   current_time    The current simulation time.
- *
- * \tparam  T               The arithmetic type for the scent diffusion model.
+ * The scratch memory used by `agent_state::update_state` to compute the
+ * visual occlusion of an agent: the cells of the visual field that contain
+ * occluding items, and the shadows that they cast (for the `SHADOW_CASTING`
+ * occlusion method). These are allocated once for each thread that computes
+ * observations (see `worker_occlusion_buffers`), so that computing an
+ * observation does not allocate memory.
  */
-template<typename T>
-inline status init(
-        agent_state& agent,
-        map<patch_data, item_properties>& world,
-        const diffusion<T>& scent_model,
-        const simulator_config& config,
-        uint64_t& current_time)
-{
-    agent.current_position = {0, 0};
-    agent.current_direction = direction::UP;
-    agent.requested_position = {0, 0};
-    agent.requested_direction = direction::UP;
-    agent.current_scent = (float*) malloc(sizeof(float) * config.scent_dimension);
-    if (agent.current_scent == NULL) {
-        fprintf(stderr, "init ERROR: Insufficient memory for agent_state.current_scent.\n");
-        return status::OUT_OF_MEMORY;
-    }
-    agent.current_vision = (float*) malloc(sizeof(float)
-        * (2*config.vision_range + 1) * (2*config.vision_range + 1) * config.color_dimension);
-    if (agent.current_vision == NULL) {
-        fprintf(stderr, "init ERROR: Insufficient memory for agent_state.current_vision.\n");
-        free(agent.current_scent); return status::OUT_OF_MEMORY;
-    }
-    agent.collected_items = (unsigned int*) calloc(config.item_types.length, sizeof(unsigned int));
-    if (agent.collected_items == NULL) {
-        fprintf(stderr, "init ERROR: Insufficient memory for agent_state.collected_items.\n");
-        free(agent.current_scent); free(agent.current_vision); return status::OUT_OF_MEMORY;
-    }
-
-    agent.agent_acted = false;
-    agent.agent_active = true;
-    new (&agent.lock) std::mutex();
-
-    patch<patch_data>* neighborhood[4]; position patch_positions[4];
-    world.mcmc_iterations *= 10; /* TODO: should this be configurable? */
-    unsigned int index = world.get_fixed_neighborhood(
-        agent.current_position, neighborhood, patch_positions);
-    world.mcmc_iterations /= 10;
-    neighborhood[index]->data.patch_lock.lock();
-    if (config.collision_policy != movement_conflict_policy::NO_COLLISIONS) {
-        for (const agent_state* neighbor : neighborhood[index]->data.agents) {
-            if (agent.current_position == neighbor->current_position)
-            {
-                /* there is already an agent at this position */
-                FILE* out = stderr;
-                core::print("init ERROR: An agent already occupies position ", out);
-                print(agent.current_position, out); core::print(".\n", out);
-                free(agent.current_scent); free(agent.current_vision);
-                free(agent.collected_items); agent.lock.~mutex();
-                neighborhood[index]->data.patch_lock.unlock();
-                return status::AGENT_ALREADY_EXISTS;
-            }
-        }
-    }
-    neighborhood[index]->data.agents.add(&agent);
-    neighborhood[index]->data.patch_lock.unlock();
+struct occlusion_buffers {
+    /* The cells of the visual field containing occluding items, and their occlusion. */
+    array<pair<unsigned int, float>> occluders;
 
-    /* initialize the scent and vision of the current agent */
-    agent.update_state(neighborhood, scent_model, config, current_time);
+    /* The occlusion of each cell of the visual field. */
+    float* shadows;
 
-    /* update the scent and vision of nearby agents */
-    for (unsigned int i = 0; i < 4; i++) {
-        for (agent_state* neighbor : neighborhood[i]->data.agents) {
-            if (neighbor == &agent) continue;
-            patch<patch_data>* other_neighborhood[4];
-            world.get_fixed_neighborhood(
-                neighbor->current_position, other_neighborhood, patch_positions);
-            neighbor->update_state(other_neighborhood, scent_model, config, current_time);
-        }
+    static inline void free(occlusion_buffers& buffers) {
+        core::free(buffers.occluders);
+        core::free(buffers.shadows);
     }
-    return status::OK;
-}
+};
 
-/**
- * Reads the given agent_state `agent` from the input stream `in`. 
- */
-template<typename Stream>
-inline bool read(agent_state& agent, Stream& in, const simulator_config& config)
-{
-    agent.current_scent = (float*) malloc(sizeof(float) * config.scent_dimension);
-    if (agent.current_scent == NULL) {
-        fprintf(stderr, "read ERROR: Insufficient memory for agent_state.current_scent.\n");
+inline bool init(occlusion_buffers& buffers, unsigned int cell_count) {
+    if (!array_init(buffers.occluders, cell_count)) {
+        fprintf(stderr, "init ERROR: Insufficient memory for occlusion_buffers.occluders.\n");
         return false;
     }
-    agent.current_vision = (float*) malloc(sizeof(float)
-        * (2*config.vision_range + 1) * (2*config.vision_range + 1) * config.color_dimension);
-    if (agent.current_vision == NULL) {
-        fprintf(stderr, "read ERROR: Insufficient memory for agent_state.current_vision.\n");
-        free(agent.current_scent); return false;
-    }
-    agent.collected_items = (unsigned int*) malloc(sizeof(unsigned int) * config.item_types.length);
-    if (agent.collected_items == NULL) {
-        fprintf(stderr, "read ERROR: Insufficient memory for agent_state.collected_items.\n");
-        free(agent.current_scent); free(agent.current_vision); return false;
+    buffers.shadows = (float*) calloc(cell_count, sizeof(float));
+    if (buffers.shadows == NULL) {
+        fprintf(stderr, "init ERROR: Insufficient memory for occlusion_buffers.shadows.\n");
+        core::free(buffers.occluders); return false;
     }
-    new (&agent.lock) std::mutex();
-
-    if (!read(agent.current_position, in)
-     || !read(agent.current_direction, in)
-     || !read(agent.current_scent, in, config.scent_dimension)
-     || !read(agent.current_vision, in, (2*config.vision_range + 1) * (2*config.vision_range + 1) * config.color_dimension)
-     || !read(agent.agent_acted, in)
-     || !read(agent.agent_active, in)
-     || !read(agent.requested_position, in)
-     || !read(agent.requested_direction, in)
-     || !read(agent.collected_items, in, (unsigned int) config.item_types.length))
-    {
-         free(agent.current_scent); free(agent.current_vision);
-         free(agent.collected_items); return false;
-     }
-     return true;
+    return true;
 }
 
 /**
- * Writes the given agent_state `agent` to the output stream `out`. 
+ * The occlusion_buffers of each thread of a simulator's `thread_pool`,
+ * indexed by the thread ID. The buffers of thread 0, which is the calling
+ * thread, are also used outside of `simulator::step` while holding the
+ * simulator lock, such as when adding or removing agents.
  */
-template<typename Stream>
-inline bool write(const agent_state& agent, Stream& out, const simulator_config& config)
-{
-    return write(agent.current_position, out)
-        && write(agent.current_direction, out)
-        && write(agent.current_scent, out, config.scent_dimension)
-        && write(agent.current_vision, out, (2*config.vision_range + 1) * (2*config.vision_range + 1) * config.color_dimension)
-        && write(agent.agent_acted, out)
-        && write(agent.agent_active, out)
-        && write(agent.requested_position, out)
-        && write(agent.requested_direction, out)
-        && write(agent.collected_items, out, (unsigned int) config.item_types.length);
-}
+struct worker_occlusion_buffers {
+    occlusion_buffers* buffers;
+    unsigned int thread_count;
 
-/**
- * This structure contains full information about a patch. This is more than we
- * need for simulation, but it is useful for visualization.
- */
-struct patch_state {
-    position patch_position;
-    bool fixed;
-    float* scent;
-    float* vision;
-    item* items;
-    unsigned int item_count;
-    position* agent_positions;
-    direction* agent_directions;
-    unsigned int agent_count;
+    worker_occlusion_buffers(unsigned int thread_count, unsigned int cell_count) {
+        if (!init_helper(thread_count, cell_count))
+            exit(EXIT_FAILURE);
+    }
 
-    static inline void move(const patch_state& src, patch_state& dst) {
-        core::move(src.patch_position, dst.patch_position);
-        core::move(src.fixed, dst.fixed);
-        core::move(src.scent, dst.scent);
-        core::move(src.vision, dst.vision);
-        core::move(src.items, dst.items);
-        core::move(src.item_count, dst.item_count);
-        core::move(src.agent_positions, dst.agent_positions);
-        core::move(src.agent_directions, dst.agent_directions);
-        core::move(src.agent_count, dst.agent_count);
+    ~worker_occlusion_buffers() { free_helper(); }
+
+    inline occlusion_buffers& operator [] (unsigned int thread_id) {
+        return buffers[thread_id];
     }
 
-    static inline void free(patch_state& patch) {
-        if (patch.scent != nullptr)
-            core::free(patch.scent);
-        if (patch.vision != nullptr)
-            core::free(patch.vision);
-        core::free(patch.items);
-        core::free(patch.agent_positions);
-        core::free(patch.agent_directions);
+    static inline void free(worker_occlusion_buffers& worker_buffers) {
+        worker_buffers.free_helper();
     }
 
-    template<bool InitializeScent, bool InitializeVision>
-    inline bool init_helper(unsigned int n,
-            unsigned int scent_dimension, unsigned int color_dimension,
-            unsigned int item_count, unsigned int agent_count)
-    {
-        if (InitializeScent) {
-            scent = (float*) calloc(n * n * scent_dimension, sizeof(float));
-            if (scent == NULL) {
-                fprintf(stderr, "patch_state.init_helper ERROR: Insufficient memory for scent.\n");
-                return false;
-            }
-        } else {
-            scent = nullptr;
+private:
+    inline bool init_helper(unsigned int new_thread_count, unsigned int cell_count) {
+        thread_count = max(1u, new_thread_count);
+        buffers = (occlusion_buffers*) malloc(sizeof(occlusion_buffers) * thread_count);
+        if (buffers == NULL) {
+            fprintf(stderr, "worker_occlusion_buffers.init_helper ERROR: Insufficient memory for buffers.\n");
+            return false;
         }
-        if (InitializeVision) {
-            vision = (float*) calloc(n * n * color_dimension, sizeof(float));
-            if (vision == NULL) {
-                fprintf(stderr, "patch_state.init_helper ERROR: Insufficient memory for vision.\n");
-                if (InitializeScent) core::free(scent);
+        for (unsigned int i = 0; i < thread_count; i++) {
+            if (!init(buffers[i], cell_count)) {
+                for (unsigned int j = 0; j < i; j++)
+                    core::free(buffers[j]);
+                core::free(buffers);
                 return false;
             }
-        } else {
-            vision = nullptr;
-        }
-        items = (item*) malloc(sizeof(item) * item_count);
-        if (items == NULL) {
-            fprintf(stderr, "patch_state.init_helper ERROR: Insufficient memory for items.\n");
-            if (InitializeScent) core::free(scent);
-            if (InitializeVision) core::free(vision);
-            return false;
-        }
-        agent_positions = (position*) malloc(sizeof(position) * agent_count);
-        if (agent_positions == NULL) {
-            fprintf(stderr, "patch_state.init_helper ERROR: Insufficient memory for agent_positions.\n");
-            if (InitializeScent) core::free(scent);
-            if (InitializeVision) core::free(vision);
-            core::free(items); return false;
-        }
-        agent_directions = (direction*) malloc(sizeof(direction) * agent_count);
-        if (agent_directions == NULL) {
-            fprintf(stderr, "patch_state.init_helper ERROR: Insufficient memory for agent_directions.\n");
-            if (InitializeScent) core::free(scent);
-            if (InitializeVision) core::free(vision);
-            core::free(items); core::free(agent_positions);
-            return false;
         }
         return true;
     }
+
+    inline void free_helper() {
+        for (unsigned int i = 0; i < thread_count; i++)
+            core::free(buffers[i]);
+        core::free(buffers);
+    }
+
+    friend bool init(worker_occlusion_buffers&, unsigned int, unsigned int);
 };
 
+inline bool init(worker_occlusion_buffers& worker_buffers,
+        unsigned int thread_count, unsigned int cell_count)
+{
+    return worker_buffers.init_helper(thread_count, cell_count);
+}
+
 /**
- * Initializes the memory of the given patch_state `patch`. This function does
- * not initialize the contents of any of the fields, except for `scent` and
- * `vision`, which are initialized to zeros.
+ * Returns the number of floats between the starts of consecutive observations
+ * of an agent in its `agent_store`: the scent followed by the visual field,
+ * rounded up to a whole number of 64-byte cache lines.
  */
-template<bool InitializeScent, bool InitializeVision>
-inline bool init(patch_state& patch, unsigned int n,
-        unsigned int scent_dimension, unsigned int color_dimension,
-        unsigned int item_count, unsigned int agent_count)
-{
-    patch.item_count = item_count;
-    patch.agent_count = agent_count;
-    return patch.init_helper<InitializeScent, InitializeVision>(n, scent_dimension, color_dimension, item_count, agent_count);
+inline size_t observation_stride(const simulator_config& config) {
+    const size_t floats_per_line = 64 / sizeof(float);
+    const size_t vision_size = (size_t) (2*config.vision_range + 1)
+            * (2*config.vision_range + 1) * config.color_dimension;
+    return (config.scent_dimension + vision_size + floats_per_line - 1) / floats_per_line * floats_per_line;
 }
 
 /**
- * Reads the given patch_state `patch` from the input stream `in`.
+ * Returns the number of observations in the ring that stores the last
+ * `history_length` observations of an agent (see `agent_state::history`).
  */
-template<typename Stream>
-bool read(patch_state& patch, Stream& in, const simulator_config& config) {
-    bool has_scent, has_vision;
-    unsigned int n = config.patch_size;
-    if (!read(patch.patch_position, in) || !read(patch.fixed, in)
-     || !read(patch.item_count, in) || !read(patch.agent_count, in)
-     || !read(has_scent, in) || !read(has_vision, in)) return false;
+inline unsigned int history_slot_count(unsigned int history_length) {
+    return 2 * history_length;
+}
 
-    if (has_scent) {
-        if (has_vision) {
-            if (!patch.init_helper<true, true>(n, config.scent_dimension, config.color_dimension, patch.item_count, patch.agent_count)
-             || !read(patch.scent, in, n * n * config.scent_dimension)
-             || !read(patch.vision, in, n * n * config.color_dimension))
-                return false;
-        } else {
-            if (!patch.init_helper<true, false>(n, config.scent_dimension, config.color_dimension, patch.item_count, patch.agent_count)
-             || !read(patch.scent, in, n * n * config.scent_dimension))
-                return false;
-        }
-    } else {
-        if (has_vision) {
-            if (!patch.init_helper<false, true>(n, config.scent_dimension, config.color_dimension, patch.item_count, patch.agent_count)
-             || !read(patch.vision, in, n * n * config.color_dimension))
-                return false;
+/** Represents the state of an agent in the simulator. */
+struct agent_state {
+    /* Current position of the agent. */
+    position current_position;
+
+    /* Current direction of the agent. */
+    direction current_direction;
+
+    /* Scent at the current position. */
+    float* current_scent;
+
+    /**
+     * Visual field at the current position. Consists of 'pixels'
+     * in row-major order, where each pixel is a contiguous chunk
+     * of D floats (where D is the color dimension).
+     */
+    float* current_vision;
+
+    /**
+     * Buffers into which the scent and visual field are computed during a
+     * time step. They are swapped with `current_scent` and `current_vision`
+     * once computed, so that readers can access the observations of the
+     * last completed time step while the next ones are computed.
+     */
+    float* next_scent;
+    float* next_vision;
+
+    /**
+     * Incremented before and after `current_scent` and `current_vision` are
+     * swapped with the next buffers (or moved by `relocate_observations`), so
+     * it is odd while they are being modified. `get_observation` uses this to
+     * copy the last published observations without locking.
+     */
+    std::atomic<uint64_t> observation_epoch;
+
+    /**
+     * Once the agent is added to an `agent_store`, its observations are kept
+     * in a ring of `history_length + 1` observations, each of
+     * `observation_stride(config)` floats, in which `history_head` is the
+     * index of the current observation, and the next one is computed into
+     * the following index. So that the last `history_length` observations
+     * are always contiguous, the first `history_length - 1` observations in
+     * the ring are mirrored after its end, giving `history_slot_count`
+     * observations in total. Before the agent is added to a store, `history`
+     * is `nullptr`, and the current and next observations are separate
+     * allocations.
+     */
+    float* history;
+    unsigned int history_head;
+
+    /**
+     * The index of this agent in the simulator's `agent_store`, which also
+     * determines where its observation buffers are stored.
+     */
+    unsigned int store_index;
+
+    enum : uint8_t {
+        /* the agent has not yet acted in the current turn */
+        ACTION_IDLE = 0,
+        /* an action is being written to `requested_position` and `requested_direction` */
+        ACTION_SUBMITTING = 1,
+        /* the agent has acted in the current turn */
+        ACTION_SUBMITTED = 2,
+        /* the simulator is applying the agent's action */
+        ACTION_APPLYING = 3,
+        ACTION_MASK = 3,
+
+        /* the simulator will wait for this agent to act before advancing the simulation */
+        ACTIVE = 4,
+
+        /* the action was counted in `simulator::acted_agent_count` */
+        ACTION_COUNTED = 8
+    };
+
+    /**
+     * The state of the agent's action in the current turn, along with
+     * whether the agent is active. These share a single atomic so that
+     * actions can be submitted without any locks: an action is claimed by
+     * changing the state from `ACTION_IDLE` to `ACTION_SUBMITTING`, after
+     * which the requested position and direction are written, and the
+     * state is set to `ACTION_SUBMITTED`, atomically with reading whether
+     * the agent is active. The simulator resets the state to `ACTION_IDLE`
+     * once the action is applied.
+     */
+    std::atomic<uint8_t> action_slot;
+
+    /**
+     * The order in which the agent acted in the current turn, relative to
+     * other agents, used to resolve movement conflicts.
+     */
+    uint64_t action_sequence;
+
+    /**
+     * The position which the agent requested to move this turn.
+     */
+    position requested_position;
+
+    /**
+     * The direction which the agent requested to rotate to this turn.
+     */
+    direction requested_direction;
+
+    /** Number of items of each type in the agent's storage. */
+    unsigned int* collected_items;
+
+    /**
+     * The position and direction of the agent, and the sum of the versions
+     * of the patches in its neighborhood, when `current_vision` was
+     * computed. If none of these have changed, the visual field is reused.
+     * Since versions only increase, and the neighborhood is determined by
+     * the position, the sum changes whenever any of the patches change.
+     */
+    position observed_position;
+    direction observed_direction;
+    uint64_t observed_version;
+
+    /**
+     * The number of items in the agent's field of view when `current_vision`
+     * was computed.
+     */
+    unsigned int visible_item_count;
+
+    /**
+     * The actions of the agent's plan, which the simulator submits on behalf
+     * of the agent, one per time step (see `simulator::submit_plan`).
+     * `plan_position` is the number of actions that have been submitted, and
+     * `plan_pending` is `true` if the plan submitted the action of the
+     * current turn. `plan_state` is `plan_status::RUNNING` while the plan is
+     * executed, and records how the plan ended during the time step in which
+     * it ended. These are protected by the simulator lock, and are not
+     * serialized.
+     */
+    action* plan_actions;
+    unsigned int plan_length;
+    unsigned int plan_position;
+    uint8_t plan_abort_conditions;
+    plan_status plan_state;
+    bool plan_pending;
+
+    /* The value of `visible_item_count` when the plan was last advanced. */
+    unsigned int plan_visible_item_count;
+
+    /**
+     * Lock used by the simulator to prevent simultaneous updates
+     * to an agent's state.
+     */
+    std::mutex lock;
+
+    /**
+     * Whether the agent was removed from the simulator (protected by
+     * `lock`), and the next agent in the list of removed agents that are not
+     * yet freed (see `simulator::retired_agents`).
+     */
+    bool removed;
+    agent_state* next_retired;
+
+    inline void add_color(unsigned int pixel,
+            const float* color, unsigned int color_dimension)
+    {
+        float* dst = next_vision + (size_t) pixel * color_dimension;
+        for (unsigned int i = 0; i < color_dimension; i++)
+            dst[i] += color[i];
+    }
+
+    inline void occlude_color(unsigned int pixel,
+            unsigned int color_dimension, const float occlusion)
+    {
+        float* dst = next_vision + (size_t) pixel * color_dimension;
+        const float visibility = 1.0f - occlusion;
+        for (unsigned int i = 0; i < color_dimension; i++)
+            dst[i] = dst[i] * visibility;
+    }
+
+    /**
+     * Returns `true` if the simulator will wait for this agent to act
+     * before advancing the simulation.
+     */
+    inline bool is_active() const {
+        return (action_slot & ACTIVE) != 0;
+    }
+
+    /* Returns `true` if the agent has already acted in the current turn. */
+    inline bool has_acted() const {
+        return (action_slot & ACTION_MASK) >= ACTION_SUBMITTED;
+    }
+
+    /**
+     * Claims the action slot of this agent for the current turn. Returns
+     * `false` if the agent has already acted.
+     */
+    inline bool claim_action() {
+        uint8_t slot = action_slot;
+        do {
+            if ((slot & ACTION_MASK) != ACTION_IDLE) return false;
+        } while (!action_slot.compare_exchange_weak(slot, (uint8_t) (slot | ACTION_SUBMITTING)));
+        return true;
+    }
+
+    /**
+     * Submits the action written to `requested_position` and
+     * `requested_direction` after a successful call to `claim_action`.
+     * Returns `true` if the agent was active when the action was submitted,
+     * in which case the action counts toward advancing the simulation.
+     */
+    inline bool submit_action() {
+        uint8_t slot = action_slot;
+        uint8_t new_slot;
+        do {
+            new_slot = (slot & ~ACTION_MASK) | ACTION_SUBMITTED;
+            if (slot & ACTIVE) new_slot |= ACTION_COUNTED;
+        } while (!action_slot.compare_exchange_weak(slot, new_slot));
+        return (new_slot & ACTION_COUNTED) != 0;
+    }
+
+    /**
+     * Copies the position, direction, scent, and visual field of the last
+     * published observation of this agent into `location`, `orientation`,
+     * `scent`, and `vision`, without locking. This may be called while the
+     * simulator computes the next observation, in which case the copy is
+     * retried if the observation is published during the copy. Returns the
+     * number of times the observation has been published or moved.
+     *
+     * Since the simulator moves the observation buffers when agents are
+     * added or removed, this should be called from
+     * `simulator::get_observations`, or while holding `lock`.
+     */
+    inline uint64_t get_observation(position& location, direction& orientation,
+            float* scent, float* vision, const simulator_config& config) const
+    {
+        const size_t vision_size = (size_t) (2*config.vision_range + 1)
+                * (2*config.vision_range + 1) * config.color_dimension;
+        while (true) {
+            uint64_t epoch = observation_epoch.load(std::memory_order_acquire);
+            if (epoch % 2 == 1) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            location = observed_position;
+            orientation = observed_direction;
+            memcpy(scent, current_scent, sizeof(float) * config.scent_dimension);
+            memcpy(vision, current_vision, sizeof(float) * vision_size);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (observation_epoch.load(std::memory_order_relaxed) == epoch)
+                return epoch / 2;
+        }
+    }
+
+    /**
+     * Copies the last `config.history_length` published observations of this
+     * agent, oldest first, into `observations`, without locking, in the same
+     * manner as `get_observation`. Each observation occupies
+     * `observation_stride(config)` floats in `observations`, and consists of
+     * the scent followed by the visual field (and padding). Observations
+     * from before the agent was added to the simulator are zero. Returns
+     * the number of times the observation has been published or moved.
+     *
+     * The agent must be in an `agent_store`, and this should be called from
+     * `simulator::get_observation_histories`, or while holding `lock`.
+     */
+    inline uint64_t get_observation_history(float* observations, const simulator_config& config) const
+    {
+        const size_t stride = observation_stride(config);
+        const unsigned int ring_size = config.history_length + 1;
+        while (true) {
+            uint64_t epoch = observation_epoch.load(std::memory_order_acquire);
+            if (epoch % 2 == 1) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            /* the oldest observation is two slots after the current one */
+            const float* oldest = history + ((history_head + 2) % ring_size) * stride;
+            memcpy(observations, oldest, sizeof(float) * config.history_length * stride);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (observation_epoch.load(std::memory_order_relaxed) == epoch)
+                return epoch / 2;
+        }
+    }
+
+    /**
+     * Computes the scent and visual field of this agent into the next
+     * observation buffers, and publishes them. If `advance_history` is
+     * false, the new observation replaces the current one in the agent's
+     * observation history, rather than being appended to it (this is used
+     * when the observation changes between time steps, such as when a
+     * nearby agent is added or removed). The visual occlusion is computed
+     * in the given scratch `buffers`. Returns `false` if there is
+     * insufficient memory for the occluding items, in which case the
+     * observation is not published.
+     */
+    template<typename T>
+    inline bool update_state(
+            patch<patch_data>* const* neighborhood,
+            unsigned int neighborhood_size,
+            const diffusion<T>& scent_model,
+            const vision_tables& tables,
+            occlusion_buffers& buffers,
+            const simulator_config& config,
+            uint64_t current_time,
+            bool advance_history)
+    {
+        /* the visual field only needs to be recomputed if something nearby has changed */
+        uint64_t version = 0;
+        for (unsigned int i = 0; i < neighborhood_size; i++)
+            version += neighborhood[i]->data.version;
+        bool vision_changed = (current_position != observed_position
+            || current_direction != observed_direction || version != observed_version);
+
+        /* first zero out the next scent and vision (the vision is copied if it's unchanged) */
+        memset(next_scent, 0, sizeof(float) * config.scent_dimension);
+        if (vision_changed)
+            memset(next_vision, 0, sizeof(float) * tables.cell_count * config.color_dimension);
+        else memcpy(next_vision, current_vision, sizeof(float) * tables.cell_count * config.color_dimension);
+
+        /* an agent without a direction has no visual field, but still perceives scent */
+        const bool compute_vision = vision_changed && current_direction != direction::COUNT;
+
+        /* the pixel in the agent's visual field corresponding to each cell */
+        const unsigned int* pixels = NULL;
+        const float* fov_occlusion = NULL;
+        if (compute_vision) {
+            pixels = tables.pixels + (size_t) current_direction * tables.cell_count;
+            fov_occlusion = tables.fov_occlusion + (size_t) current_direction * tables.cell_count;
+        }
+
+        /* the visual field cells containing items that occlude vision, and their occlusion */
+        array<pair<unsigned int, float>>& occluders = buffers.occluders;
+        occluders.clear();
+        unsigned int item_count = 0;
+
+        JBW_PROFILE_PHASE(scent_timer, step_phase::SCENT);
+        JBW_PROFILE_COUNT(step_phase::SCENT, 1);
+        for (unsigned int i = 0; i < neighborhood_size; i++) {
+            /* iterate over neighboring items, and add their contributions to scent and vision */
+            for (unsigned int j = 0; j < neighborhood[i]->items.length; j++) {
+                const item& item = neighborhood[i]->items[j];
+                compute_scent_contribution(scent_model, item, current_position, current_time, config, next_scent);
+                if (!compute_vision) continue;
+
+                /* if the item is in the visual field, add its color to the appropriate pixel */
+                position relative_position = item.location - current_position;
+                if (item.deletion_time == 0
+                 && (unsigned int) abs(relative_position.x) <= config.vision_range
+                 && (unsigned int) abs(relative_position.y) <= config.vision_range) {
+                    const unsigned int cell = tables.index_of(relative_position);
+                    const float visual_occlusion = config.item_types[item.item_type].visual_occlusion;
+                    if (visual_occlusion != 0.0f && (relative_position.x != 0 || relative_position.y != 0)
+                     && !occluders.add(make_pair(cell, visual_occlusion)))
+                    {
+                        fprintf(stderr, "agent_state.update_state ERROR: Insufficient memory for occluders.\n");
+                        return false;
+                    }
+                    add_color(pixels[cell],
+                        config.item_types[item.item_type].color,
+                        config.color_dimension);
+                    if (!tables.limited_field_of_view || fov_occlusion[cell] < 1.0f)
+                        item_count++;
+                 }
+            }
+
+            /* iterate over neighboring agents, and add their contributions to scent and vision */
+            if (!compute_vision) continue;
+            for (agent_state* agent : neighborhood[i]->data.agents) {
+                /* compute neighbor position in agent coordinates */
+                position relative_position = agent->current_position - current_position;
+
+                /* if the neighbor is in the visual field, add its color to the appropriate pixel */
+                if ((unsigned int) abs(relative_position.x) <= config.vision_range
+                 && (unsigned int) abs(relative_position.y) <= config.vision_range) {
+                    add_color(pixels[tables.index_of(relative_position)],
+                        config.agent_color, config.color_dimension);
+                }
+            }
+        }
+
+        JBW_PROFILE_STOP(scent_timer);
+
+        if (!compute_vision) {
+            publish_observation(version, config, advance_history);
+            return true;
+        }
+        visible_item_count = item_count;
+
+        JBW_PROFILE_PHASE(vision_timer, step_phase::VISION);
+        JBW_PROFILE_COUNT(step_phase::VISION, 1);
+
+        /* cast the shadow of each occluding item onto the cells behind it */
+        float* shadows = NULL;
+        if (tables.method == occlusion_method::SHADOW_CASTING && occluders.length > 0) {
+            shadows = buffers.shadows;
+            memset(shadows, 0, sizeof(float) * tables.cell_count);
+            for (const pair<unsigned int, float>& occluder : occluders) {
+                const unsigned int end = tables.shadow_offsets[occluder.key + 1];
+                for (unsigned int k = tables.shadow_offsets[occluder.key]; k < end; k++)
+                    shadows[tables.shadow_cells[k]] += occluder.value * tables.shadow_fractions[k];
+            }
+        }
+
+        /* Apply visual occlusion. */
+        int64_t V = (int64_t) config.vision_range;
+        unsigned int cell = 0;
+        for (int64_t i = -V; i <= V; i++) {
+            for (int64_t j = -V; j <= V; j++, cell++) {
+                if (i == 0 && j == 0) continue;
+
+                /* Check if this cell is outside the agent's field of view. */
+                if (tables.limited_field_of_view && fov_occlusion[cell] > 0.0f) {
+                    occlude_color(pixels[cell], config.color_dimension, fov_occlusion[cell]);
+                    if (fov_occlusion[cell] == 1.0f) continue;
+                }
+
+                /* Check if this cell is occluded by any items. */
+                float occlusion = 0.0f;
+                if (tables.method == occlusion_method::PER_CELL) {
+                    for (const pair<unsigned int, float>& occluder : occluders)
+                        occlusion += occluder.value * tables.shadow_fraction(occluder.key, cell);
+                } else if (shadows != NULL) {
+                    occlusion = shadows[cell];
+                }
+                if (occlusion > 0.0f)
+                    occlude_color(pixels[cell], config.color_dimension, min(1.0f, occlusion));
+            }
+        }
+        publish_observation(version, config, advance_history);
+        return true;
+    }
+
+    /**
+     * Makes the next scent and visual field, which were just computed, the
+     * current ones, so that they are visible to readers. If the agent is not
+     * yet in an `agent_store`, the buffers are swapped. Otherwise, the head
+     * of the observation history is advanced (or if `advance_history` is
+     * false, the next observation is copied over the current one).
+     *
+     * This holds `lock` while publishing, so that threads that read the
+     * state of the agent while holding `lock` (see
+     * `simulator::get_agent_states`) never see a partially published
+     * observation, but they only wait for the publication itself, rather
+     * than for the computation of the observation. The caller must not hold
+     * `lock`.
+     */
+    inline void publish_observation(uint64_t version,
+            const simulator_config& config, bool advance_history)
+    {
+        lock.lock();
+        uint64_t epoch = observation_epoch.load(std::memory_order_relaxed);
+        observation_epoch.store(epoch + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        if (history == nullptr) {
+            core::swap(current_scent, next_scent);
+            core::swap(current_vision, next_vision);
         } else {
-            if (!patch.init_helper<false, false>(n, config.scent_dimension, config.color_dimension, patch.item_count, patch.agent_count))
-                return false;
+            const size_t stride = observation_stride(config);
+            const unsigned int ring_size = config.history_length + 1;
+            if (advance_history) {
+                history_head = (history_head + 1) % ring_size;
+            } else {
+                memcpy(current_scent, next_scent, sizeof(float) * stride);
+            }
+
+            /* update the mirror of the current observation, if it has one */
+            if (history_head + 1 < config.history_length)
+                memcpy(history + (history_head + ring_size) * stride,
+                        history + history_head * stride, sizeof(float) * stride);
+            set_history_pointers(stride, config.history_length, config.scent_dimension);
         }
+        observed_position = current_position;
+        observed_direction = current_direction;
+        observed_version = version;
+
+        observation_epoch.store(epoch + 2, std::memory_order_release);
+        lock.unlock();
     }
 
-    return read(patch.items, in, patch.item_count)
-        && read(patch.agent_positions, in, patch.agent_count)
-        && read(patch.agent_directions, in, patch.agent_count);
-}
+    /**
+     * Moves the observation history of this agent into `new_history`, which
+     * has room for `history_slot_count(history_length)` observations of
+     * `stride` floats. If the agent is not yet in an `agent_store`, its
+     * current scent and visual field become the only observation in the
+     * history, and the earlier observations are zero. The move is published
+     * through `observation_epoch`, so that concurrent calls to
+     * `get_observation` retry rather than copy a partially moved observation.
+     */
+    inline void relocate_observations(float* new_history, size_t stride,
+            unsigned int history_length, unsigned int scent_dimension, size_t vision_size)
+    {
+        uint64_t epoch = observation_epoch.load(std::memory_order_relaxed);
+        observation_epoch.store(epoch + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
 
-/**
- * Writes the given patch_state `patch` to the output stream `out`.
- */
-template<typename Stream>
-bool write(const patch_state& patch, Stream& out, const simulator_config& config) {
-    unsigned int n = config.patch_size;
-    return write(patch.patch_position, out) && write(patch.fixed, out)
-        && write(patch.item_count, out) && write(patch.agent_count, out)
-        && write(patch.scent != nullptr, out) && write(patch.vision != nullptr, out)
-        && (patch.scent == nullptr || write(patch.scent, out, n * n * config.scent_dimension))
-        && (patch.vision == nullptr || write(patch.vision, out, n * n * config.color_dimension))
-        && write(patch.items, out, patch.item_count)
-        && write(patch.agent_positions, out, patch.agent_count)
-        && write(patch.agent_directions, out, patch.agent_count);
-}
+        if (history != nullptr) {
+            memcpy(new_history, history, sizeof(float) * history_slot_count(history_length) * stride);
+        } else {
+            memset(new_history, 0, sizeof(float) * history_slot_count(history_length) * stride);
+            memcpy(new_history, current_scent, sizeof(float) * scent_dimension);
+            memcpy(new_history + scent_dimension, current_vision, sizeof(float) * vision_size);
+            if (history_length > 1)
+                memcpy(new_history + (history_length + 1) * stride, new_history, sizeof(float) * stride);
+            history_head = 0;
+        }
+        history = new_history;
+        set_history_pointers(stride, history_length, scent_dimension);
 
-void* alloc_position_keys(size_t n, size_t element_size) {
-    position* keys = (position*) malloc(sizeof(position) * n);
-    if (keys == NULL) return NULL;
-    for (unsigned int i = 0; i < n; i++)
-        position::set_empty(keys[i]);
-    return (void*) keys;
-}
+        observation_epoch.store(epoch + 2, std::memory_order_release);
+    }
+
+    /**
+     * Replaces the observation history of this agent, which must be in an
+     * `agent_store`, with a copy of that of `src`, which has the same
+     * dimensions. This is used when copying agents between simulators.
+     */
+    inline void copy_history(const agent_state& src, size_t stride,
+            unsigned int history_length, unsigned int scent_dimension)
+    {
+        uint64_t epoch = observation_epoch.load(std::memory_order_relaxed);
+        observation_epoch.store(epoch + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        memcpy(history, src.history, sizeof(float) * history_slot_count(history_length) * stride);
+        history_head = src.history_head;
+        set_history_pointers(stride, history_length, scent_dimension);
+
+        observation_epoch.store(epoch + 2, std::memory_order_release);
+    }
+
+    /**
+     * Points the current and next scent and visual field into the
+     * observation history, according to `history_head`.
+     */
+    inline void set_history_pointers(size_t stride,
+            unsigned int history_length, unsigned int scent_dimension)
+    {
+        float* current = history + history_head * stride;
+        float* next = history + ((history_head + 1) % (history_length + 1)) * stride;
+        current_scent = current;
+        current_vision = current + scent_dimension;
+        next_scent = next;
+        next_vision = next + scent_dimension;
+    }
+
+    /** Frees all allocated memory associated with this agent state. */
+    inline static void free(agent_state& agent) {
+        core::free(agent.current_scent);
+        core::free(agent.current_vision);
+        core::free(agent.next_scent);
+        core::free(agent.next_vision);
+        core::free(agent.collected_items);
+        if (agent.plan_actions != nullptr)
+            core::free(agent.plan_actions);
+        agent.lock.~mutex();
+    }
+
+    /**
+     * Recomputes the scent and vision of all other agents that may perceive
+     * the given `agent`, using the given scratch `buffers`.
+     */
+    template<typename T>
+    static inline status update_nearby_agents(const agent_state& agent,
+            map<patch_data, item_properties>& world,
+            const diffusion<T>& scent_model,
+            const vision_tables& tables,
+            occlusion_buffers& buffers,
+            const simulator_config& config,
+            uint64_t current_time)
+    {
+        array<patch<patch_data>*> neighborhood(16);
+        if (!get_perception_neighborhood(world, agent.current_position, config, neighborhood))
+            return status::OUT_OF_MEMORY;
+
+        /* collect the neighbors first, since retrieving their neighborhoods may create new patches */
+        array<agent_state*> neighbors(16);
+        for (patch<patch_data>* p : neighborhood) {
+            if (!neighbors.ensure_capacity(neighbors.length + p->data.agents.length))
+                return status::OUT_OF_MEMORY;
+            for (agent_state* neighbor : p->data.agents)
+                if (neighbor != &agent) neighbors[neighbors.length++] = neighbor;
+        }
+
+        for (agent_state* neighbor : neighbors) {
+            neighborhood.length = 0;
+            if (!get_perception_neighborhood(world, neighbor->current_position, config, neighborhood))
+                return status::OUT_OF_MEMORY;
+            if (!neighbor->update_state(neighborhood.data, (unsigned int) neighborhood.length,
+                    scent_model, tables, buffers, config, current_time, false))
+                return status::OUT_OF_MEMORY;
+        }
+        return status::OK;
+    }
+
+    /**
+     * Removes this agent from the world and frees all allocated memory.
+     * Returns `status::OUT_OF_MEMORY` if the scent and vision of the nearby
+     * agents could not be updated, in which case the agent is still freed.
+     */
+    template<typename T>
+    inline static status free(agent_state& agent,
+            map<patch_data, item_properties>& world,
+            const diffusion<T>& scent_model,
+            const vision_tables& tables,
+            occlusion_buffers& buffers,
+            const simulator_config& config,
+            uint64_t& current_time)
+    {
+        status result = remove_from_world(agent, world, scent_model, tables, buffers, config, current_time);
+        free(agent);
+        return result;
+    }
+
+    /**
+     * Removes this agent from the world, without freeing it, and updates the
+     * scent and vision of the nearby agents. Returns `status::OUT_OF_MEMORY`
+     * if they could not be updated, in which case the agent is still
+     * removed.
+     */
+    template<typename T>
+    inline static status remove_from_world(agent_state& agent,
+            map<patch_data, item_properties>& world,
+            const diffusion<T>& scent_model,
+            const vision_tables& tables,
+            occlusion_buffers& buffers,
+            const simulator_config& config,
+            uint64_t& current_time)
+    {
+        patch<patch_data>* neighborhood[4]; position patch_positions[4];
+        unsigned int index = world.get_fixed_neighborhood(agent.current_position, neighborhood, patch_positions);
+        neighborhood[index]->data.patch_lock.lock();
+        unsigned j = neighborhood[index]->data.agents.index_of(&agent);
+        neighborhood[index]->data.agents.remove(j);
+        neighborhood[index]->data.version++;
+        neighborhood[index]->data.patch_lock.unlock();
+
+        /* update the scent and vision of nearby agents */
+        return update_nearby_agents(agent, world, scent_model, tables, buffers, config, current_time);
+    }
+};
+
+/**
+ * Allocates the current and next scent and visual field buffers of the given
+ * `agent`, and initializes its `observation_epoch`. The agent has no
+ * observation history until it is added to an `agent_store`.
+ */
+inline bool init_observation_buffers(agent_state& agent, const simulator_config& config)
+{
+    const size_t vision_size = (size_t) (2*config.vision_range + 1)
+            * (2*config.vision_range + 1) * config.color_dimension;
+    agent.current_scent = (float*) malloc(sizeof(float) * config.scent_dimension);
+    if (agent.current_scent == NULL) {
+        fprintf(stderr, "init_observation_buffers ERROR: Insufficient memory for agent_state.current_scent.\n");
+        return false;
+    }
+    agent.current_vision = (float*) malloc(sizeof(float) * vision_size);
+    if (agent.current_vision == NULL) {
+        fprintf(stderr, "init_observation_buffers ERROR: Insufficient memory for agent_state.current_vision.\n");
+        free(agent.current_scent); return false;
+    }
+    agent.next_scent = (float*) malloc(sizeof(float) * config.scent_dimension);
+    if (agent.next_scent == NULL) {
+        fprintf(stderr, "init_observation_buffers ERROR: Insufficient memory for agent_state.next_scent.\n");
+        free(agent.current_scent); free(agent.current_vision); return false;
+    }
+    agent.next_vision = (float*) malloc(sizeof(float) * vision_size);
+    if (agent.next_vision == NULL) {
+        fprintf(stderr, "init_observation_buffers ERROR: Insufficient memory for agent_state.next_vision.\n");
+        free(agent.current_scent); free(agent.current_vision);
+        free(agent.next_scent); return false;
+    }
+    new (&agent.observation_epoch) std::atomic<uint64_t>(0);
+    agent.history = nullptr;
+    agent.history_head = 0;
+    return true;
+}
+
+/**
+ * Frees the buffers allocated by `init_observation_buffers`.
+ */
+inline void free_observation_buffers(agent_state& agent) {
+    free(agent.current_scent); free(agent.current_vision);
+    free(agent.next_scent); free(agent.next_vision);
+}
+
+/**
+ * Initializes the given `agent` without an action plan.
+ */
+inline void init_plan(agent_state& agent) {
+    agent.plan_actions = nullptr;
+    agent.plan_length = 0;
+    agent.plan_position = 0;
+    agent.plan_abort_conditions = PLAN_ABORT_NEVER;
+    agent.plan_state = plan_status::NONE;
+    agent.plan_pending = false;
+    agent.plan_visible_item_count = 0;
+}
+
+/**
+ * Initializes an agent's state in the provided world.
+ *
+ * \param   agent_state     Agent state to initialize.
+ * \param   world           Map of the world in which the agent is initialized.
+ * \param   scent_model     The scent diffusion model.
+ * \param   tables          The precomputed visual field geometry.
+ * \param   buffers         The scratch memory used to compute visual occlusion.
+ * \param   config          The configuration for this simulation.
+ * \param   current_time    The current simulation time.
+ *
+ * \tparam  T               The arithmetic type for the scent diffusion model.
+ */
+template<typename T>
+inline status init(
+        agent_state& agent,
+        map<patch_data, item_properties>& world,
+        const diffusion<T>& scent_model,
+        const vision_tables& tables,
+        occlusion_buffers& buffers,
+        const simulator_config& config,
+        uint64_t& current_time)
+{
+    agent.current_position = {0, 0};
+    agent.current_direction = direction::UP;
+    agent.requested_position = {0, 0};
+    agent.requested_direction = direction::UP;
+    if (!init_observation_buffers(agent, config))
+        return status::OUT_OF_MEMORY;
+    agent.collected_items = (unsigned int*) calloc(config.item_types.length, sizeof(unsigned int));
+    if (agent.collected_items == NULL) {
+        fprintf(stderr, "init ERROR: Insufficient memory for agent_state.collected_items.\n");
+        free_observation_buffers(agent); return status::OUT_OF_MEMORY;
+    }
+
+    new (&agent.action_slot) std::atomic<uint8_t>(agent_state::ACTIVE);
+    agent.action_sequence = 0;
+    agent.observed_direction = direction::COUNT;
+    agent.visible_item_count = 0;
+    init_plan(agent);
+    new (&agent.lock) std::mutex();
+    agent.removed = false;
+
+    patch<patch_data>* neighborhood[4]; position patch_positions[4];
+    world.mcmc_iterations *= 10; /* TODO: should this be configurable? */
+    world.get_fixed_neighborhood(agent.current_position, neighborhood, patch_positions);
+    world.mcmc_iterations /= 10;
+
+    /* generate the rest of the world that the agent can perceive */
+    array<patch<patch_data>*> perceived_patches(16);
+    if (!get_perception_neighborhood(world, agent.current_position, config, perceived_patches)) {
+        fprintf(stderr, "init ERROR: Insufficient memory for the neighborhood of the agent.\n");
+        free_observation_buffers(agent);
+        free(agent.collected_items); agent.lock.~mutex();
+        return status::OUT_OF_MEMORY;
+    }
+
+    /* this does not create any patches, so `perceived_patches` remains valid */
+    unsigned int index = world.get_fixed_neighborhood(
+        agent.current_position, neighborhood, patch_positions);
+    neighborhood[index]->data.patch_lock.lock();
+    if (config.collision_policy != movement_conflict_policy::NO_COLLISIONS) {
+        for (const agent_state* neighbor : neighborhood[index]->data.agents) {
+            if (agent.current_position == neighbor->current_position)
+            {
+                /* there is already an agent at this position */
+                FILE* out = stderr;
+                core::print("init ERROR: An agent already occupies position ", out);
+                print(agent.current_position, out); core::print(".\n", out);
+                free_observation_buffers(agent);
+                free(agent.collected_items); agent.lock.~mutex();
+                neighborhood[index]->data.patch_lock.unlock();
+                return status::AGENT_ALREADY_EXISTS;
+            }
+        }
+    }
+    neighborhood[index]->data.agents.add(&agent);
+    neighborhood[index]->data.version++;
+    neighborhood[index]->data.patch_lock.unlock();
+
+    /* initialize the scent and vision of the current agent */
+    if (!agent.update_state(perceived_patches.data, (unsigned int) perceived_patches.length,
+            scent_model, tables, buffers, config, current_time, true))
+    {
+        neighborhood[index]->data.patch_lock.lock();
+        neighborhood[index]->data.agents.remove(neighborhood[index]->data.agents.index_of(&agent));
+        neighborhood[index]->data.version++;
+        neighborhood[index]->data.patch_lock.unlock();
+        free_observation_buffers(agent);
+        free(agent.collected_items); agent.lock.~mutex();
+        return status::OUT_OF_MEMORY;
+    }
+
+    /* update the scent and vision of nearby agents */
+    return agent_state::update_nearby_agents(agent, world, scent_model, tables, buffers, config, current_time);
+}
+
+/**
+ * Reads the given agent_state `agent` from the input stream `in`. 
+ */
+template<typename Stream>
+inline bool read(agent_state& agent, Stream& in, const simulator_config& config)
+{
+    if (!init_observation_buffers(agent, config))
+        return false;
+    agent.collected_items = (unsigned int*) malloc(sizeof(unsigned int) * config.item_types.length);
+    if (agent.collected_items == NULL) {
+        fprintf(stderr, "read ERROR: Insufficient memory for agent_state.collected_items.\n");
+        free_observation_buffers(agent); return false;
+    }
+    new (&agent.lock) std::mutex();
+    agent.removed = false;
+
+    bool agent_acted, agent_active;
+    if (!read(agent.current_position, in)
+     || !read(agent.current_direction, in)
+     || !read(agent.current_scent, in, config.scent_dimension)
+     || !read(agent.current_vision, in, (2*config.vision_range + 1) * (2*config.vision_range + 1) * config.color_dimension)
+     || !read(agent_acted, in)
+     || !read(agent_active, in)
+     || !read(agent.requested_position, in)
+     || !read(agent.requested_direction, in)
+     || !read(agent.collected_items, in, (unsigned int) config.item_types.length)
+     || !read(agent.action_sequence, in))
+    {
+         free_observation_buffers(agent);
+         free(agent.collected_items); agent.lock.~mutex();
+         return false;
+     }
+
+    /* the observations that were read are published, but are recomputed in
+       the next step since no sum of patch versions equals `UINT64_MAX` */
+    agent.observed_position = agent.current_position;
+    agent.observed_direction = agent.current_direction;
+    agent.observed_version = UINT64_MAX;
+    agent.visible_item_count = 0;
+    init_plan(agent);
+
+    /* actions of active agents are counted in `simulator::acted_agent_count` */
+    uint8_t slot = agent_state::ACTION_IDLE;
+    if (agent_active) slot |= agent_state::ACTIVE;
+    if (agent_acted) slot |= agent_state::ACTION_SUBMITTED;
+    if (agent_acted && agent_active) slot |= agent_state::ACTION_COUNTED;
+    new (&agent.action_slot) std::atomic<uint8_t>(slot);
+     return true;
+}
+
+/**
+ * Writes the given agent_state `agent` to the output stream `out`. 
+ */
+template<typename Stream>
+inline bool write(const agent_state& agent, Stream& out, const simulator_config& config)
+{
+    return write(agent.current_position, out)
+        && write(agent.current_direction, out)
+        && write(agent.current_scent, out, config.scent_dimension)
+        && write(agent.current_vision, out, (2*config.vision_range + 1) * (2*config.vision_range + 1) * config.color_dimension)
+        && write(agent.has_acted(), out)
+        && write(agent.is_active(), out)
+        && write(agent.requested_position, out)
+        && write(agent.requested_direction, out)
+        && write(agent.collected_items, out, (unsigned int) config.item_types.length)
+        && write(agent.action_sequence, out);
+}
+
+/**
+ * Initializes the given agent_state `agent` as a copy of `src`, for a fork
+ * of the simulator containing `src`. The copy is not added to any patch.
+ */
+inline bool init(agent_state& agent, const agent_state& src, const simulator_config& config)
+{
+    if (!init_observation_buffers(agent, config))
+        return false;
+    agent.collected_items = (unsigned int*) malloc(sizeof(unsigned int) * config.item_types.length);
+    if (agent.collected_items == NULL) {
+        fprintf(stderr, "init ERROR: Insufficient memory for agent_state.collected_items.\n");
+        free_observation_buffers(agent); return false;
+    }
+
+    const size_t vision_size = (size_t) (2*config.vision_range + 1)
+            * (2*config.vision_range + 1) * config.color_dimension;
+    agent.current_position = src.current_position;
+    agent.current_direction = src.current_direction;
+    memcpy(agent.current_scent, src.current_scent, sizeof(float) * config.scent_dimension);
+    memcpy(agent.current_vision, src.current_vision, sizeof(float) * vision_size);
+    memcpy(agent.collected_items, src.collected_items, sizeof(unsigned int) * config.item_types.length);
+    agent.requested_position = src.requested_position;
+    agent.requested_direction = src.requested_direction;
+    agent.action_sequence = src.action_sequence;
+
+    /* the patch versions are copied as well, so the visual field can be reused */
+    agent.observed_position = src.observed_position;
+    agent.observed_direction = src.observed_direction;
+    agent.observed_version = src.observed_version;
+    agent.visible_item_count = src.visible_item_count;
+
+    /* the fork continues any plan of `src` */
+    agent.plan_length = src.plan_length;
+    agent.plan_position = src.plan_position;
+    agent.plan_abort_conditions = src.plan_abort_conditions;
+    agent.plan_state = src.plan_state;
+    agent.plan_pending = src.plan_pending;
+    agent.plan_visible_item_count = src.plan_visible_item_count;
+    agent.plan_actions = nullptr;
+    if (src.plan_actions != nullptr) {
+        agent.plan_actions = (action*) malloc(sizeof(action) * src.plan_length);
+        if (agent.plan_actions == NULL) {
+            fprintf(stderr, "init ERROR: Insufficient memory for agent_state.plan_actions.\n");
+            free_observation_buffers(agent); free(agent.collected_items);
+            return false;
+        }
+        memcpy(agent.plan_actions, src.plan_actions, sizeof(action) * src.plan_length);
+    }
+
+    new (&agent.action_slot) std::atomic<uint8_t>(src.action_slot.load());
+    new (&agent.lock) std::mutex();
+    agent.removed = false;
+    return true;
+}
+
+/**
+ * This structure contains full information about a patch. This is more than we
+ * need for simulation, but it is useful for visualization. `version` is
+ * unique to each rendering of the patch by `simulator::get_map`, unless the
+ * same rendering is returned from its cache, so callers can pass it back to
+ * `get_map` to skip the patch while it is unchanged.
+ */
+struct patch_state {
+    position patch_position;
+    bool fixed;
+    uint64_t version;
+    float* scent;
+    float* vision;
+    item* items;
+    unsigned int item_count;
+    position* agent_positions;
+    direction* agent_directions;
+    unsigned int agent_count;
+
+    static inline void move(const patch_state& src, patch_state& dst) {
+        core::move(src.patch_position, dst.patch_position);
+        core::move(src.fixed, dst.fixed);
+        core::move(src.version, dst.version);
+        core::move(src.scent, dst.scent);
+        core::move(src.vision, dst.vision);
+        core::move(src.items, dst.items);
+        core::move(src.item_count, dst.item_count);
+        core::move(src.agent_positions, dst.agent_positions);
+        core::move(src.agent_directions, dst.agent_directions);
+        core::move(src.agent_count, dst.agent_count);
+    }
+
+    static inline void free(patch_state& patch) {
+        if (patch.scent != nullptr)
+            core::free(patch.scent);
+        if (patch.vision != nullptr)
+            core::free(patch.vision);
+        core::free(patch.items);
+        core::free(patch.agent_positions);
+        core::free(patch.agent_directions);
+    }
+
+    template<bool InitializeScent, bool InitializeVision>
+    inline bool init_helper(unsigned int n,
+            unsigned int scent_dimension, unsigned int color_dimension,
+            unsigned int item_count, unsigned int agent_count)
+    {
+        if (InitializeScent) {
+            scent = (float*) calloc(n * n * scent_dimension, sizeof(float));
+            if (scent == NULL) {
+                fprintf(stderr, "patch_state.init_helper ERROR: Insufficient memory for scent.\n");
+                return false;
+            }
+        } else {
+            scent = nullptr;
+        }
+        if (InitializeVision) {
+            vision = (float*) calloc(n * n * color_dimension, sizeof(float));
+            if (vision == NULL) {
+                fprintf(stderr, "patch_state.init_helper ERROR: Insufficient memory for vision.\n");
+                if (InitializeScent) core::free(scent);
+                return false;
+            }
+        } else {
+            vision = nullptr;
+        }
+        items = (item*) malloc(sizeof(item) * item_count);
+        if (items == NULL) {
+            fprintf(stderr, "patch_state.init_helper ERROR: Insufficient memory for items.\n");
+            if (InitializeScent) core::free(scent);
+            if (InitializeVision) core::free(vision);
+            return false;
+        }
+        agent_positions = (position*) malloc(sizeof(position) * agent_count);
+        if (agent_positions == NULL) {
+            fprintf(stderr, "patch_state.init_helper ERROR: Insufficient memory for agent_positions.\n");
+            if (InitializeScent) core::free(scent);
+            if (InitializeVision) core::free(vision);
+            core::free(items); return false;
+        }
+        agent_directions = (direction*) malloc(sizeof(direction) * agent_count);
+        if (agent_directions == NULL) {
+            fprintf(stderr, "patch_state.init_helper ERROR: Insufficient memory for agent_directions.\n");
+            if (InitializeScent) core::free(scent);
+            if (InitializeVision) core::free(vision);
+            core::free(items); core::free(agent_positions);
+            return false;
+        }
+        return true;
+    }
+};
+
+/**
+ * Initializes the memory of the given patch_state `patch`. This function does
+ * not initialize the contents of any of the fields, except for `scent` and
+ * `vision`, which are initialized to zeros.
+ */
+template<bool InitializeScent, bool InitializeVision>
+inline bool init(patch_state& patch, unsigned int n,
+        unsigned int scent_dimension, unsigned int color_dimension,
+        unsigned int item_count, unsigned int agent_count)
+{
+    patch.version = 0;
+    patch.item_count = item_count;
+    patch.agent_count = agent_count;
+    return patch.init_helper<InitializeScent, InitializeVision>(n, scent_dimension, color_dimension, item_count, agent_count);
+}
+
+/**
+ * Initializes the given patch_state `patch` as a copy of `src`.
+ */
+inline bool init(patch_state& patch, const patch_state& src,
+        unsigned int n, unsigned int scent_dimension, unsigned int color_dimension)
+{
+    bool success;
+    if (src.scent != nullptr) {
+        if (src.vision != nullptr)
+            success = patch.init_helper<true, true>(n, scent_dimension, color_dimension, src.item_count, src.agent_count);
+        else success = patch.init_helper<true, false>(n, scent_dimension, color_dimension, src.item_count, src.agent_count);
+    } else {
+        if (src.vision != nullptr)
+            success = patch.init_helper<false, true>(n, scent_dimension, color_dimension, src.item_count, src.agent_count);
+        else success = patch.init_helper<false, false>(n, scent_dimension, color_dimension, src.item_count, src.agent_count);
+    }
+    if (!success) return false;
+
+    patch.patch_position = src.patch_position;
+    patch.fixed = src.fixed;
+    patch.version = src.version;
+    patch.item_count = src.item_count;
+    patch.agent_count = src.agent_count;
+    if (src.scent != nullptr)
+        memcpy(patch.scent, src.scent, sizeof(float) * n * n * scent_dimension);
+    if (src.vision != nullptr)
+        memcpy(patch.vision, src.vision, sizeof(float) * n * n * color_dimension);
+    memcpy(patch.items, src.items, sizeof(item) * src.item_count);
+    memcpy(patch.agent_positions, src.agent_positions, sizeof(position) * src.agent_count);
+    memcpy(patch.agent_directions, src.agent_directions, sizeof(direction) * src.agent_count);
+    return true;
+}
+
+/**
+ * Reads the given patch_state `patch` from the input stream `in`. The
+ * `version` is not serialized, so it is set to zero (see
+ * `send_get_map_delta` in mpi.h, which sends it separately).
+ */
+template<typename Stream>
+bool read(patch_state& patch, Stream& in, const simulator_config& config) {
+    bool has_scent, has_vision;
+    unsigned int n = config.patch_size;
+    patch.version = 0;
+    if (!read(patch.patch_position, in) || !read(patch.fixed, in)
+     || !read(patch.item_count, in) || !read(patch.agent_count, in)
+     || !read(has_scent, in) || !read(has_vision, in)) return false;
+
+    if (has_scent) {
+        if (has_vision) {
+            if (!patch.init_helper<true, true>(n, config.scent_dimension, config.color_dimension, patch.item_count, patch.agent_count)
+             || !read(patch.scent, in, n * n * config.scent_dimension)
+             || !read(patch.vision, in, n * n * config.color_dimension))
+                return false;
+        } else {
+            if (!patch.init_helper<true, false>(n, config.scent_dimension, config.color_dimension, patch.item_count, patch.agent_count)
+             || !read(patch.scent, in, n * n * config.scent_dimension))
+                return false;
+        }
+    } else {
+        if (has_vision) {
+            if (!patch.init_helper<false, true>(n, config.scent_dimension, config.color_dimension, patch.item_count, patch.agent_count)
+             || !read(patch.vision, in, n * n * config.color_dimension))
+                return false;
+        } else {
+            if (!patch.init_helper<false, false>(n, config.scent_dimension, config.color_dimension, patch.item_count, patch.agent_count))
+                return false;
+        }
+    }
+
+    return read(patch.items, in, patch.item_count)
+        && read(patch.agent_positions, in, patch.agent_count)
+        && read(patch.agent_directions, in, patch.agent_count);
+}
+
+/**
+ * Writes the given patch_state `patch` to the output stream `out`.
+ */
+template<typename Stream>
+bool write(const patch_state& patch, Stream& out, const simulator_config& config) {
+    unsigned int n = config.patch_size;
+    return write(patch.patch_position, out) && write(patch.fixed, out)
+        && write(patch.item_count, out) && write(patch.agent_count, out)
+        && write(patch.scent != nullptr, out) && write(patch.vision != nullptr, out)
+        && (patch.scent == nullptr || write(patch.scent, out, n * n * config.scent_dimension))
+        && (patch.vision == nullptr || write(patch.vision, out, n * n * config.color_dimension))
+        && write(patch.items, out, patch.item_count)
+        && write(patch.agent_positions, out, patch.agent_count)
+        && write(patch.agent_directions, out, patch.agent_count);
+}
+
+/**
+ * An immutable copy of a patch of the world at the end of a time step, which
+ * `simulator::get_map` reads without the simulator lock. Unlike patch_state,
+ * `items` also contains the deleted items, which still have scent. A
+ * patch_snapshot is shared by every world_snapshot in which the patch is
+ * unchanged, and it is freed once `references` reaches zero.
+ */
+struct patch_snapshot {
+    position patch_position;
+    bool fixed;
+    uint64_t version;
+
+    /**
+     * The time after which the scent of the items in this patch no longer
+     * changes, since every item has been fully diffused (or decayed, if it
+     * was deleted).
+     */
+    uint64_t scent_settled_time;
+
+    item* items;
+    unsigned int item_count;
+    position* agent_positions;
+    direction* agent_directions;
+    unsigned int agent_count;
+    std::atomic<unsigned int> references;
+
+    static inline void free(patch_snapshot& patch) {
+        core::free(patch.items);
+        core::free(patch.agent_positions);
+        core::free(patch.agent_directions);
+    }
+};
+
+/**
+ * Initializes the given patch_snapshot `snapshot` as a copy of the patch
+ * `src` at `patch_position`, with a single reference.
+ */
+inline bool init(patch_snapshot& snapshot,
+        const patch<patch_data>& src, const position& patch_position,
+        unsigned int deleted_item_lifetime)
+{
+    snapshot.items = (item*) malloc(sizeof(item) * max((size_t) 1, src.items.length));
+    if (snapshot.items == NULL) {
+        fprintf(stderr, "init ERROR: Insufficient memory for patch_snapshot.items.\n");
+        return false;
+    }
+    snapshot.agent_positions = (position*) malloc(sizeof(position) * max((size_t) 1, src.data.agents.length));
+    if (snapshot.agent_positions == NULL) {
+        fprintf(stderr, "init ERROR: Insufficient memory for patch_snapshot.agent_positions.\n");
+        core::free(snapshot.items); return false;
+    }
+    snapshot.agent_directions = (direction*) malloc(sizeof(direction) * max((size_t) 1, src.data.agents.length));
+    if (snapshot.agent_directions == NULL) {
+        fprintf(stderr, "init ERROR: Insufficient memory for patch_snapshot.agent_directions.\n");
+        core::free(snapshot.items); core::free(snapshot.agent_positions);
+        return false;
+    }
+
+    memcpy(snapshot.items, src.items.data, sizeof(item) * src.items.length);
+    snapshot.scent_settled_time = 0;
+    for (const item& item : src.items) {
+        /* see `compute_scent_contribution` */
+        if (item.creation_time > 0)
+            snapshot.scent_settled_time = max(snapshot.scent_settled_time, item.creation_time + deleted_item_lifetime - 1);
+        if (item.deletion_time > 0)
+            snapshot.scent_settled_time = max(snapshot.scent_settled_time, item.deletion_time + deleted_item_lifetime - 1);
+    }
+    for (unsigned int i = 0; i < src.data.agents.length; i++) {
+        snapshot.agent_positions[i] = src.data.agents[i]->current_position;
+        snapshot.agent_directions[i] = src.data.agents[i]->current_direction;
+    }
+    snapshot.patch_position = patch_position;
+    snapshot.fixed = src.fixed;
+    snapshot.version = src.data.version;
+    snapshot.item_count = (unsigned int) src.items.length;
+    snapshot.agent_count = (unsigned int) src.data.agents.length;
+    new (&snapshot.references) std::atomic<unsigned int>(1);
+    return true;
+}
+
+/**
+ * Releases a reference to the given patch_snapshot `snapshot`, freeing it if
+ * this was the last reference.
+ */
+inline void release_snapshot(patch_snapshot* snapshot) {
+    if (--snapshot->references == 0) {
+        core::free(*snapshot);
+        core::free(snapshot);
+    }
+}
+
+/**
+ * A block of up to `CAPACITY` consecutive patches of a world_snapshot. A
+ * chunk is shared by every world_snapshot in which none of its patches
+ * changed, so that publishing a snapshot only copies the chunks containing
+ * changed patches, and it is freed once `references` reaches zero.
+ */
+struct snapshot_chunk {
+    static constexpr unsigned int CAPACITY = 64;
+
+    patch_snapshot* patches[CAPACITY];
+    unsigned int patch_count;
+    std::atomic<unsigned int> references;
+
+    static inline void free(snapshot_chunk& chunk) {
+        for (unsigned int i = 0; i < chunk.patch_count; i++)
+            release_snapshot(chunk.patches[i]);
+    }
+};
+
+/**
+ * Returns a new, empty snapshot_chunk with a single reference, or `nullptr`
+ * if there is insufficient memory.
+ */
+inline snapshot_chunk* new_snapshot_chunk() {
+    snapshot_chunk* chunk = (snapshot_chunk*) malloc(sizeof(snapshot_chunk));
+    if (chunk == nullptr) {
+        fprintf(stderr, "new_snapshot_chunk ERROR: Insufficient memory for snapshot_chunk.\n");
+        return nullptr;
+    }
+    chunk->patch_count = 0;
+    new (&chunk->references) std::atomic<unsigned int>(1);
+    return chunk;
+}
+
+/**
+ * Releases a reference to the given snapshot_chunk `chunk`, freeing it if
+ * this was the last reference.
+ */
+inline void release_snapshot(snapshot_chunk* chunk) {
+    if (--chunk->references == 0) {
+        core::free(*chunk);
+        core::free(chunk);
+    }
+}
+
+/**
+ * An immutable copy of the world at the end of the time step `time`, which
+ * the simulator publishes so that `get_map` can read the world without the
+ * simulator lock. The patches are sorted by patch position in row-major
+ * order (by `y`, and then by `x`), as in `map::patches`, and stored in
+ * `chunks`, each of which is full, except for the last. The world_snapshot
+ * is freed once `references` reaches zero.
+ */
+struct world_snapshot {
+    uint64_t time;
+    snapshot_chunk** chunks;
+    size_t chunk_count;
+    size_t patch_count;
+    std::atomic<unsigned int> references;
+
+    /* Returns the patch at `index` in row-major order. */
+    inline patch_snapshot* get_patch(size_t index) const {
+        return chunks[index / snapshot_chunk::CAPACITY]->patches[index % snapshot_chunk::CAPACITY];
+    }
+
+    /**
+     * Returns the index of the first patch whose position is not before
+     * `patch_position` in row-major order.
+     */
+    inline size_t lower_bound(const position& patch_position) const {
+        size_t begin = 0, end = patch_count;
+        while (begin < end) {
+            size_t middle = begin + (end - begin) / 2;
+            const position& current = get_patch(middle)->patch_position;
+            if (current.y < patch_position.y || (current.y == patch_position.y && current.x < patch_position.x))
+                begin = middle + 1;
+            else end = middle;
+        }
+        return begin;
+    }
+
+    /* Returns the patch at `patch_position`, or `nullptr` if there is none. */
+    inline patch_snapshot* get(const position& patch_position) const {
+        size_t index = lower_bound(patch_position);
+        if (index == patch_count || get_patch(index)->patch_position != patch_position)
+            return nullptr;
+        return get_patch(index);
+    }
+
+    /**
+     * Stores the patch at `patch_position` and the eight patches around it
+     * in `neighbors`, in row-major order, where `neighbors[4]` is the patch
+     * at `patch_position`. Missing patches are `nullptr`.
+     */
+    inline void get_neighbors(const position& patch_position, const patch_snapshot* neighbors[9]) const {
+        for (int64_t y = -1; y <= 1; y++)
+            for (int64_t x = -1; x <= 1; x++)
+                neighbors[(y + 1) * 3 + (x + 1)] = get(patch_position + position(x, y));
+    }
+
+    static inline void free(world_snapshot& snapshot) {
+        for (size_t i = 0; i < snapshot.chunk_count; i++)
+            release_snapshot(snapshot.chunks[i]);
+        core::free(snapshot.chunks);
+    }
+};
+
+/**
+ * Releases a reference to the given world_snapshot `snapshot`, freeing it if
+ * this was the last reference.
+ */
+inline void release_snapshot(world_snapshot* snapshot) {
+    if (--snapshot->references == 0) {
+        core::free(*snapshot);
+        core::free(snapshot);
+    }
+}
+
+/**
+ * Contiguous storage for the agents in a simulator, which are assigned the
+ * dense indices `[0, length)`. When an agent is removed, the last agent is
+ * moved into its index. The scent and visual field of every agent are stored
+ * in a single slab `observations`, rather than in separate allocations, where
+ * the agent at index `i` owns the observation history `get_history(i)` (see
+ * `agent_state::history`), which holds `slot_count` observations. Each
+ * observation contains the scent followed by the visual field, and starts on
+ * a cache line. Similarly, the position, direction, and step flags of the
+ * agents are stored contiguously in `positions`, `directions`, and `flags`,
+ * and their rewards in the last time step in `rewards`, so that `step` reads
+ * them without dereferencing each agent. `positions` and `directions` mirror
+ * `agent_state::current_position` and `agent_state::current_direction`,
+ * which the patches and the bindings read through `agent_state` pointers.
+ *
+ * The simulator lock must be held to modify the store.
+ */
+struct agent_store {
+    /* The agents and their IDs, indexed by `agent_state::store_index`. */
+    agent_state** agents;
+    uint64_t* ids;
+    unsigned int length;
+    unsigned int capacity;
+
+    /* The position and direction of each agent, and its flags in the current time step (see `ACTION_APPLIED`). */
+    position* positions;
+    direction* directions;
+    uint8_t* flags;
+
+    /* The number of floats in the scent, and in the visual field, of each agent. */
+    unsigned int scent_size;
+    size_t vision_size;
+
+    /* The number of floats between the starts of consecutive observations. */
+    size_t stride;
+
+    /* The number of observations kept for each agent, and the number of slots in its history. */
+    unsigned int history_length;
+    unsigned int slot_count;
+
+    /* The observation slab, and the (unaligned) allocation that contains it. */
+    float* observations;
+    void* observation_memory;
+
+    /* The reward of each agent in the last time step (see `compute_rewards`). */
+    float* rewards;
+
+    /**
+     * The position of each agent, and the number of items of each type it
+     * had collected, when its reward was last computed.
+     */
+    position* reward_positions;
+    unsigned int* reward_items;
+    unsigned int item_type_count;
+
+    enum : size_t {
+        /* the alignment of each observation buffer, in bytes */
+        BUFFER_ALIGNMENT = 64
+    };
+
+    enum : uint8_t {
+        /* the action of the agent is applied in the current time step */
+        ACTION_APPLIED = 1 << 0,
+        /* the agent moved, or turned, in the current time step */
+        MOVED = 1 << 1,
+        TURNED = 1 << 2
+    };
+
+    agent_store(const simulator_config& config, unsigned int initial_capacity) {
+        if (!init_helper(config, initial_capacity))
+            exit(EXIT_FAILURE);
+    }
+
+    ~agent_store() { free_helper(); }
+
+    /* Returns the observation history of the agent at `index`. */
+    inline float* get_history(unsigned int index) const {
+        return observations + (size_t) index * slot_count * stride;
+    }
+
+    /**
+     * Ensures there is room for at least `new_length` agents. If the slab is
+     * reallocated, the observations of every agent are moved into the new
+     * slab (while holding the lock of each agent), and the previous slab is
+     * returned in `old_memory`, so that the caller can free it once no thread
+     * is reading from it. Otherwise, `old_memory` is set to `nullptr`.
+     */
+    inline bool ensure_capacity(unsigned int new_length, void*& old_memory)
+    {
+        old_memory = nullptr;
+        if (new_length <= capacity) return true;
+        unsigned int new_capacity = capacity;
+        while (new_capacity < new_length)
+            new_capacity *= 2;
+
+        agent_state** new_agents = (agent_state**) realloc(agents, sizeof(agent_state*) * new_capacity);
+        if (new_agents == NULL) {
+            fprintf(stderr, "agent_store.ensure_capacity ERROR: Insufficient memory for agents.\n");
+            return false;
+        }
+        agents = new_agents;
+        uint64_t* new_ids = (uint64_t*) realloc(ids, sizeof(uint64_t) * new_capacity);
+        if (new_ids == NULL) {
+            fprintf(stderr, "agent_store.ensure_capacity ERROR: Insufficient memory for ids.\n");
+            return false;
+        }
+        ids = new_ids;
+        position* new_positions = (position*) realloc(positions, sizeof(position) * new_capacity);
+        if (new_positions == NULL) {
+            fprintf(stderr, "agent_store.ensure_capacity ERROR: Insufficient memory for positions.\n");
+            return false;
+        }
+        positions = new_positions;
+        direction* new_directions = (direction*) realloc(directions, sizeof(direction) * new_capacity);
+        if (new_directions == NULL) {
+            fprintf(stderr, "agent_store.ensure_capacity ERROR: Insufficient memory for directions.\n");
+            return false;
+        }
+        directions = new_directions;
+        uint8_t* new_flags = (uint8_t*) realloc(flags, sizeof(uint8_t) * new_capacity);
+        if (new_flags == NULL) {
+            fprintf(stderr, "agent_store.ensure_capacity ERROR: Insufficient memory for flags.\n");
+            return false;
+        }
+        flags = new_flags;
+        float* new_rewards = (float*) realloc(rewards, sizeof(float) * new_capacity);
+        if (new_rewards == NULL) {
+            fprintf(stderr, "agent_store.ensure_capacity ERROR: Insufficient memory for rewards.\n");
+            return false;
+        }
+        rewards = new_rewards;
+        position* new_reward_positions = (position*) realloc(reward_positions, sizeof(position) * new_capacity);
+        if (new_reward_positions == NULL) {
+            fprintf(stderr, "agent_store.ensure_capacity ERROR: Insufficient memory for reward_positions.\n");
+            return false;
+        }
+        reward_positions = new_reward_positions;
+        unsigned int* new_reward_items = (unsigned int*) realloc(reward_items,
+                sizeof(unsigned int) * max((size_t) 1, (size_t) new_capacity * item_type_count));
+        if (new_reward_items == NULL) {
+            fprintf(stderr, "agent_store.ensure_capacity ERROR: Insufficient memory for reward_items.\n");
+            return false;
+        }
+        reward_items = new_reward_items;
+        float* new_observations;
+        void* new_memory = alloc_observations(new_capacity, new_observations);
+        if (new_memory == NULL) return false;
+
+        for (unsigned int i = 0; i < length; i++) {
+            agents[i]->lock.lock();
+            agents[i]->relocate_observations(new_observations + (size_t) i * slot_count * stride,
+                    stride, history_length, scent_size, vision_size);
+            agents[i]->lock.unlock();
+        }
+        old_memory = observation_memory;
+        observation_memory = new_memory;
+        observations = new_observations;
+        capacity = new_capacity;
+        return true;
+    }
+
+    /**
+     * Adds the given `agent` with the given `id` at the next index, moving
+     * its observations from the buffers allocated by `init` or `read` into
+     * the slab.
+     *
+     * Precondition: `length < capacity`.
+     */
+    inline void add(uint64_t id, agent_state* agent)
+    {
+        float* old_current_scent = agent->current_scent;
+        float* old_current_vision = agent->current_vision;
+        float* old_next_scent = agent->next_scent;
+        float* old_next_vision = agent->next_vision;
+        agent->relocate_observations(get_history(length), stride, history_length, scent_size, vision_size);
+        core::free(old_current_scent); core::free(old_current_vision);
+        core::free(old_next_scent); core::free(old_next_vision);
+
+        agent->store_index = length;
+        agents[length] = agent;
+        ids[length] = id;
+        positions[length] = agent->current_position;
+        directions[length] = agent->current_direction;
+        flags[length] = 0;
+        rewards[length] = 0.0f;
+        reward_positions[length] = agent->current_position;
+        memcpy(reward_items + (size_t) length * item_type_count,
+                agent->collected_items, sizeof(unsigned int) * item_type_count);
+        length++;
+    }
+
+    /**
+     * Removes the given `agent`, moving the last agent into its index, and
+     * detaches the observation buffers of `agent` so that they are not freed
+     * along with it. No other thread may read the observations of `agent`.
+     */
+    inline void remove(agent_state& agent)
+    {
+        unsigned int index = agent.store_index;
+        length--;
+        if (index != length) {
+            agent_state* moved = agents[length];
+            moved->lock.lock();
+            moved->relocate_observations(get_history(index), stride, history_length, scent_size, vision_size);
+            moved->store_index = index;
+            moved->lock.unlock();
+            agents[index] = moved;
+            ids[index] = ids[length];
+            positions[index] = positions[length];
+            directions[index] = directions[length];
+            flags[index] = flags[length];
+            rewards[index] = rewards[length];
+            reward_positions[index] = reward_positions[length];
+            memcpy(reward_items + (size_t) index * item_type_count,
+                    reward_items + (size_t) length * item_type_count,
+                    sizeof(unsigned int) * item_type_count);
+        }
+        release(agent);
+    }
+
+    /**
+     * Copies the observation history and the reward state of the agent at
+     * `src_index` in `src`, which has the same dimensions as this store, to
+     * the agent at `index`.
+     */
+    inline void copy_agent(unsigned int index, const agent_store& src, unsigned int src_index) {
+        agents[index]->copy_history(*src.agents[src_index], stride, history_length, scent_size);
+        flags[index] = src.flags[src_index];
+        rewards[index] = src.rewards[src_index];
+        reward_positions[index] = src.reward_positions[src_index];
+        memcpy(reward_items + (size_t) index * item_type_count,
+                src.reward_items + (size_t) src_index * item_type_count,
+                sizeof(unsigned int) * item_type_count);
+    }
+
+    /**
+     * Evaluates the reward schema in `config` (see
+     * `simulator_config::reward_item_deltas`) for every agent, since its
+     * reward was last computed, and writes the reward of the agent at index
+     * `i` to `rewards[i]`.
+     */
+    inline void compute_rewards(const simulator_config& config)
+    {
+        for (unsigned int i = 0; i < length; i++) {
+            const agent_state& agent = *agents[i];
+            unsigned int* previous_items = reward_items + (size_t) i * item_type_count;
+            const position offset = positions[i] - reward_positions[i];
+            float reward = config.reward_per_step
+                    + config.reward_per_distance * (float) (abs(offset.x) + abs(offset.y));
+            if (config.reward_item_deltas != NULL) {
+                for (unsigned int t = 0; t < item_type_count; t++)
+                    reward += config.reward_item_deltas[t] * ((float) agent.collected_items[t] - (float) previous_items[t]);
+            }
+            rewards[i] = reward;
+            reward_positions[i] = positions[i];
+            memcpy(previous_items, agent.collected_items, sizeof(unsigned int) * item_type_count);
+        }
+    }
+
+    /* Detaches the observation buffers of the given `agent`, which are owned by the store. */
+    static inline void release(agent_state& agent) {
+        agent.history = nullptr;
+        agent.current_scent = nullptr;
+        agent.current_vision = nullptr;
+        agent.next_scent = nullptr;
+        agent.next_vision = nullptr;
+    }
+
+    static inline void free(agent_store& store) {
+        store.free_helper();
+    }
+
+private:
+    inline bool init_helper(const simulator_config& config, unsigned int initial_capacity)
+    {
+        length = 0;
+        capacity = max(1u, initial_capacity);
+        scent_size = config.scent_dimension;
+        vision_size = (size_t) (2*config.vision_range + 1) * (2*config.vision_range + 1) * config.color_dimension;
+        stride = observation_stride(config);
+        history_length = config.history_length;
+        slot_count = history_slot_count(history_length);
+        item_type_count = (unsigned int) config.item_types.length;
+
+        agents = (agent_state**) malloc(sizeof(agent_state*) * capacity);
+        if (agents == NULL) {
+            fprintf(stderr, "agent_store.init_helper ERROR: Insufficient memory for agents.\n");
+            return false;
+        }
+        ids = (uint64_t*) malloc(sizeof(uint64_t) * capacity);
+        if (ids == NULL) {
+            fprintf(stderr, "agent_store.init_helper ERROR: Insufficient memory for ids.\n");
+            core::free(agents); return false;
+        }
+        positions = (position*) malloc(sizeof(position) * capacity);
+        if (positions == NULL) {
+            fprintf(stderr, "agent_store.init_helper ERROR: Insufficient memory for positions.\n");
+            core::free(agents); core::free(ids); return false;
+        }
+        directions = (direction*) malloc(sizeof(direction) * capacity);
+        if (directions == NULL) {
+            fprintf(stderr, "agent_store.init_helper ERROR: Insufficient memory for directions.\n");
+            core::free(agents); core::free(ids);
+            core::free(positions); return false;
+        }
+        flags = (uint8_t*) malloc(sizeof(uint8_t) * capacity);
+        if (flags == NULL) {
+            fprintf(stderr, "agent_store.init_helper ERROR: Insufficient memory for flags.\n");
+            core::free(agents); core::free(ids);
+            core::free(positions); core::free(directions); return false;
+        }
+        rewards = (float*) malloc(sizeof(float) * capacity);
+        if (rewards == NULL) {
+            fprintf(stderr, "agent_store.init_helper ERROR: Insufficient memory for rewards.\n");
+            core::free(agents); core::free(ids); core::free(positions);
+            core::free(directions); core::free(flags); return false;
+        }
+        reward_positions = (position*) malloc(sizeof(position) * capacity);
+        if (reward_positions == NULL) {
+            fprintf(stderr, "agent_store.init_helper ERROR: Insufficient memory for reward_positions.\n");
+            core::free(agents); core::free(ids); core::free(positions);
+            core::free(directions); core::free(flags);
+            core::free(rewards); return false;
+        }
+        reward_items = (unsigned int*) malloc(sizeof(unsigned int) * max((size_t) 1, (size_t) capacity * item_type_count));
+        if (reward_items == NULL) {
+            fprintf(stderr, "agent_store.init_helper ERROR: Insufficient memory for reward_items.\n");
+            core::free(agents); core::free(ids); core::free(positions);
+            core::free(directions); core::free(flags);
+            core::free(rewards); core::free(reward_positions); return false;
+        }
+        observation_memory = alloc_observations(capacity, observations);
+        if (observation_memory == NULL) {
+            core::free(agents); core::free(ids); core::free(positions);
+            core::free(directions); core::free(flags); core::free(rewards);
+            core::free(reward_positions); core::free(reward_items);
+            return false;
+        }
+        return true;
+    }
+
+    inline void free_helper() {
+        core::free(agents);
+        core::free(ids);
+        core::free(positions);
+        core::free(directions);
+        core::free(flags);
+        core::free(rewards);
+        core::free(reward_positions);
+        core::free(reward_items);
+        core::free(observation_memory);
+    }
+
+    /**
+     * Allocates a slab for `slab_capacity` agents, returning the allocation,
+     * and storing the first aligned address within it in `slab`.
+     */
+    inline void* alloc_observations(unsigned int slab_capacity, float*& slab) const
+    {
+        void* memory = malloc(sizeof(float) * slot_count * stride * slab_capacity + BUFFER_ALIGNMENT);
+        if (memory == NULL) {
+            fprintf(stderr, "agent_store.alloc_observations ERROR: Insufficient memory for observation slab.\n");
+            return NULL;
+        }
+        slab = (float*) (((uintptr_t) memory + BUFFER_ALIGNMENT - 1) & ~((uintptr_t) BUFFER_ALIGNMENT - 1));
+        return memory;
+    }
+
+    friend bool init(agent_store&, const simulator_config&, unsigned int);
+};
+
+/**
+ * Initializes the given agent_store `store` with room for `initial_capacity`
+ * agents, whose observations have the dimensions given in `config`.
+ */
+inline bool init(agent_store& store,
+        const simulator_config& config, unsigned int initial_capacity)
+{
+    return store.init_helper(config, initial_capacity);
+}
+
+/**
+ * An immutable snapshot of the agents in a simulator, sorted by ID. This is
+ * used to look up agents when submitting actions, without holding the
+ * simulator lock. The simulator replaces the snapshot whenever agents are
+ * added or removed.
+ */
+struct agent_directory {
+    uint64_t* ids;
+    agent_state** agents;
+    unsigned int length;
+
+    /* Returns the agent with the given `id`, or `nullptr` if there is no such agent. */
+    inline agent_state* get(uint64_t id) const {
+        unsigned int start = 0, end = length;
+        while (start < end) {
+            unsigned int middle = start + (end - start) / 2;
+            if (ids[middle] < id) start = middle + 1;
+            else end = middle;
+        }
+        return (start < length && ids[start] == id) ? agents[start] : nullptr;
+    }
+
+    static inline void free(agent_directory& directory) {
+        core::free(directory.ids);
+        core::free(directory.agents);
+    }
+};
+
+/**
+ * Initializes the given agent_directory `directory` with the agents in the
+ * given map `agents`.
+ */
+inline bool init(agent_directory& directory,
+        const hash_map<uint64_t, agent_state*>& agents)
+{
+    directory.length = (unsigned int) agents.table.size;
+    directory.ids = (uint64_t*) malloc(sizeof(uint64_t) * max(1u, directory.length));
+    if (directory.ids == NULL) {
+        fprintf(stderr, "init ERROR: Insufficient memory for agent_directory.ids.\n");
+        return false;
+    }
+    directory.agents = (agent_state**) malloc(sizeof(agent_state*) * max(1u, directory.length));
+    if (directory.agents == NULL) {
+        fprintf(stderr, "init ERROR: Insufficient memory for agent_directory.agents.\n");
+        free(directory.ids); return false;
+    }
+
+    unsigned int index = 0;
+    for (const auto& entry : agents) {
+        directory.ids[index] = entry.key;
+        directory.agents[index] = entry.value;
+        index++;
+    }
+    if (directory.length > 1)
+        sort(directory.ids, directory.agents, directory.length);
+    return true;
+}
+
+/**
+ * A request by `agent` to move into the position `target`, which is used to
+ * resolve movement conflicts in `simulator::step`. `sequence` orders the
+ * requests by the time at which their actions were submitted.
+ */
+struct move_request {
+    position target;
+    uint64_t sequence;
+    agent_state* agent;
+
+    /* the index of `agent` in the agent store */
+    unsigned int index;
+};
+
+inline bool operator < (const move_request& first, const move_request& second) {
+    if (first.target == second.target)
+        return first.sequence < second.sequence;
+    return first.target < second.target;
+}
+
+/**
+ * The move requests into the position `target`, which are stored contiguously
+ * in `[begin, end)` of the sorted requests. `winner` is the agent that will
+ * move into `target`, or `nullptr` if no agent may move into it. `blocked`
+ * is true if there is an item at `target` that blocks movement.
+ */
+struct move_target {
+    position target;
+    unsigned int begin, end;
+    agent_state* winner;
+    bool blocked;
+};
+
+enum class patch_update_type : uint8_t {
+    /* the agent moved out of the patch */
+    LEAVE = 0,
+    /* the agent moved into the patch */
+    ENTER = 1,
+    /* the agent moved to a position in the patch, and collects the items there */
+    COLLECT = 2,
+    /* the agent moved or turned, which changes what is visible in the patch */
+    CHANGE = 3
+};
+
+/**
+ * An update to the patch at `patch_position` due to the action of `agent`,
+ * which is at index `sequence` in the agent store, that is applied in
+ * `simulator::step` once all moves are resolved. The updates are sorted so
+ * that the updates to each patch are contiguous and in the order of the
+ * agents. Thus, each patch can be updated by a different thread, and the
+ * result is the same as applying every update in order on one thread.
+ */
+struct patch_update {
+    position patch_position;
+    unsigned int sequence;
+    patch_update_type type;
+    agent_state* agent;
+};
+
+inline bool operator < (const patch_update& first, const patch_update& second) {
+    if (first.patch_position != second.patch_position)
+        return first.patch_position < second.patch_position;
+    if (first.sequence != second.sequence)
+        return first.sequence < second.sequence;
+    return first.type < second.type;
+}
+
+/**
+ * The arrays that `simulator::step` uses to resolve the moves of a time step
+ * and to apply the resulting patch updates. They are kept in the simulator
+ * so that their memory is reused across time steps, and their capacities are
+ * kept sufficient for every agent (see `ensure_capacity`), in the same way
+ * as `simulator::move_requests`.
+ */
+struct step_buffers {
+    /* The positions that agents failed to leave, to which no other agent may move. */
+    array<position> occupied_positions;
+
+    /* The updates to the patches, sorted so that the updates to each patch are contiguous. */
+    array<patch_update> updates;
+
+    /* The offsets in `updates` at which the updates to each patch begin, followed by `updates.length`. */
+    array<size_t> patch_offsets;
+
+    /* For each agent in the agent store, whether it collected an item. */
+    array<bool> collected;
+
+    step_buffers(size_t agent_capacity) :
+        occupied_positions(2 * agent_capacity), updates(4 * agent_capacity),
+        patch_offsets(4 * agent_capacity + 1), collected(agent_capacity)
+    { }
+
+    /**
+     * Ensures that the step of `agent_count` agents doesn't need to expand
+     * these arrays: every agent moves into at most one target, and produces
+     * at most four patch updates.
+     */
+    inline bool ensure_capacity(size_t agent_count) {
+        return occupied_positions.ensure_capacity(2 * agent_count)
+            && updates.ensure_capacity(4 * agent_count)
+            && patch_offsets.ensure_capacity(4 * agent_count + 1)
+            && collected.ensure_capacity(agent_count);
+    }
+
+    inline void clear() {
+        occupied_positions.clear();
+        updates.clear();
+        patch_offsets.clear();
+        collected.clear();
+    }
+
+    static inline void free(step_buffers& buffers) {
+        core::free(buffers.occupied_positions);
+        core::free(buffers.updates);
+        core::free(buffers.patch_offsets);
+        core::free(buffers.collected);
+    }
+};
+
+inline bool init(step_buffers& buffers, size_t agent_capacity) {
+    if (!array_init(buffers.occupied_positions, 2 * agent_capacity)) {
+        return false;
+    } else if (!array_init(buffers.updates, 4 * agent_capacity)) {
+        core::free(buffers.occupied_positions);
+        return false;
+    } else if (!array_init(buffers.patch_offsets, 4 * agent_capacity + 1)) {
+        core::free(buffers.occupied_positions);
+        core::free(buffers.updates);
+        return false;
+    } else if (!array_init(buffers.collected, agent_capacity)) {
+        core::free(buffers.occupied_positions);
+        core::free(buffers.updates);
+        core::free(buffers.patch_offsets);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * An entry in an `expiry_queue`: the patch at `patch_position` contains an
+ * item that expires at `expiry_time`.
+ */
+struct expiry_entry {
+    uint64_t expiry_time;
+    position patch_position;
+};
+
+inline bool operator < (const expiry_entry& first, const expiry_entry& second) {
+    return first.expiry_time < second.expiry_time;
+}
+
+/**
+ * The patches containing deleted items, in the order in which the items
+ * expire (once their scent has fully decayed), so that the simulator can
+ * remove the expired items of each time step without scanning the items of
+ * every patch. Every item expires `deleted_item_lifetime` steps after it is
+ * deleted, so items expire in the order in which they are deleted, and this
+ * timing wheel reduces to a ring buffer, where the entries of each time step
+ * are contiguous.
+ */
+struct expiry_queue {
+    /* The ring buffer of entries, whose capacity is a power of two. */
+    expiry_entry* entries;
+    size_t start;
+    size_t length;
+    size_t capacity;
+
+    expiry_queue(size_t initial_capacity) {
+        if (!init_helper(initial_capacity))
+            exit(EXIT_FAILURE);
+    }
+
+    ~expiry_queue() { free_helper(); }
+
+    /**
+     * Adds an entry for an item in the patch at `patch_position` that
+     * expires at `expiry_time`, which must not precede that of any entry in
+     * the queue.
+     */
+    inline bool push(uint64_t expiry_time, const position& patch_position) {
+        if (length > 0) {
+            /* the items of a patch often expire together */
+            const expiry_entry& last = entries[(start + length - 1) & (capacity - 1)];
+            if (last.expiry_time == expiry_time && last.patch_position == patch_position)
+                return true;
+        }
+        if (length == capacity && !expand())
+            return false;
+        entries[(start + length) & (capacity - 1)] = {expiry_time, patch_position};
+        length++;
+        return true;
+    }
+
+    /* Returns `true` if the first entry in the queue expires at or before `time`. */
+    inline bool is_due(uint64_t time) const {
+        return length > 0 && entries[start].expiry_time <= time;
+    }
+
+    inline const expiry_entry& front() const {
+        return entries[start];
+    }
+
+    inline void pop() {
+        start = (start + 1) & (capacity - 1);
+        length--;
+    }
+
+    static inline void swap(expiry_queue& first, expiry_queue& second) {
+        core::swap(first.entries, second.entries);
+        core::swap(first.start, second.start);
+        core::swap(first.length, second.length);
+        core::swap(first.capacity, second.capacity);
+    }
+
+    static inline void free(expiry_queue& queue) {
+        queue.free_helper();
+    }
+
+private:
+    inline bool init_helper(size_t initial_capacity) {
+        capacity = 1;
+        while (capacity < initial_capacity)
+            capacity *= 2;
+        start = 0;
+        length = 0;
+        entries = (expiry_entry*) malloc(sizeof(expiry_entry) * capacity);
+        if (entries == NULL) {
+            fprintf(stderr, "expiry_queue.init_helper ERROR: Insufficient memory for entries.\n");
+            return false;
+        }
+        return true;
+    }
+
+    inline void free_helper() {
+        core::free(entries);
+    }
+
+    /* Doubles the capacity of the ring buffer, moving the entries to its start. */
+    inline bool expand() {
+        expiry_entry* new_entries = (expiry_entry*) malloc(sizeof(expiry_entry) * 2 * capacity);
+        if (new_entries == NULL) {
+            fprintf(stderr, "expiry_queue.expand ERROR: Insufficient memory for entries.\n");
+            return false;
+        }
+        for (size_t i = 0; i < length; i++)
+            new_entries[i] = entries[(start + i) & (capacity - 1)];
+        core::free(entries);
+        entries = new_entries;
+        start = 0;
+        capacity *= 2;
+        return true;
+    }
+
+    friend bool init(expiry_queue&, size_t);
+    friend bool init(expiry_queue&, const expiry_queue&);
+};
+
+/**
+ * Initializes the given expiry_queue `queue` with room for
+ * `initial_capacity` entries.
+ */
+inline bool init(expiry_queue& queue, size_t initial_capacity) {
+    return queue.init_helper(initial_capacity);
+}
+
+/**
+ * Initializes the given expiry_queue `queue` as a copy of `src`.
+ */
+inline bool init(expiry_queue& queue, const expiry_queue& src) {
+    if (!queue.init_helper(src.length))
+        return false;
+    for (size_t i = 0; i < src.length; i++)
+        queue.entries[i] = src.entries[(src.start + i) & (src.capacity - 1)];
+    queue.length = src.length;
+    return true;
+}
+
+void* alloc_position_keys(size_t n, size_t element_size) {
+    position* keys = (position*) malloc(sizeof(position) * n);
+    if (keys == NULL) return NULL;
+    for (unsigned int i = 0; i < n; i++)
+        position::set_empty(keys[i]);
+    return (void*) keys;
+}
+
+template<typename FunctionType>
+inline bool operator == (const energy_function<FunctionType>& first, const energy_function<FunctionType>& second) {
+    return first.fn == second.fn && first.arg_count == second.arg_count
+        && memcmp(first.args, second.args, sizeof(float) * first.arg_count) == 0;
+}
+
+/**
+ * Returns whether the tables in `simulation_tables` computed for the
+ * simulator_config `first` are the same as those for `second`. Only the
+ * fields from which the tables are computed are compared.
+ */
+inline bool shares_tables(const simulator_config& first, const simulator_config& second)
+{
+    if (first.diffusion_param != second.diffusion_param
+     || first.decay_param != second.decay_param
+     || first.patch_size != second.patch_size
+     || first.deleted_item_lifetime != second.deleted_item_lifetime
+     || first.vision_range != second.vision_range
+     || first.agent_field_of_view != second.agent_field_of_view
+     || first.occlusion != second.occlusion
+     || first.item_types.length != second.item_types.length)
+        return false;
+    for (unsigned int i = 0; i < first.item_types.length; i++) {
+        if (!(first.item_types[i].intensity_fn == second.item_types[i].intensity_fn))
+            return false;
+        for (unsigned int j = 0; j < first.item_types.length; j++)
+            if (!(first.item_types[i].interaction_fns[j] == second.item_types[i].interaction_fns[j]))
+                return false;
+    }
+    return true;
+}
+
+/* Updates the FNV-1a hash `hash` with the `length` bytes at `data`. */
+inline void hash_bytes(uint64_t& hash, const void* data, size_t length) {
+    const unsigned char* bytes = (const unsigned char*) data;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+}
+
+template<typename FunctionType>
+inline void hash_bytes(uint64_t& hash, const energy_function<FunctionType>& fn) {
+    hash_bytes(hash, &fn.fn, sizeof(fn.fn));
+    hash_bytes(hash, &fn.arg_count, sizeof(fn.arg_count));
+    hash_bytes(hash, fn.args, sizeof(float) * fn.arg_count);
+}
+
+/**
+ * Returns a hash of the fields of the given simulator_config `config` that
+ * are compared by `shares_tables`.
+ */
+inline uint64_t hash_tables(const simulator_config& config)
+{
+    uint64_t hash = 14695981039346656037ull;
+    hash_bytes(hash, &config.diffusion_param, sizeof(config.diffusion_param));
+    hash_bytes(hash, &config.decay_param, sizeof(config.decay_param));
+    hash_bytes(hash, &config.patch_size, sizeof(config.patch_size));
+    hash_bytes(hash, &config.deleted_item_lifetime, sizeof(config.deleted_item_lifetime));
+    hash_bytes(hash, &config.vision_range, sizeof(config.vision_range));
+    hash_bytes(hash, &config.agent_field_of_view, sizeof(config.agent_field_of_view));
+    hash_bytes(hash, &config.occlusion, sizeof(config.occlusion));
+    hash_bytes(hash, &config.item_types.length, sizeof(config.item_types.length));
+    for (const item_properties& properties : config.item_types) {
+        hash_bytes(hash, properties.intensity_fn);
+        for (unsigned int j = 0; j < config.item_types.length; j++)
+            hash_bytes(hash, properties.interaction_fns[j]);
+    }
+    return hash;
+}
+
+/**
+ * The immutable tables computed from a simulator_config: the scent diffusion
+ * model, the visual field geometry, and the Gibbs field cache of the item
+ * types. Since computing these dominates the cost of constructing a
+ * simulator, simulators with configurations that `shares_tables` share a
+ * single reference-counted copy, which is obtained from `acquire_tables` and
+ * returned with `release_tables`.
+ */
+struct simulation_tables {
+    /**
+     * A copy of the configuration from which the tables were computed,
+     * which also owns the item types referenced by `cache`.
+     */
+    simulator_config config;
+
+    /* The result of `hash_tables(config)`. */
+    uint64_t hash;
+
+    /* The number of simulators using these tables. */
+    unsigned int reference_count;
+
+    diffusion<double> scent_model;
+    vision_tables vision;
+    gibbs_field_cache<item_properties> cache;
+
+    static inline void free(simulation_tables& tables) {
+        core::free(tables.cache);
+        core::free(tables.vision);
+        core::free(tables.scent_model);
+        core::free(tables.config);
+    }
+};
+
+/**
+ * Computes the tables in the given simulation_tables `tables` from the given
+ * simulator_config `config`, with a `reference_count` of 1.
+ */
+inline bool init(simulation_tables& tables, const simulator_config& config)
+{
+    if (!init(tables.config, config)) {
+        return false;
+    } else if (!init(tables.scent_model, (double) config.diffusion_param,
+            (double) config.decay_param, config.patch_size, config.deleted_item_lifetime)) {
+        fprintf(stderr, "init ERROR: Unable to initialize simulation_tables.scent_model.\n");
+        free(tables.config); return false;
+    } else if (!init(tables.vision, config.vision_range, config.agent_field_of_view, config.occlusion)) {
+        fprintf(stderr, "init ERROR: Unable to initialize simulation_tables.vision.\n");
+        free(tables.config); free(tables.scent_model); return false;
+    } else if (!init(tables.cache, tables.config.item_types.data,
+            (unsigned int) tables.config.item_types.length, config.patch_size)) {
+        fprintf(stderr, "init ERROR: Unable to initialize simulation_tables.cache.\n");
+        free(tables.config); free(tables.scent_model);
+        free(tables.vision); return false;
+    }
+    tables.hash = hash_tables(config);
+    tables.reference_count = 1;
+    return true;
+}
+
+/**
+ * The simulation_tables in use by the simulators in this process, which is
+ * used to intern the tables by configuration.
+ */
+struct table_registry {
+    array<simulation_tables*> tables;
+    std::mutex lock;
+
+    table_registry() : tables(8) { }
+
+    static inline table_registry& instance() {
+        static table_registry registry;
+        return registry;
+    }
+};
+
+/**
+ * Returns the simulation_tables for the given simulator_config `config`,
+ * which are shared with any other simulator with the same tables (and are
+ * otherwise computed), incrementing their reference count. Returns `nullptr`
+ * if the tables could not be computed.
+ */
+inline simulation_tables* acquire_tables(const simulator_config& config)
+{
+    table_registry& registry = table_registry::instance();
+    const uint64_t hash = hash_tables(config);
+    std::unique_lock<std::mutex> guard(registry.lock);
+    for (simulation_tables* tables : registry.tables) {
+        if (tables->hash == hash && shares_tables(tables->config, config)) {
+            tables->reference_count++;
+            return tables;
+        }
+    }
+
+    if (!registry.tables.ensure_capacity(registry.tables.length + 1))
+        return nullptr;
+    simulation_tables* tables = (simulation_tables*) malloc(sizeof(simulation_tables));
+    if (tables == nullptr) {
+        fprintf(stderr, "acquire_tables ERROR: Insufficient memory for simulation_tables.\n");
+        return nullptr;
+    } else if (!init(*tables, config)) {
+        free(tables); return nullptr;
+    }
+    registry.tables[registry.tables.length++] = tables;
+    return tables;
+}
+
+/**
+ * Increments the reference count of the given `tables`, which were returned
+ * by `acquire_tables`, for another simulator that uses them.
+ */
+inline void retain_tables(simulation_tables* tables)
+{
+    table_registry& registry = table_registry::instance();
+    std::unique_lock<std::mutex> guard(registry.lock);
+    tables->reference_count++;
+}
+
+/**
+ * Decrements the reference count of the given `tables`, which were returned
+ * by `acquire_tables`, and frees them if they are no longer used.
+ */
+inline void release_tables(simulation_tables* tables)
+{
+    table_registry& registry = table_registry::instance();
+    std::unique_lock<std::mutex> guard(registry.lock);
+    if (--tables->reference_count > 0) return;
+    registry.tables.remove(registry.tables.index_of(tables));
+    guard.unlock();
+
+    free(*tables);
+    free(tables);
+}
+
+/**
+ * Determines the contents of a patch_state rendered by `simulator::get_map`:
+ * the versions of the patch and the eight patches around it, in the order of
+ * `world_snapshot::get_neighbors` (where missing patches have version
+ * `UINT64_MAX`), which determine its items, agents, and the items that
+ * contribute to its scent; the time at which the scent was computed, where
+ * all times after the scent of the nearby items settles are equivalent; and
+ * whether the scent and visual field were rendered.
+ */
+struct render_key {
+    uint64_t versions[9];
+    uint64_t scent_time;
+    bool has_scent;
+    bool has_vision;
+};
+
+inline bool operator == (const render_key& first, const render_key& second) {
+    for (unsigned int i = 0; i < 9; i++)
+        if (first.versions[i] != second.versions[i]) return false;
+    return first.scent_time == second.scent_time
+        && first.has_scent == second.has_scent
+        && first.has_vision == second.has_vision;
+}
+
+/**
+ * A patch_state rendered by `simulator::get_map`, and the key with which it
+ * was rendered. The rendering is referenced by the cache while it contains
+ * it, and by every `render_cache::get` that is copying it, and it is freed
+ * once `reference_count` drops to zero (see `render_cache::release`).
+ */
+struct rendered_patch {
+    render_key key;
+    patch_state state;
+    std::atomic<unsigned int> reference_count;
+
+    static inline void free(rendered_patch& patch) {
+        core::free(patch.state);
+    }
+};
+
+/**
+ * A cache of the patch_state structures rendered by `simulator::get_map`,
+ * which contains at most one rendering of each patch. Once the cache
+ * contains `MAX_PATCH_COUNT` patches, it is cleared before adding another.
+ * The cache is shared by concurrent calls to `get_map`, and its map is
+ * protected by `lock`, which is not held while patches are copied.
+ */
+struct render_cache {
+    /* The cached patches by position, which is allocated on first use. */
+    hash_map<position, rendered_patch*>* patches;
+
+    /* Incremented for every rendering, to assign each a unique version. */
+    std::atomic<uint64_t> version_counter;
+
+    std::mutex lock;
+
+    static constexpr unsigned int MAX_PATCH_COUNT = 4096;
+
+    render_cache() : patches(nullptr), version_counter(0) { }
+
+    ~render_cache() { free_helper(); }
+
+    /* Returns a new version for a rendered patch_state. */
+    inline uint64_t next_version() {
+        return ++version_counter;
+    }
+
+    /**
+     * Looks up the rendering of the patch at `patch_position` with the given
+     * `key`. If its version is `known_version`, `unchanged` is set to true.
+     * Otherwise, it is copied into the uninitialized patch_state `state`.
+     * Returns false if there is no such rendering, or if there is
+     * insufficient memory to copy it.
+     */
+    inline bool get(const position& patch_position, const render_key& key,
+            uint64_t known_version, patch_state& state, bool& unchanged,
+            const simulator_config& config)
+    {
+        rendered_patch* cached;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            if (patches == nullptr) return false;
+            bool contains;
+            cached = patches->get(patch_position, contains);
+            if (!contains || !(cached->key == key))
+                return false;
+
+            unchanged = (cached->state.version == known_version);
+            if (unchanged) return true;
+            cached->reference_count++;
+        }
+
+        /* copy the rendering without the lock, so that concurrent calls aren't serialized */
+        bool success = init(state, cached->state, config.patch_size, config.scent_dimension, config.color_dimension);
+        release(cached);
+        return success;
+    }
+
+    /**
+     * Adds a copy of the patch_state `state`, rendered with the given `key`,
+     * replacing any previous rendering of the same patch. The cache is only
+     * an optimization, so this fails silently if there is insufficient
+     * memory.
+     */
+    inline void put(const render_key& key, const patch_state& state, const simulator_config& config)
+    {
+        rendered_patch* new_patch = (rendered_patch*) malloc(sizeof(rendered_patch));
+        if (new_patch == nullptr) return;
+        new_patch->key = key;
+        new_patch->reference_count = 1;
+        if (!init(new_patch->state, state, config.patch_size, config.scent_dimension, config.color_dimension)) {
+            core::free(new_patch); return;
+        }
+
+        std::unique_lock<std::mutex> guard(lock);
+        if (patches != nullptr && patches->table.size >= MAX_PATCH_COUNT)
+            free_helper();
+        if (patches == nullptr) {
+            patches = (hash_map<position, rendered_patch*>*) malloc(sizeof(hash_map<position, rendered_patch*>));
+            if (patches == nullptr || !hash_map_init(*patches, 64, alloc_position_keys)) {
+                if (patches != nullptr) core::free(patches);
+                patches = nullptr;
+                core::free(*new_patch); core::free(new_patch);
+                return;
+            }
+        }
+
+        bool contains; unsigned int bucket;
+        rendered_patch*& cached = patches->get(state.patch_position, contains, bucket);
+        if (contains) {
+            release(cached);
+            cached = new_patch;
+        } else if (patches->check_size()) {
+            patches->put(state.patch_position, new_patch);
+        } else {
+            core::free(*new_patch); core::free(new_patch);
+        }
+    }
+
+    /* Removes all cached patches. */
+    inline void clear() {
+        std::unique_lock<std::mutex> guard(lock);
+        free_helper();
+    }
+
+    static inline void free(render_cache& cache) {
+        cache.free_helper();
+        cache.lock.~mutex();
+    }
+
+private:
+    /* Removes a reference to the given `patch`, freeing it if it was the last. */
+    static inline void release(rendered_patch* patch) {
+        if (--patch->reference_count == 0) {
+            core::free(*patch);
+            core::free(patch);
+        }
+    }
+
+    inline void free_helper() {
+        if (patches == nullptr) return;
+        for (auto entry : *patches)
+            release(entry.value);
+        core::free(*patches);
+        core::free(patches);
+        patches = nullptr;
+    }
+};
+
+/**
+ * Initializes the given render_cache `cache`, which is empty.
+ */
+inline void init(render_cache& cache) {
+    cache.patches = nullptr;
+    cache.version_counter = 0;
+    new (&cache.lock) std::mutex();
+}
+
+/**
+ * A copy of the items of a patch, which is resampled by `patch_resampler`
+ * without accessing the world.
+ */
+struct resample_patch {
+    array<item> items;
+};
+
+/* The types that `gibbs_field` requires of its map, for resampling copies of patches. */
+struct resample_map {
+    typedef resample_patch patch_type;
+    typedef item_properties item_type;
+};
+
+/**
+ * A copy of the live items of a fixed patch and of its neighbors, where the
+ * items of the patch are resampled conditioned on those of its neighbors.
+ */
+struct resample_region {
+    position patch_position;
+
+    /**
+     * `patches[(dy + 1) * 3 + (dx + 1)]` contains the live items of the patch
+     * at `patch_position + position(dx, dy)`, if `exists` is true at the same
+     * index. Thus, `patches[4]` is the patch that is resampled.
+     */
+    resample_patch patches[9];
+    bool exists[9];
+
+    /* The live items of the patch before it was resampled. */
+    array<item> original_items;
+
+    /**
+     * Resamples the items of the patch with `iterations` iterations of the
+     * `gibbs_field` sampler, using the given `cache` of a world with patch
+     * size `n`.
+     */
+    template<typename RNGType>
+    inline void resample(gibbs_field_cache<item_properties>& cache,
+            unsigned int n, unsigned int iterations, RNGType& rng)
+    {
+        /* each quadrant of the patch interacts with the three neighbors adjacent to it */
+        patch_neighborhood<resample_patch> neighborhood;
+        neighborhood.bottom_left_neighbor_count = 0;
+        neighborhood.top_left_neighbor_count = 0;
+        neighborhood.bottom_right_neighbor_count = 0;
+        neighborhood.top_right_neighbor_count = 0;
+        add_neighbors(neighborhood.bottom_left_neighborhood, neighborhood.bottom_left_neighbor_count, -1, -1);
+        add_neighbors(neighborhood.top_left_neighborhood, neighborhood.top_left_neighbor_count, -1, 1);
+        add_neighbors(neighborhood.bottom_right_neighborhood, neighborhood.bottom_right_neighbor_count, 1, -1);
+        add_neighbors(neighborhood.top_right_neighborhood, neighborhood.top_right_neighbor_count, 1, 1);
+
+        gibbs_field<resample_map> field(cache, &patch_position, &neighborhood, 1, n);
+        for (unsigned int i = 0; i < iterations; i++)
+            field.sample(rng);
+    }
+
+    static inline void free(resample_region& region) {
+        for (unsigned int i = 0; i < 9; i++)
+            if (region.exists[i]) core::free(region.patches[i].items);
+        core::free(region.original_items);
+    }
+
+private:
+    /* Adds the patch, followed by its existing neighbors in the direction of (`dx`, `dy`), to `neighborhood`. */
+    inline void add_neighbors(resample_patch* neighborhood[4],
+            uint_fast8_t& neighbor_count, int dx, int dy)
+    {
+        const unsigned int indices[] = { 4, (unsigned int) (4 + dx), (unsigned int) (4 + 3 * dy + dx), (unsigned int) (4 + 3 * dy) };
+        for (unsigned int index : indices)
+            if (exists[index]) neighborhood[neighbor_count++] = &patches[index];
+    }
+};
+
+/**
+ * Initializes the given resample_region `region` with copies of the live
+ * items of the patch at `patch_position` and of its neighbors, where
+ * `neighbors` is ordered as `resample_region::patches`, and contains `NULL`
+ * for each neighbor that does not exist.
+ */
+inline bool init(resample_region& region, const position& patch_position,
+        patch<patch_data>* const neighbors[9])
+{
+    region.patch_position = patch_position;
+    for (unsigned int i = 0; i < 9; i++) {
+        region.exists[i] = false;
+        if (neighbors[i] == NULL) continue;
+        const array<item>& items = neighbors[i]->items;
+        if (!array_init(region.patches[i].items, max((size_t) 8, items.length))) {
+            fprintf(stderr, "init ERROR: Insufficient memory for resample_region.patches.\n");
+            for (unsigned int j = 0; j < i; j++)
+                if (region.exists[j]) core::free(region.patches[j].items);
+            return false;
+        }
+        region.exists[i] = true;
+        for (const item& existing : items)
+            if (existing.deletion_time == 0) region.patches[i].items.add(existing);
+    }
+    if (!array_init(region.original_items, max((size_t) 8, region.patches[4].items.length))) {
+        fprintf(stderr, "init ERROR: Insufficient memory for resample_region.original_items.\n");
+        for (unsigned int i = 0; i < 9; i++)
+            if (region.exists[i]) core::free(region.patches[i].items);
+        return false;
+    }
+    for (const item& existing : region.patches[4].items)
+        region.original_items.add(existing);
+    return true;
+}
+
+/**
+ * Initializes the given resample_region `region` as a copy of `src`.
+ */
+inline bool init(resample_region& region, const resample_region& src)
+{
+    region.patch_position = src.patch_position;
+    for (unsigned int i = 0; i < 9; i++) {
+        region.exists[i] = false;
+        if (!src.exists[i]) continue;
+        if (!array_init(region.patches[i].items, max((size_t) 8, src.patches[i].items.length))) {
+            fprintf(stderr, "init ERROR: Insufficient memory for resample_region.patches.\n");
+            for (unsigned int j = 0; j < i; j++)
+                if (region.exists[j]) core::free(region.patches[j].items);
+            return false;
+        }
+        region.exists[i] = true;
+        for (const item& existing : src.patches[i].items)
+            region.patches[i].items.add(existing);
+    }
+    if (!array_init(region.original_items, max((size_t) 8, src.original_items.length))) {
+        fprintf(stderr, "init ERROR: Insufficient memory for resample_region.original_items.\n");
+        for (unsigned int i = 0; i < 9; i++)
+            if (region.exists[i]) core::free(region.patches[i].items);
+        return false;
+    }
+    for (const item& existing : src.original_items)
+        region.original_items.add(existing);
+    return true;
+}
+
+/**
+ * Reads the given resample_region `region` from the input stream `in`.
+ */
+template<typename Stream>
+inline bool read(resample_region& region, Stream& in)
+{
+    if (!read(region.patch_position, in))
+        return false;
+    for (unsigned int i = 0; i < 9; i++) {
+        region.exists[i] = false;
+        bool exists;
+        if (!read(exists, in) || (exists && !read(region.patches[i].items, in))) {
+            for (unsigned int j = 0; j < i; j++)
+                if (region.exists[j]) core::free(region.patches[j].items);
+            return false;
+        }
+        region.exists[i] = exists;
+    }
+    if (!read(region.original_items, in)) {
+        for (unsigned int i = 0; i < 9; i++)
+            if (region.exists[i]) core::free(region.patches[i].items);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Writes the given resample_region `region` to the output stream `out`.
+ */
+template<typename Stream>
+inline bool write(const resample_region& region, Stream& out)
+{
+    if (!write(region.patch_position, out))
+        return false;
+    for (unsigned int i = 0; i < 9; i++) {
+        if (!write(region.exists[i], out)
+         || (region.exists[i] && !write(region.patches[i].items, out)))
+            return false;
+    }
+    return write(region.original_items, out);
+}
+
+/**
+ * Resamples the items of fixed patches on a background thread, so that the
+ * world regenerates over time without adding latency to the time steps. The
+ * simulator copies the patches into `regions` and calls `start` at one time
+ * step, and applies the resampled items at the time step `apply_time`, by
+ * which the thread has usually finished. Since the copies are taken and
+ * applied at fixed time steps, and the thread uses its own random number
+ * generator, the results do not depend on the timing of the thread.
+ *
+ * The thread samples with its own `gibbs_field_cache`, rather than the one
+ * in the simulation_tables, since the Gibbs sampler modifies the cache when
+ * `SAMPLING_METHOD == GIBBS_SAMPLING` (see `map::cache`), and the tables are
+ * used by the world, and by other simulators, while the thread runs.
+ */
+struct patch_resampler {
+    /* The regions being resampled, which only `thread` accesses until `finish` is called. */
+    resample_region* regions;
+    unsigned int region_count;
+
+    /* The time step at which the resampled regions are applied, or 0 if there are none. */
+    uint64_t apply_time;
+
+    /* The cache used by `thread`, which is created by the first call to `start`. */
+    gibbs_field_cache<item_properties>* cache;
+
+    /* This is mutable since waiting for the regions does not modify them. */
+    mutable std::thread thread;
+
+    patch_resampler() : regions(nullptr), region_count(0), apply_time(0), cache(nullptr) { }
+
+    ~patch_resampler() { clear(); free_cache(); }
+
+    /**
+     * Starts resampling the `region_count` regions in `regions` on the
+     * background thread, with `iterations` MCMC iterations per region and a
+     * random number generator seeded with `seed`. The `item_type_count` item
+     * types in `item_types` must outlive this resampler, and must be the
+     * same in every call. If the cache cannot be created, the regions are
+     * discarded.
+     */
+    inline bool start(const item_properties* item_types, unsigned int item_type_count,
+            unsigned int n, unsigned int iterations, uint_fast32_t seed, uint64_t new_apply_time)
+    {
+        if (cache == nullptr) {
+            cache = (gibbs_field_cache<item_properties>*) malloc(sizeof(gibbs_field_cache<item_properties>));
+            if (cache == nullptr || !init(*cache, item_types, item_type_count, n)) {
+                fprintf(stderr, "patch_resampler.start ERROR: Unable to initialize cache.\n");
+                if (cache != nullptr) core::free(cache);
+                cache = nullptr;
+                clear();
+                return false;
+            }
+        }
+        apply_time = new_apply_time;
+
+        /* the sampler caches logarithms of up to the number of items in a patch
+           plus two, which are computed here so that it does not modify the
+           cache concurrently with the simulator */
+        log_cache<float>::instance().ensure_size(n * n + 2);
+
+        thread = std::thread([this, n, iterations, seed]() {
+            std::minstd_rand rng(seed);
+            for (unsigned int i = 0; i < region_count; i++)
+                regions[i].resample(*cache, n, iterations, rng);
+        });
+        return true;
+    }
+
+    /* Waits for the regions to be resampled, if `start` was called. */
+    inline void finish() const {
+        if (thread.joinable())
+            thread.join();
+    }
+
+    /**
+     * Copies the regions of `src`, waiting for them to be resampled, so that
+     * this resampler applies the same items at the same time step as `src`.
+     * This resampler must not have any regions.
+     */
+    inline bool copy_regions(const patch_resampler& src) {
+        src.finish();
+        if (src.region_count == 0) {
+            apply_time = src.apply_time;
+            return true;
+        }
+        regions = (resample_region*) malloc(sizeof(resample_region) * src.region_count);
+        if (regions == nullptr) {
+            fprintf(stderr, "patch_resampler.copy_regions ERROR: Insufficient memory for regions.\n");
+            return false;
+        }
+        for (; region_count < src.region_count; region_count++) {
+            if (!init(regions[region_count], src.regions[region_count])) {
+                clear();
+                return false;
+            }
+        }
+        apply_time = src.apply_time;
+        return true;
+    }
+
+    /* Exchanges the regions of this resampler with those of `other`, neither of which may be resampling. */
+    inline void swap_regions(patch_resampler& other) {
+        core::swap(regions, other.regions);
+        core::swap(region_count, other.region_count);
+        core::swap(apply_time, other.apply_time);
+    }
+
+    /* Discards the regions, waiting for the thread if it is still running. */
+    inline void clear() {
+        finish();
+        if (regions == nullptr) return;
+        for (unsigned int i = 0; i < region_count; i++)
+            core::free(regions[i]);
+        core::free(regions);
+        regions = nullptr;
+        region_count = 0;
+        apply_time = 0;
+    }
+
+    static inline void free(patch_resampler& resampler) {
+        resampler.clear();
+        resampler.free_cache();
+        resampler.thread.~thread();
+    }
+
+private:
+    inline void free_cache() {
+        if (cache == nullptr) return;
+        core::free(*cache);
+        core::free(cache);
+        cache = nullptr;
+    }
+};
+
+/**
+ * Initializes the given patch_resampler `resampler`, which has no regions.
+ */
+inline void init(patch_resampler& resampler) {
+    resampler.regions = nullptr;
+    resampler.region_count = 0;
+    resampler.apply_time = 0;
+    resampler.cache = nullptr;
+    new (&resampler.thread) std::thread();
+}
+
+/**
+ * Reads the regions of the given patch_resampler `resampler`, which must not
+ * have any regions, from the input stream `in`. The regions were resampled
+ * before they were written, so they are applied without restarting the
+ * thread.
+ */
+template<typename Stream>
+bool read(patch_resampler& resampler, Stream& in)
+{
+    unsigned int region_count;
+    if (!read(resampler.apply_time, in) || !read(region_count, in))
+        return false;
+    if (region_count == 0) return true;
+    resampler.regions = (resample_region*) malloc(sizeof(resample_region) * region_count);
+    if (resampler.regions == nullptr) {
+        fprintf(stderr, "read ERROR: Insufficient memory for patch_resampler.regions.\n");
+        return false;
+    }
+    for (; resampler.region_count < region_count; resampler.region_count++) {
+        if (!read(resampler.regions[resampler.region_count], in)) {
+            resampler.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Writes the regions of the given patch_resampler `resampler` to the output
+ * stream `out`, waiting for them to be resampled.
+ */
+template<typename Stream>
+bool write(const patch_resampler& resampler, Stream& out)
+{
+    resampler.finish();
+    if (!write(resampler.apply_time, out) || !write(resampler.region_count, out))
+        return false;
+    for (unsigned int i = 0; i < resampler.region_count; i++)
+        if (!write(resampler.regions[i], out)) return false;
+    return true;
+}
+
+/**
+ * The types of records in an action log (see `simulator::start_action_log`).
+ * The log begins with `ACTION_LOG_MAGIC`, `ACTION_LOG_VERSION`, the seed of
+ * the world, the checkpoint interval, and the simulator_config, followed by
+ * a sequence of records, each of which begins with its type:
+ *
+ *  - `ADD_AGENT`: the time and the ID of the new agent.
+ *  - `REMOVE_AGENT`: the time and the ID of the removed agent.
+ *  - `STEP`: the time before the step, the number of agents whose actions
+ *    were applied, and for each such agent (in the order in which `step`
+ *    visits them), its ID, the sequence number of its action, and its
+ *    requested position and direction.
+ *  - `CHECKPOINT`: the time and the `simulator::state_hash` at that time.
+ *  - `END`: the end of the log.
+ */
+enum class action_log_record : uint8_t {
+    ADD_AGENT = 0,
+    REMOVE_AGENT = 1,
+    STEP = 2,
+    CHECKPOINT = 3,
+    END = 4
+};
+
+constexpr uint32_t ACTION_LOG_MAGIC = 0x4a42574c;
+constexpr uint32_t ACTION_LOG_VERSION = 1;
+
+/**
+ * Reads the given action_log_record `record` from the stream `in`.
+ */
+template<typename Stream>
+inline bool read(action_log_record& record, Stream& in) {
+    uint8_t c;
+    if (!read(c, in)) return false;
+    record = (action_log_record) c;
+    return true;
+}
+
+/**
+ * Writes the given action_log_record `record` to the stream `out`.
+ */
+template<typename Stream>
+inline bool write(const action_log_record& record, Stream& out) {
+    return write((uint8_t) record, out);
+}
+
+/**
+ * Mixes the value `x` into the given `hash`, as in the finalizer of
+ * SplitMix64. Used to compute `simulator::state_hash`.
+ */
+inline uint64_t mix_state_hash(uint64_t hash, uint64_t x) {
+    hash ^= x + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+    hash ^= hash >> 30; hash *= 0xbf58476d1ce4e5b9ull;
+    hash ^= hash >> 27; hash *= 0x94d049bb133111ebull;
+    return hash ^ (hash >> 31);
+}
+
+/**
+ * Simulator that forms the core of our experimentation framework.
+ *
+ * \tparam  SimulatorData   Type to store additional state in the simulation.
+ */
+template<typename SimulatorData>
+class simulator {
+    /* Configuration for this simulator. */
+    simulator_config config;
+
+    /**
+     * The diffusion model to simulate scent, the precomputed geometry of the
+     * visual field, and the Gibbs field cache used by `world`, which are
+     * shared with other simulators with equivalent configurations.
+     */
+    simulation_tables* tables;
+
+    /* Map of the world managed by this simulator. */
+    map<patch_data, item_properties> world;
+
+    /* Threads used to compute the observations of the agents in parallel. */
+    thread_pool workers;
+
+    /* The scratch memory that each thread in `workers` uses to compute visual occlusion. */
+    worker_occlusion_buffers worker_buffers;
+
+    /* Agents managed by this simulator. */
+    hash_map<uint64_t, agent_state*> agents;
+
+    /**
+     * The same agents as `agents`, stored contiguously along with their
+     * observations, which `step` iterates over.
+     */
+    agent_store store;
+
+    /* Semaphores in this simulator. */
+    hash_map<uint64_t, bool> semaphores;
+
+    /* A counter for assigning IDs to new agents and semaphores. */
+    uint64_t id_counter;
+
+    /* Lock for the agent and semaphore tables, used to prevent simultaneous updates. */
+    std::mutex simulator_lock;
+
+    /**
+     * Snapshot of `agents` used to look up agents when submitting actions,
+     * which does not require `simulator_lock`. It is replaced (while holding
+     * `simulator_lock`) whenever agents are added or removed.
+     */
+    std::atomic<agent_directory*> directory;
+
+    /**
+     * The number of threads currently reading from `directory`. An old
+     * directory (and any agent removed with it) is only freed once this is
+     * zero.
+     */
+    std::atomic<unsigned int> directory_readers;
+
+    /**
+     * The number of threads in `get_agent_states`, which may lock an agent
+     * found in `directory` after they stop reading it. A removed agent is
+     * only freed once this is zero, and until then, it is kept in the list
+     * `retired_agents` (linked by `agent_state::next_retired`), which is
+     * protected by `simulator_lock`. No thread waits for this counter, so
+     * `get_agent_states` may block on an agent lock while it is counted.
+     */
+    std::atomic<unsigned int> agent_lockers;
+    agent_state* retired_agents;
+
+    /* A previous observation slab of `store`, in the list `retired_observations`. */
+    struct retired_slab {
+        void* memory;
+        retired_slab* next;
+    };
+
+    /**
+     * The number of views of the observation slab that are pinned by
+     * `pin_observations`. While this is nonzero, a slab that is replaced by
+     * `agent_store::ensure_capacity` is kept in the list
+     * `retired_observations`, rather than freed. Both are protected by
+     * `simulator_lock`.
+     */
+    unsigned int observation_pins;
+    retired_slab* retired_observations;
+
+    /**
+     * The latest world_snapshot, which `get_map` reads without
+     * `simulator_lock`, or `nullptr` if none has been published. Nothing is
+     * published until the first call to `get_map`. After that, it is
+     * replaced (while holding `simulator_lock`) at the end of every time
+     * step, and whenever agents are added or removed.
+     */
+    std::atomic<world_snapshot*> published_world;
+
+    /**
+     * The number of threads currently acquiring a reference to
+     * `published_world`. A replaced snapshot is only released once this is
+     * zero. Unlike `directory_readers`, this does not count the threads
+     * reading the snapshot, since each holds its own reference.
+     */
+    std::atomic<unsigned int> snapshot_readers;
+
+    /* The patches most recently rendered by `get_map`. */
+    render_cache rendered_patches;
+
+    /* A counter used to order the actions submitted by agents. */
+    std::atomic<uint64_t> action_counter;
+
+    /**
+     * The move requests of the agents acting in the current time step, sorted
+     * by target position, and the distinct targets of these requests, sorted
+     * by position. These are only populated within `step`, and their memory
+     * is reused across time steps (`add_agent` ensures they have enough
+     * capacity for every agent).
+     */
+    array<move_request> move_requests;
+    array<move_target> move_targets;
+
+    /* The other arrays used within `step`, whose memory is also reused across time steps. */
+    step_buffers buffers;
+
+    /**
+     * The positions of the patches whose items or agents may have changed
+     * since the last world_snapshot was published, which may contain
+     * duplicates, and the `map::generation_count` of the world when it was
+     * published. Unless patches were generated in the meantime,
+     * `publish_world` shares the chunks of the previous snapshot, and only
+     * copies the chunks containing the patches in `dirty_patches`.
+     */
+    array<position> dirty_patches;
+    uint64_t published_generation;
+
+    /**
+     * The patches containing deleted items, in the order in which the items
+     * expire. The expired items are removed in `compute_observations`.
+     */
+    expiry_queue expiring_items;
+
+    /**
+     * The fixed patches near the agents that are being resampled in the
+     * background, if `config.resample_interval` is positive.
+     */
+    patch_resampler resampler;
+
+    /**
+     * Counter for how many agents have acted and how many semaphores have
+     * signaled during each time step. This counter is used to force the
+     * simulator to wait until all agents have acted and all semaphores have
+     * signaled, before advancing the simulation time step.
+     */
+    std::atomic<unsigned int> acted_agent_count;
+
+    /**
+     * The number of active agents and semaphores in the simulation. The
+     * simulation only waits for active agents (see `agent_state::ACTIVE`)
+     * before advancing time.
+     */
+    std::atomic<unsigned int> active_agent_count;
+
+    /**
+     * The file to which the actions applied in each time step are logged
+     * (see `start_action_log`), or `nullptr` if logging is disabled, and the
+     * number of time steps between the state hashes written to the log.
+     */
+    FILE* action_log;
+    unsigned int checkpoint_interval;
+
+    /**
+     * Whether this simulator is being advanced by `replay`, in which case
+     * time only advances as the log dictates.
+     */
+    bool replaying;
+
+#if defined(JBW_PROFILE)
+    /* The time spent in each phase of the time steps (see `get_step_profile`). */
+    step_profiler profiler;
+#endif
+
+    /* For storing additional state in the simulation. */
+    SimulatorData data;
+
+    typedef patch<patch_data> patch_type;
+
+public:
+    /**
+     * Constructs a new simulator with the given simulator_config `conf` and
+     * SimulatorData `data`, calling the copy constructor for `data`. The
+     * observations of the agents are computed by `thread_count` threads.
+     */
+    simulator(const simulator_config& conf,
+            const SimulatorData& data,
+            uint_fast32_t seed,
+            unsigned int thread_count = 1) :
+        config(conf), tables(acquire_tables_or_exit(config)),
+        world(config.patch_size,
+            config.mcmc_iterations,
+            tables->cache, seed),
+        workers(thread_count), worker_buffers(thread_count, tables->vision.cell_count), agents(32), store(config, 32), semaphores(8), id_counter(1),
+        directory(nullptr), directory_readers(0), agent_lockers(0), retired_agents(nullptr),
+        observation_pins(0), retired_observations(nullptr),
+        published_world(nullptr), snapshot_readers(0),
+        action_counter(0), move_requests(32), move_targets(32), buffers(32), dirty_patches(16), published_generation(0), expiring_items(64),
+        acted_agent_count(0), active_agent_count(0), action_log(nullptr),
+        checkpoint_interval(0), replaying(false), data(data), time(0)
+    {
+        if (!update_directory()) {
+            fprintf(stderr, "simulator ERROR: Unable to initialize agent directory.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /**
+     * Constructs a new simulator with the given simulator_config `conf` and
+     * SimulatorData `data`, calling the copy constructor for `data`.
+     */
+    simulator(const simulator_config& conf,
+            const SimulatorData& data) :
+#if !defined(NDEBUG)
+        simulator(conf, data, 0) { }
+#else
+        simulator(conf, data, (uint_fast32_t) milliseconds()) { }
+#endif
+
+    ~simulator() { free_helper(); }
+
+    /* Current simulation time step. */
+    uint64_t time;
+
+    /**
+     * Adds a new agent to this simulator. Upon success, `new_agent` and
+     * `new_agent_id` will contain the ID of the new agent as well as a pointer
+     * to its state.
+     */
+    inline status add_agent(uint64_t& new_agent_id, agent_state*& new_agent) {
+        simulator_lock.lock();
+        if (!agents.check_size()) {
+            simulator_lock.unlock();
+            fprintf(stderr, "simulator.add_agent ERROR: Failed to expand agent table.\n");
+            return status::OUT_OF_MEMORY;
+        } else if (!move_requests.ensure_capacity(agents.table.size + 1)
+                || !move_targets.ensure_capacity(agents.table.size + 1)
+                || !buffers.ensure_capacity(agents.table.size + 1))
+        {
+            simulator_lock.unlock();
+            fprintf(stderr, "simulator.add_agent ERROR: Failed to expand move request arrays.\n");
+            return status::OUT_OF_MEMORY;
+        }
+
+        void* old_observations;
+        if (!store.ensure_capacity(store.length + 1, old_observations)) {
+            simulator_lock.unlock();
+            fprintf(stderr, "simulator.add_agent ERROR: Failed to expand agent store.\n");
+            return status::OUT_OF_MEMORY;
+        } else if (old_observations != nullptr) {
+            /* the observations were moved, so wait for any readers of the previous slab */
+            while (directory_readers > 0)
+                std::this_thread::yield();
+            retire_observations(old_observations);
+        }
+
+        unsigned int bucket = agents.table.index_to_insert(id_counter);
+        new_agent = (agent_state*) malloc(sizeof(agent_state));
+        new_agent_id = id_counter;
+        if (new_agent == nullptr) {
+            simulator_lock.unlock();
+            return status::OUT_OF_MEMORY;
+        }
+
+        status init_status = init(*new_agent, world, tables->scent_model, tables->vision, worker_buffers[0], config, time);
+        if (init_status != status::OK) {
+            core::free(new_agent);
+            simulator_lock.unlock();
+            return init_status;
+        }
+        mark_dirty(new_agent->current_position);
+        store.add(id_counter, new_agent);
+        agents.table.keys[bucket] = id_counter;
+        agents.values[bucket] = new_agent;
+        agents.table.size++;
+        if (!update_directory()) {
+            agents.remove_at(bucket);
+            store.remove(*new_agent);
+            agent_state::free(*new_agent, world, tables->scent_model, tables->vision, worker_buffers[0], config, time);
+            core::free(new_agent);
+            simulator_lock.unlock();
+            return status::OUT_OF_MEMORY;
+        }
+        active_agent_count++;
+        id_counter++;
+        log_agent_record(action_log_record::ADD_AGENT, new_agent_id);
+        update_world_snapshot();
+        simulator_lock.unlock();
+        return status::OK;
+    }
+
+    /**
+     * Removes the given agent from this simulator. Returns
+     * `status::OUT_OF_MEMORY` if the observations of the nearby agents could
+     * not be updated, in which case the agent is still removed.
+     *
+     * \param   agent_id  ID of the agent to remove.
+     */
+    inline status remove_agent(uint64_t agent_id) {
+        simulator_lock.lock();
+        bool contains; unsigned int bucket;
+        agent_state* agent = agents.get(agent_id, contains, bucket);
+        if (!contains) {
+            simulator_lock.unlock();
+            return status::INVALID_AGENT_ID;
+        }
+        agents.remove_at(bucket);
+
+        /* once no thread is submitting an action for this agent, it can be freed */
+        if (!update_directory()) {
+            agents.put(agent_id, agent);
+            simulator_lock.unlock();
+            return status::OUT_OF_MEMORY;
+        }
+
+        agent->lock.lock();
+        uint8_t slot = agent->action_slot;
+        if (slot & agent_state::ACTION_COUNTED)
+            --acted_agent_count;
+        if (slot & agent_state::ACTIVE)
+            --active_agent_count;
+        agent->removed = true;
+        agent->lock.unlock();
+        mark_dirty(agent->current_position);
+        store.remove(*agent);
+        status result = agent_state::remove_from_world(*agent, world, tables->scent_model, tables->vision, worker_buffers[0], config, time);
+        if (result != status::OK)
+            fprintf(stderr, "simulator.remove_agent ERROR: Failed to update the observations of the agents near the removed agent.\n");
+
+        /* a thread in `get_agent_states` may still be about to lock the agent */
+        agent->next_retired = retired_agents;
+        retired_agents = agent;
+        free_retired_agents();
+        log_agent_record(action_log_record::REMOVE_AGENT, agent_id);
+
+        if (all_agents_acted())
+            step(); /* advance the simulation by one time step */
+        else update_world_snapshot();
+        simulator_lock.unlock();
+
+        return result;
+    }
+
+    /**
+     * Adds a new semaphore for this simulator. Upon success,
+     * `new_semaphore_id` will contain the ID of the new semaphore.
+     */
+    inline status add_semaphore(uint64_t& new_semaphore_id) {
+        simulator_lock.lock();
+        if (!semaphores.check_size()) {
+            simulator_lock.unlock();
+            fprintf(stderr, "simulator.create_semaphore ERROR: Failed to expand semaphore table.\n");
+            return status::OUT_OF_MEMORY;
+        }
+
+        unsigned int bucket = semaphores.table.index_to_insert(id_counter);
+        new_semaphore_id = id_counter;
+        semaphores.table.keys[bucket] = id_counter;
+        semaphores.values[bucket] = false;
+        semaphores.table.size++;
+        active_agent_count++;
+        id_counter++;
+        simulator_lock.unlock();
+        return status::OK;
+    }
+
+    /**
+     * Removes the given semaphore from this simulator.
+     *
+     * \param   semaphore_id  ID of the semaphore to remove.
+     */
+    inline status remove_semaphore(uint64_t semaphore_id) {
+        simulator_lock.lock();
+        bool contains; unsigned int bucket;
+        bool signaled = semaphores.get(semaphore_id, contains, bucket);
+        if (!contains) {
+            simulator_lock.unlock();
+            return status::INVALID_SEMAPHORE_ID;
+        }
+        semaphores.remove_at(bucket);
+        if (signaled)
+            --acted_agent_count;
+        --active_agent_count;
+
+        if (all_agents_acted())
+            step(); /* advance the simulation by one time step */
+        simulator_lock.unlock();
+
+        return status::OK;
+    }
+
+    /**
+     * Signals a semaphore in the simulation.
+     *
+     * \param   semaphore_id  ID of the semaphore to signal.
+     */
+    inline status signal_semaphore(uint64_t semaphore_id) {
+        bool contains;
+        simulator_lock.lock();
+        bool& signaled = semaphores.get(semaphore_id, contains);
+        if (!contains) {
+            simulator_lock.unlock();
+            return status::INVALID_SEMAPHORE_ID;
+        } else if (signaled) {
+            simulator_lock.unlock();
+            return status::SEMAPHORE_ALREADY_SIGNALED;
+        }
+        signaled = true;
+        acted_agent_count++;
+        if (all_agents_acted())
+            step(); /* advance the simulation by one time step */
+        simulator_lock.unlock();
+        return status::OK;
+    }
+
+    /**
+     * Sets whether the agent with the given ID is active.
+     */
+    inline status set_agent_active(uint64_t agent_id, bool active) {
+        bool contains;
+        std::unique_lock<std::mutex> lock(simulator_lock);
+        agent_state* agent = agents.get(agent_id, contains);
+        if (!contains)
+            return status::INVALID_AGENT_ID;
+
+        /* this is atomic with respect to agents submitting actions */
+        if (active) {
+            uint8_t slot = agent->action_slot;
+            uint8_t new_slot;
+            do {
+                if (slot & agent_state::ACTIVE) return status::OK;
+                new_slot = slot | agent_state::ACTIVE;
+                /* an action submitted while the agent was inactive now counts */
+                if ((slot & agent_state::ACTION_MASK) == agent_state::ACTION_SUBMITTED)
+                    new_slot |= agent_state::ACTION_COUNTED;
+            } while (!agent->action_slot.compare_exchange_weak(slot, new_slot));
+            active_agent_count++;
+            if (new_slot & agent_state::ACTION_COUNTED)
+                acted_agent_count++;
+        } else {
+            if (!(agent->action_slot.fetch_and((uint8_t) ~agent_state::ACTIVE) & agent_state::ACTIVE))
+                return status::OK;
+
+            /* wait for any thread that counted an action of this agent to
+               add it to `acted_agent_count` before it is subtracted */
+            while (directory_readers > 0)
+                std::this_thread::yield();
+            if (agent->action_slot.fetch_and((uint8_t) ~agent_state::ACTION_COUNTED) & agent_state::ACTION_COUNTED)
+                --acted_agent_count;
+            --active_agent_count;
+        }
+
+        if (all_agents_acted())
+            step(); /* advance the simulation by one time step */
+        return status::OK;
+    }
+
+    /**
+     * Sets whether the agent with the given ID is active.
+     */
+    inline status is_agent_active(uint64_t agent_id, bool& active) {
+        bool contains;
+        std::unique_lock<std::mutex> lock(simulator_lock);
+        agent_state* agent_ptr = agents.get(agent_id, contains);
+        if (!contains)
+            return status::INVALID_AGENT_ID;
+        active = agent_ptr->is_active();
+        return status::OK;
+    }
+
+    /**
+     * Moves an agent.
+     *
+     * Note that the agent is only actually moved when the simulation time step
+     * advances, and only if the agent has not already acted for the current
+     * time step.
+     *
+     * \param   agent_id  ID of the agent to move.
+     * \param   dir       Direction along which to move, *relative* to the
+     *                    agent's current direction.
+     * \param   num_steps Number of steps to take in the specified direction.
+     */
+    inline status move(uint64_t agent_id, direction dir, unsigned int num_steps)
+    {
+        status result;
+        action a = {action_type::MOVE, dir, num_steps};
+        act(&agent_id, &a, 1, &result);
+        return result;
+    }
+
+    /**
+     * Turns an agent.
+     *
+     * Note that the agent is only actually turned when the simulation time
+     * step advances, and only if the agent has not already acted for the
+     * current time step.
+     *
+     * \param   agent_id ID of the agent to move.
+     * \param   dir      Direction to turn, *relative* to the agent's current
+     *                   direction.
+     */
+    inline status turn(uint64_t agent_id, direction dir)
+    {
+        status result;
+        action a = {action_type::TURN, dir, 0};
+        act(&agent_id, &a, 1, &result);
+        return result;
+    }
+
+    /**
+     * Instructs the agent to do nothing this turn.
+     *
+     * \param   agent_id ID of the agent.
+     */
+    inline status do_nothing(uint64_t agent_id)
+    {
+        status result;
+        action a = {action_type::DO_NOTHING, direction::UP, 0};
+        act(&agent_id, &a, 1, &result);
+        return result;
+    }
+
+    /**
+     * Submits a batch of actions, where the agent with ID `agent_ids[i]`
+     * takes the action `actions[i]`, for each `i` in `[0, count)`. The
+     * result for each agent is stored in `results[i]`, and has the same
+     * meaning as the return value of `move`, `turn`, and `do_nothing`.
+     *
+     * The whole batch is submitted within a single read of the agent
+     * directory, and the simulation is advanced by at most one time step,
+     * once every action in the batch has been submitted.
+     */
+    inline void act(const uint64_t* agent_ids,
+            const action* actions, size_t count, status* results)
+    {
+        unsigned int counted_actions = 0;
+        directory_readers++;
+        const agent_directory& current_directory = *directory.load();
+        for (size_t i = 0; i < count; i++) {
+            results[i] = check_permissions(actions[i]);
+            if (results[i] != status::OK) continue;
+
+            agent_state* agent = current_directory.get(agent_ids[i]);
+            if (agent == nullptr) {
+                results[i] = status::INVALID_AGENT_ID; continue;
+            } else if (!agent->claim_action()) {
+                results[i] = status::AGENT_ALREADY_ACTED; continue;
+            }
+
+            request_action(*agent, actions[i]);
+            agent->action_sequence = action_counter++;
+            if (agent->submit_action()) counted_actions++;
+        }
+        bool ready = (counted_actions > 0)
+                  && ((acted_agent_count += counted_actions) == active_agent_count);
+        directory_readers--;
+
+        /* this must be done after leaving the directory, since `update_directory` waits while holding `simulator_lock` */
+        if (ready) {
+            std::unique_lock<std::mutex> lock(simulator_lock);
+            if (all_agents_acted())
+                step(); /* advance the simulation by one time step */
+        }
+    }
+
+    /**
+     * Submits a plan of `count` actions for the agent with the given ID. The
+     * simulator takes the actions on behalf of the agent, one per time step,
+     * so the agent does not need to act again until the plan ends. The plan
+     * ends once all of its actions are taken, or once any of the
+     * `abort_conditions` (a combination of `plan_abort_condition` flags)
+     * holds after one of its actions is taken. During the time step in which
+     * the plan ends (e.g. in the `on_step` callback), `agent_state::plan_state`
+     * records how it ended, and `agent_state::plan_position` is the number of
+     * actions that were taken.
+     *
+     * The first action is submitted immediately, unless the agent has
+     * already acted in the current turn, in which case it is submitted in
+     * the next turn. This replaces any previous plan of the agent, and a
+     * `count` of 0 cancels it.
+     *
+     * \param   agent_id          ID of the agent.
+     * \param   actions           The actions of the plan, in order.
+     * \param   count             The length of `actions`.
+     * \param   abort_conditions  The conditions under which the plan stops
+     *                            early.
+     */
+    inline status submit_plan(uint64_t agent_id, const action* actions,
+            unsigned int count, uint8_t abort_conditions = PLAN_ABORT_NEVER)
+    {
+        for (unsigned int i = 0; i < count; i++) {
+            status result = check_permissions(actions[i]);
+            if (result != status::OK) return result;
+        }
+
+        action* plan_actions = nullptr;
+        if (count > 0) {
+            plan_actions = (action*) malloc(sizeof(action) * count);
+            if (plan_actions == nullptr) {
+                fprintf(stderr, "simulator.submit_plan ERROR: Insufficient memory for plan_actions.\n");
+                return status::OUT_OF_MEMORY;
+            }
+            memcpy(plan_actions, actions, sizeof(action) * count);
+        }
+
+        bool contains;
+        std::unique_lock<std::mutex> lock(simulator_lock);
+        agent_state* agent = agents.get(agent_id, contains);
+        if (!contains) {
+            if (plan_actions != nullptr) core::free(plan_actions);
+            return status::INVALID_AGENT_ID;
+        }
+
+        if (agent->plan_actions != nullptr)
+            core::free(agent->plan_actions);
+        agent->plan_actions = plan_actions;
+        agent->plan_length = count;
+        agent->plan_position = 0;
+        agent->plan_abort_conditions = abort_conditions;
+        agent->plan_pending = false;
+        agent->plan_visible_item_count = agent->visible_item_count;
+        if (count == 0) {
+            agent->plan_state = plan_status::NONE;
+            return status::OK;
+        }
+        agent->plan_state = plan_status::RUNNING;
+
+        if (submit_plan_action(*agent)) {
+            acted_agent_count++;
+            if (all_agents_acted())
+                step(); /* advance the simulation by one time step */
+        }
+        return status::OK;
+    }
+
+    /**
+     * Retrieves an array of pointers to agent_state structures, storing them
+     * in `states`, which is parallel to the specified `agent_ids` array, and
+     * has length `agent_count`. For any invalid agent ID, the corresponding
+     * agent_state is set to nullptr.
+     *
+     * The agents are looked up in the agent directory, so this does not
+     * require the simulator lock. The agents are only locked after this
+     * thread stops reading the directory, since threads that replace the
+     * directory wait for its readers while holding the simulator lock. An
+     * agent that is removed in the meantime is not freed until this
+     * function returns (see `agent_lockers`), and its state is set to
+     * nullptr. An agent that is locked by the caller is not removed until
+     * the caller unlocks it.
+     *
+     * NOTE: This function will lock each non-null agent in `states`. The
+     *       caller must unlock them afterwards.
+     *
+     * \param      states The output array of agent_state pointers.
+     * \param   agent_ids The array of agent IDs whose states to retrieve.
+     * \param agent_count The length of `states` and `agent_ids`.
+     */
+    inline void get_agent_states(agent_state** states,
+            uint64_t* agent_ids, unsigned int agent_count)
+    {
+        agent_lockers++;
+        directory_readers++;
+        const agent_directory& current_directory = *directory.load();
+        for (unsigned int i = 0; i < agent_count; i++)
+            states[i] = current_directory.get(agent_ids[i]);
+        directory_readers--;
+
+        for (unsigned int i = 0; i < agent_count; i++) {
+            if (states[i] == nullptr) continue;
+            states[i]->lock.lock();
+            if (states[i]->removed) {
+                states[i]->lock.unlock();
+                states[i] = nullptr;
+            }
+        }
+        agent_lockers--;
+    }
+
+    /**
+     * Copies the observations of the last completed time step for the agents
+     * with the given IDs, without taking any locks, so that the observations
+     * can be read while the simulator computes the next time step. For any
+     * invalid agent ID, the corresponding result is set to
+     * `status::INVALID_AGENT_ID`.
+     *
+     * \param   agent_ids   The array of agent IDs whose observations to copy.
+     * \param   agent_count The length of `agent_ids` and the output arrays.
+     * \param   positions   The output array of agent positions.
+     * \param   directions  The output array of agent directions.
+     * \param   scents      The output array of scents, each of which has
+     *                      `scent_dimension` floats.
+     * \param   visions     The output array of visual fields, each of which
+     *                      has `(2*vision_range + 1)^2 * color_dimension`
+     *                      floats.
+     * \param   results     The output array of statuses.
+     */
+    inline void get_observations(const uint64_t* agent_ids,
+            unsigned int agent_count, position* positions, direction* directions,
+            float* scents, float* visions, status* results)
+    {
+        const size_t vision_size = (size_t) (2*config.vision_range + 1)
+                * (2*config.vision_range + 1) * config.color_dimension;
+        directory_readers++;
+        const agent_directory& current_directory = *directory.load();
+        for (unsigned int i = 0; i < agent_count; i++) {
+            const agent_state* agent = current_directory.get(agent_ids[i]);
+            if (agent == nullptr) {
+                results[i] = status::INVALID_AGENT_ID;
+                continue;
+            }
+            agent->get_observation(positions[i], directions[i],
+                scents + (size_t) i * config.scent_dimension,
+                visions + i * vision_size, config);
+            results[i] = status::OK;
+        }
+        directory_readers--;
+    }
+
+    /**
+     * Copies the last `history_length` observations (see `simulator_config`)
+     * of the agents with the given IDs, oldest first, without taking any
+     * locks, in the same manner as `get_observations`. The history of each
+     * agent is copied in a single block from its observation ring (see
+     * `agent_state::history`). For any invalid agent ID, the corresponding
+     * result is set to `status::INVALID_AGENT_ID`.
+     *
+     * \param   agent_ids   The array of agent IDs whose histories to copy.
+     * \param   agent_count The length of `agent_ids` and `results`.
+     * \param   histories   The output array of histories. The history of
+     *                      agent `i` starts at
+     *                      `histories + i * history_length * stride`, where
+     *                      `stride = observation_stride(config)`, and
+     *                      consists of `history_length` observations, each
+     *                      of which is the scent followed by the visual
+     *                      field, starting `stride` floats apart.
+     * \param   results     The output array of statuses.
+     */
+    inline void get_observation_histories(const uint64_t* agent_ids,
+            unsigned int agent_count, float* histories, status* results)
+    {
+        const size_t history_size = config.history_length * observation_stride(config);
+        directory_readers++;
+        const agent_directory& current_directory = *directory.load();
+        for (unsigned int i = 0; i < agent_count; i++) {
+            const agent_state* agent = current_directory.get(agent_ids[i]);
+            if (agent == nullptr) {
+                results[i] = status::INVALID_AGENT_ID;
+                continue;
+            }
+            agent->get_observation_history(histories + i * history_size, config);
+            results[i] = status::OK;
+        }
+        directory_readers--;
+    }
+
+    /**
+     * Pins the observation slab, which contains the observation histories
+     * of all agents (see `agent_store`), and computes where the history of
+     * each of the agents with the given IDs begins in it, so that the
+     * bindings can expose the histories without copying them. The slab is
+     * not freed, even if it is replaced when agents are added, until
+     * `unpin_observations` has been called once for every call to this
+     * function. For any invalid agent ID, the corresponding result is set to
+     * `status::INVALID_AGENT_ID`. Since this acquires the simulator lock, it
+     * must not be called from the `on_step` callback.
+     *
+     * The history of the agent with ID `agent_ids[i]` consists of the last
+     * `history_length` observations, oldest first, starting at
+     * `slab + offsets[i]` (where `slab` is the returned pointer), each of
+     * which is the scent followed by the visual field, starting
+     * `observation_stride(config)` floats apart. Since the simulator writes
+     * the observations in place, these locations only hold the history
+     * until the next time step, or until agents are added or removed, after
+     * which this function must be called again. The slab must not be read
+     * while the simulator computes a time step.
+     *
+     * \param   agent_ids   The array of agent IDs whose histories to locate.
+     * \param   agent_count The length of `agent_ids` and the output arrays.
+     * \param   offsets     The output array of offsets into the slab, in floats.
+     * \param   results     The output array of statuses.
+     * \returns The observation slab.
+     */
+    inline const float* pin_observations(const uint64_t* agent_ids,
+            unsigned int agent_count, size_t* offsets, status* results)
+    {
+        std::unique_lock<std::mutex> lock(simulator_lock);
+        const unsigned int ring_size = config.history_length + 1;
+        for (unsigned int i = 0; i < agent_count; i++) {
+            bool contains;
+            const agent_state* agent = agents.get(agent_ids[i], contains);
+            if (!contains) {
+                results[i] = status::INVALID_AGENT_ID;
+                continue;
+            }
+
+            /* the oldest observation is two slots after the current one (see `agent_state::get_observation_history`) */
+            const float* oldest = agent->history + ((agent->history_head + 2) % ring_size) * store.stride;
+            offsets[i] = (size_t) (oldest - store.observations);
+            results[i] = status::OK;
+        }
+        observation_pins++;
+        return store.observations;
+    }
+
+    /**
+     * Releases a view of the observation slab pinned by `pin_observations`.
+     * Once no view is pinned, the slabs that were replaced in the meantime
+     * are freed.
+     */
+    inline void unpin_observations() {
+        std::unique_lock<std::mutex> lock(simulator_lock);
+        if (--observation_pins > 0) return;
+        while (retired_observations != nullptr) {
+            retired_slab* slab = retired_observations;
+            retired_observations = slab->next;
+            core::free(slab->memory);
+            core::free(slab);
+        }
+    }
+
+    /**
+     * Copies the rewards of the agents with the given IDs in the last time
+     * step, which the simulator evaluates from the reward schema in `config`
+     * (see `simulator_config::reward_item_deltas`). The reward of an agent
+     * that was added since the last time step is 0. For any invalid agent
+     * ID, the corresponding result is set to `status::INVALID_AGENT_ID`.
+     * Since this acquires the simulator lock, it must not be called from
+     * the `on_step` callback.
+     *
+     * \param   agent_ids   The array of agent IDs whose rewards to copy.
+     * \param   agent_count The length of `agent_ids` and the output arrays.
+     * \param   rewards     The output array of rewards.
+     * \param   results     The output array of statuses.
+     */
+    inline void get_rewards(const uint64_t* agent_ids,
+            unsigned int agent_count, float* rewards, status* results)
+    {
+        std::unique_lock<std::mutex> lock(simulator_lock);
+        for (unsigned int i = 0; i < agent_count; i++) {
+            bool contains;
+            agent_state* agent = agents.get(agent_ids[i], contains);
+            if (!contains) {
+                results[i] = status::INVALID_AGENT_ID;
+                continue;
+            }
+            rewards[i] = store.rewards[agent->store_index];
+            results[i] = status::OK;
+        }
+    }
+
+    /**
+     * Retrieves an array of IDs of all agents in this simulation.
+     *
+     * \param   agent_ids The array that will be populated with agent IDs.
+     */
+    inline status get_agent_ids(array<uint64_t>& agent_ids)
+    {
+        std::unique_lock<std::mutex> lock(simulator_lock);
+        if (!agent_ids.ensure_capacity(agent_ids.length + agents.table.size)) {
+            simulator_lock.unlock();
+            return status::OUT_OF_MEMORY;
+        }
+        for (const auto& entry : agents)
+            agent_ids[agent_ids.length++] = entry.key;
+        return status::OK;
+    }
+
+    /**
+     * Retrieves an array of all semaphore IDs in the simulation as well as
+     * whether or not they've been signaled during this turn.
+     *
+     * \param   semaphore_list The array to write the semaphore information.
+     */
+    inline status get_semaphores(array<pair<uint64_t, bool>>& semaphore_list) {
+        std::unique_lock<std::mutex> lock(simulator_lock);
+        if (!semaphore_list.ensure_capacity(semaphore_list.length + semaphores.table.size)) {
+            simulator_lock.unlock();
+            return status::OUT_OF_MEMORY;
+        }
+        for (const auto& entry : semaphores)
+            semaphore_list[semaphore_list.length++] = {entry.key, entry.value};
+        return status::OK;
+    }
+
+    /**
+     * Retrieves the set of patches of the map within the bounding box defined
+     * by `bottom_left_corner` and `top_right_corner`. The patches are stored
+     * in the map `patches`.
+     *
+     * The patches are read from the world_snapshot published at the end of
+     * the last time step, without holding the simulator lock, so this does
+     * not delay `step` or the submission of actions. Only the first call
+     * acquires the simulator lock, to publish the first snapshot.
+     *
+     * Rendered patches are cached, and reused while the patch and its
+     * neighbors are unchanged (and the scent of their items is unchanged).
+     * If `known_versions` is not `nullptr`, any patch whose
+     * `patch_state::version` is `known_versions[patch_position]` is
+     * unchanged since it was returned by a previous call, and it is omitted
+     * from `patches`.
+     *
+     * \param bottom_left_corner The bottom-left corner of the bounding box in
+     *      which to retrieve the map patches.
+     * \param top_right_corner The top-right corner of the bounding box in
+     *      which to retrieve the map patches.
+     * \param patches The output array of array of patch_state structures which
+     *      will contain the state of the retrieved patches. Each inner array
+     *      represents a row of patches that all share the same `y` value in
+     *      their patch positions;
+     * \param known_versions The versions of the patches that the caller
+     *      already has, by patch position, or `nullptr`.
+     */
+    template<bool GetScentMap, bool GetVisionMap>
+    status get_map(
+            position bottom_left_corner,
+            position top_right_corner,
+            array<array<patch_state>>& patches,
+            const hash_map<position, uint64_t>* known_versions = nullptr)
+    {
+        position bottom_left_patch_position, top_right_patch_position;
+        world.world_to_patch_coordinates(bottom_left_corner, bottom_left_patch_position);
+        world.world_to_patch_coordinates(top_right_corner, top_right_patch_position);
+
+        world_snapshot* snapshot = acquire_world_snapshot();
+        if (snapshot == nullptr)
+            return status::OUT_OF_MEMORY;
+
+        status result = status::OK;
+        for (int64_t y = bottom_left_patch_position.y - 1; y <= top_right_patch_position.y && result == status::OK; y++) {
+            size_t index = snapshot->lower_bound(position(bottom_left_patch_position.x - 1, y));
+            if (index == snapshot->patch_count || snapshot->get_patch(index)->patch_position.y != y
+             || snapshot->get_patch(index)->patch_position.x > top_right_patch_position.x)
+                continue;
+
+            if (!patches.ensure_capacity(patches.length + 1)) {
+                result = status::OUT_OF_MEMORY;
+                break;
+            }
+            array<patch_state>& current_row = patches[patches.length];
+            if (!array_init(current_row, 16)) {
+                result = status::OUT_OF_MEMORY;
+                break;
+            }
+            patches.length++;
+
+            for (; index < snapshot->patch_count; index++) {
+                const patch_snapshot& patch = *snapshot->get_patch(index);
+                if (patch.patch_position.y != y || patch.patch_position.x > top_right_patch_position.x)
+                    break;
+                if (!current_row.ensure_capacity(current_row.length + 1)) {
+                    result = status::OUT_OF_MEMORY;
+                    break;
+                }
 
-/**
- * Simulator that forms the core of our experimentation framework.
- *
- * \tparam  SimulatorData   Type to store additional state in the simulation.
- */
-template<typename SimulatorData>
-class simulator {
-    /* Configuration for this simulator. */
-    simulator_config config;
+                uint64_t known_version = 0;
+                if (known_versions != nullptr) {
+                    bool contains;
+                    uint64_t version = known_versions->get(patch.patch_position, contains);
+                    if (contains) known_version = version;
+                }
 
-    /* Map of the world managed by this simulator. */
-    map<patch_data, item_properties> world;
+                /* check if this patch was already rendered */
+                const patch_snapshot* neighbors[9];
+                snapshot->get_neighbors(patch.patch_position, neighbors);
+                render_key key;
+                const bool cacheable = get_render_key<GetScentMap, GetVisionMap>(*snapshot, neighbors, key);
+                patch_state& state = current_row[current_row.length];
+                bool unchanged = false;
+                if (cacheable && rendered_patches.get(patch.patch_position, key, known_version, state, unchanged, config)) {
+                    if (!unchanged) current_row.length++;
+                    continue;
+                }
 
-    /* The diffusion model to simulate scent. */
-    diffusion<double> scent_model;
+                if (!init<GetScentMap, GetVisionMap>(state, config.patch_size,
+                    config.scent_dimension, config.color_dimension,
+                    patch.item_count, patch.agent_count))
+                {
+                    result = status::OUT_OF_MEMORY;
+                    break;
+                }
+                current_row.length++;
+                render_patch<GetScentMap, GetVisionMap>(*snapshot, neighbors, state);
+                state.version = rendered_patches.next_version();
+                if (cacheable)
+                    rendered_patches.put(key, state, config);
+            }
 
-    /* Agents managed by this simulator. */
-    hash_map<uint64_t, agent_state*> agents;
+            if (current_row.length == 0) {
+                core::free(current_row);
+                patches.length--;
+            }
+        }
 
-    /* Semaphores in this simulator. */
-    hash_map<uint64_t, bool> semaphores;
+        release_snapshot(snapshot);
+        return result;
+    }
 
-    /* A counter for assigning IDs to new agents and semaphores. */
-    uint64_t id_counter;
+    /**
+     * Returns a SimulatorData reference associated with this simulator.
+     */
+    inline SimulatorData& get_data() {
+        return data;
+    }
 
-    /* Lock for the agent and semaphore tables, used to prevent simultaneous updates. */
-    std::mutex simulator_lock;
+    /**
+     * Returns a SimulatorData reference associated with this simulator.
+     */
+    inline const SimulatorData& get_data() const {
+        return data;
+    }
 
-    /* A map from positions to a list of agents that request to move there. */
-    hash_map<position, array<agent_state*>> requested_moves;
+    /**
+     * Returns the simulator configuration used to construct this simulator.
+     */
+    inline const simulator_config& get_config() const {
+        return config;
+    }
 
-    /* Lock for the requested_moves map, used to prevent simultaneous updates. */
-    std::mutex requested_move_lock;
+    inline map<patch_data, item_properties>& get_world() {
+        return world;
+    }
 
     /**
-     * Counter for how many agents have acted and how many semaphores have
-     * signaled during each time step. This counter is used to force the
-     * simulator to wait until all agents have acted and all semaphores have
-     * signaled, before advancing the simulation time step.
+     * Initializes `forked` as a fork of this simulator, which can then be
+     * advanced independently, for example to search over sequences of
+     * actions. See `init(simulator<SimulatorData>&, simulator<SimulatorData>&)`.
+     *
+     * This holds the simulator lock, so this simulator does not advance
+     * during the fork, but `act` does not take the lock, so no actions may
+     * be submitted to this simulator concurrently.
      */
-    unsigned int acted_agent_count;
+    inline status fork(simulator<SimulatorData>& forked) {
+        return init(forked, *this);
+    }
 
     /**
-     * The number of active agents and semaphores in the simulation. The
-     * simulation only waits for agents with `agent_active` set to `true`
-     * before advancing time.
+     * Initializes `snapshot` with the current state of this simulator, to
+     * which it can later be reset with `restore`. A snapshot is a fork that
+     * is not advanced, so it shares the patches of the world copy-on-write.
+     * As with `fork`, no actions may be submitted to this simulator
+     * concurrently.
      */
-    unsigned int active_agent_count;
+    inline status snapshot(simulator<SimulatorData>& snapshot) {
+        return init(snapshot, *this);
+    }
 
-    /* For storing additional state in the simulation. */
-    SimulatorData data;
+    /**
+     * Resets this simulator to the state of the given `snapshot`, which was
+     * created by `snapshot` (or `fork`) from this simulator, or from one with
+     * an equivalent configuration. The agents, semaphores, and time are
+     * copied from `snapshot`, and the world is forked from it, so the
+     * patches are shared copy-on-write. Unlike constructing a new
+     * simulator, this reuses the tables, threads, and agent storage of this
+     * simulator, and does not regenerate the world around the agents. The
+     * SimulatorData of this simulator is kept.
+     *
+     * Returns `status::PERMISSION_ERROR` if `snapshot` does not share the
+     * tables of this simulator. If the restore fails, this simulator is
+     * unchanged. No other thread may access this simulator during the
+     * restore, and no actions may be submitted to `snapshot`.
+     */
+    inline status restore(simulator<SimulatorData>& snapshot) {
+        std::unique_lock<std::mutex> lock(simulator_lock);
+        return restore_helper(snapshot);
+    }
 
-    typedef patch<patch_data> patch_type;
+    /**
+     * Resets this simulator to the state of the given `snapshot`, as in
+     * `restore(simulator<SimulatorData>&)`, but seeds the random number
+     * generator of the world with `seed`. The patches that already exist in
+     * `snapshot` are unchanged, but any patches generated afterwards differ
+     * from those that would be generated from `snapshot`.
+     */
+    inline status restore(simulator<SimulatorData>& snapshot, uint_fast32_t seed) {
+        std::unique_lock<std::mutex> lock(simulator_lock);
+        status result = restore_helper(snapshot);
+        if (result == status::OK) {
+            world.rng.seed(seed);
+            world.initial_seed = seed;
+        }
+        return result;
+    }
 
-public:
     /**
-     * Constructs a new simulator with the given simulator_config `conf` and
-     * SimulatorData `data`, calling the copy constructor for `data`.
+     * Starts logging the actions applied in each time step to `file` (see
+     * `action_log_record`), along with the seed of the world and the
+     * configuration of this simulator, so that the simulation can be
+     * reproduced by `replay` without any clients. Every
+     * `new_checkpoint_interval` time steps, the `state_hash` is also logged, so
+     * that `replay` can detect divergence or corruption. Logging must be
+     * started before any agents are added or any patches are generated.
+     *
+     * The log ends when `stop_action_log` is called, or when this simulator
+     * is restored or freed. The caller retains ownership of `file`, which
+     * must remain open until then. Returns `false` if logging could not be
+     * started.
      */
-    simulator(const simulator_config& conf,
-            const SimulatorData& data,
-            uint_fast32_t seed) :
-        config(conf),
-        world(config.patch_size,
-            config.mcmc_iterations,
-            config.item_types.data,
-            (unsigned int) config.item_types.length, seed),
-        agents(32), semaphores(8), id_counter(1), requested_moves(32, alloc_position_keys),
-        acted_agent_count(0), active_agent_count(0), data(data), time(0)
-    {
-        if (!init(scent_model, (double) config.diffusion_param,
-                (double) config.decay_param, config.patch_size, config.deleted_item_lifetime)) {
-            fprintf(stderr, "simulator ERROR: Unable to initialize scent_model.\n");
-            exit(EXIT_FAILURE);
+    inline bool start_action_log(FILE* file, unsigned int new_checkpoint_interval = 100) {
+        std::unique_lock<std::mutex> lock(simulator_lock);
+        if (action_log != nullptr) {
+            fprintf(stderr, "simulator.start_action_log ERROR: This simulator is already logging actions.\n");
+            return false;
+        } else if (time != 0 || agents.table.size != 0 || world.patches.size != 0) {
+            fprintf(stderr, "simulator.start_action_log ERROR: Actions can only be logged from the initial state of the simulator.\n");
+            return false;
+        }
+
+        fixed_width_stream<FILE*> out(file);
+        new_checkpoint_interval = max(1u, new_checkpoint_interval);
+        if (!write(ACTION_LOG_MAGIC, out) || !write(ACTION_LOG_VERSION, out)
+         || !write((uint64_t) world.initial_seed, out)
+         || !write(new_checkpoint_interval, out) || !write(config, out))
+        {
+            fprintf(stderr, "simulator.start_action_log ERROR: Unable to write the header of the action log.\n");
+            return false;
         }
+        action_log = file;
+        checkpoint_interval = new_checkpoint_interval;
+        return true;
     }
 
     /**
-     * Constructs a new simulator with the given simulator_config `conf` and
-     * SimulatorData `data`, calling the copy constructor for `data`.
+     * Ends the action log started by `start_action_log`, and flushes it.
+     * Returns `false` if this simulator is not logging actions, or if the
+     * end of the log could not be written.
      */
-    simulator(const simulator_config& conf,
-            const SimulatorData& data) :
-#if !defined(NDEBUG)
-        simulator(conf, data, 0) { }
+    inline bool stop_action_log() {
+        std::unique_lock<std::mutex> lock(simulator_lock);
+        if (action_log == nullptr) return false;
+        return end_action_log();
+    }
+
+    /**
+     * Returns a hash of the state of this simulator that is reproduced by
+     * `replay`: the time, the position, direction, and collected items of
+     * each agent, and the items of each patch of the world.
+     */
+    inline uint64_t state_hash() {
+        std::unique_lock<std::mutex> lock(simulator_lock);
+        return compute_state_hash();
+    }
+
+    /**
+     * Initializes the uninitialized step_profile `profile` with the time
+     * spent in each phase of the time steps of this simulator, along with
+     * the records of up to `max_recent_steps` of the most recent steps. The
+     * profiler is only compiled in if `JBW_PROFILE` is defined. Otherwise,
+     * the profile is empty and not `enabled`. This function does not
+     * acquire the simulator lock.
+     */
+    inline status get_step_profile(step_profile& profile, unsigned int max_recent_steps = 64) const {
+#if defined(JBW_PROFILE)
+        if (!profiler.get_profile(profile, max_recent_steps))
+            return status::OUT_OF_MEMORY;
 #else
-        simulator(conf, data, (uint_fast32_t) milliseconds()) { }
+        init(profile);
 #endif
+        return status::OK;
+    }
 
-    ~simulator() { free_helper(); }
+    static inline void free(simulator& s) {
+        s.free_helper();
+        core::free(s.agents);
+        core::free(s.store);
+        core::free(s.semaphores);
+        core::free(s.move_requests);
+        core::free(s.move_targets);
+        core::free(s.buffers);
+        core::free(s.dirty_patches);
+        core::free(s.expiring_items);
+        core::free(s.rendered_patches);
+        core::free(s.resampler);
+        core::free(s.config);
+        core::free(s.workers);
+        core::free(s.worker_buffers);
+        core::free(s.world);
+        core::free(s.data);
+        s.simulator_lock.~mutex();
+    }
 
-    /* Current simulation time step. */
-    uint64_t time;
+private:
+    /**
+     * Advances the simulation by one time step, and continues to advance it
+     * while the action plans of the agents submit the remaining actions
+     * that the simulation waits for.
+     *
+     * Precondition: The mutex is locked. This function does not release the mutex.
+     */
+    inline void step() {
+        /* time only advances as dictated by the log during a replay */
+        if (replaying) return;
+        while (step_once() && all_agents_acted()) { }
+    }
 
     /**
-     * Adds a new agent to this simulator. Upon success, `new_agent` and
-     * `new_agent_id` will contain the ID of the new agent as well as a pointer
-     * to its state.
+     * Returns `true` if all active agents have acted and all semaphores have
+     * signaled in the current turn. This must be called after modifying
+     * either counter: the counters are modified and loaded with sequentially
+     * consistent operations, so of any two threads that concurrently modify
+     * them (such as an agent acting in `act` without the lock, and
+     * `set_agent_active`), at least one observes both modifications.
      */
-    inline status add_agent(uint64_t& new_agent_id, agent_state*& new_agent) {
-        simulator_lock.lock();
-        if (!agents.check_size()) {
-            simulator_lock.unlock();
-            fprintf(stderr, "simulator.add_agent ERROR: Failed to expand agent table.\n");
-            return status::OUT_OF_MEMORY;
+    inline bool all_agents_acted() const {
+        unsigned int acted = acted_agent_count.load();
+        return acted == active_agent_count.load();
+    }
+
+    /**
+     * Advances the simulation by one time step. Returns `true` if the action
+     * plans of the agents submitted any actions, for the next turn, that
+     * count toward advancing the simulation.
+     *
+     * Precondition: The mutex is locked. This function does not release the mutex.
+     */
+    inline bool step_once()
+    {
+        JBW_PROFILE_BIND(&profiler);
+        JBW_PROFILE_PHASE(step_timer, step_phase::TOTAL);
+
+        /* collect the submitted actions, which are applied in this step */
+        move_requests.clear();
+        buffers.clear();
+        for (unsigned int i = 0; i < store.length; i++) {
+            agent_state* agent = store.agents[i];
+            store.flags[i] = 0;
+            if ((agent->action_slot & agent_state::ACTION_MASK) != agent_state::ACTION_SUBMITTED)
+                continue;
+            agent->action_slot |= agent_state::ACTION_APPLYING;
+            store.flags[i] = agent_store::ACTION_APPLIED;
+            move_requests[move_requests.length++] = {agent->requested_position, agent->action_sequence, agent, i};
         }
+        if (action_log != nullptr)
+            log_step();
 
-        unsigned int bucket = agents.table.index_to_insert(id_counter);
-        new_agent = (agent_state*) malloc(sizeof(agent_state));
-        new_agent_id = id_counter;
-        if (new_agent == nullptr) {
-            simulator_lock.unlock();
-            return status::OUT_OF_MEMORY;
+        /* group the requested moves by target, in the order in which they were submitted */
+        JBW_PROFILE_PHASE(grouping_timer, step_phase::COLLISIONS);
+        move_targets.clear();
+        if (config.collision_policy != movement_conflict_policy::NO_COLLISIONS) {
+            if (move_requests.length > 1)
+                sort(move_requests);
+            for (unsigned int i = 0; i < move_requests.length; i++) {
+                const move_request& request = move_requests[i];
+                if (i == 0 || request.target != move_requests[i - 1].target)
+                    move_targets[move_targets.length++] = {request.target, i, i + 1, nullptr, false};
+                else move_targets.last().end++;
+
+                /* give preference to agents that don't move */
+                if (store.positions[request.index] == request.target)
+                    core::swap(move_requests[move_targets.last().begin], move_requests[i]);
+            }
+
+            for (move_target& target : move_targets) {
+                if (config.collision_policy == movement_conflict_policy::RANDOM
+                 && store.positions[move_requests[target.begin].index] != target.target)
+                {
+                    /* use the generator of the world, so that the simulation is reproducible from its seed */
+                    unsigned int result = world.rng() % (target.end - target.begin);
+                    core::swap(move_requests[target.begin], move_requests[target.begin + result]);
+                }
+                target.winner = move_requests[target.begin].agent;
+            }
         }
 
-        status init_status = init(*new_agent, world, scent_model, config, time);
-        if (init_status != status::OK) {
-            core::free(new_agent);
-            simulator_lock.unlock();
-            return init_status;
+        JBW_PROFILE_STOP(grouping_timer);
+        JBW_PROFILE_COUNT(step_phase::COLLISIONS, move_targets.length);
+
+        /* generate the patches around each target in order, since new patches are sampled using the random number generator of the world */
+        JBW_PROFILE_PHASE(target_patch_timer, step_phase::PATCH_GENERATION);
+        for (const move_target& target : move_targets) {
+            patch_type* neighborhood[4]; position patch_positions[4];
+            world.get_fixed_neighborhood(target.target, neighborhood, patch_positions);
+        }
+        JBW_PROFILE_STOP(target_patch_timer);
+        JBW_PROFILE_COUNT(step_phase::PATCH_GENERATION, move_targets.length);
+
+        /* check for items that block movement, where each thread checks a subset of the targets */
+        JBW_PROFILE_PHASE(blocking_timer, step_phase::COLLISIONS);
+        std::atomic<unsigned int> next_target(0);
+        auto check_targets = [&](unsigned int thread_id) {
+            for (unsigned int i = next_target++; i < move_targets.length; i = next_target++) {
+                move_target& target = move_targets[i];
+                position patch_position;
+                world.world_to_patch_coordinates(target.target, patch_position);
+                const patch_type& current_patch = world.get_existing_patch(patch_position);
+                for (const item& item : current_patch.items) {
+                    if (item.location == target.target && item.deletion_time == 0
+                     && config.item_types[item.item_type].blocks_movement)
+                    {
+                        target.blocked = true;
+                        break;
+                    }
+                }
+            }
+        };
+        workers.run(check_targets);
+
+        array<position>& occupied_positions = buffers.occupied_positions;
+        for (move_target& target : move_targets) {
+            if (target.blocked) {
+                /* there is an item at our new position that blocks movement */
+                occupied_positions.add(store.positions[move_requests[target.begin].index]);
+                target.winner = nullptr; /* prevent any agent from moving here */
+            }
         }
-        agents.table.keys[bucket] = id_counter;
-        agents.values[bucket] = new_agent;
-        agents.table.size++;
-        active_agent_count++;
-        id_counter++;
-        simulator_lock.unlock();
-        return status::OK;
-    }
 
-    /**
-     * Removes the given agent from this simulator.
-     *
-     * \param   agent_id  ID of the agent to remove.
-     */
-    inline status remove_agent(uint64_t agent_id) {
-        simulator_lock.lock();
-        bool contains; unsigned int bucket;
-        agent_state* agent = agents.get(agent_id, contains, bucket);
-        if (!contains) {
-            simulator_lock.unlock();
-            return status::INVALID_AGENT_ID;
+        /* need to ensure agents don't move into positions where other agents failed to move */
+        while (occupied_positions.length > 0) {
+            move_target* target = get_move_target(occupied_positions.pop());
+            if (target == nullptr || target->winner == nullptr)
+                continue;
+            for (unsigned int i = target->begin; i < target->end; i++)
+                occupied_positions.add(store.positions[move_requests[i].index]);
+            target->winner = nullptr; /* prevent any agent from moving here */
         }
-        agents.remove_at(bucket);
-        agent->lock.lock();
-        if (agent->agent_acted) {
-            unrequest_position(*agent);
-            --acted_agent_count;
+        JBW_PROFILE_STOP(blocking_timer);
+
+        time++;
+        acted_agent_count = 0;
+
+        JBW_PROFILE_PHASE(pickup_timer, step_phase::ITEM_PICKUP);
+
+        /* apply the actions to the agents in order, and record the resulting updates to the patches */
+        array<patch_update>& updates = buffers.updates;
+        for (unsigned int i = 0; i < store.length; i++) {
+            agent_state* agent = store.agents[i];
+            agent->lock.lock();
+            if (!(store.flags[i] & agent_store::ACTION_APPLIED)) continue;
+
+            const position old_position = store.positions[i];
+            const direction old_direction = store.directions[i];
+            const direction new_direction = agent->requested_direction;
+            position new_position = old_position;
+
+            /* check if this agent moved, in accordance with the collision policy */
+            position old_patch_position;
+            world.world_to_patch_coordinates(old_position, old_patch_position);
+            if (config.collision_policy == movement_conflict_policy::NO_COLLISIONS
+                || (agent == get_move_target(agent->requested_position)->winner))
+            {
+                new_position = agent->requested_position;
+
+                /* this may sample new patches, so it must be done in order */
+                patch_type* neighborhood[4]; position patch_positions[4];
+                unsigned int index = world.get_fixed_neighborhood(
+                    new_position, neighborhood, patch_positions);
+                const position& patch_position = patch_positions[index];
+
+                updates[updates.length++] = {patch_position, i, patch_update_type::COLLECT, agent};
+                if (old_patch_position != patch_position) {
+                    updates[updates.length++] = {old_patch_position, i, patch_update_type::LEAVE, agent};
+                    updates[updates.length++] = {patch_position, i, patch_update_type::ENTER, agent};
+                }
+                if (new_position != old_position)
+                    updates[updates.length++] = {patch_position, i, patch_update_type::CHANGE, agent};
+            }
+            if (new_position == old_position && new_direction != old_direction)
+                updates[updates.length++] = {old_patch_position, i, patch_update_type::CHANGE, agent};
+
+            store.positions[i] = new_position;
+            store.directions[i] = new_direction;
+            if (new_position != old_position) store.flags[i] |= agent_store::MOVED;
+            if (new_direction != old_direction) store.flags[i] |= agent_store::TURNED;
+            agent->current_position = new_position;
+            agent->current_direction = new_direction;
+            agent->action_slot &= agent_state::ACTIVE;
         }
-        if (agent->agent_active)
-            --active_agent_count;
-        agent->lock.unlock();
-        core::free(*agent, world, scent_model, config, time);
-        core::free(agent);
 
-        if (acted_agent_count == active_agent_count)
-            step(); /* advance the simulation by one time step */
-        simulator_lock.unlock();
+        /* group the updates by patch, and apply the updates to different patches in parallel */
+        if (updates.length > 1)
+            sort(updates);
+        array<size_t>& patch_offsets = buffers.patch_offsets;
+        for (size_t i = 0; i < updates.length; i++) {
+            if (i == 0 || updates[i].patch_position != updates[i - 1].patch_position)
+                patch_offsets[patch_offsets.length++] = i;
+        }
+        patch_offsets[patch_offsets.length++] = updates.length;
+
+        array<bool>& collected = buffers.collected;
+        for (unsigned int i = 0; i < store.length; i++)
+            collected[i] = false;
+        std::atomic<size_t> next_patch(0);
+        auto update_patches = [&](unsigned int thread_id) {
+            for (size_t i = next_patch++; i + 1 < patch_offsets.length; i = next_patch++)
+                apply_patch_updates(updates.data + patch_offsets[i], updates.data + patch_offsets[i + 1], collected.data);
+        };
+        workers.run(update_patches);
+        for (size_t i = 0; i + 1 < patch_offsets.length; i++)
+            mark_patch_dirty(updates[patch_offsets[i]].patch_position);
+
+        /* schedule the removal of the collected items in the order of the agents */
+        for (unsigned int i = 0; i < store.length; i++) {
+            if (!collected[i]) continue;
+            position patch_position;
+            world.world_to_patch_coordinates(store.positions[i], patch_position);
+            if (!expiring_items.push(time + config.deleted_item_lifetime, patch_position))
+                fprintf(stderr, "simulator.step ERROR: Insufficient memory to schedule the removal of a collected item.\n");
+            JBW_PROFILE_COUNT(step_phase::ITEM_PICKUP, 1);
+        }
+        JBW_PROFILE_STOP(pickup_timer);
+
+        /* evaluate the reward schema for every agent, whose rewards are otherwise always zero */
+        if (has_reward_schema(config))
+            store.compute_rewards(config);
+
+        /* the actions are applied, so threads reading the agents' states
+           only wait for each new observation to be published, rather than
+           for all of them to be computed (see `publish_observation`) */
+        for (unsigned int i = 0; i < store.length; i++)
+            store.agents[i]->lock.unlock();
+
+        /* apply the patches that were resampled in the background, and start resampling the patches near the agents */
+        if (config.resample_interval > 0 && time % config.resample_interval == 0) {
+            apply_resampled_patches();
+            start_resampling();
+        }
 
-        return status::OK;
+#if !defined(NDEBUG)
+        /* check for collisions, if there aren't supposed to be any */
+        if (config.collision_policy != movement_conflict_policy::NO_COLLISIONS) {
+            for (unsigned int i = 0; i < agents.table.capacity; i++) {
+                if (is_empty(agents.table.keys[i])) continue;
+                for (unsigned int j = i + 1; j < agents.table.capacity; j++) {
+                    if (is_empty(agents.table.keys[j])) continue;
+                    if (agents.values[i]->current_position == agents.values[j]->current_position)
+                        fprintf(stderr, "simulator.step WARNING: Agents %u and %u are at the same position.\n", i, j);
+                }
+            }
+        }
+#endif
+
+        /* compute new scent and vision for each agent */
+        update_agent_scent_and_vision();
+
+        /* reset all semaphores to their non-signaled state */
+        for (auto entry : semaphores)
+            entry.value = false;
+
+        if (action_log != nullptr && time % checkpoint_interval == 0)
+            log_checkpoint();
+
+        /* submit the next actions of the agents' plans */
+        bool plans_acted = advance_plans();
+
+        /* publish the new state of the world for `get_map` */
+        update_world_snapshot();
+        free_retired_agents();
+
+        /* Invoke the step callback function for each agent. */
+        JBW_PROFILE_PHASE(on_step_timer, step_phase::ON_STEP);
+        on_step((simulator<SimulatorData>*) this, (const hash_map<uint64_t, agent_state*>&) agents, time);
+        JBW_PROFILE_STOP(on_step_timer);
+
+        JBW_PROFILE_STOP(step_timer);
+#if defined(JBW_PROFILE)
+        profiler.end_step(time);
+#endif
+        return plans_acted;
     }
 
     /**
-     * Adds a new semaphore for this simulator. Upon success,
-     * `new_semaphore_id` will contain the ID of the new semaphore.
+     * Checks the abort conditions of the action plan of each agent, whose
+     * action in this time step was applied, and submits the next action of
+     * each plan that continues, for the next turn. Plans that end are
+     * recorded in `agent_state::plan_state` until the next time step.
+     * Returns `true` if any of the submitted actions count toward advancing
+     * the simulation.
+     *
+     * Precondition: The mutex is locked, and the observations of the agents
+     *               have been computed.
      */
-    inline status add_semaphore(uint64_t& new_semaphore_id) {
-        simulator_lock.lock();
-        if (!semaphores.check_size()) {
-            simulator_lock.unlock();
-            fprintf(stderr, "simulator.create_semaphore ERROR: Failed to expand semaphore table.\n");
-            return status::OUT_OF_MEMORY;
-        }
+    inline bool advance_plans()
+    {
+        unsigned int counted_actions = 0;
+        for (unsigned int i = 0; i < store.length; i++) {
+            agent_state& agent = *store.agents[i];
+            if (agent.plan_state != plan_status::RUNNING) {
+                /* plans that ended in the previous time step were already reported */
+                agent.plan_state = plan_status::NONE;
+                continue;
+            }
 
-        unsigned int bucket = semaphores.table.index_to_insert(id_counter);
-        new_semaphore_id = id_counter;
-        semaphores.table.keys[bucket] = id_counter;
-        semaphores.values[bucket] = false;
-        semaphores.table.size++;
-        active_agent_count++;
-        id_counter++;
-        simulator_lock.unlock();
-        return status::OK;
+            if (agent.plan_pending) {
+                agent.plan_pending = false;
+                if ((agent.plan_abort_conditions & PLAN_ABORT_BLOCKED)
+                 && agent.current_position != agent.requested_position)
+                {
+                    end_plan(agent, plan_status::ABORTED_BLOCKED);
+                    continue;
+                } else if ((agent.plan_abort_conditions & PLAN_ABORT_ITEM_VISIBLE)
+                        && agent.visible_item_count > agent.plan_visible_item_count)
+                {
+                    end_plan(agent, plan_status::ABORTED_ITEM_VISIBLE);
+                    continue;
+                }
+            }
+            agent.plan_visible_item_count = agent.visible_item_count;
+
+            if (agent.plan_position == agent.plan_length)
+                end_plan(agent, plan_status::COMPLETED);
+            else if (submit_plan_action(agent))
+                counted_actions++;
+        }
+        if (counted_actions == 0)
+            return false;
+        acted_agent_count += counted_actions;
+        return true;
     }
 
     /**
-     * Removes the given semaphore from this simulator.
-     *
-     * \param   semaphore_id  ID of the semaphore to remove.
+     * Submits the next action of the plan of the given `agent`, unless the
+     * agent has already acted in the current turn, in which case the plan
+     * resumes in the next turn. Returns `true` if the action counts toward
+     * advancing the simulation.
      */
-    inline status remove_semaphore(uint64_t semaphore_id) {
-        simulator_lock.lock();
-        bool contains; unsigned int bucket;
-        bool signaled = semaphores.get(semaphore_id, contains, bucket);
-        if (!contains) {
-            simulator_lock.unlock();
-            return status::INVALID_SEMAPHORE_ID;
-        }
-        semaphores.remove_at(bucket);
-        if (signaled)
-            --acted_agent_count;
-        --active_agent_count;
+    inline bool submit_plan_action(agent_state& agent) {
+        if (!agent.claim_action())
+            return false;
+        request_action(agent, agent.plan_actions[agent.plan_position++]);
+        agent.action_sequence = action_counter++;
+        agent.plan_pending = true;
+        return agent.submit_action();
+    }
 
-        if (acted_agent_count == active_agent_count)
-            step(); /* advance the simulation by one time step */
-        simulator_lock.unlock();
+    /* Ends the plan of the given `agent`, recording the `result` in `agent.plan_state`. */
+    inline void end_plan(agent_state& agent, plan_status result) {
+        core::free(agent.plan_actions);
+        agent.plan_actions = nullptr;
+        agent.plan_state = result;
+    }
 
-        return status::OK;
+    /* Logs the addition or removal of the agent with the given `agent_id`, if logging is enabled. */
+    inline void log_agent_record(action_log_record type, uint64_t agent_id) {
+        if (action_log == nullptr) return;
+        fixed_width_stream<FILE*> out(action_log);
+        if (!write(type, out) || !write(time, out) || !write(agent_id, out))
+            abort_action_log();
     }
 
     /**
-     * Signals a semaphore in the simulation.
-     *
-     * \param   semaphore_id  ID of the semaphore to signal.
+     * Logs the actions in `move_requests`, which are applied in the current
+     * time step, in the order in which the agents are stored.
      */
-    inline status signal_semaphore(uint64_t semaphore_id) {
-        bool contains;
-        simulator_lock.lock();
-        bool& signaled = semaphores.get(semaphore_id, contains);
-        if (!contains) {
-            simulator_lock.unlock();
-            return status::INVALID_SEMAPHORE_ID;
-        } else if (signaled) {
-            simulator_lock.unlock();
-            return status::SEMAPHORE_ALREADY_SIGNALED;
+    inline void log_step() {
+        fixed_width_stream<FILE*> out(action_log);
+        if (!write(action_log_record::STEP, out) || !write(time, out)
+         || !write(move_requests.length, out))
+        {
+            abort_action_log(); return;
+        }
+        for (const move_request& request : move_requests) {
+            const agent_state* agent = request.agent;
+            if (!write(store.ids[agent->store_index], out)
+             || !write(agent->action_sequence, out)
+             || !write(agent->requested_position, out)
+             || !write(agent->requested_direction, out))
+            {
+                abort_action_log(); return;
+            }
         }
-        signaled = true;
-        if (++acted_agent_count == active_agent_count)
-            step(); /* advance the simulation by one time step */
-        simulator_lock.unlock();
-        return status::OK;
     }
 
-    /**
-     * Sets whether the agent with the given ID is active.
-     */
-    inline status set_agent_active(uint64_t agent_id, bool active) {
-        bool contains;
-        simulator_lock.lock();
-        agent_state* agent_ptr = agents.get(agent_id, contains);
-        if (!contains) {
-            simulator_lock.unlock();
-            return status::INVALID_AGENT_ID;
+    /* Logs the `state_hash` at the current time, and flushes the log. */
+    inline void log_checkpoint() {
+        fixed_width_stream<FILE*> out(action_log);
+        if (!write(action_log_record::CHECKPOINT, out) || !write(time, out)
+         || !write(compute_state_hash(), out))
+        {
+            abort_action_log(); return;
         }
-        agent_state& agent = *agent_ptr;
-        agent.lock.lock();
-        simulator_lock.unlock();
+        fflush(action_log);
+    }
 
-        if (agent.agent_active && !active) {
-            agent.agent_active = false;
-            agent.lock.unlock();
+    /* Writes the end of the action log, flushes it, and disables logging. */
+    inline bool end_action_log() {
+        fixed_width_stream<FILE*> out(action_log);
+        bool success = write(action_log_record::END, out) && fflush(action_log) == 0;
+        action_log = nullptr;
+        return success;
+    }
 
-            simulator_lock.lock();
-            if (acted_agent_count == --active_agent_count)
-                step(); /* advance the simulation by one time step */
-            simulator_lock.unlock();
-        } else if (!agent.agent_active && active) {
-            agent.agent_active = true;
-            agent.lock.unlock();
+    /* Disables logging after the action log could not be written. */
+    inline void abort_action_log() {
+        fprintf(stderr, "simulator ERROR: Unable to write to the action log. Logging has stopped.\n");
+        action_log = nullptr;
+    }
 
-            simulator_lock.lock();
-            active_agent_count++;
-            simulator_lock.unlock();
-        } else {
-            agent.lock.unlock();
+    /* Computes the hash returned by `state_hash`. */
+    inline uint64_t compute_state_hash() const {
+        uint64_t hash = mix_state_hash(0, time);
+
+        /* the agents are hashed in order of their IDs */
+        array<uint64_t> ids(max(1u, store.length));
+        array<unsigned int> indices(max(1u, store.length));
+        for (unsigned int i = 0; i < store.length; i++) {
+            ids[ids.length++] = store.ids[i];
+            indices[indices.length++] = i;
         }
-        return status::OK;
+        if (store.length > 1)
+            sort(ids.data, indices.data, (unsigned int) ids.length);
+        for (unsigned int i = 0; i < ids.length; i++) {
+            const agent_state& agent = *store.agents[indices[i]];
+            hash = mix_state_hash(hash, ids[i]);
+            hash = mix_state_hash(hash, (uint64_t) agent.current_position.x);
+            hash = mix_state_hash(hash, (uint64_t) agent.current_position.y);
+            hash = mix_state_hash(hash, (uint64_t) agent.current_direction);
+            for (unsigned int j = 0; j < config.item_types.length; j++)
+                hash = mix_state_hash(hash, agent.collected_items[j]);
+        }
+
+        /* the patches are combined independently of the order in which they are stored */
+        uint64_t patch_sum = 0;
+        for (const auto& row : world.patches) {
+            for (const auto& entry : row.value) {
+                const patch_type& current_patch = entry.value;
+                uint64_t patch_hash = mix_state_hash(mix_state_hash(0, (uint64_t) entry.key), (uint64_t) row.key);
+                patch_hash = mix_state_hash(patch_hash, current_patch.fixed ? 1 : 0);
+                for (const item& item : current_patch.items) {
+                    patch_hash = mix_state_hash(patch_hash, item.item_type);
+                    patch_hash = mix_state_hash(patch_hash, (uint64_t) item.location.x);
+                    patch_hash = mix_state_hash(patch_hash, (uint64_t) item.location.y);
+                    patch_hash = mix_state_hash(patch_hash, item.creation_time);
+                    patch_hash = mix_state_hash(patch_hash, item.deletion_time);
+                }
+                patch_sum += patch_hash;
+            }
+        }
+        return mix_state_hash(hash, patch_sum);
     }
 
     /**
-     * Sets whether the agent with the given ID is active.
+     * Replays the records of the action log in the stream `in` (see
+     * `replay`). The time steps are advanced by calling `step_once`
+     * directly, without `simulator_lock`, since no other thread may access
+     * this simulator during the replay.
      */
-    inline status is_agent_active(uint64_t agent_id, bool& active) {
-        bool contains;
-        std::unique_lock<std::mutex> lock(simulator_lock);
-        agent_state* agent_ptr = agents.get(agent_id, contains);
-        if (!contains)
-            return status::INVALID_AGENT_ID;
-        active = agent_ptr->agent_active;
-        return status::OK;
+    template<typename Stream>
+    inline bool replay_helper(Stream& in, unsigned int& checkpoint_count)
+    {
+        checkpoint_count = 0;
+        while (true) {
+            action_log_record type;
+            uint64_t record_time;
+            if (!read(type, in)) {
+                fprintf(stderr, "replay WARNING: The action log ended without an end record.\n");
+                return true;
+            } else if (type == action_log_record::END) {
+                return true;
+            } else if (!read(record_time, in)) {
+                fprintf(stderr, "replay ERROR: The action log is truncated.\n");
+                return false;
+            } else if (record_time != time) {
+                fprintf(stderr, "replay ERROR: The action log contains a record at time %llu, but the simulation is at time %llu.\n",
+                        (unsigned long long) record_time, (unsigned long long) time);
+                return false;
+            }
+
+            uint64_t agent_id, hash;
+            agent_state* agent;
+            size_t action_count;
+            switch (type) {
+            case action_log_record::ADD_AGENT:
+                if (!read(agent_id, in)) break;
+                /* semaphores are not logged, so the IDs of the agents may skip values */
+                id_counter = agent_id;
+                if (agents.table.contains(agent_id) || add_agent(agent_id, agent) != status::OK) {
+                    fprintf(stderr, "replay ERROR: Unable to add agent %llu at time %llu.\n",
+                            (unsigned long long) agent_id, (unsigned long long) time);
+                    return false;
+                }
+                continue;
+            case action_log_record::REMOVE_AGENT:
+                if (!read(agent_id, in)) break;
+                if (remove_agent(agent_id) != status::OK) {
+                    fprintf(stderr, "replay ERROR: Unable to remove agent %llu at time %llu.\n",
+                            (unsigned long long) agent_id, (unsigned long long) time);
+                    return false;
+                }
+                continue;
+            case action_log_record::STEP:
+                if (!read(action_count, in)) break;
+                for (size_t i = 0; i < action_count; i++) {
+                    position requested_position;
+                    direction requested_direction;
+                    uint64_t action_sequence;
+                    if (!read(agent_id, in) || !read(action_sequence, in)
+                     || !read(requested_position, in) || !read(requested_direction, in))
+                    {
+                        fprintf(stderr, "replay ERROR: The action log is truncated.\n");
+                        return false;
+                    }
+                    bool contains;
+                    agent = agents.get(agent_id, contains);
+                    if (!contains) {
+                        fprintf(stderr, "replay ERROR: The action log refers to agent %llu at time %llu, which does not exist.\n",
+                                (unsigned long long) agent_id, (unsigned long long) time);
+                        return false;
+                    }
+                    agent->action_sequence = action_sequence;
+                    agent->requested_position = requested_position;
+                    agent->requested_direction = requested_direction;
+                    agent->action_slot = (uint8_t) ((agent->action_slot & agent_state::ACTIVE) | agent_state::ACTION_SUBMITTED);
+                }
+                step_once();
+                continue;
+            case action_log_record::CHECKPOINT:
+                if (!read(hash, in)) break;
+                if (hash != compute_state_hash()) {
+                    fprintf(stderr, "replay ERROR: The simulation diverged from the action log at time %llu.\n",
+                            (unsigned long long) time);
+                    return false;
+                }
+                checkpoint_count++;
+                continue;
+            case action_log_record::END:
+                return true;
+            }
+
+            fprintf(stderr, "replay ERROR: The action log is truncated or contains an invalid record.\n");
+            return false;
+        }
     }
 
     /**
-     * Moves an agent.
-     *
-     * Note that the agent is only actually moved when the simulation time step
-     * advances, and only if the agent has not already acted for the current
-     * time step.
-     *
-     * \param   agent_id  ID of the agent to move.
-     * \param   dir       Direction along which to move, *relative* to the
-     *                    agent's current direction.
-     * \param   num_steps Number of steps to take in the specified direction.
+     * Applies the updates in `[begin, end)`, which are all updates to the
+     * same patch, in order. If the agent at index `i` in the agent store
+     * collects an item, `collected[i]` is set to true. No other thread may
+     * modify this patch, or the agents of these updates, but this function
+     * may be called concurrently for different patches.
      */
-    inline status move(uint64_t agent_id, direction dir, unsigned int num_steps)
+    inline void apply_patch_updates(
+            const patch_update* begin, const patch_update* end, bool* collected)
     {
-        if (num_steps > config.max_steps_per_movement
-         || config.allowed_movement_directions[(size_t) dir] == action_policy::DISALLOWED)
-            return status::PERMISSION_ERROR;
+        patch_type& current_patch = world.get_existing_patch(begin->patch_position);
+        for (const patch_update* update = begin; update != end; update++) {
+            agent_state* agent = update->agent;
+            switch (update->type) {
+            case patch_update_type::LEAVE:
+                current_patch.data.patch_lock.lock();
+                current_patch.data.agents.remove(current_patch.data.agents.index_of(agent));
+                current_patch.data.version++;
+                current_patch.data.patch_lock.unlock();
+                break;
+            case patch_update_type::ENTER:
+                current_patch.data.patch_lock.lock();
+                current_patch.data.agents.add(agent);
+                current_patch.data.patch_lock.unlock();
+                break;
+            case patch_update_type::CHANGE:
+                current_patch.data.version++;
+                break;
+            case patch_update_type::COLLECT:
+                /* delete any items that are automatically picked up at this cell */
+                for (unsigned int j = 0; j < current_patch.items.length; j++) {
+                    const item& item = current_patch.items[j];
+                    if (item.location == agent->current_position && item.deletion_time == 0) {
+                        /* there is an item at our new position */
+                        const unsigned int item_type = item.item_type;
+                        bool collect = true;
+                        for (unsigned int i = 0; i < config.item_types.length; i++) {
+                            if (agent->collected_items[i] < config.item_types[item_type].required_item_counts[i]) {
+                                collect = false; break;
+                            }
+                        }
 
-        bool contains;
-        simulator_lock.lock();
-        agent_state& agent = *agents.get(agent_id, contains);
-        if (!contains) {
-            simulator_lock.unlock();
-            return status::INVALID_AGENT_ID;
+                        /* the items may be shared with a fork, in which case they are copied first */
+                        if (collect && current_patch.unshare_items()) {
+                            /* collect this item */
+                            current_patch.items[j].deletion_time = time;
+                            agent->collected_items[item_type]++;
+                            current_patch.data.version++;
+                            collected[update->sequence] = true;
+
+                            for (unsigned int i = 0; i < config.item_types.length; i++) {
+                                if (agent->collected_items[i] < config.item_types[item_type].required_item_costs[i])
+                                    agent->collected_items[i] = 0;
+                                else agent->collected_items[i] -= config.item_types[item_type].required_item_costs[i];
+                            }
+                        }
+                    }
+                }
+                break;
+            }
         }
-        agent.lock.lock();
-        simulator_lock.unlock();
+    }
 
-        if (agent.agent_acted) {
-            agent.lock.unlock();
-            return status::AGENT_ALREADY_ACTED;
+    /**
+     * Copies the fixed patches within `config.resample_radius` patches of
+     * each agent, along with their neighbors, and starts resampling them in
+     * the background. The results are applied by `apply_resampled_patches`
+     * after `config.resample_interval` time steps.
+     */
+    inline void start_resampling() {
+        if (store.length == 0) return;
+
+        /* collect the positions of the patches near the agents, in a deterministic order */
+        const int64_t radius = config.resample_radius;
+        const size_t width = 2 * (size_t) radius + 1;
+        array<position> patch_positions(store.length * width * width);
+        for (unsigned int i = 0; i < store.length; i++) {
+            position center;
+            world.world_to_patch_coordinates(store.positions[i], center);
+            for (int64_t dy = -radius; dy <= radius; dy++)
+                for (int64_t dx = -radius; dx <= radius; dx++)
+                    patch_positions[patch_positions.length++] = center + position(dx, dy);
         }
-        agent.agent_acted = true;
+        if (patch_positions.length > 1)
+            sort(patch_positions);
 
-        agent.requested_position = agent.current_position;
-        agent.requested_direction = agent.current_direction;
-        if (config.allowed_movement_directions[(size_t) dir] != action_policy::IGNORED) {
-            position diff(0, 0);
-            switch (dir) {
-            case direction::UP   : diff.x = 0; diff.y = num_steps; break;
-            case direction::DOWN : diff.x = 0; diff.y = -((int64_t) num_steps); break;
-            case direction::LEFT : diff.x = -((int64_t) num_steps); diff.y = 0; break;
-            case direction::RIGHT: diff.x = num_steps; diff.y = 0; break;
-            case direction::COUNT: break;
-            }
-
-            switch (agent.current_direction) {
-            case direction::UP: break;
-            case direction::DOWN: diff.x *= -1; diff.y *= -1; break;
-            case direction::LEFT:
-                core::swap(diff.x, diff.y);
-                diff.x *= -1; break;
-            case direction::RIGHT:
-                core::swap(diff.x, diff.y);
-                diff.y *= -1; break;
-            case direction::COUNT: break;
-            }
-
-            agent.requested_position += diff;
-        }
-
-        /* add the agent's move to the list of requested moves */
-        request_position(agent);
-
-        if (agent.agent_active) {
-            agent.lock.unlock();
-            simulator_lock.lock();
-            if (++acted_agent_count == active_agent_count)
-                step(); /* advance the simulation by one time step */
-            simulator_lock.unlock();
-        } else {
-            agent.lock.unlock();
+        resampler.regions = (resample_region*) malloc(sizeof(resample_region) * patch_positions.length);
+        if (resampler.regions == nullptr) {
+            fprintf(stderr, "simulator.start_resampling ERROR: Insufficient memory for regions.\n");
+            return;
         }
-        return status::OK;
+        for (size_t i = 0; i < patch_positions.length; i++) {
+            if (i > 0 && patch_positions[i] == patch_positions[i - 1]) continue;
+            patch_type* current = world.get_patch_if_exists(patch_positions[i]);
+            if (current == nullptr || !current->fixed) continue;
+
+            patch_type* neighbors[9];
+            for (int64_t dy = -1; dy <= 1; dy++)
+                for (int64_t dx = -1; dx <= 1; dx++)
+                    neighbors[(dy + 1) * 3 + (dx + 1)] = world.get_patch_if_exists(patch_positions[i] + position(dx, dy));
+            if (!init(resampler.regions[resampler.region_count], patch_positions[i], neighbors)) {
+                resampler.clear();
+                return;
+            }
+            resampler.region_count++;
+        }
+
+        /* the seed is drawn even if none of the patches are fixed, so that the
+           draws from the world's random number generator are predictable */
+        uint_fast32_t seed = (uint_fast32_t) world.rng();
+        resampler.start(tables->config.item_types.data, (unsigned int) tables->config.item_types.length,
+                config.patch_size, config.resample_iterations, seed, time + config.resample_interval);
     }
 
     /**
-     * Turns an agent.
-     *
-     * Note that the agent is only actually turned when the simulation time
-     * step advances, and only if the agent has not already acted for the
-     * current time step.
-     *
-     * \param   agent_id ID of the agent to move.
-     * \param   dir      Direction to turn, *relative* to the agent's current
-     *                   direction.
+     * Waits for the patches copied by `start_resampling` to be resampled,
+     * and applies the results to the world. Items that the resampling removed
+     * are deleted, unless they were collected in the meantime, and new items
+     * are created, unless another item or an agent now occupies their
+     * location. Thus, the resampled items interact with the scent model and
+     * the expiry of deleted items like collected items do.
      */
-    inline status turn(uint64_t agent_id, direction dir)
-    {
-        if (config.allowed_rotations[(size_t) dir] == action_policy::DISALLOWED)
-            return status::PERMISSION_ERROR;
-
-        bool contains;
-        simulator_lock.lock();
-        agent_state& agent = *agents.get(agent_id, contains);
-        if (!contains) {
-            simulator_lock.unlock();
-            return status::INVALID_AGENT_ID;
+    inline void apply_resampled_patches() {
+        resampler.finish();
+        if (resampler.apply_time != time) {
+            /* the regions were copied before the simulator was restored to a different time */
+            resampler.clear();
+            return;
         }
-        agent.lock.lock();
-        simulator_lock.unlock();
 
-        if (agent.agent_acted) {
-            agent.lock.unlock();
-            return status::AGENT_ALREADY_ACTED;
-        }
-        agent.agent_acted = true;
+        for (unsigned int r = 0; r < resampler.region_count; r++) {
+            const resample_region& region = resampler.regions[r];
+            const array<item>& resampled_items = region.patches[4].items;
+            patch_type& current_patch = world.get_existing_patch(region.patch_position);
+            bool changed = false, deleted = false;
+
+            /* delete the items that were removed by the resampling */
+            for (const item& old_item : region.original_items) {
+                if (contains_item(resampled_items, old_item)) continue;
+                for (unsigned int j = 0; j < current_patch.items.length; j++) {
+                    const item& existing = current_patch.items[j];
+                    if (existing.deletion_time != 0 || existing.location != old_item.location
+                     || existing.item_type != old_item.item_type) continue;
+                    if (!current_patch.unshare_items()) break;
+                    current_patch.items[j].deletion_time = time;
+                    changed = true; deleted = true;
+                    break;
+                }
+            }
 
-        agent.requested_position = agent.current_position;
-        agent.requested_direction = agent.current_direction;
+            /* create the items that were added by the resampling */
+            for (const item& new_item : resampled_items) {
+                if (contains_item(region.original_items, new_item)) continue;
+                bool occupied = false;
+                for (const item& existing : current_patch.items) {
+                    if (existing.deletion_time == 0 && existing.location == new_item.location) {
+                        occupied = true; break;
+                    }
+                }
+                for (const agent_state* agent : current_patch.data.agents) {
+                    if (agent->current_position == new_item.location) {
+                        occupied = true; break;
+                    }
+                }
+                if (occupied) continue;
+                if (!current_patch.unshare_items() || !current_patch.items.add({new_item.item_type, new_item.location, time, 0})) {
+                    fprintf(stderr, "simulator.apply_resampled_patches ERROR: Insufficient memory to add a resampled item.\n");
+                    break;
+                }
+                changed = true;
+            }
 
-        if (config.allowed_rotations[(size_t) dir] != action_policy::IGNORED) {
-            switch (dir) {
-            case direction::UP: break;
-            case direction::DOWN:
-                if (agent.current_direction == direction::UP) agent.requested_direction = direction::DOWN;
-                else if (agent.current_direction == direction::DOWN) agent.requested_direction = direction::UP;
-                else if (agent.current_direction == direction::LEFT) agent.requested_direction = direction::RIGHT;
-                else if (agent.current_direction == direction::RIGHT) agent.requested_direction = direction::LEFT;
-                break;
-            case direction::LEFT:
-                if (agent.current_direction == direction::UP) agent.requested_direction = direction::LEFT;
-                else if (agent.current_direction == direction::DOWN) agent.requested_direction = direction::RIGHT;
-                else if (agent.current_direction == direction::LEFT) agent.requested_direction = direction::DOWN;
-                else if (agent.current_direction == direction::RIGHT) agent.requested_direction = direction::UP;
-                break;
-            case direction::RIGHT:
-                if (agent.current_direction == direction::UP) agent.requested_direction = direction::RIGHT;
-                else if (agent.current_direction == direction::DOWN) agent.requested_direction = direction::LEFT;
-                else if (agent.current_direction == direction::LEFT) agent.requested_direction = direction::UP;
-                else if (agent.current_direction == direction::RIGHT) agent.requested_direction = direction::DOWN;
-                break;
-            case direction::COUNT: break;
+            if (changed) {
+                current_patch.data.version++;
+                mark_patch_dirty(region.patch_position);
             }
+            if (deleted && !expiring_items.push(time + config.deleted_item_lifetime, region.patch_position))
+                fprintf(stderr, "simulator.apply_resampled_patches ERROR: Insufficient memory to schedule the removal of a deleted item.\n");
         }
+        resampler.clear();
+    }
 
-        /* add the agent's move to the list of requested moves */
-        request_position(agent);
+    /* Returns `true` if `items` contains an item of the same type as `query` at the same location. */
+    static inline bool contains_item(const array<item>& items, const item& query) {
+        for (const item& existing : items)
+            if (existing.location == query.location && existing.item_type == query.item_type) return true;
+        return false;
+    }
 
-        if (agent.agent_active) {
-            agent.lock.unlock();
-            simulator_lock.lock();
-            if (++acted_agent_count == active_agent_count)
-                step(); /* advance the simulation by one time step */
-            simulator_lock.unlock();
-        } else {
-            agent.lock.unlock();
+    /* Precondition: This thread has no agent locks. */
+    inline void update_agent_scent_and_vision() {
+        if (!compute_observations())
+            fprintf(stderr, "simulator.update_agent_scent_and_vision ERROR: Insufficient memory to compute agent observations.\n");
+    }
+
+    /**
+     * Removes the items that have expired by the current time, which were
+     * deleted long enough ago that they no longer have any scent, from the
+     * patches in `expiring_items`.
+     */
+    inline void remove_expired_items() {
+        while (expiring_items.is_due(time)) {
+            patch_type& patch = world.get_existing_patch(expiring_items.front().patch_position);
+            if (!remove_expired_items(patch)) return; /* retry in the next time step */
+            mark_patch_dirty(expiring_items.front().patch_position);
+            expiring_items.pop();
         }
-        return status::OK;
+    }
+
+    /* Removes the items in the given patch that were deleted long enough ago that they no longer have any scent. */
+    inline bool remove_expired_items(patch_type& patch) {
+        for (unsigned int j = 0; j < patch.items.length; j++) {
+            const item& item = patch.items[j];
+            if (item.deletion_time > 0 && time >= item.deletion_time + config.deleted_item_lifetime) {
+                if (!patch.unshare_items()) return false;
+                patch.items.remove(j); j--;
+                patch.data.version++;
+            }
+        }
+        return true;
     }
 
     /**
-     * Instructs the agent to do nothing this turn.
+     * Computes the scent and vision of every agent, using the threads in
+     * `workers`. Agents are grouped by the patch they occupy, and each
+     * thread computes the observations of one group at a time, so that
+     * agents that perceive the same patches are processed together. Each
+     * observation is published while holding the lock of its agent.
      *
-     * \param   agent_id ID of the agent.
+     * Precondition: This thread has no agent locks.
      */
-    inline status do_nothing(uint64_t agent_id)
-    {
-        if (!config.no_op_allowed) return status::PERMISSION_ERROR;
+    inline bool compute_observations() {
+        /* create any missing patches first, since this invalidates pointers to existing patches */
+        JBW_PROFILE_PHASE(patch_timer, step_phase::PATCH_GENERATION);
+        array<patch_type*> neighborhood(16);
+        for (unsigned int i = 0; i < store.length; i++) {
+            neighborhood.length = 0;
+            if (!get_perception_neighborhood(world, store.positions[i], config, neighborhood))
+                return false;
+        }
+        JBW_PROFILE_STOP(patch_timer);
+        JBW_PROFILE_COUNT(step_phase::PATCH_GENERATION, store.length);
 
-        bool contains;
-        simulator_lock.lock();
-        agent_state& agent = *agents.get(agent_id, contains);
-        if (!contains) {
-            simulator_lock.unlock();
-            return status::INVALID_AGENT_ID;
+        /* sort the agents by the patch they occupy */
+        unsigned int agent_count = store.length;
+        array<position> agent_patches(max(1u, agent_count));
+        array<agent_state*> ordered_agents(max(1u, agent_count));
+        for (unsigned int i = 0; i < agent_count; i++) {
+            world.world_to_patch_coordinates(store.positions[i], agent_patches[agent_patches.length++]);
+            ordered_agents[ordered_agents.length++] = store.agents[i];
         }
-        agent.lock.lock();
-        simulator_lock.unlock();
+        if (agent_count > 1)
+            sort(agent_patches.data, ordered_agents.data, agent_count);
+
+        /* collect the neighborhood of each agent, along with the first agent of each group */
+        array<patch_type*> neighborhoods(max(1u, 4 * agent_count));
+        array<unsigned int> neighborhood_offsets(agent_count + 1);
+        array<unsigned int> group_offsets(16);
+        for (unsigned int i = 0; i < agent_count; i++) {
+            if ((i == 0 || agent_patches[i] != agent_patches[i - 1]) && !group_offsets.add(i))
+                return false;
+            neighborhood_offsets[i] = (unsigned int) neighborhoods.length;
+            if (!get_perception_neighborhood(world, ordered_agents[i]->current_position, config, neighborhoods))
+                return false;
+        }
+        neighborhood_offsets[agent_count] = (unsigned int) neighborhoods.length;
+        if (!group_offsets.add(agent_count))
+            return false;
+
+        /* remove expired items serially, so that the observations below only read from the world */
+        remove_expired_items();
+
+        std::atomic<unsigned int> next_group(0);
+        std::atomic<bool> success(true);
+        auto compute_group_observations = [&](unsigned int thread_id) {
+            JBW_PROFILE_BIND(&profiler);
+            for (unsigned int g = next_group++; g + 1 < group_offsets.length; g = next_group++) {
+                for (unsigned int i = group_offsets[g]; i < group_offsets[g + 1]; i++) {
+                    if (!ordered_agents[i]->update_state(neighborhoods.data + neighborhood_offsets[i],
+                            neighborhood_offsets[i + 1] - neighborhood_offsets[i],
+                            tables->scent_model, tables->vision, worker_buffers[thread_id], config, time, true))
+                        success = false;
+                }
+            }
+        };
+        workers.run(compute_group_observations);
+        return success;
+    }
 
-        if (agent.agent_acted) {
-            agent.lock.unlock();
-            return status::AGENT_ALREADY_ACTED;
+    /**
+     * Returns `status::PERMISSION_ERROR` if the given action `a` is
+     * disallowed by the simulator configuration, and `status::OK` otherwise.
+     */
+    inline status check_permissions(const action& a) const
+    {
+        switch (a.type) {
+        case action_type::MOVE:
+            if (a.num_steps > config.max_steps_per_movement
+             || config.allowed_movement_directions[(size_t) a.dir] == action_policy::DISALLOWED)
+                return status::PERMISSION_ERROR;
+            return status::OK;
+        case action_type::TURN:
+            if (config.allowed_rotations[(size_t) a.dir] == action_policy::DISALLOWED)
+                return status::PERMISSION_ERROR;
+            return status::OK;
+        case action_type::DO_NOTHING:
+            if (!config.no_op_allowed) return status::PERMISSION_ERROR;
+            return status::OK;
         }
-        agent.agent_acted = true;
+        return status::PERMISSION_ERROR;
+    }
 
+    /**
+     * Writes the requested position and direction of the given `agent`,
+     * whose action slot has been claimed, for the permitted action `a`.
+     */
+    inline void request_action(agent_state& agent, const action& a)
+    {
         agent.requested_position = agent.current_position;
         agent.requested_direction = agent.current_direction;
+        if (a.type == action_type::MOVE) {
+            const direction dir = a.dir;
+            const unsigned int num_steps = a.num_steps;
+            if (config.allowed_movement_directions[(size_t) dir] != action_policy::IGNORED) {
+                position diff(0, 0);
+                switch (dir) {
+                case direction::UP   : diff.x = 0; diff.y = num_steps; break;
+                case direction::DOWN : diff.x = 0; diff.y = -((int64_t) num_steps); break;
+                case direction::LEFT : diff.x = -((int64_t) num_steps); diff.y = 0; break;
+                case direction::RIGHT: diff.x = num_steps; diff.y = 0; break;
+                case direction::COUNT: break;
+                }
 
-        /* add the agent's move to the list of requested moves */
-        request_position(agent);
+                switch (agent.current_direction) {
+                case direction::UP: break;
+                case direction::DOWN: diff.x *= -1; diff.y *= -1; break;
+                case direction::LEFT:
+                    core::swap(diff.x, diff.y);
+                    diff.x *= -1; break;
+                case direction::RIGHT:
+                    core::swap(diff.x, diff.y);
+                    diff.y *= -1; break;
+                case direction::COUNT: break;
+                }
 
-        if (agent.agent_active) {
-            agent.lock.unlock();
-            simulator_lock.lock();
-            if (++acted_agent_count == active_agent_count)
-                step(); /* advance the simulation by one time step */
-            simulator_lock.unlock();
-        } else {
-            agent.lock.unlock();
+                agent.requested_position += diff;
+            }
+        } else if (a.type == action_type::TURN) {
+            const direction dir = a.dir;
+            if (config.allowed_rotations[(size_t) dir] != action_policy::IGNORED) {
+                switch (dir) {
+                case direction::UP: break;
+                case direction::DOWN:
+                    if (agent.current_direction == direction::UP) agent.requested_direction = direction::DOWN;
+                    else if (agent.current_direction == direction::DOWN) agent.requested_direction = direction::UP;
+                    else if (agent.current_direction == direction::LEFT) agent.requested_direction = direction::RIGHT;
+                    else if (agent.current_direction == direction::RIGHT) agent.requested_direction = direction::LEFT;
+                    break;
+                case direction::LEFT:
+                    if (agent.current_direction == direction::UP) agent.requested_direction = direction::LEFT;
+                    else if (agent.current_direction == direction::DOWN) agent.requested_direction = direction::RIGHT;
+                    else if (agent.current_direction == direction::LEFT) agent.requested_direction = direction::DOWN;
+                    else if (agent.current_direction == direction::RIGHT) agent.requested_direction = direction::UP;
+                    break;
+                case direction::RIGHT:
+                    if (agent.current_direction == direction::UP) agent.requested_direction = direction::RIGHT;
+                    else if (agent.current_direction == direction::DOWN) agent.requested_direction = direction::LEFT;
+                    else if (agent.current_direction == direction::LEFT) agent.requested_direction = direction::UP;
+                    else if (agent.current_direction == direction::RIGHT) agent.requested_direction = direction::DOWN;
+                    break;
+                case direction::COUNT: break;
+                }
+            }
         }
-        return status::OK;
     }
 
     /**
-     * Retrieves an array of pointers to agent_state structures, storing them
-     * in `states`, which is parallel to the specified `agent_ids` array, and
-     * has length `agent_count`. For any invalid agent ID, the corresponding
-     * agent_state is set to nullptr.
-     *
-     * NOTE: This function will lock each non-null agent in `states`. The
-     *       caller must unlock them afterwards.
+     * Recreates `directory` from the current agents, and frees the previous
+     * directory once no threads are reading from it.
      *
-     * \param      states The output array of agent_state pointers.
-     * \param   agent_ids The array of agent IDs whose states to retrieve.
-     * \param agent_count The length of `states` and `agent_ids`.
+     * Precondition: The simulator lock is held.
      */
-    inline void get_agent_states(agent_state** states,
-            uint64_t* agent_ids, unsigned int agent_count)
-    {
-        std::unique_lock<std::mutex> lock(simulator_lock);
-        for (unsigned int i = 0; i < agent_count; i++) {
-            bool contains;
-            states[i] = agents.get(agent_ids[i], contains);
-            if (contains) states[i]->lock.lock();
-            else states[i] = nullptr;
+    inline bool update_directory() {
+        agent_directory* new_directory = (agent_directory*) malloc(sizeof(agent_directory));
+        if (new_directory == nullptr) {
+            fprintf(stderr, "simulator.update_directory ERROR: Insufficient memory for agent_directory.\n");
+            return false;
+        } else if (!init(*new_directory, agents)) {
+            core::free(new_directory);
+            return false;
+        }
+
+        agent_directory* old_directory = directory.exchange(new_directory);
+        if (old_directory != nullptr) {
+            while (directory_readers > 0)
+                std::this_thread::yield();
+            core::free(*old_directory);
+            core::free(old_directory);
         }
+        return true;
     }
 
     /**
-     * Retrieves an array of IDs of all agents in this simulation.
+     * Frees the agents in `retired_agents` if no thread is in
+     * `get_agent_states`. Otherwise, they are freed by a later call.
      *
-     * \param   agent_ids The array that will be populated with agent IDs.
+     * Precondition: The simulator lock is held.
      */
-    inline status get_agent_ids(array<uint64_t>& agent_ids)
-    {
-        std::unique_lock<std::mutex> lock(simulator_lock);
-        if (!agent_ids.ensure_capacity(agent_ids.length + agents.table.size)) {
-            simulator_lock.unlock();
-            return status::OUT_OF_MEMORY;
+    inline void free_retired_agents() {
+        if (retired_agents == nullptr || agent_lockers > 0)
+            return;
+        while (retired_agents != nullptr) {
+            agent_state* agent = retired_agents;
+            retired_agents = agent->next_retired;
+            core::free(*agent);
+            core::free(agent);
         }
-        for (const auto& entry : agents)
-            agent_ids[agent_ids.length++] = entry.key;
-        return status::OK;
     }
 
     /**
-     * Retrieves an array of all semaphore IDs in the simulation as well as
-     * whether or not they've been signaled during this turn.
+     * Frees the observation slab `memory`, which was replaced by
+     * `agent_store::ensure_capacity`, unless a view of a slab is pinned (see
+     * `pin_observations`), in which case it is added to
+     * `retired_observations`, and freed once no view is pinned.
      *
-     * \param   semaphore_list The array to write the semaphore information.
+     * Precondition: The simulator lock is held.
      */
-    inline status get_semaphores(array<pair<uint64_t, bool>>& semaphore_list) {
-        std::unique_lock<std::mutex> lock(simulator_lock);
-        if (!semaphore_list.ensure_capacity(semaphore_list.length + semaphores.table.size)) {
-            simulator_lock.unlock();
-            return status::OUT_OF_MEMORY;
+    inline void retire_observations(void* memory) {
+        if (observation_pins == 0) {
+            core::free(memory);
+            return;
         }
-        for (const auto& entry : semaphores)
-            semaphore_list[semaphore_list.length++] = {entry.key, entry.value};
-        return status::OK;
+        retired_slab* slab = (retired_slab*) malloc(sizeof(retired_slab));
+        if (slab == nullptr) {
+            /* the slab may still be read through a pinned view, so it cannot be freed */
+            fprintf(stderr, "simulator.retire_observations ERROR: Insufficient memory to retire the observation slab.\n");
+            return;
+        }
+        slab->memory = memory;
+        slab->next = retired_observations;
+        retired_observations = slab;
     }
 
     /**
-     * Retrieves the set of patches of the map within the bounding box defined
-     * by `bottom_left_corner` and `top_right_corner`. The patches are stored
-     * in the map `patches`.
+     * Publishes a world_snapshot of the current state of the world, and
+     * releases the previously published snapshot. If `reuse_patches` is
+     * true, and no patches were generated since the previous snapshot, the
+     * chunks of the previous snapshot are shared, and only the chunks
+     * containing patches in `dirty_patches` whose version changed are
+     * copied, along with those patches, so this takes time proportional to
+     * the number of chunks, rather than patches. Otherwise, each fixed patch
+     * whose version is unchanged is shared, and the other patches are
+     * copied. Threads reading a snapshot never block this function.
      *
-     * \param bottom_left_corner The bottom-left corner of the bounding box in
-     *      which to retrieve the map patches.
-     * \param top_right_corner The top-right corner of the bounding box in
-     *      which to retrieve the map patches.
-     * \param patches The output array of array of patch_state structures which
-     *      will contain the state of the retrieved patches. Each inner array
-     *      represents a row of patches that all share the same `y` value in
-     *      their patch positions;
+     * Precondition: The simulator lock is held.
      */
-    template<bool GetScentMap, bool GetVisionMap>
-    status get_map(
-            position bottom_left_corner,
-            position top_right_corner,
-            array<array<patch_state>>& patches)
-    {
-        position bottom_left_patch_position, top_right_patch_position;
-        world.world_to_patch_coordinates(bottom_left_corner, bottom_left_patch_position);
-        world.world_to_patch_coordinates(top_right_corner, top_right_patch_position);
-
-        simulator_lock.lock();
-
-        status result = status::OK;
-        apply_contiguous(world.patches, bottom_left_patch_position.y - 1,
-            (unsigned int) (top_right_patch_position.y - bottom_left_patch_position.y + 2),
-            [&](const array_map<int64_t, patch_type>& row, int64_t y)
-        {
-            if (!patches.ensure_capacity(patches.length + 1)) {
-                result = status::OUT_OF_MEMORY;
-                return false;
-            }
-            array<patch_state>& current_row = patches[patches.length];
-            if (!array_init(current_row, 16)) {
-                result = status::OUT_OF_MEMORY;
-                return false;
+    inline bool publish_world(bool reuse_patches) {
+        world_snapshot* new_snapshot = (world_snapshot*) malloc(sizeof(world_snapshot));
+        if (new_snapshot == nullptr) {
+            fprintf(stderr, "simulator.publish_world ERROR: Insufficient memory for world_snapshot.\n");
+            return false;
+        }
+        const world_snapshot* old_snapshot = published_world;
+        const bool reuse_index = reuse_patches && old_snapshot != nullptr
+                && world.generation_count == published_generation;
+        size_t patch_count = 0;
+        if (reuse_index) {
+            patch_count = old_snapshot->patch_count;
+        } else {
+            for (const auto& row : world.patches)
+                patch_count += row.value.size;
+        }
+        const size_t chunk_count = (patch_count + snapshot_chunk::CAPACITY - 1) / snapshot_chunk::CAPACITY;
+        new_snapshot->chunks = (snapshot_chunk**) malloc(sizeof(snapshot_chunk*) * max((size_t) 1, chunk_count));
+        if (new_snapshot->chunks == nullptr) {
+            fprintf(stderr, "simulator.publish_world ERROR: Insufficient memory for world_snapshot.chunks.\n");
+            core::free(new_snapshot); return false;
+        }
+        new_snapshot->time = time;
+        new_snapshot->chunk_count = 0;
+        new_snapshot->patch_count = 0;
+        new (&new_snapshot->references) std::atomic<unsigned int>(1);
+
+        if (reuse_index) {
+            /* the world contains the same patches as the previous snapshot, in the same order */
+            for (size_t i = 0; i < chunk_count; i++) {
+                new_snapshot->chunks[i] = old_snapshot->chunks[i];
+                new_snapshot->chunks[i]->references++;
             }
-            patches.length++;
-
-            apply_contiguous(row, bottom_left_patch_position.x - 1,
-                (unsigned int) (top_right_patch_position.x - bottom_left_patch_position.x + 2),
-                [&](const patch_type& patch, int64_t x)
-            {
-                if (!current_row.ensure_capacity(current_row.length + 1)) {
-                    result = status::OUT_OF_MEMORY;
-                    return false;
-                }
-                patch_state& state = current_row[current_row.length];
-                if (!init<GetScentMap, GetVisionMap>(state, config.patch_size,
-                    config.scent_dimension, config.color_dimension,
-                    (unsigned int) patch.items.length,
-                    (unsigned int) patch.data.agents.length))
-                {
-                    result = status::OUT_OF_MEMORY;
-                    return false;
-                }
-                current_row.length++;
-
-                state.patch_position = position(x, y);
-                state.item_count = 0;
-                state.fixed = patch.fixed;
-                for (unsigned int i = 0; i < patch.items.length; i++) {
-                    if (patch.items[i].deletion_time == 0) {
-                        state.items[state.item_count] = patch.items[i];
-                        state.item_count++;
+            new_snapshot->chunk_count = chunk_count;
+            new_snapshot->patch_count = patch_count;
+
+            for (const position& patch_position : dirty_patches) {
+                size_t index = new_snapshot->lower_bound(patch_position);
+                if (index == patch_count || new_snapshot->get_patch(index)->patch_position != patch_position)
+                    continue;
+                const patch_type& current_patch = world.get_existing_patch(patch_position);
+                if (new_snapshot->get_patch(index)->version == current_patch.data.version)
+                    continue; /* unchanged, or already copied */
+
+                /* copy the chunk containing the patch, unless it was already copied */
+                snapshot_chunk*& chunk = new_snapshot->chunks[index / snapshot_chunk::CAPACITY];
+                if (chunk == old_snapshot->chunks[index / snapshot_chunk::CAPACITY]) {
+                    snapshot_chunk* new_chunk = new_snapshot_chunk();
+                    if (new_chunk == nullptr) {
+                        core::free(*new_snapshot); core::free(new_snapshot);
+                        return false;
+                    }
+                    for (unsigned int i = 0; i < chunk->patch_count; i++) {
+                        new_chunk->patches[i] = chunk->patches[i];
+                        new_chunk->patches[i]->references++;
                     }
+                    new_chunk->patch_count = chunk->patch_count;
+                    release_snapshot(chunk);
+                    chunk = new_chunk;
                 }
 
-                for (unsigned int i = 0; i < patch.data.agents.length; i++) {
-                    state.agent_positions[i] = patch.data.agents[i]->current_position;
-                    state.agent_directions[i] = patch.data.agents[i]->current_direction;
+                patch_snapshot* snapshot = copy_patch(current_patch, patch_position);
+                if (snapshot == nullptr) {
+                    core::free(*new_snapshot); core::free(new_snapshot);
+                    return false;
                 }
-
-                /* consider all patches in the neighborhood of 'patch' */
-                position patch_world_position = position(x, y) * config.patch_size;
-                if (GetScentMap) {
-                    for (unsigned int a = 0; a < config.patch_size; a++) {
-                        for (unsigned int b = 0; b < config.patch_size; b++) {
-                            position current_position = patch_world_position + position(a, b);
-                            patch_type* neighborhood[4]; position patch_positions[4];
-                            unsigned int patch_count = world.get_neighborhood(current_position, neighborhood, patch_positions);
-                            for (unsigned int i = 0; i < patch_count; i++) {
-                                /* iterate over neighboring items, and add their contributions to scent and vision */
-                                for (unsigned int j = 0; j < neighborhood[i]->items.length; j++) {
-                                    const item& item = neighborhood[i]->items[j];
-
-                                    /* check if the item is too old; if so, ignore it */
-                                    if (item.deletion_time > 0 && time >= item.deletion_time + config.deleted_item_lifetime)
-                                        continue;
-
-                                    compute_scent_contribution(scent_model, item, current_position, time,
-                                            config, state.scent + ((a*config.patch_size + b)*config.scent_dimension));
-                                }
-                            }
-                        }
+                patch_snapshot*& entry = chunk->patches[index % snapshot_chunk::CAPACITY];
+                release_snapshot(entry);
+                entry = snapshot;
+            }
+        } else {
+            for (const auto& row : world.patches) {
+                for (const auto& entry : row.value) {
+                    const patch_type& current_patch = entry.value;
+                    const position patch_position(entry.key, row.key);
+
+                    /* the items of patches that are not fixed may be resampled without changing their version */
+                    patch_snapshot* snapshot = nullptr;
+                    if (reuse_patches && old_snapshot != nullptr && current_patch.fixed) {
+                        snapshot = old_snapshot->get(patch_position);
+                        if (snapshot != nullptr && snapshot->fixed && snapshot->version == current_patch.data.version)
+                            snapshot->references++;
+                        else snapshot = nullptr;
                     }
-                }
-
-                if (GetVisionMap) {
-                    for (const item& item : patch.items) {
-                        if (item.deletion_time != 0) continue;
-                        position relative_position = item.location - patch_world_position;
-                        float* pixel = state.vision + ((relative_position.x*config.patch_size + relative_position.y)*config.color_dimension);
-                        for (unsigned int i = 0; i < config.color_dimension; i++)
-                            pixel[i] += config.item_types[item.item_type].color[i];
+                    if (snapshot == nullptr) {
+                        snapshot = copy_patch(current_patch, patch_position);
+                        if (snapshot == nullptr) {
+                            core::free(*new_snapshot); core::free(new_snapshot);
+                            return false;
+                        }
                     }
 
-                    for (const agent_state* agent : patch.data.agents) {
-                        position relative_position = agent->current_position - patch_world_position;
-                        float* pixel = state.vision + ((relative_position.x*config.patch_size + relative_position.y)*config.color_dimension);
-                        for (unsigned int i = 0; i < config.color_dimension; i++)
-                            pixel[i] += config.agent_color[i];
+                    if (new_snapshot->patch_count % snapshot_chunk::CAPACITY == 0) {
+                        snapshot_chunk* new_chunk = new_snapshot_chunk();
+                        if (new_chunk == nullptr) {
+                            release_snapshot(snapshot);
+                            core::free(*new_snapshot); core::free(new_snapshot);
+                            return false;
+                        }
+                        new_snapshot->chunks[new_snapshot->chunk_count++] = new_chunk;
                     }
+                    snapshot_chunk& chunk = *new_snapshot->chunks[new_snapshot->chunk_count - 1];
+                    chunk.patches[chunk.patch_count++] = snapshot;
+                    new_snapshot->patch_count++;
                 }
-
-                return true;
-            });
-
-            if (current_row.length == 0) {
-                core::free(current_row);
-                patches.length--;
             }
-            return true;
-        });
+        }
 
-        simulator_lock.unlock();
-        return result;
+        published_generation = world.generation_count;
+        dirty_patches.clear();
+        replace_world_snapshot(new_snapshot);
+        return true;
+    }
+
+    /* Returns a new patch_snapshot of `current_patch`, or `nullptr` if there is insufficient memory. */
+    inline patch_snapshot* copy_patch(const patch_type& current_patch, const position& patch_position) {
+        patch_snapshot* snapshot = (patch_snapshot*) malloc(sizeof(patch_snapshot));
+        if (snapshot == nullptr || !init(*snapshot, current_patch, patch_position, config.deleted_item_lifetime)) {
+            fprintf(stderr, "simulator.publish_world ERROR: Insufficient memory for patch_snapshot.\n");
+            if (snapshot != nullptr) core::free(snapshot);
+            return nullptr;
+        }
+        return snapshot;
     }
 
     /**
-     * Returns a SimulatorData reference associated with this simulator.
+     * Records that the items or agents of the patch at `patch_position` may
+     * have changed, so that `publish_world` copies it. Nothing is recorded
+     * if no snapshot has been published, since the next one copies every
+     * patch.
      */
-    inline SimulatorData& get_data() {
-        return data;
+    inline void mark_patch_dirty(const position& patch_position) {
+        if (published_world.load() == nullptr) return;
+        if (!dirty_patches.add(patch_position)) {
+            /* the generation count never reaches this, so the next snapshot copies every changed patch */
+            published_generation = UINT64_MAX;
+        }
+    }
+
+    /* Records that the patch containing the world position `location` may have changed (see `mark_patch_dirty`). */
+    inline void mark_dirty(const position& location) {
+        position patch_position;
+        world.world_to_patch_coordinates(location, patch_position);
+        mark_patch_dirty(patch_position);
     }
 
     /**
-     * Returns a SimulatorData reference associated with this simulator.
+     * Replaces `published_world` with `new_snapshot`, which may be
+     * `nullptr`, and releases the previous snapshot once no thread is
+     * acquiring it.
+     *
+     * Precondition: The simulator lock is held.
      */
-    inline const SimulatorData& get_data() const {
-        return data;
+    inline void replace_world_snapshot(world_snapshot* new_snapshot) {
+        world_snapshot* old_snapshot = published_world.exchange(new_snapshot);
+        if (old_snapshot != nullptr) {
+            while (snapshot_readers > 0)
+                std::this_thread::yield();
+            release_snapshot(old_snapshot);
+        }
     }
 
     /**
-     * Returns the simulator configuration used to construct this simulator.
+     * Publishes a new world_snapshot if one has been published before. If
+     * it cannot be published, the previous snapshot is withdrawn, so that
+     * `get_map` never reads an outdated world.
+     *
+     * Precondition: The simulator lock is held.
      */
-    inline const simulator_config& get_config() const {
-        return config;
+    inline void update_world_snapshot(bool reuse_patches = true) {
+        if (published_world.load() != nullptr && !publish_world(reuse_patches))
+            replace_world_snapshot(nullptr);
+        dirty_patches.clear();
     }
 
-    inline map<patch_data, item_properties>& get_world() {
-        return world;
-    }
+    /**
+     * Returns the latest world_snapshot, with an additional reference that
+     * the caller must release with `release_snapshot`. If none has been
+     * published, one is published first. Returns `nullptr` if there is
+     * insufficient memory to publish it.
+     */
+    inline world_snapshot* acquire_world_snapshot() {
+        snapshot_readers++;
+        world_snapshot* snapshot = published_world;
+        if (snapshot != nullptr)
+            snapshot->references++;
+        snapshot_readers--;
+        if (snapshot != nullptr)
+            return snapshot;
 
-    static inline void free(simulator& s) {
-        s.free_helper();
-        core::free(s.agents);
-        core::free(s.semaphores);
-        core::free(s.requested_moves);
-        core::free(s.config);
-        core::free(s.scent_model);
-        core::free(s.world);
-        core::free(s.data);
-        s.simulator_lock.~mutex();
-        s.requested_move_lock.~mutex();
+        std::unique_lock<std::mutex> lock(simulator_lock);
+        if (published_world.load() == nullptr && !publish_world(false))
+            return nullptr;
+        snapshot = published_world;
+        snapshot->references++;
+        return snapshot;
     }
 
-private:
-    /* Precondition: The mutex is locked. This function does not release the mutex. */
-    inline void step()
+    /**
+     * Computes the render_key of the patch whose neighborhood in the
+     * world_snapshot `snapshot` is `neighbors` (as returned by
+     * `world_snapshot::get_neighbors`). Returns false if the patch should
+     * not be cached, since some of these patches are not fixed, and so
+     * their items may be resampled without changing their version.
+     */
+    template<bool GetScentMap, bool GetVisionMap>
+    inline bool get_render_key(const world_snapshot& snapshot,
+            const patch_snapshot* const neighbors[9], render_key& key) const
     {
-        requested_move_lock.lock();
-        if (config.collision_policy == movement_conflict_policy::RANDOM) {
-            for (auto entry : requested_moves) {
-                array<agent_state*>& conflicts = entry.value;
-                if (conflicts[0]->current_position == entry.key) continue; /* give preference to agents that don't move */
-                unsigned int result = sample_uniform((unsigned int)conflicts.length);
-                core::swap(conflicts[0], conflicts[result]);
-            }
-        }
-
-        /* check for items that block movement */
-        array<position> occupied_positions(16);
-        for (auto entry : requested_moves) {
-            patch_type* neighborhood[4]; position patch_positions[4];
-            unsigned int index = world.get_fixed_neighborhood(
-                entry.key, neighborhood, patch_positions);
-            patch_type& current_patch = *neighborhood[index];
-            for (item& item : current_patch.items) {
-                if (item.location == entry.key && item.deletion_time == 0 && config.item_types[item.item_type].blocks_movement) {
-                    /* there is an item at our new position that blocks movement */
-                    array<agent_state*>& conflicts = entry.value;
-                    occupied_positions.add(conflicts[0]->current_position);
-                    conflicts[0] = NULL; /* prevent any agent from moving here */
-                }
+        uint64_t scent_settled_time = 0;
+        for (unsigned int i = 0; i < 9; i++) {
+            if (neighbors[i] == nullptr) {
+                key.versions[i] = UINT64_MAX;
+                continue;
+            } else if (!neighbors[i]->fixed) {
+                return false;
             }
+            key.versions[i] = neighbors[i]->version;
+            scent_settled_time = max(scent_settled_time, neighbors[i]->scent_settled_time);
         }
+        key.scent_time = GetScentMap ? min(snapshot.time, scent_settled_time) : 0;
+        key.has_scent = GetScentMap;
+        key.has_vision = GetVisionMap;
+        return true;
+    }
 
-        /* need to ensure agents don't move into positions where other agents failed to move */
-        if (config.collision_policy != movement_conflict_policy::NO_COLLISIONS) {
-            array<position> occupied_positions(16);
-            for (auto entry : requested_moves) {
-                array<agent_state*>& conflicts = entry.value;
-                for (unsigned int i = 1; i < conflicts.length; i++)
-                    occupied_positions.add(conflicts[i]->current_position);
+    /**
+     * Fills in the given patch_state `state`, which was initialized for the
+     * patch `neighbors[4]` of the world_snapshot `snapshot`, by copying its
+     * items and agents, and computing its scent and visual field, where
+     * `neighbors` is returned by `world_snapshot::get_neighbors`. This does
+     * not read the world, so it does not require the simulator lock.
+     */
+    template<bool GetScentMap, bool GetVisionMap>
+    inline void render_patch(const world_snapshot& snapshot,
+            const patch_snapshot* const neighbors[9], patch_state& state) const
+    {
+        const patch_snapshot& patch = *neighbors[4];
+        state.patch_position = patch.patch_position;
+        state.fixed = patch.fixed;
+        state.item_count = 0;
+        for (unsigned int i = 0; i < patch.item_count; i++) {
+            if (patch.items[i].deletion_time == 0) {
+                state.items[state.item_count] = patch.items[i];
+                state.item_count++;
             }
         }
 
-        bool contains;
-        while (occupied_positions.length > 0) {
-            array<agent_state*>& conflicts = requested_moves.get(occupied_positions.pop(), contains);
-            if (!contains || conflicts[0] == NULL) {
-                continue;
-            }
-            else if (contains) {
-                for (unsigned int i = 0; i < conflicts.length; i++)
-                    occupied_positions.add(conflicts[i]->current_position);
-                conflicts[0] = NULL; /* prevent any agent from moving here */
-            }
+        for (unsigned int i = 0; i < patch.agent_count; i++) {
+            state.agent_positions[i] = patch.agent_positions[i];
+            state.agent_directions[i] = patch.agent_directions[i];
         }
 
-        time++;
-        acted_agent_count = 0;
-        for (auto entry : agents) {
-            agent_state* agent = entry.value;
-            agent->lock.lock();
-            if (!agent->agent_acted) continue;
-
-            agent->current_direction = agent->requested_direction;
-
-            /* check if this agent moved, in accordance with the collision policy */
-            position old_patch_position;
-            world.world_to_patch_coordinates(agent->current_position, old_patch_position);
-            if (config.collision_policy == movement_conflict_policy::NO_COLLISIONS
-                || (agent == requested_moves.get(agent->requested_position)[0]))
-            {
-                agent->current_position = agent->requested_position;
-
-                /* delete any items that are automatically picked up at this cell */
-                patch_type* neighborhood[4]; position patch_positions[4];
-                unsigned int index = world.get_fixed_neighborhood(
-                    agent->current_position, neighborhood, patch_positions);
-                patch_type& current_patch = *neighborhood[index];
-                for (item& item : current_patch.items) {
-                    if (item.location == agent->current_position && item.deletion_time == 0) {
-                        /* there is an item at our new position */
-                        bool collect = true;
-                        for (unsigned int i = 0; i < config.item_types.length; i++) {
-                            if (agent->collected_items[i] < config.item_types[item.item_type].required_item_counts[i]) {
-                                collect = false; break;
-                            }
-                        }
-
-                        if (collect) {
-                            /* collect this item */
-                            item.deletion_time = time;
-                            agent->collected_items[item.item_type]++;
-
-                            for (unsigned int i = 0; i < config.item_types.length; i++) {
-                                if (agent->collected_items[i] < config.item_types[item.item_type].required_item_costs[i])
-                                    agent->collected_items[i] = 0;
-                                else agent->collected_items[i] -= config.item_types[item.item_type].required_item_costs[i];
+        const position patch_world_position = patch.patch_position * config.patch_size;
+        if (GetScentMap) {
+            for (unsigned int a = 0; a < config.patch_size; a++) {
+                for (unsigned int b = 0; b < config.patch_size; b++) {
+                    position current_position = patch_world_position + position(a, b);
+
+                    /* iterate over the same neighborhood, in the same order, as `map::get_neighborhood`, and add the contributions of its items to scent */
+                    const int64_t min_x = (a < config.patch_size / 2) ? -1 : 0;
+                    const int64_t min_y = (b < config.patch_size / 2) ? -1 : 0;
+                    for (int64_t y = min_y; y <= min_y + 1; y++) {
+                        for (int64_t x = min_x; x <= min_x + 1; x++) {
+                            const patch_snapshot* neighbor = neighbors[(y + 1) * 3 + (x + 1)];
+                            if (neighbor == nullptr) continue;
+                            for (unsigned int j = 0; j < neighbor->item_count; j++) {
+                                compute_scent_contribution(tables->scent_model, neighbor->items[j], current_position, snapshot.time,
+                                        config, state.scent + ((a*config.patch_size + b)*config.scent_dimension));
                             }
                         }
                     }
                 }
+            }
+        }
 
-                if (old_patch_position != patch_positions[index]) {
-                    patch_type& prev_patch = world.get_existing_patch(old_patch_position);
-                    prev_patch.data.patch_lock.lock();
-                    prev_patch.data.agents.remove(prev_patch.data.agents.index_of(agent));
-                    prev_patch.data.patch_lock.unlock();
-                    current_patch.data.patch_lock.lock();
-                    current_patch.data.agents.add(agent);
-                    current_patch.data.patch_lock.unlock();
-                }
+        if (GetVisionMap) {
+            for (unsigned int i = 0; i < patch.item_count; i++) {
+                const item& item = patch.items[i];
+                if (item.deletion_time != 0) continue;
+                position relative_position = item.location - patch_world_position;
+                float* pixel = state.vision + ((relative_position.x*config.patch_size + relative_position.y)*config.color_dimension);
+                for (unsigned int j = 0; j < config.color_dimension; j++)
+                    pixel[j] += config.item_types[item.item_type].color[j];
+            }
+
+            for (unsigned int i = 0; i < patch.agent_count; i++) {
+                position relative_position = patch.agent_positions[i] - patch_world_position;
+                float* pixel = state.vision + ((relative_position.x*config.patch_size + relative_position.y)*config.color_dimension);
+                for (unsigned int j = 0; j < config.color_dimension; j++)
+                    pixel[j] += config.agent_color[j];
             }
-            agent->agent_acted = false;
         }
+    }
 
-#if !defined(NDEBUG)
-        /* check for collisions, if there aren't supposed to be any */
-        if (config.collision_policy != movement_conflict_policy::NO_COLLISIONS) {
-            for (unsigned int i = 0; i < agents.table.capacity; i++) {
-                if (is_empty(agents.table.keys[i])) continue;
-                for (unsigned int j = i + 1; j < agents.table.capacity; j++) {
-                    if (is_empty(agents.table.keys[j])) continue;
-                    if (agents.values[i]->current_position == agents.values[j]->current_position)
-                        fprintf(stderr, "simulator.step WARNING: Agents %u and %u are at the same position.\n", i, j);
+    /**
+     * Returns the move_target in `move_targets` with the given `target`
+     * position, or `nullptr` if no agent requested to move there.
+     */
+    inline move_target* get_move_target(const position& target)
+    {
+        unsigned int begin = 0, end = (unsigned int) move_targets.length;
+        while (begin < end) {
+            unsigned int middle = begin + (end - begin) / 2;
+            if (move_targets[middle].target == target)
+                return &move_targets[middle];
+            else if (move_targets[middle].target < target)
+                begin = middle + 1;
+            else end = middle;
+        }
+        return nullptr;
+    }
+
+    /**
+     * Replaces the state of this simulator with that of `snapshot` (see
+     * `restore`). Everything that may fail is allocated before this
+     * simulator is modified.
+     *
+     * Precondition: The simulator lock is held.
+     */
+    inline status restore_helper(simulator<SimulatorData>& snapshot)
+    {
+        if (snapshot.tables != tables)
+            return status::PERMISSION_ERROR;
+        std::unique_lock<std::mutex> snapshot_lock(snapshot.simulator_lock);
+
+        const unsigned int agent_count = snapshot.store.length;
+        void* old_observations;
+        array<uint64_t> semaphore_ids(max((size_t) 1, semaphores.table.size));
+        if (!agents.check_size((unsigned int) snapshot.agents.table.size)
+         || !semaphores.check_size((unsigned int) snapshot.semaphores.table.size)
+         || !move_requests.ensure_capacity(agent_count)
+         || !move_targets.ensure_capacity(agent_count)
+         || !buffers.ensure_capacity(agent_count))
+        {
+            fprintf(stderr, "simulator.restore ERROR: Failed to expand agent and semaphore tables.\n");
+            return status::OUT_OF_MEMORY;
+        } else if (!store.ensure_capacity(agent_count, old_observations)) {
+            fprintf(stderr, "simulator.restore ERROR: Failed to expand agent store.\n");
+            return status::OUT_OF_MEMORY;
+        } else if (old_observations != nullptr) {
+            retire_observations(old_observations);
+        }
+        for (const auto& entry : semaphores)
+            semaphore_ids[semaphore_ids.length++] = entry.key;
+
+        /* the patches being resampled in the snapshot are applied at the same time step here */
+        patch_resampler new_resampler;
+        if (!new_resampler.copy_regions(snapshot.resampler))
+            return status::OUT_OF_MEMORY;
+
+        /* copy the agents of the snapshot, in the order in which `step` visits them */
+        array<agent_state*> new_agents(max(1u, agent_count));
+        hash_map<const agent_state*, agent_state*> forked_agents(snapshot.agents.table.capacity);
+        for (unsigned int i = 0; i < agent_count; i++) {
+            agent_state* agent = (agent_state*) malloc(sizeof(agent_state));
+            if (agent == nullptr || !init(*agent, *snapshot.store.agents[i], config)) {
+                if (agent != nullptr) core::free(agent);
+                for (agent_state* new_agent : new_agents) {
+                    core::free(*new_agent); core::free(new_agent);
                 }
+                return status::OUT_OF_MEMORY;
             }
+            new_agents[new_agents.length++] = agent;
+            forked_agents.put(snapshot.store.agents[i], agent);
         }
-#endif
-
-        /* compute new scent and vision for each agent */
-        update_agent_scent_and_vision();
-
-        /* reset the requested moves */
-        for (auto entry : requested_moves)
-            core::free(entry.value);
-        requested_moves.clear();
-        requested_move_lock.unlock();
-
-        /* reset all semaphores to their non-signaled state */
-        for (auto entry : semaphores)
-            entry.value = false;
 
-        /* Invoke the step callback function for each agent. */
-        on_step((simulator<SimulatorData>*) this, (const hash_map<uint64_t, agent_state*>&) agents, time);
-    }
+        /* fork the world of the snapshot, along with the directory of the new agents */
+        agent_directory* new_directory = (agent_directory*) malloc(sizeof(agent_directory));
+        map<patch_data, item_properties>* new_world =
+                (map<patch_data, item_properties>*) malloc(sizeof(map<patch_data, item_properties>));
+        if (new_directory == nullptr || new_world == nullptr
+         || !init(*new_directory, snapshot.agents))
+        {
+            fprintf(stderr, "simulator.restore ERROR: Insufficient memory for world and agent_directory.\n");
+            if (new_directory != nullptr) core::free(new_directory);
+            if (new_world != nullptr) core::free(new_world);
+            for (agent_state* new_agent : new_agents) {
+                core::free(*new_agent); core::free(new_agent);
+            }
+            return status::OUT_OF_MEMORY;
+        } else if (!init(*new_world, snapshot.world, forked_agents)) {
+            core::free(*new_directory); core::free(new_directory);
+            core::free(new_world);
+            for (agent_state* new_agent : new_agents) {
+                core::free(*new_agent); core::free(new_agent);
+            }
+            return status::OUT_OF_MEMORY;
+        }
+        for (unsigned int i = 0; i < new_directory->length; i++)
+            new_directory->agents[i] = forked_agents.get(new_directory->agents[i]);
+
+        expiry_queue new_expiring_items(snapshot.expiring_items.length);
+        const expiry_queue& snapshot_items = snapshot.expiring_items;
+        for (size_t i = 0; i < snapshot_items.length; i++) {
+            const expiry_entry& entry = snapshot_items.entries[(snapshot_items.start + i) & (snapshot_items.capacity - 1)];
+            new_expiring_items.push(entry.expiry_time, entry.patch_position);
+        }
 
-    /* Precondition: This thread has all agent locks, which it will release. */
-    inline void update_agent_scent_and_vision() {
-        for (auto entry : agents) {
-            agent_state* agent = entry.value;
-            patch_type* neighborhood[4]; position patch_positions[4];
-            world.get_fixed_neighborhood(
-                agent->current_position, neighborhood, patch_positions);
-            agent->update_state(neighborhood, scent_model, config, time);
+        /* replace the agents, which are retired in case a thread in `get_agent_states` is about to lock them */
+        for (unsigned int i = 0; i < store.length; i++) {
+            agent_state* agent = store.agents[i];
+            bool contains; unsigned int bucket;
+            agents.get(store.ids[i], contains, bucket);
+            agents.remove_at(bucket);
+            agent_store::release(*agent);
+            agent->lock.lock();
+            agent->removed = true;
             agent->lock.unlock();
+            agent->next_retired = retired_agents;
+            retired_agents = agent;
         }
-    }
-
-    inline void request_position(agent_state& agent)
-    {
-        /* check for collisions with other agents */
-        if (config.collision_policy == movement_conflict_policy::NO_COLLISIONS)
-            return;
-
-        bool contains; unsigned int bucket;
-        std::unique_lock<std::mutex> lock(requested_move_lock);
-        requested_moves.check_size(alloc_position_keys);
-        array<agent_state*>& agents = requested_moves.get(agent.requested_position, contains, bucket);
-        if (!contains) {
-            array_init(agents, 8);
-            requested_moves.table.keys[bucket] = agent.requested_position;
-            requested_moves.table.size++;
+        store.length = 0;
+        for (unsigned int i = 0; i < agent_count; i++) {
+            agents.put(snapshot.store.ids[i], new_agents[i]);
+            store.add(snapshot.store.ids[i], new_agents[i]);
+            store.copy_agent(i, snapshot.store, i);
         }
-        agents.add(&agent);
-        if (agent.current_position == agent.requested_position)
-            core::swap(agents[0], agents.last());
+        agent_directory* old_directory = directory.exchange(new_directory);
+        while (directory_readers > 0)
+            std::this_thread::yield();
+        core::free(*old_directory);
+        core::free(old_directory);
+        free_retired_agents();
+
+        for (uint64_t semaphore_id : semaphore_ids) {
+            bool contains; unsigned int bucket;
+            semaphores.get(semaphore_id, contains, bucket);
+            semaphores.remove_at(bucket);
+        }
+        for (const auto& entry : snapshot.semaphores)
+            semaphores.put(entry.key, entry.value);
+
+        core::free(world);
+        core::move(*new_world, world);
+        core::free(new_world);
+        expiry_queue::swap(expiring_items, new_expiring_items);
+
+        time = snapshot.time;
+        id_counter = snapshot.id_counter;
+        action_counter = snapshot.action_counter.load();
+        acted_agent_count = snapshot.acted_agent_count.load();
+        active_agent_count = snapshot.active_agent_count.load();
+
+        /* the patch versions of the new world are unrelated to those of the previous snapshot */
+        update_world_snapshot(false);
+        rendered_patches.clear();
+        resampler.clear();
+        resampler.swap_regions(new_resampler);
+
+        /* the restored state cannot be reproduced from the action log */
+        if (action_log != nullptr) {
+            fprintf(stderr, "simulator.restore WARNING: The action log has ended, since the restored state cannot be replayed.\n");
+            end_action_log();
+        }
+        return status::OK;
     }
 
-    inline void unrequest_position(agent_state& agent)
-    {
-        if (!agent.agent_acted || config.collision_policy == movement_conflict_policy::NO_COLLISIONS)
-            return;
-
-        bool contains; unsigned int bucket;
-        std::unique_lock<std::mutex> lock(requested_move_lock);
-        array<agent_state*>& agents = requested_moves.get(agent.requested_position, contains, bucket);
-        if (!contains) return;
-        unsigned int index = agents.index_of(&agent);
-        if (index != agents.length)
-            agents.remove(index);
+    inline void free_helper() {
+        if (action_log != nullptr)
+            end_action_log();
+        /* the resampling thread reads the tables, so it must finish before they are released */
+        resampler.clear();
+        for (unsigned int i = 0; i < store.length; i++) {
+            agent_state* agent = store.agents[i];
+            agent_store::release(*agent);
+            core::free(*agent);
+            core::free(agent);
+        }
+        /* no thread may be in `get_agent_states` while the simulator is freed */
+        while (retired_agents != nullptr) {
+            agent_state* agent = retired_agents;
+            retired_agents = agent->next_retired;
+            core::free(*agent);
+            core::free(agent);
+        }
+        /* nor may any view of the observations be pinned */
+        while (retired_observations != nullptr) {
+            retired_slab* slab = retired_observations;
+            retired_observations = slab->next;
+            core::free(slab->memory);
+            core::free(slab);
+        }
+        agent_directory* current_directory = directory;
+        if (current_directory != nullptr) {
+            core::free(*current_directory);
+            core::free(current_directory);
+        }
+        world_snapshot* current_snapshot = published_world;
+        if (current_snapshot != nullptr)
+            release_snapshot(current_snapshot);
+        release_tables(tables);
     }
 
-    inline void free_helper() {
-        for (auto entry : requested_moves)
-            core::free(entry.value);
-        for (auto entry : agents) {
-            core::free(*entry.value);
-            core::free(entry.value);
+    /* Returns the tables for the given `config`, exiting if they could not be computed. */
+    static inline simulation_tables* acquire_tables_or_exit(const simulator_config& config) {
+        if (!is_valid(config))
+            exit(EXIT_FAILURE);
+        simulation_tables* tables = acquire_tables(config);
+        if (tables == nullptr) {
+            fprintf(stderr, "simulator ERROR: Unable to initialize scent, vision, and item tables.\n");
+            exit(EXIT_FAILURE);
         }
+        return tables;
     }
 
-    template<typename A> friend status init(simulator<A>&, const simulator_config&, const A&, uint_fast32_t);
-    template<typename A, typename B> friend bool read(simulator<A>&, B&, const A&);
+    template<typename A> friend status init(simulator<A>&, const simulator_config&, const A&, uint_fast32_t, unsigned int);
+    template<typename A> friend status init(simulator<A>&, simulator<A>&);
+    template<typename A, typename B> friend bool read(simulator<A>&, B&, const A&, unsigned int);
     template<typename A, typename B> friend bool write(const simulator<A>&, B&);
+    template<typename A, typename B> friend bool replay(simulator<A>&, B&, unsigned int&);
 };
 
 /**
  * Constructs a new simulator with the given simulator_config `config` and
  * SimulatorData `data`, calling the
  * `bool init(SimulatorData&, const SimulatorData&)` function to initialize
- * `data`.
+ * `data`. The observations of the agents are computed by `thread_count`
+ * threads. Returns `status::PERMISSION_ERROR` if `config` is invalid (see
+ * `is_valid`).
  */
 template<typename SimulatorData>
 status init(simulator<SimulatorData>& sim, 
         const simulator_config& config,
         const SimulatorData& data,
-        uint_fast32_t seed)
+        uint_fast32_t seed,
+        unsigned int thread_count)
 {
+    if (!is_valid(config))
+        return status::PERMISSION_ERROR;
     sim.time = 0;
     sim.acted_agent_count = 0;
     sim.active_agent_count = 0;
@@ -2262,31 +7150,106 @@ status init(simulator<SimulatorData>& sim,
         free(sim.data); return status::OUT_OF_MEMORY;
     } else if (!hash_map_init(sim.semaphores, 8)) {
         free(sim.data); free(sim.agents); return status::OUT_OF_MEMORY;
-    } else if (!hash_map_init(sim.requested_moves, 32, alloc_position_keys)) {
+    } else if (!array_init(sim.move_requests, 32)) {
         free(sim.data); free(sim.agents);
         free(sim.semaphores); return status::OUT_OF_MEMORY;
+    } else if (!array_init(sim.move_targets, 32)) {
+        free(sim.data); free(sim.agents);
+        free(sim.semaphores); free(sim.move_requests);
+        return status::OUT_OF_MEMORY;
+    } else if (!array_init(sim.dirty_patches, 16)) {
+        free(sim.data); free(sim.agents); free(sim.semaphores);
+        free(sim.move_requests); free(sim.move_targets);
+        return status::OUT_OF_MEMORY;
+    } else if (!init(sim.buffers, 32)) {
+        free(sim.data); free(sim.agents); free(sim.semaphores);
+        free(sim.move_requests); free(sim.move_targets); free(sim.dirty_patches);
+        return status::OUT_OF_MEMORY;
     } else if (!init(sim.config, config)) {
         free(sim.data); free(sim.agents); free(sim.semaphores);
-        free(sim.requested_moves); return status::OUT_OF_MEMORY;
-    } else if (!init(sim.scent_model, (double) sim.config.diffusion_param,
-            (double) sim.config.decay_param, sim.config.patch_size, sim.config.deleted_item_lifetime)) {
+        free(sim.move_requests); free(sim.move_targets); free(sim.dirty_patches); free(sim.buffers);
+        return status::OUT_OF_MEMORY;
+    } else if ((sim.tables = acquire_tables(sim.config)) == nullptr) {
         free(sim.data); free(sim.config);
         free(sim.agents); free(sim.semaphores);
-        free(sim.requested_moves); return status::OUT_OF_MEMORY;
+        free(sim.move_requests); free(sim.move_targets); free(sim.dirty_patches); free(sim.buffers);
+        return status::OUT_OF_MEMORY;
     } else if (!init(sim.world, sim.config.patch_size,
-            sim.config.mcmc_iterations,
-            sim.config.item_types.data,
-            (unsigned int) sim.config.item_types.length, seed)) {
+            sim.config.mcmc_iterations, sim.tables->cache, seed)) {
+        free(sim.config); free(sim.data);
+        free(sim.agents); free(sim.semaphores);
+        free(sim.move_requests); free(sim.move_targets); free(sim.dirty_patches); free(sim.buffers);
+        release_tables(sim.tables); return status::OUT_OF_MEMORY;
+    } else if (!init(sim.workers, thread_count)) {
+        free(sim.config); free(sim.data);
+        free(sim.agents); free(sim.semaphores);
+        free(sim.move_requests); free(sim.move_targets); free(sim.dirty_patches); free(sim.buffers); release_tables(sim.tables);
+        free(sim.world);
+        return status::OUT_OF_MEMORY;
+    } else if (!init(sim.worker_buffers, thread_count, sim.tables->vision.cell_count)) {
+        free(sim.config); free(sim.data);
+        free(sim.agents); free(sim.semaphores);
+        free(sim.move_requests); free(sim.move_targets); free(sim.dirty_patches); free(sim.buffers); release_tables(sim.tables);
+        free(sim.world); free(sim.workers);
+        return status::OUT_OF_MEMORY;
+    } else if (!init(sim.store, sim.config, 32)) {
+        free(sim.config); free(sim.data);
+        free(sim.agents); free(sim.semaphores);
+        free(sim.move_requests); free(sim.move_targets); free(sim.dirty_patches); free(sim.buffers); release_tables(sim.tables);
+        free(sim.world); free(sim.workers); free(sim.worker_buffers);
+        return status::OUT_OF_MEMORY;
+    } else if (!init(sim.expiring_items, 64)) {
         free(sim.config); free(sim.data);
         free(sim.agents); free(sim.semaphores);
-        free(sim.requested_moves); free(sim.scent_model);
+        free(sim.move_requests); free(sim.move_targets); free(sim.dirty_patches); free(sim.buffers); release_tables(sim.tables);
+        free(sim.world); free(sim.workers); free(sim.worker_buffers); free(sim.store);
         return status::OUT_OF_MEMORY;
     }
+
+    sim.directory = nullptr;
+    sim.directory_readers = 0;
+    sim.agent_lockers = 0;
+    sim.retired_agents = nullptr;
+    sim.observation_pins = 0;
+    sim.retired_observations = nullptr;
+    sim.published_world = nullptr;
+    sim.published_generation = 0;
+    sim.snapshot_readers = 0;
+    sim.action_log = nullptr;
+    sim.checkpoint_interval = 0;
+    sim.replaying = false;
+    sim.action_counter = 0;
+    if (!sim.update_directory()) {
+        free(sim.config); free(sim.data);
+        free(sim.agents); free(sim.semaphores);
+        free(sim.move_requests); free(sim.move_targets); free(sim.dirty_patches); free(sim.buffers); release_tables(sim.tables);
+        free(sim.world); free(sim.workers); free(sim.worker_buffers); free(sim.store);
+        free(sim.expiring_items); return status::OUT_OF_MEMORY;
+    }
+    init(sim.rendered_patches);
+    init(sim.resampler);
+#if defined(JBW_PROFILE)
+    init(sim.profiler);
+#endif
     new (&sim.simulator_lock) std::mutex();
-    new (&sim.requested_move_lock) std::mutex();
     return status::OK;
 }
 
+/**
+ * Constructs a new simulator with the given simulator_config `config` and
+ * SimulatorData `data`, calling the
+ * `bool init(SimulatorData&, const SimulatorData&)` function to initialize
+ * `data`. The observations of the agents are computed by a single thread.
+ */
+template<typename SimulatorData>
+inline status init(simulator<SimulatorData>& sim, 
+        const simulator_config& config,
+        const SimulatorData& data,
+        uint_fast32_t seed)
+{
+    return init(sim, config, data, seed, 1);
+}
+
 /**
  * Constructs a new simulator with the given simulator_config `config` and
  * SimulatorData `data`, calling the
@@ -2306,6 +7269,173 @@ inline status init(simulator<SimulatorData>& sim,
     return init(sim, config, data, seed);
 }
 
+/**
+ * Initializes the given simulator `sim` as a fork of `src`: a copy that can
+ * be advanced independently of `src`, and which evolves identically to `src`
+ * given the same actions. The agents, semaphores, time, and SimulatorData
+ * (by calling `bool init(SimulatorData&, const SimulatorData&)`) are copied.
+ * The patches of the world are shared with `src` copy-on-write, so no items
+ * are copied until either simulator modifies them, and the scent, vision,
+ * and item tables are shared as well. This makes forking much cheaper than
+ * copying the simulator with `write` and `read`.
+ *
+ * The simulator lock of `src` is held during the fork, so `src` does not
+ * advance, but no actions may be submitted to `src` concurrently.
+ */
+template<typename SimulatorData>
+status init(simulator<SimulatorData>& sim, simulator<SimulatorData>& src)
+{
+    std::unique_lock<std::mutex> lock(src.simulator_lock);
+
+    /* the patches being resampled are copied, so that the fork applies the same items as `src` */
+    patch_resampler resampler;
+    if (!resampler.copy_regions(src.resampler))
+        return status::OUT_OF_MEMORY;
+
+    sim.time = src.time;
+    sim.acted_agent_count = src.acted_agent_count.load();
+    sim.active_agent_count = src.active_agent_count.load();
+    sim.id_counter = src.id_counter;
+    if (!init(sim.data, src.data)) {
+        return status::OUT_OF_MEMORY;
+    } else if (!init(sim.config, src.config)) {
+        free(sim.data); return status::OUT_OF_MEMORY;
+    } else if (!hash_map_init(sim.agents, src.agents.table.capacity)) {
+        free(sim.data); free(sim.config);
+        return status::OUT_OF_MEMORY;
+    } else if (!hash_map_init(sim.semaphores, src.semaphores.table.capacity)) {
+        free(sim.data); free(sim.config);
+        free(sim.agents); return status::OUT_OF_MEMORY;
+    } else if (!array_init(sim.move_requests, src.move_requests.capacity)) {
+        free(sim.data); free(sim.config);
+        free(sim.agents); free(sim.semaphores);
+        return status::OUT_OF_MEMORY;
+    } else if (!array_init(sim.move_targets, src.move_targets.capacity)) {
+        free(sim.data); free(sim.config);
+        free(sim.agents); free(sim.semaphores);
+        free(sim.move_requests); return status::OUT_OF_MEMORY;
+    } else if (!array_init(sim.dirty_patches, 16)) {
+        free(sim.data); free(sim.config);
+        free(sim.agents); free(sim.semaphores);
+        free(sim.move_requests); free(sim.move_targets);
+        return status::OUT_OF_MEMORY;
+    } else if (!init(sim.buffers, src.move_requests.capacity)) {
+        free(sim.data); free(sim.config);
+        free(sim.agents); free(sim.semaphores);
+        free(sim.move_requests); free(sim.move_targets); free(sim.dirty_patches);
+        return status::OUT_OF_MEMORY;
+    }
+    for (const auto& entry : src.semaphores)
+        sim.semaphores.put(entry.key, entry.value);
+
+    /* copy the agents, keeping track of the copy of each agent for the patches below */
+    hash_map<const agent_state*, agent_state*> forked_agents(src.agents.table.capacity);
+    for (const auto& entry : src.agents) {
+        agent_state* agent = (agent_state*) malloc(sizeof(agent_state));
+        if (agent == nullptr || !init(*agent, *entry.value, sim.config)) {
+            if (agent != nullptr) free(agent);
+            for (auto forked : sim.agents) {
+                free(*forked.value); free(forked.value);
+            }
+            free(sim.data); free(sim.config);
+            free(sim.agents); free(sim.semaphores);
+            free(sim.move_requests); free(sim.move_targets); free(sim.dirty_patches); free(sim.buffers);
+            return status::OUT_OF_MEMORY;
+        }
+        sim.agents.put(entry.key, agent);
+        forked_agents.put(entry.value, agent);
+    }
+
+    /* the scent model, visual field geometry, Gibbs field cache, and items are shared */
+    sim.tables = src.tables;
+    retain_tables(sim.tables);
+    if (!init(sim.world, src.world, forked_agents)) {
+        for (auto entry : sim.agents) {
+            free(*entry.value); free(entry.value);
+        }
+        free(sim.data); free(sim.config);
+        free(sim.agents); free(sim.semaphores);
+        free(sim.move_requests); free(sim.move_targets); free(sim.dirty_patches); free(sim.buffers);
+        release_tables(sim.tables); return status::OUT_OF_MEMORY;
+    } else if (!init(sim.workers, src.workers.thread_count)) {
+        for (auto entry : sim.agents) {
+            free(*entry.value); free(entry.value);
+        }
+        free(sim.data); free(sim.config);
+        free(sim.agents); free(sim.semaphores);
+        free(sim.move_requests); free(sim.move_targets); free(sim.dirty_patches); free(sim.buffers);
+        release_tables(sim.tables); free(sim.world);
+        return status::OUT_OF_MEMORY;
+    } else if (!init(sim.worker_buffers, src.workers.thread_count, sim.tables->vision.cell_count)) {
+        for (auto entry : sim.agents) {
+            free(*entry.value); free(entry.value);
+        }
+        free(sim.data); free(sim.config);
+        free(sim.agents); free(sim.semaphores);
+        free(sim.move_requests); free(sim.move_targets); free(sim.dirty_patches); free(sim.buffers);
+        release_tables(sim.tables); free(sim.world);
+        free(sim.workers); return status::OUT_OF_MEMORY;
+    } else if (!init(sim.store, sim.config, src.store.length)) {
+        for (auto entry : sim.agents) {
+            free(*entry.value); free(entry.value);
+        }
+        free(sim.data); free(sim.config);
+        free(sim.agents); free(sim.semaphores);
+        free(sim.move_requests); free(sim.move_targets); free(sim.dirty_patches); free(sim.buffers);
+        release_tables(sim.tables); free(sim.world);
+        free(sim.workers); free(sim.worker_buffers); return status::OUT_OF_MEMORY;
+    } else if (!init(sim.expiring_items, src.expiring_items)) {
+        for (auto entry : sim.agents) {
+            free(*entry.value); free(entry.value);
+        }
+        free(sim.data); free(sim.config);
+        free(sim.agents); free(sim.semaphores);
+        free(sim.move_requests); free(sim.move_targets); free(sim.dirty_patches); free(sim.buffers);
+        release_tables(sim.tables); free(sim.world);
+        free(sim.workers); free(sim.worker_buffers); free(sim.store);
+        return status::OUT_OF_MEMORY;
+    }
+
+    sim.directory = nullptr;
+    sim.directory_readers = 0;
+    sim.agent_lockers = 0;
+    sim.retired_agents = nullptr;
+    sim.observation_pins = 0;
+    sim.retired_observations = nullptr;
+    sim.published_world = nullptr;
+    sim.published_generation = 0;
+    sim.snapshot_readers = 0;
+    sim.action_log = nullptr;
+    sim.checkpoint_interval = 0;
+    sim.replaying = false;
+    sim.action_counter = src.action_counter.load();
+    if (!sim.update_directory()) {
+        for (auto entry : sim.agents) {
+            free(*entry.value); free(entry.value);
+        }
+        free(sim.data); free(sim.config);
+        free(sim.agents); free(sim.semaphores);
+        free(sim.move_requests); free(sim.move_targets); free(sim.dirty_patches); free(sim.buffers);
+        release_tables(sim.tables); free(sim.world);
+        free(sim.workers); free(sim.worker_buffers); free(sim.store);
+        free(sim.expiring_items); return status::OUT_OF_MEMORY;
+    }
+
+    /* add the agents to the store in the same order as `src`, so that `step` visits them in the same order */
+    for (unsigned int i = 0; i < src.store.length; i++) {
+        sim.store.add(src.store.ids[i], forked_agents.get(src.store.agents[i]));
+        sim.store.copy_agent(i, src.store, i);
+    }
+    init(sim.rendered_patches);
+    init(sim.resampler);
+    sim.resampler.swap_regions(resampler);
+#if defined(JBW_PROFILE)
+    init(sim.profiler);
+#endif
+    new (&sim.simulator_lock) std::mutex();
+    return status::OK;
+}
+
 template<typename Stream>
 inline bool read(agent_state*& agent, Stream& in,
         const hash_map<uint64_t, agent_state*>& agents)
@@ -2326,16 +7456,21 @@ inline bool write(const agent_state* agent, Stream& out,
 /**
  * Reads the given simulator `sim` from the input stream `in`. The
  * SimulatorData of `sim` is not read from `in`. Rather, it is initialized by
- * the given `data` argument.
+ * the given `data` argument. The observations of the agents are computed by
+ * `thread_count` threads, which is not stored in the stream. The version of
+ * the format is determined by the simulator_config at the start of the
+ * stream (see `SIMULATOR_FORMAT_VERSION`).
  *
  * \returns `true` if successful; `false` otherwise.
  */
 template<typename SimulatorData, typename Stream>
-bool read(simulator<SimulatorData>& sim, Stream& in, const SimulatorData& data)
+bool read(simulator<SimulatorData>& sim, Stream& in,
+        const SimulatorData& data, unsigned int thread_count)
 {
+    uint32_t version;
     if (!init(sim.data, data)) {
         return false;
-    } if (!read(sim.config, in)) {
+    } if (!read(sim.config, in, version)) {
         free(sim.data); return false;
     }
 
@@ -2369,7 +7504,10 @@ bool read(simulator<SimulatorData>& sim, Stream& in, const SimulatorData& data)
         free(sim.config); return false;
     }
 
-    if (!read(sim.world, in, sim.config.item_types.data, (unsigned int) sim.config.item_types.length, sim.agents)) {
+    /* the scent model, visual field geometry, and Gibbs field cache are shared */
+    sim.tables = acquire_tables(sim.config);
+    if (sim.tables == nullptr || !read(sim.world, in, sim.tables->cache, sim.agents)) {
+        if (sim.tables != nullptr) release_tables(sim.tables);
         for (auto entry : sim.agents) {
             free(*entry.value); free(entry.value);
         }
@@ -2378,41 +7516,204 @@ bool read(simulator<SimulatorData>& sim, Stream& in, const SimulatorData& data)
         free(sim.config); return false;
     }
 
+    /* move requests are only stored within `step`, so this map is always
+       empty, and is only read for compatibility with the serialized format */
     default_scribe scribe;
-    if (!read(sim.requested_moves, in, alloc_position_keys, scribe, sim.agents)) {
+    hash_map<position, array<agent_state*>>* requested_moves = (hash_map<position, array<agent_state*>>*)
+            malloc(sizeof(hash_map<position, array<agent_state*>>));
+    if (requested_moves == nullptr || !read(*requested_moves, in, alloc_position_keys, scribe, sim.agents)) {
+        if (requested_moves != nullptr) free(requested_moves);
         for (auto entry : sim.agents) {
             free(*entry.value); free(entry.value);
         }
         free(sim.semaphores);
         free(sim.data); free(sim.agents);
         free(sim.config); free(sim.world);
-        return false;
+        release_tables(sim.tables); return false;
+    }
+    for (auto entry : *requested_moves)
+        free(entry.value);
+    free(*requested_moves); free(requested_moves);
+
+    /* `add_agent` ensures these have enough capacity for every agent */
+    size_t move_capacity = max((size_t) 32, (size_t) sim.agents.table.size);
+    if (!array_init(sim.move_requests, move_capacity)) {
+        for (auto entry : sim.agents) {
+            free(*entry.value); free(entry.value);
+        }
+        free(sim.semaphores);
+        free(sim.data); free(sim.agents);
+        free(sim.config); free(sim.world);
+        release_tables(sim.tables); return false;
+    } else if (!array_init(sim.move_targets, move_capacity)) {
+        for (auto entry : sim.agents) {
+            free(*entry.value); free(entry.value);
+        }
+        free(sim.semaphores); free(sim.move_requests);
+        free(sim.data); free(sim.agents);
+        free(sim.config); free(sim.world);
+        release_tables(sim.tables); return false;
+    } else if (!array_init(sim.dirty_patches, 16)) {
+        for (auto entry : sim.agents) {
+            free(*entry.value); free(entry.value);
+        }
+        free(sim.semaphores); free(sim.move_requests); free(sim.move_targets);
+        free(sim.data); free(sim.agents);
+        free(sim.config); free(sim.world);
+        release_tables(sim.tables); return false;
+    } else if (!init(sim.buffers, move_capacity)) {
+        for (auto entry : sim.agents) {
+            free(*entry.value); free(entry.value);
+        }
+        free(sim.semaphores); free(sim.move_requests); free(sim.move_targets); free(sim.dirty_patches);
+        free(sim.data); free(sim.agents);
+        free(sim.config); free(sim.world);
+        release_tables(sim.tables); return false;
     }
 
-    /* reinitialize the scent model */
+    unsigned int acted_agent_count, active_agent_count;
     if (!read(sim.time, in)
-     || !read(sim.acted_agent_count, in)
-     || !read(sim.active_agent_count, in)
-     || !read(sim.id_counter, in)
-     || !init(sim.scent_model, (double) sim.config.diffusion_param,
-            (double) sim.config.decay_param, sim.config.patch_size,
-            sim.config.deleted_item_lifetime))
+     || !read(acted_agent_count, in)
+     || !read(active_agent_count, in)
+     || !read(sim.id_counter, in))
     {
         for (auto entry : sim.agents) {
             free(*entry.value); free(entry.value);
         }
-        for (auto entry : sim.requested_moves)
-            free(entry.value);
-        free(sim.semaphores);
+        free(sim.semaphores); release_tables(sim.tables);
+        free(sim.data); free(sim.world); free(sim.agents);
+        free(sim.move_requests); free(sim.move_targets); free(sim.dirty_patches); free(sim.buffers); free(sim.config);
+        return false;
+    }
+
+    sim.acted_agent_count = acted_agent_count;
+    sim.active_agent_count = active_agent_count;
+
+    patch_resampler resampler;
+    if (version >= 2 && !read(resampler, in)) {
+        for (auto entry : sim.agents) {
+            free(*entry.value); free(entry.value);
+        }
+        free(sim.semaphores); release_tables(sim.tables);
+        free(sim.data); free(sim.world); free(sim.agents);
+        free(sim.move_requests); free(sim.move_targets); free(sim.dirty_patches); free(sim.buffers); free(sim.config);
+        return false;
+    }
+
+    /* start the worker threads */
+    if (!init(sim.workers, thread_count)) {
+        for (auto entry : sim.agents) {
+            free(*entry.value); free(entry.value);
+        }
+        free(sim.semaphores); release_tables(sim.tables);
+        free(sim.data); free(sim.world); free(sim.agents);
+        free(sim.move_requests); free(sim.move_targets); free(sim.dirty_patches); free(sim.buffers); free(sim.config);
+        return false;
+    } else if (!init(sim.worker_buffers, thread_count, sim.tables->vision.cell_count)) {
+        for (auto entry : sim.agents) {
+            free(*entry.value); free(entry.value);
+        }
+        free(sim.semaphores); release_tables(sim.tables);
+        free(sim.data); free(sim.world); free(sim.agents); free(sim.workers);
+        free(sim.move_requests); free(sim.move_targets); free(sim.dirty_patches); free(sim.buffers); free(sim.config);
+        return false;
+    }
+
+    /* allocate the contiguous agent storage */
+    if (!init(sim.store, sim.config, agent_count)) {
+        for (auto entry : sim.agents) {
+            free(*entry.value); free(entry.value);
+        }
+        free(sim.semaphores); release_tables(sim.tables);
+        free(sim.data); free(sim.world); free(sim.agents); free(sim.workers); free(sim.worker_buffers);
+        free(sim.move_requests); free(sim.move_targets); free(sim.dirty_patches); free(sim.buffers); free(sim.config);
+        return false;
+    }
+
+    /* schedule the removal of the deleted items, in the order in which they expire */
+    array<expiry_entry> deleted_items(64);
+    for (const auto& row : sim.world.patches) {
+        for (const auto& column : row.value) {
+            for (const item& item : column.value.items) {
+                if (item.deletion_time == 0) continue;
+                if (!deleted_items.add({item.deletion_time + sim.config.deleted_item_lifetime, position(column.key, row.key)})) {
+                    for (auto entry : sim.agents) {
+                        free(*entry.value); free(entry.value);
+                    }
+                    free(sim.semaphores); release_tables(sim.tables);
+                    free(sim.data); free(sim.world); free(sim.agents); free(sim.workers); free(sim.worker_buffers);
+                    free(sim.move_requests); free(sim.move_targets); free(sim.dirty_patches); free(sim.buffers); free(sim.config);
+                    free(sim.store); return false;
+                }
+            }
+        }
+    }
+    if (deleted_items.length > 1)
+        sort(deleted_items);
+    if (!init(sim.expiring_items, deleted_items.length)) {
+        for (auto entry : sim.agents) {
+            free(*entry.value); free(entry.value);
+        }
+        free(sim.semaphores); release_tables(sim.tables);
+        free(sim.data); free(sim.world); free(sim.agents); free(sim.workers); free(sim.worker_buffers);
+        free(sim.move_requests); free(sim.move_targets); free(sim.dirty_patches); free(sim.buffers); free(sim.config);
+        free(sim.store); return false;
+    }
+    for (const expiry_entry& deleted_item : deleted_items)
+        sim.expiring_items.push(deleted_item.expiry_time, deleted_item.patch_position);
+
+    /* submitted actions are ordered after those already submitted */
+    uint64_t action_counter = 0;
+    for (const auto& entry : sim.agents)
+        action_counter = max(action_counter, entry.value->action_sequence + 1);
+    sim.directory = nullptr;
+    sim.directory_readers = 0;
+    sim.agent_lockers = 0;
+    sim.retired_agents = nullptr;
+    sim.observation_pins = 0;
+    sim.retired_observations = nullptr;
+    sim.published_world = nullptr;
+    sim.published_generation = 0;
+    sim.snapshot_readers = 0;
+    sim.action_log = nullptr;
+    sim.checkpoint_interval = 0;
+    sim.replaying = false;
+    sim.action_counter = action_counter;
+    if (!sim.update_directory()) {
+        for (auto entry : sim.agents) {
+            free(*entry.value); free(entry.value);
+        }
+        free(sim.semaphores); release_tables(sim.tables);
         free(sim.data); free(sim.world); free(sim.agents);
-        free(sim.requested_moves); free(sim.config);
+        free(sim.move_requests); free(sim.move_targets); free(sim.dirty_patches); free(sim.buffers); free(sim.config);
+        free(sim.workers); free(sim.worker_buffers); free(sim.store); free(sim.expiring_items);
         return false;
     }
+
+    /* move the agents into the store in order of their IDs */
+    const agent_directory& directory = *sim.directory.load();
+    for (unsigned int i = 0; i < directory.length; i++)
+        sim.store.add(directory.ids[i], directory.agents[i]);
+    init(sim.rendered_patches);
+    init(sim.resampler);
+    sim.resampler.swap_regions(resampler);
+#if defined(JBW_PROFILE)
+    init(sim.profiler);
+#endif
     new (&sim.simulator_lock) std::mutex();
-    new (&sim.requested_move_lock) std::mutex();
     return true;
 }
 
+/**
+ * Reads the given simulator `sim` from the input stream `in`, in which the
+ * observations of the agents are computed by a single thread (see
+ * `read(simulator<SimulatorData>&, Stream&, const SimulatorData&, unsigned int)`).
+ */
+template<typename SimulatorData, typename Stream>
+inline bool read(simulator<SimulatorData>& sim, Stream& in, const SimulatorData& data) {
+    return read(sim, in, data, 1);
+}
+
 /**
  * Writes the given simulator `sim` to the output stream `out`.
  *
@@ -2437,14 +7738,75 @@ bool write(const simulator<SimulatorData>& sim, Stream& out)
         }
     }
 
+    /* move requests are only stored within `step`, so an empty map is
+       written for compatibility with the serialized format */
     default_scribe scribe;
+    hash_map<position, array<agent_state*>> requested_moves(1, alloc_position_keys);
     return write(sim.semaphores, out)
         && write(sim.world, out, agent_ids)
-        && write(sim.requested_moves, out, scribe, agent_ids)
+        && write(requested_moves, out, scribe, agent_ids)
         && write(sim.time, out)
-        && write(sim.acted_agent_count, out)
-        && write(sim.active_agent_count, out)
-        && write(sim.id_counter, out);
+        && write(sim.acted_agent_count.load(), out)
+        && write(sim.active_agent_count.load(), out)
+        && write(sim.id_counter, out)
+        && write(sim.resampler, out);
+}
+
+/**
+ * Reads the header of an action log, written by
+ * `simulator::start_action_log`, from the stream `in`. Upon success,
+ * `config` is initialized with the configuration of the logged simulator,
+ * and `seed` and `checkpoint_interval` contain the seed of its world and the
+ * number of time steps between checkpoints. A simulator constructed with
+ * `config` and `seed` can then be advanced by `replay`.
+ *
+ * \returns `true` if successful; `false` otherwise.
+ */
+template<typename Stream>
+bool read_action_log_header(Stream& in, simulator_config& config,
+        uint_fast32_t& seed, unsigned int& checkpoint_interval)
+{
+    uint32_t magic, version;
+    uint64_t log_seed;
+    if (!read(magic, in) || magic != ACTION_LOG_MAGIC) {
+        fprintf(stderr, "read_action_log_header ERROR: The stream does not contain an action log.\n");
+        return false;
+    } else if (!read(version, in) || version != ACTION_LOG_VERSION) {
+        fprintf(stderr, "read_action_log_header ERROR: Unsupported action log version.\n");
+        return false;
+    }
+    if (!read(log_seed, in) || !read(checkpoint_interval, in) || !read(config, in))
+        return false;
+    seed = (uint_fast32_t) log_seed;
+    return true;
+}
+
+/**
+ * Re-simulates the action log in the stream `in`, whose header was read by
+ * `read_action_log_header`, in the given simulator `sim`, which must have
+ * been constructed with the configuration and seed from the header, and
+ * not modified since. The agents are added and removed, and their actions
+ * are applied, as in the logged simulation, as fast as possible: no clients
+ * are involved, and the simulator lock is not acquired during the time
+ * steps, so no other thread may access `sim` during the replay. At every
+ * checkpoint, the `simulator::state_hash` of `sim` is compared with the
+ * logged hash. The number of checkpoints that were verified is written to
+ * `checkpoint_count`.
+ *
+ * \returns `true` if the log was replayed to its end without diverging;
+ *      `false` if the log is corrupted, or the simulation diverged from it.
+ */
+template<typename SimulatorData, typename Stream>
+bool replay(simulator<SimulatorData>& sim, Stream& in, unsigned int& checkpoint_count)
+{
+    if (sim.time != 0 || sim.agents.table.size != 0) {
+        fprintf(stderr, "replay ERROR: The simulator must be in its initial state.\n");
+        return false;
+    }
+    sim.replaying = true;
+    bool result = sim.replay_helper(in, checkpoint_count);
+    sim.replaying = false;
+    return result;
 }
 
 } /* namespace jbw */
@@ -0,0 +1,211 @@
+/**
+ * Copyright 2019, The Jelly Bean World Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+#ifndef JBW_SIMULATOR_BATCH_H_
+#define JBW_SIMULATOR_BATCH_H_
+
+#include "simulator.h"
+
+namespace jbw {
+
+using namespace core;
+
+/**
+ * A batch of independent simulators ("worlds") with the same configuration,
+ * each containing a single agent, which are stepped together. This is useful
+ * for training with many environments in a single process: one call to
+ * `step` submits an action for every world, advances the worlds in parallel,
+ * and writes the observations and rewards of all agents into contiguous
+ * buffers. The rewards are evaluated by each world from the reward schema in
+ * its configuration (see `simulator_config::reward_item_deltas`).
+ *
+ * The worlds are advanced by the threads in `workers`, so each world
+ * computes its observations with a single thread. The worlds must not be
+ * modified by other threads during `step`.
+ *
+ * \tparam  SimulatorData   Type to store additional state in each world.
+ */
+template<typename SimulatorData>
+struct simulator_batch {
+	simulator<SimulatorData>* worlds;
+	unsigned int world_count;
+
+	/* The ID and state of the agent in each world. */
+	uint64_t* agent_ids;
+	agent_state** agents;
+
+	/* The number of floats in the scent, and in the visual field, of each agent. */
+	unsigned int scent_size;
+	size_t vision_size;
+
+	/* Threads used to step the worlds in parallel. */
+	thread_pool workers;
+
+	/**
+	 * Constructs a batch of `world_count` worlds with the given
+	 * simulator_config `config`, calling the copy constructor for `data`.
+	 * World `i` is seeded with `seed + i`. If `item_rewards` is not NULL,
+	 * it contains the reward for collecting one item of each type in
+	 * `config.item_types`, which replaces `config.reward_item_deltas`.
+	 * Otherwise, the worlds use `config.reward_item_deltas`. The worlds
+	 * are stepped by `thread_count` threads.
+	 */
+	simulator_batch(const simulator_config& config,
+			const SimulatorData& data, unsigned int world_count,
+			const float* item_rewards, uint_fast32_t seed,
+			unsigned int thread_count) :
+		workers(thread_count)
+	{
+		if (!init_helper(config, data, world_count, item_rewards, seed))
+			exit(EXIT_FAILURE);
+	}
+
+	~simulator_batch() { free_helper(); }
+
+	/**
+	 * Submits `actions[i]` for the agent in world `i`, for every world, and
+	 * advances the worlds in parallel. The status of each action is written
+	 * to `results`. Then, for the agent in each world `i`, its position and
+	 * direction are written to `positions[i]` and `directions[i]`, its scent
+	 * and visual field are written to `scents + i*scent_size` and
+	 * `visions + i*vision_size`, and its reward in this step is written to
+	 * `rewards[i]`.
+	 *
+	 * If an action fails, the corresponding world does not advance, and its
+	 * reward is 0.
+	 */
+	inline void step(const action* actions, status* results,
+			position* positions, direction* directions,
+			float* scents, float* visions, float* rewards)
+	{
+		std::atomic<unsigned int> next_world(0);
+		auto step_worlds = [&](unsigned int thread_id) {
+			for (unsigned int i = next_world++; i < world_count; i = next_world++) {
+				worlds[i].act(&agent_ids[i], &actions[i], 1, &results[i]);
+
+				status observation_result, reward_result;
+				worlds[i].get_observations(&agent_ids[i], 1, &positions[i], &directions[i],
+						scents + (size_t) i * scent_size, visions + i * vision_size, &observation_result);
+				if (results[i] == status::OK)
+					worlds[i].get_rewards(&agent_ids[i], 1, &rewards[i], &reward_result);
+				else rewards[i] = 0.0f;
+			}
+		};
+		workers.run(step_worlds);
+	}
+
+	/* Returns the world at the given `index`. */
+	inline simulator<SimulatorData>& get_world(unsigned int index) {
+		return worlds[index];
+	}
+
+	/* Returns the ID of the agent in the world at the given `index`. */
+	inline uint64_t get_agent_id(unsigned int index) const {
+		return agent_ids[index];
+	}
+
+	static inline void free(simulator_batch<SimulatorData>& batch) {
+		batch.free_helper();
+		core::free(batch.workers);
+	}
+
+private:
+	inline bool init_helper(const simulator_config& config,
+			const SimulatorData& data, unsigned int new_world_count,
+			const float* new_item_rewards, uint_fast32_t seed)
+	{
+		world_count = new_world_count;
+		scent_size = config.scent_dimension;
+		vision_size = (size_t) (2*config.vision_range + 1) * (2*config.vision_range + 1) * config.color_dimension;
+
+		simulator_config world_config(config);
+		if (new_item_rewards != NULL && world_config.reward_item_deltas == NULL)
+			world_config.reward_item_deltas = (float*) malloc(sizeof(float) * max((size_t) 1, config.item_types.length));
+
+		worlds = (simulator<SimulatorData>*) malloc(sizeof(simulator<SimulatorData>) * max(1u, world_count));
+		agent_ids = (uint64_t*) malloc(sizeof(uint64_t) * max(1u, world_count));
+		agents = (agent_state**) malloc(sizeof(agent_state*) * max(1u, world_count));
+		if ((new_item_rewards != NULL && world_config.reward_item_deltas == NULL) || worlds == NULL || agent_ids == NULL || agents == NULL) {
+			fprintf(stderr, "simulator_batch.init_helper ERROR: Out of memory.\n");
+			if (worlds != NULL) core::free(worlds);
+			if (agent_ids != NULL) core::free(agent_ids);
+			if (agents != NULL) core::free(agents);
+			return false;
+		}
+		if (new_item_rewards != NULL) {
+			for (unsigned int t = 0; t < config.item_types.length; t++)
+				world_config.reward_item_deltas[t] = new_item_rewards[t];
+		}
+
+		/* the worlds are stepped in parallel by `workers`, rather than by their own threads */
+		for (unsigned int i = 0; i < world_count; i++) {
+			status result = init(worlds[i], world_config, data, seed + i, 1);
+			if (result == status::OK) {
+				result = worlds[i].add_agent(agent_ids[i], agents[i]);
+				if (result != status::OK) core::free(worlds[i]);
+			}
+			if (result != status::OK) {
+				fprintf(stderr, "simulator_batch.init_helper ERROR: Unable to initialize world %u.\n", i);
+				for (unsigned int j = 0; j < i; j++)
+					core::free(worlds[j]);
+				core::free(worlds); core::free(agent_ids); core::free(agents);
+				return false;
+			}
+		}
+		return true;
+	}
+
+	inline void free_helper() {
+		for (unsigned int i = 0; i < world_count; i++)
+			core::free(worlds[i]);
+		core::free(worlds);
+		core::free(agent_ids);
+		core::free(agents);
+	}
+
+	template<typename A>
+	friend bool init(simulator_batch<A>&, const simulator_config&,
+			const A&, unsigned int, const float*, uint_fast32_t, unsigned int);
+};
+
+/**
+ * Initializes the given simulator_batch `batch` with `world_count` worlds
+ * with the given simulator_config `config`, calling the
+ * `bool init(SimulatorData&, const SimulatorData&)` function to initialize
+ * the data of each world. World `i` is seeded with `seed + i`. If
+ * `item_rewards` is not NULL, it contains the reward for collecting one item
+ * of each type in `config.item_types`, which replaces
+ * `config.reward_item_deltas`. The worlds are stepped by `thread_count`
+ * threads.
+ */
+template<typename SimulatorData>
+bool init(simulator_batch<SimulatorData>& batch,
+		const simulator_config& config, const SimulatorData& data,
+		unsigned int world_count, const float* item_rewards,
+		uint_fast32_t seed, unsigned int thread_count)
+{
+	if (!init(batch.workers, thread_count)) {
+		return false;
+	} else if (!batch.init_helper(config, data, world_count, item_rewards, seed)) {
+		core::free(batch.workers);
+		return false;
+	}
+	return true;
+}
+
+} /* namespace jbw */
+
+#endif /* JBW_SIMULATOR_BATCH_H_ */
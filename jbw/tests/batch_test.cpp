@@ -0,0 +1,146 @@
+/**
+ * Copyright 2019, The Jelly Bean World Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+#define _USE_MATH_DEFINES
+#include <jbw/simulator_batch.h>
+#include "test_common.h"
+
+#include <core/timer.h>
+#include <cmath>
+#include <thread>
+
+constexpr unsigned int world_count = 64;
+constexpr unsigned int max_time = 500;
+
+void on_step(const simulator<empty_data>* sim,
+		const hash_map<uint64_t, agent_state*>& agents, uint64_t time)
+{ }
+
+/* Checks that a batch created without `item_rewards` uses the reward schema in `config`. */
+bool test_config_rewards(const simulator_config& config)
+{
+	constexpr unsigned int test_world_count = 4;
+	simulator_config reward_config(config);
+	reward_config.reward_item_deltas = (float*) malloc(sizeof(float) * max((size_t) 1, config.item_types.length));
+	if (reward_config.reward_item_deltas == nullptr) {
+		fprintf(stderr, "ERROR: Out of memory.\n");
+		return false;
+	}
+	for (unsigned int t = 0; t < config.item_types.length; t++)
+		reward_config.reward_item_deltas[t] = 2.0f;
+	simulator_batch<empty_data> batch(reward_config, empty_data(), test_world_count, NULL, 0, std::thread::hardware_concurrency());
+
+	action actions[test_world_count];
+	status results[test_world_count];
+	position positions[test_world_count];
+	direction directions[test_world_count];
+	float rewards[test_world_count];
+	float* scents = (float*) malloc(sizeof(float) * test_world_count * batch.scent_size);
+	float* visions = (float*) malloc(sizeof(float) * test_world_count * batch.vision_size);
+	if (scents == nullptr || visions == nullptr) {
+		fprintf(stderr, "ERROR: Out of memory.\n");
+		if (scents != nullptr) free(scents);
+		return false;
+	}
+
+	double total_reward = 0.0;
+	for (unsigned int t = 0; t < 100; t++) {
+		for (unsigned int i = 0; i < test_world_count; i++)
+			actions[i] = {action_type::MOVE, direction::UP, 1};
+		batch.step(actions, results, positions, directions, scents, visions, rewards);
+		for (unsigned int i = 0; i < test_world_count; i++)
+			total_reward += rewards[i];
+	}
+	free(scents); free(visions);
+
+	unsigned int collected_count = 0;
+	for (unsigned int i = 0; i < test_world_count; i++)
+		collected_count += batch.agents[i]->collected_items[0];
+	if (total_reward != 2.0 * collected_count) {
+		fprintf(stderr, "test_config_rewards ERROR: The total reward is %lf, but %u items were collected.\n", total_reward, collected_count);
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, const char** argv)
+{
+	simulator_config config;
+	init_banana_config(config);
+
+	float item_rewards[] = { 1.0f };
+	simulator_batch<empty_data> batch(config, empty_data(), world_count, item_rewards, 0, std::thread::hardware_concurrency());
+
+	size_t vision_size = (2*config.vision_range + 1) * (2*config.vision_range + 1) * config.color_dimension;
+	action* actions = (action*) malloc(sizeof(action) * world_count);
+	status* results = (status*) malloc(sizeof(status) * world_count);
+	position* positions = (position*) malloc(sizeof(position) * world_count);
+	direction* directions = (direction*) malloc(sizeof(direction) * world_count);
+	float* scents = (float*) malloc(sizeof(float) * world_count * config.scent_dimension);
+	float* visions = (float*) malloc(sizeof(float) * world_count * vision_size);
+	float* rewards = (float*) malloc(sizeof(float) * world_count);
+	if (actions == nullptr || results == nullptr || positions == nullptr || directions == nullptr
+	 || scents == nullptr || visions == nullptr || rewards == nullptr)
+	{
+		fprintf(stderr, "ERROR: Out of memory.\n");
+		return EXIT_FAILURE;
+	}
+
+	unsigned int error_count = 0;
+	double total_reward = 0.0;
+	timer stopwatch;
+	for (unsigned int t = 0; t < max_time; t++) {
+		/* every fifth action is a turn, and the rest are moves */
+		for (unsigned int i = 0; i < world_count; i++) {
+			if ((t + i) % 5 == 0) actions[i] = {action_type::TURN, direction::LEFT, 0};
+			else actions[i] = {action_type::MOVE, direction::UP, 1};
+		}
+
+		batch.step(actions, results, positions, directions, scents, visions, rewards);
+		for (unsigned int i = 0; i < world_count; i++) {
+			if (results[i] != status::OK) error_count++;
+			total_reward += rewards[i];
+		}
+	}
+	unsigned long long elapsed = stopwatch.milliseconds();
+
+	for (unsigned int i = 0; i < world_count; i++) {
+		if (batch.get_world(i).time != max_time) {
+			fprintf(stderr, "ERROR: World %u is at time %llu, but expected %u.\n",
+					i, (unsigned long long) batch.get_world(i).time, max_time);
+			error_count++;
+		}
+	}
+
+	/* the rewards evaluated by the worlds must account for every collected item */
+	unsigned int collected_count = 0;
+	for (unsigned int i = 0; i < world_count; i++)
+		collected_count += batch.agents[i]->collected_items[0];
+	if (total_reward != (double) collected_count) {
+		fprintf(stderr, "ERROR: The total reward is %lf, but %u items were collected.\n", total_reward, collected_count);
+		error_count++;
+	}
+
+	fprintf(stderr, "%u worlds completed %u steps (%u errors, total reward %lf): %lf world steps per second.\n",
+			world_count, max_time, error_count, total_reward,
+			((double) world_count * max_time / elapsed) * 1000);
+	free(actions); free(results); free(positions); free(directions);
+	free(scents); free(visions); free(rewards);
+
+	if (!test_config_rewards(config))
+		error_count++;
+	return (error_count == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
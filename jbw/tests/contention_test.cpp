@@ -0,0 +1,191 @@
+/**
+ * Copyright 2019, The Jelly Bean World Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+#define _USE_MATH_DEFINES
+#include "test_common.h"
+
+#include <core/timer.h>
+#include <cmath>
+#include <thread>
+
+constexpr unsigned int agent_count = 256;
+constexpr unsigned int max_time = 500;
+constexpr unsigned int toggle_time = 200;
+constexpr unsigned int stall_timeout = 10000;
+
+/**
+ * Runs the agent threads while another thread repeatedly deactivates and
+ * reactivates each agent, concurrently with its actions. Returns `false` if
+ * the simulation stops advancing for `stall_timeout` milliseconds before
+ * `toggle_time` steps are taken.
+ */
+bool run_toggling_agents(simulator<empty_data>& sim, const uint64_t* agent_ids,
+		std::atomic_uint& action_count, std::atomic_uint& error_count)
+{
+	{
+		std::unique_lock<std::mutex> lock(step_lock);
+		simulation_running = true;
+	}
+
+	std::thread agents[agent_count];
+	for (unsigned int i = 0; i < agent_count; i++) {
+		agents[i] = std::thread([&,i]() {
+			run_agent(sim, agent_ids[i], action_count, error_count);
+		});
+	}
+
+	std::atomic_bool toggling(true);
+	std::thread toggler([&]() {
+		for (unsigned int i = 0; toggling; i = (i + 1) % agent_count) {
+			if (sim.set_agent_active(agent_ids[i], false) != status::OK
+			 || sim.set_agent_active(agent_ids[i], true) != status::OK)
+				error_count++;
+		}
+	});
+
+	bool stalled = false;
+	uint64_t start_time = sim_time;
+	uint64_t last_time = start_time;
+	timer stopwatch;
+	while (true) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		std::unique_lock<std::mutex> lock(step_lock);
+		if (sim_time >= start_time + toggle_time) break;
+		if (sim_time != last_time) {
+			last_time = sim_time;
+			stopwatch.start();
+		} else if (stopwatch.milliseconds() > stall_timeout) {
+			fprintf(stderr, "ERROR: The simulation stalled at time %llu while agents were toggled.\n", (unsigned long long) sim_time);
+			stalled = true; break;
+		}
+	}
+
+	toggling = false;
+	toggler.join();
+	stop_agents();
+	for (unsigned int i = 0; i < agent_count; i++)
+		agents[i].join();
+	return !stalled;
+}
+
+/**
+ * Adds an agent while this thread holds the lock of the agent with ID
+ * `agent_id`, and another thread waits for that lock in
+ * `get_agent_states`. Returns `false` if the agent is not added within
+ * `stall_timeout` milliseconds.
+ */
+bool test_add_while_locked(simulator<empty_data>& sim, uint64_t agent_id)
+{
+	agent_state* agent;
+	sim.get_agent_states(&agent, &agent_id, 1);
+	if (agent == nullptr) {
+		fprintf(stderr, "ERROR: Unable to retrieve the agent state.\n");
+		return false;
+	}
+
+	std::atomic_bool waiter_found_agent(false);
+	std::thread waiter([&]() {
+		agent_state* waiting_agent;
+		sim.get_agent_states(&waiting_agent, &agent_id, 1);
+		if (waiting_agent != nullptr) {
+			waiter_found_agent = true;
+			waiting_agent->lock.unlock();
+		}
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	std::atomic_bool added(false);
+	status add_result = status::OK;
+	std::thread adder([&]() {
+		uint64_t new_agent_id; agent_state* new_agent;
+		add_result = sim.add_agent(new_agent_id, new_agent);
+		added = true;
+	});
+
+	timer stopwatch;
+	while (!added && stopwatch.milliseconds() < stall_timeout)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	bool success = added;
+	if (!success)
+		fprintf(stderr, "ERROR: Adding an agent blocked on a thread waiting for an agent lock.\n");
+
+	agent->lock.unlock();
+	adder.join();
+	waiter.join();
+	if (add_result != status::OK) {
+		fprintf(stderr, "ERROR: Unable to add new agent.\n");
+		return false;
+	} else if (!waiter_found_agent) {
+		fprintf(stderr, "ERROR: The waiting thread did not find the agent.\n");
+		return false;
+	}
+	return success;
+}
+
+void on_step(const simulator<empty_data>* sim,
+		const hash_map<uint64_t, agent_state*>& agents, uint64_t time)
+{
+	notify_step(time);
+}
+
+int main(int argc, const char** argv)
+{
+	simulator_config config;
+	init_banana_config(config);
+
+	simulator<empty_data> sim(config, empty_data(), 0, std::thread::hardware_concurrency());
+
+	uint64_t agent_ids[agent_count];
+	if (!add_agents(sim, agent_ids, agent_count))
+		return EXIT_FAILURE;
+	sim_time = sim.time;
+
+	std::atomic_uint action_count(0);
+	std::atomic_uint error_count(0);
+	std::thread agents[agent_count];
+	timer stopwatch;
+	for (unsigned int i = 0; i < agent_count; i++) {
+		agents[i] = std::thread([&,i]() {
+			run_agent(sim, agent_ids[i], action_count, error_count);
+		});
+	}
+
+	uint64_t start_time = sim_time;
+	while (true) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		std::unique_lock<std::mutex> lock(step_lock);
+		if (sim_time >= start_time + max_time) break;
+	}
+	stop_agents();
+	unsigned long long elapsed = stopwatch.milliseconds();
+	for (unsigned int i = 0; i < agent_count; i++)
+		agents[i].join();
+
+	fprintf(stderr, "%u agent threads completed %u actions (%u errors): %lf simulation steps per second, %lf actions per second.\n",
+			agent_count, action_count.load(), error_count.load(),
+			((double) (sim_time - start_time) / elapsed) * 1000,
+			((double) action_count.load() / elapsed) * 1000);
+
+	/* deactivating and reactivating agents must never prevent the simulation from advancing */
+	if (!run_toggling_agents(sim, agent_ids, action_count, error_count))
+		return EXIT_FAILURE;
+	fprintf(stderr, "The simulation advanced while agents were deactivated and reactivated (%u errors).\n", error_count.load());
+
+	/* threads waiting for an agent lock must not block adding agents */
+	if (!test_add_while_locked(sim, agent_ids[0]))
+		return EXIT_FAILURE;
+	return (error_count == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
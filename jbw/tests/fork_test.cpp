@@ -0,0 +1,328 @@
+/**
+ * Copyright 2019, The Jelly Bean World Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+#define _USE_MATH_DEFINES
+#include "test_common.h"
+
+#include <core/timer.h>
+#include <cmath>
+
+constexpr unsigned int fork_count = 1000;
+constexpr unsigned int lookahead = 20;
+constexpr unsigned int max_time = 200;
+
+void on_step(const simulator<empty_data>* sim,
+		const hash_map<uint64_t, agent_state*>& agents, uint64_t time)
+{ }
+
+/**
+ * Returns `true` if the agents with the given `agent_id` in `first` and
+ * `second` have the same observation.
+ */
+bool same_observation(simulator<empty_data>& first,
+		simulator<empty_data>& second, uint64_t agent_id,
+		const simulator_config& config)
+{
+	size_t vision_size = (2*config.vision_range + 1) * (2*config.vision_range + 1) * config.color_dimension;
+	array<float> scents(2 * config.scent_dimension);
+	array<float> visions(2 * vision_size);
+	position positions[2]; direction directions[2]; status results[2];
+	first.get_observations(&agent_id, 1, &positions[0], &directions[0], scents.data, visions.data, &results[0]);
+	second.get_observations(&agent_id, 1, &positions[1], &directions[1],
+			scents.data + config.scent_dimension, visions.data + vision_size, &results[1]);
+	return results[0] == status::OK && results[1] == status::OK
+		&& positions[0] == positions[1] && directions[0] == directions[1]
+		&& memcmp(scents.data, scents.data + config.scent_dimension, sizeof(float) * config.scent_dimension) == 0
+		&& memcmp(visions.data, visions.data + vision_size, sizeof(float) * vision_size) == 0;
+}
+
+/**
+ * Advances `first` and `second` with the same actions for `duration` time
+ * steps, and returns `false` if their states ever differ, where `second` is
+ * a copy of `first` described by `copy_name`.
+ */
+bool advance_identically(simulator<empty_data>& first,
+		simulator<empty_data>& second, uint64_t agent_id,
+		unsigned int duration, const char* copy_name)
+{
+	for (unsigned int t = 0; t < duration; t++) {
+		if (take_action(first, agent_id, t) != status::OK
+		 || take_action(second, agent_id, t) != status::OK)
+		{
+			fprintf(stderr, "ERROR: Unable to move the agent in the %s.\n", copy_name);
+			return false;
+		} else if (first.time != second.time || first.state_hash() != second.state_hash()) {
+			fprintf(stderr, "ERROR: The %s diverged from the original simulator at time %llu.\n",
+					copy_name, (unsigned long long) first.time);
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Appends a hash of the items and version of each patch in the world of
+ * `sim` to `hashes`, in the order of the patches.
+ */
+void hash_patches(simulator<empty_data>& sim, array<uint64_t>& hashes)
+{
+	const auto& patches = sim.get_world().patches;
+	for (size_t i = 0; i < patches.size; i++) {
+		const auto& row = patches.values[i];
+		for (size_t j = 0; j < row.size; j++) {
+			const auto& current = row.values[j];
+			uint64_t hash = mix_state_hash(current.data.version, current.items.length);
+			for (const item& current_item : current.items) {
+				hash = mix_state_hash(hash, current_item.item_type);
+				hash = mix_state_hash(hash, (uint64_t) current_item.location.x);
+				hash = mix_state_hash(hash, (uint64_t) current_item.location.y);
+				hash = mix_state_hash(hash, current_item.creation_time);
+				hash = mix_state_hash(hash, current_item.deletion_time);
+			}
+			hashes.add(hash);
+		}
+	}
+}
+
+/**
+ * Returns `true` if the patches of `sim` have the given `patch_hashes` (see
+ * `hash_patches`), and `sim` has the given `time` and `state_hash`.
+ */
+bool is_unchanged(simulator<empty_data>& sim, const array<uint64_t>& patch_hashes,
+		uint64_t time, uint64_t state_hash)
+{
+	array<uint64_t> current_hashes(max((size_t) 1, patch_hashes.length));
+	hash_patches(sim, current_hashes);
+	return sim.time == time && sim.state_hash() == state_hash
+		&& current_hashes.length == patch_hashes.length
+		&& memcmp(current_hashes.data, patch_hashes.data, sizeof(uint64_t) * patch_hashes.length) == 0;
+}
+
+/**
+ * Checks that advancing a fork of `sim` doesn't modify `sim`, with which it
+ * shares its patches copy-on-write: the agent with the given `agent_id`
+ * collects items in the fork, while the items and versions of the patches
+ * of `sim`, and its `state_hash`, are unchanged, both while the fork exists
+ * and after it is freed.
+ */
+bool test_copy_on_write(simulator<empty_data>& sim, uint64_t agent_id)
+{
+	array<uint64_t> patch_hashes(64);
+	hash_patches(sim, patch_hashes);
+	const uint64_t time = sim.time;
+	const uint64_t state_hash = sim.state_hash();
+
+	simulator<empty_data>* forked = (simulator<empty_data>*) malloc(sizeof(simulator<empty_data>));
+	if (forked == nullptr || sim.fork(*forked) != status::OK) {
+		fprintf(stderr, "ERROR: Unable to fork the simulator.\n");
+		if (forked != nullptr) free(forked);
+		return false;
+	}
+
+	/* move straight through the items, so that the agent collects them */
+	bool success = true;
+	for (unsigned int t = 0; t < max_time; t++) {
+		if (forked->move(agent_id, direction::UP, 1) != status::OK) {
+			fprintf(stderr, "ERROR: Unable to move the agent in the fork.\n");
+			success = false; break;
+		}
+	}
+	agent_state* forked_agent;
+	forked->get_agent_states(&forked_agent, &agent_id, 1);
+	unsigned int collected_count = 0;
+	if (forked_agent != nullptr) {
+		collected_count = forked_agent->collected_items[0];
+		forked_agent->lock.unlock();
+	}
+	if (collected_count == 0) {
+		fprintf(stderr, "ERROR: The agent did not collect any items in the fork.\n");
+		success = false;
+	}
+
+	if (!is_unchanged(sim, patch_hashes, time, state_hash)) {
+		fprintf(stderr, "ERROR: Advancing the fork modified the original simulator.\n");
+		success = false;
+	}
+	free(*forked); free(forked);
+	if (!is_unchanged(sim, patch_hashes, time, state_hash)) {
+		fprintf(stderr, "ERROR: Freeing the fork modified the original simulator.\n");
+		success = false;
+	}
+	return success;
+}
+
+/**
+ * Checks that the patches being resampled in the background (see
+ * `simulator_config::resample_interval`) are carried over by `fork`,
+ * `restore`, and serialization, by copying a simulator partway through a
+ * resampling interval, and advancing past the end of the interval.
+ */
+bool test_resampling(const simulator_config& config)
+{
+	simulator<empty_data> sim(config, empty_data(), 0);
+	uint64_t agent_id;
+	agent_state* agent;
+	if (sim.add_agent(agent_id, agent) != status::OK) {
+		fprintf(stderr, "ERROR: Unable to add new agent.\n");
+		return false;
+	}
+
+	/* stop partway through an interval, while patches are being resampled */
+	for (unsigned int t = 0; t < 3 * config.resample_interval + config.resample_interval / 2; t++)
+		take_action(sim, agent_id, t);
+
+	simulator<empty_data>* forked = (simulator<empty_data>*) malloc(sizeof(simulator<empty_data>));
+	if (forked == nullptr || sim.fork(*forked) != status::OK) {
+		fprintf(stderr, "ERROR: Unable to fork the simulator.\n");
+		if (forked != nullptr) free(forked);
+		return false;
+	}
+	bool success = advance_identically(sim, *forked, agent_id, 2 * config.resample_interval, "fork");
+	free(*forked); free(forked);
+
+	/* a simulator restored to a snapshot must evolve like a fork of the snapshot */
+	simulator<empty_data>* snapshot = (simulator<empty_data>*) malloc(sizeof(simulator<empty_data>));
+	if (snapshot == nullptr || sim.snapshot(*snapshot) != status::OK) {
+		fprintf(stderr, "ERROR: Unable to snapshot the simulator.\n");
+		if (snapshot != nullptr) free(snapshot);
+		return false;
+	}
+	for (unsigned int t = 0; t < config.resample_interval; t++)
+		take_action(sim, agent_id, t);
+	forked = (simulator<empty_data>*) malloc(sizeof(simulator<empty_data>));
+	if (sim.restore(*snapshot) != status::OK || forked == nullptr || snapshot->fork(*forked) != status::OK) {
+		fprintf(stderr, "ERROR: Unable to restore the simulator.\n");
+		if (forked != nullptr) free(forked);
+		free(*snapshot); free(snapshot);
+		return false;
+	}
+	success &= advance_identically(sim, *forked, agent_id, 2 * config.resample_interval, "restored simulator");
+	free(*forked); free(forked);
+	free(*snapshot); free(snapshot);
+
+	/* a simulator read from a stream must evolve like the one that was written */
+	FILE* file = tmpfile();
+	simulator<empty_data>* read_sim = (simulator<empty_data>*) malloc(sizeof(simulator<empty_data>));
+	if (file == nullptr || read_sim == nullptr) {
+		fprintf(stderr, "ERROR: Unable to create a temporary file.\n");
+		if (file != nullptr) fclose(file);
+		if (read_sim != nullptr) free(read_sim);
+		return false;
+	}
+	fixed_width_stream<FILE*> out(file);
+	bool written = write(sim, out);
+	rewind(file);
+	fixed_width_stream<FILE*> in(file);
+	if (!written || !read(*read_sim, in, empty_data())) {
+		fprintf(stderr, "ERROR: Unable to write and read the simulator.\n");
+		fclose(file); free(read_sim);
+		return false;
+	}
+	fclose(file);
+	success &= advance_identically(sim, *read_sim, agent_id, 2 * config.resample_interval, "deserialized simulator");
+	free(*read_sim); free(read_sim);
+	return success;
+}
+
+int main(int argc, const char** argv)
+{
+	simulator_config config;
+	init_banana_config(config);
+
+	simulator<empty_data> sim(config, empty_data(), 0);
+
+	uint64_t agent_id;
+	agent_state* agent;
+	if (sim.add_agent(agent_id, agent) != status::OK) {
+		fprintf(stderr, "ERROR: Unable to add new agent.\n");
+		return EXIT_FAILURE;
+	}
+
+	unsigned int error_count = 0;
+	for (unsigned int t = 0; t < max_time; t++)
+		if (take_action(sim, agent_id, t) != status::OK) error_count++;
+
+	/* repeatedly fork the simulator and advance the fork, as in a lookahead search */
+	timer stopwatch;
+	for (unsigned int i = 0; i < fork_count; i++) {
+		simulator<empty_data>* forked = (simulator<empty_data>*) malloc(sizeof(simulator<empty_data>));
+		if (forked == nullptr || sim.fork(*forked) != status::OK) {
+			fprintf(stderr, "ERROR: Unable to fork the simulator.\n");
+			if (forked != nullptr) free(forked);
+			return EXIT_FAILURE;
+		}
+		for (unsigned int t = 0; t < lookahead; t++)
+			if (take_action(*forked, agent_id, i + t) != status::OK) error_count++;
+		free(*forked); free(forked);
+	}
+	unsigned long long elapsed = stopwatch.milliseconds();
+
+	/* a fork must evolve identically to the original given the same actions */
+	simulator<empty_data>* forked = (simulator<empty_data>*) malloc(sizeof(simulator<empty_data>));
+	if (forked == nullptr || sim.fork(*forked) != status::OK) {
+		fprintf(stderr, "ERROR: Unable to fork the simulator.\n");
+		if (forked != nullptr) free(forked);
+		return EXIT_FAILURE;
+	}
+	for (unsigned int t = 0; t < max_time; t++) {
+		if (take_action(sim, agent_id, t) != status::OK) error_count++;
+		if (take_action(*forked, agent_id, t) != status::OK) error_count++;
+		if (sim.time != forked->time || !same_observation(sim, *forked, agent_id, config)) {
+			fprintf(stderr, "ERROR: The fork diverged from the original simulator at time %llu.\n",
+					(unsigned long long) sim.time);
+			error_count++; break;
+		}
+	}
+	free(*forked); free(forked);
+
+	/* the items collected in a fork must not be removed from the original */
+	if (!test_copy_on_write(sim, agent_id))
+		error_count++;
+
+	/* repeatedly advance the simulator and restore it to a snapshot, as in episodic training */
+	simulator<empty_data>* snapshot = (simulator<empty_data>*) malloc(sizeof(simulator<empty_data>));
+	if (snapshot == nullptr || sim.snapshot(*snapshot) != status::OK) {
+		fprintf(stderr, "ERROR: Unable to snapshot the simulator.\n");
+		if (snapshot != nullptr) free(snapshot);
+		return EXIT_FAILURE;
+	}
+	stopwatch.start();
+	for (unsigned int i = 0; i < fork_count; i++) {
+		for (unsigned int t = 0; t < lookahead; t++)
+			if (take_action(sim, agent_id, i + t) != status::OK) error_count++;
+		if (sim.restore(*snapshot, i) != status::OK) {
+			fprintf(stderr, "ERROR: Unable to restore the simulator.\n");
+			error_count++; break;
+		}
+	}
+	unsigned long long restore_elapsed = stopwatch.milliseconds();
+	if (sim.time != snapshot->time || !same_observation(sim, *snapshot, agent_id, config)) {
+		fprintf(stderr, "ERROR: The restored simulator differs from the snapshot.\n");
+		error_count++;
+	}
+	free(*snapshot); free(snapshot);
+
+	config.resample_interval = 10;
+	config.resample_radius = 1;
+	config.resample_iterations = 200;
+	if (!test_resampling(config))
+		error_count++;
+
+	fprintf(stderr, "Completed %u forks and %u restores, after %u steps each (%u errors): %lf forks per second, %lf restores per second.\n",
+			fork_count, fork_count, lookahead, error_count,
+			((double) fork_count / elapsed) * 1000, ((double) fork_count / restore_elapsed) * 1000);
+	return (error_count == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
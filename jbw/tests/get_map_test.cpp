@@ -0,0 +1,201 @@
+/**
+ * Copyright 2019, The Jelly Bean World Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+
+#define _USE_MATH_DEFINES
+#include "test_common.h"
+
+#include <thread>
+
+constexpr unsigned int thread_count = 4;
+constexpr unsigned int repetition_count = 20;
+
+void on_step(const simulator<empty_data>* sim,
+		const hash_map<uint64_t, agent_state*>& agents, uint64_t time)
+{ }
+
+inline void free_map(array<array<patch_state>>& patches) {
+	for (array<patch_state>& row : patches) {
+		for (patch_state& patch : row)
+			free(patch);
+		free(row);
+	}
+	patches.clear();
+}
+
+/**
+ * Retrieves the map around the origin of `sim`, with the scent and visual
+ * field of each patch, omitting the patches in `known_versions`, if it is
+ * not `nullptr`. The versions of the retrieved patches are added to
+ * `versions`, which must have sufficient capacity.
+ */
+bool get_versions(simulator<empty_data>& sim,
+		hash_map<position, uint64_t>& versions,
+		const hash_map<position, uint64_t>* known_versions = nullptr)
+{
+	array<array<patch_state>> patches(4);
+	if (sim.get_map<true, true>({-64, -64}, {64, 64}, patches, known_versions) != status::OK) {
+		fprintf(stderr, "ERROR: get_map failed.\n");
+		free_map(patches); return false;
+	}
+	for (const array<patch_state>& row : patches)
+		for (const patch_state& patch : row) {
+			if (!versions.check_size()) {
+				fprintf(stderr, "ERROR: Out of memory.\n");
+				free_map(patches); return false;
+			}
+			versions.put(patch.patch_position, patch.version);
+		}
+	free_map(patches);
+	return true;
+}
+
+/* Returns `true` if `first` and `second` contain the same patch versions. */
+bool same_versions(const hash_map<position, uint64_t>& first, const hash_map<position, uint64_t>& second)
+{
+	if (first.table.size != second.table.size) return false;
+	for (const auto& entry : first) {
+		bool contains;
+		uint64_t version = second.get(entry.key, contains);
+		if (!contains || version != entry.value) return false;
+	}
+	return true;
+}
+
+/**
+ * Checks that `get_map` omits the patches whose versions are known to the
+ * caller, and only those.
+ */
+bool test_known_versions(simulator<empty_data>& sim, uint64_t agent_id)
+{
+	hash_map<position, uint64_t> versions(64, alloc_position_keys);
+	if (!get_versions(sim, versions)) return false;
+	if (versions.table.size == 0) {
+		fprintf(stderr, "ERROR: get_map returned no patches.\n");
+		return false;
+	}
+
+	/* nothing changed, so the cached renderings are returned */
+	bool success = true;
+	hash_map<position, uint64_t> cached(64, alloc_position_keys);
+	if (!get_versions(sim, cached)) return false;
+	if (!same_versions(versions, cached)) {
+		fprintf(stderr, "ERROR: get_map rendered unchanged patches again.\n");
+		success = false;
+	}
+
+	/* all the patches are known, so none are returned */
+	hash_map<position, uint64_t> returned(64, alloc_position_keys);
+	if (!get_versions(sim, returned, &versions)) return false;
+	if (returned.table.size != 0) {
+		fprintf(stderr, "ERROR: get_map returned %u patches whose versions are known.\n", returned.table.size);
+		success = false;
+	}
+
+	/* only the patch with an outdated version is returned */
+	position outdated_position;
+	for (auto entry : versions) {
+		outdated_position = entry.key;
+		entry.value--;
+		break;
+	}
+	if (!get_versions(sim, returned, &versions)) return false;
+	bool contains;
+	returned.get(outdated_position, contains);
+	if (returned.table.size != 1 || !contains) {
+		fprintf(stderr, "ERROR: get_map returned %u patches, rather than the one whose known version is outdated.\n", returned.table.size);
+		success = false;
+	}
+	for (auto entry : versions) {
+		if (entry.key == outdated_position) {
+			entry.value++;
+			break;
+		}
+	}
+
+	/* the agent's scent changes the patches around it, which are returned again */
+	for (unsigned int t = 0; t < 2; t++) {
+		if (take_action(sim, agent_id, t) != status::OK) {
+			fprintf(stderr, "ERROR: Unable to move the agent.\n");
+			return false;
+		}
+	}
+	hash_map<position, uint64_t> changed(64, alloc_position_keys);
+	if (!get_versions(sim, changed, &versions)) return false;
+	if (changed.table.size == 0) {
+		fprintf(stderr, "ERROR: get_map omitted patches that changed.\n");
+		success = false;
+	}
+	for (const auto& entry : changed) {
+		uint64_t known_version = versions.get(entry.key, contains);
+		if (contains && known_version == entry.value) {
+			fprintf(stderr, "ERROR: get_map returned a patch whose version is known.\n");
+			success = false;
+		}
+	}
+	return success;
+}
+
+/**
+ * Checks that concurrent calls to `get_map`, which copy the same cached
+ * renderings, return the same patches.
+ */
+bool test_concurrent_gets(simulator<empty_data>& sim)
+{
+	hash_map<position, uint64_t> versions(64, alloc_position_keys);
+	if (!get_versions(sim, versions)) return false;
+
+	std::atomic_uint error_count(0);
+	std::thread threads[thread_count];
+	for (unsigned int i = 0; i < thread_count; i++) {
+		threads[i] = std::thread([&]() {
+			for (unsigned int j = 0; j < repetition_count; j++) {
+				hash_map<position, uint64_t> cached(64, alloc_position_keys);
+				if (!get_versions(sim, cached) || !same_versions(versions, cached))
+					error_count++;
+			}
+		});
+	}
+	for (unsigned int i = 0; i < thread_count; i++)
+		threads[i].join();
+
+	if (error_count > 0) {
+		fprintf(stderr, "ERROR: %u concurrent calls to get_map returned different patches.\n", error_count.load());
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, const char** argv)
+{
+	simulator_config config;
+	init_banana_config(config);
+
+	simulator<empty_data> sim(config, empty_data(), 0);
+	uint64_t agent_id;
+	agent_state* agent;
+	if (sim.add_agent(agent_id, agent) != status::OK) {
+		fprintf(stderr, "ERROR: Unable to add new agent.\n");
+		return EXIT_FAILURE;
+	}
+
+	unsigned int error_count = 0;
+	if (!test_known_versions(sim, agent_id)) error_count++;
+	if (!test_concurrent_gets(sim)) error_count++;
+
+	fprintf(stderr, "Completed the get_map tests (%u errors).\n", error_count);
+	return (error_count == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,220 @@
+/**
+ * Copyright 2019, The Jelly Bean World Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+
+#define _USE_MATH_DEFINES
+#include "test_common.h"
+
+#include <cmath>
+
+constexpr unsigned int history_length = 4;
+constexpr unsigned int max_time = 5 * (history_length + 1) + 2;
+
+void on_step(const simulator<empty_data>* sim,
+		const hash_map<uint64_t, agent_state*>& agents, uint64_t time)
+{ }
+
+/**
+ * Checks that the history of the agent with the given `agent_id` contains
+ * the last `history_length` of the `recorded_count` observations in
+ * `recorded`, each of which occupies `stride` floats, where the
+ * observations from before the agent was added are zero.
+ */
+bool check_history(simulator<empty_data>& sim, uint64_t agent_id,
+		const float* recorded, unsigned int recorded_count,
+		size_t stride, size_t observation_size, float* history)
+{
+	status result;
+	sim.get_observation_histories(&agent_id, 1, history, &result);
+	if (result != status::OK) {
+		fprintf(stderr, "ERROR: Unable to get the observation history.\n");
+		return false;
+	}
+
+	bool success = true;
+	for (unsigned int j = 0; j < history_length; j++) {
+		/* the oldest observation is first */
+		const float* frame = history + j * stride;
+		const unsigned int age = history_length - 1 - j;
+		if (age >= recorded_count) {
+			for (size_t k = 0; k < observation_size; k++) {
+				if (frame[k] != 0.0f) {
+					fprintf(stderr, "ERROR: Observation %u of the history at time %llu is from before the agent was added, but is not zero.\n",
+							j, (unsigned long long) sim.time);
+					success = false; break;
+				}
+			}
+		} else if (memcmp(frame, recorded + (recorded_count - 1 - age) * stride, sizeof(float) * observation_size) != 0) {
+			fprintf(stderr, "ERROR: Observation %u of the history at time %llu differs from the observation at time %llu.\n",
+					j, (unsigned long long) sim.time, (unsigned long long) (sim.time - age));
+			success = false;
+		}
+	}
+	return success;
+}
+
+/**
+ * Checks that the history of the agent with the given `agent_id` located by
+ * `pin_observations` matches the copy in `history` made by `check_history`.
+ */
+bool check_pinned_history(simulator<empty_data>& sim, uint64_t agent_id,
+		size_t stride, size_t observation_size, const float* history)
+{
+	size_t offset; status result;
+	const float* slab = sim.pin_observations(&agent_id, 1, &offset, &result);
+	bool success = true;
+	if (result != status::OK) {
+		fprintf(stderr, "ERROR: Unable to pin the observation history.\n");
+		success = false;
+	} else {
+		for (unsigned int j = 0; j < history_length; j++) {
+			if (memcmp(slab + offset + j * stride, history + j * stride, sizeof(float) * observation_size) != 0) {
+				fprintf(stderr, "ERROR: Observation %u of the pinned history at time %llu differs from the copied history.\n",
+						j, (unsigned long long) sim.time);
+				success = false;
+			}
+		}
+	}
+	sim.unpin_observations();
+	return success;
+}
+
+/**
+ * Checks that the observations in the first `history_length - 1` slots of
+ * the observation ring of the agent with the given `agent_id`, other than
+ * the slot into which the next observation is computed, are mirrored after
+ * the end of the ring (see `agent_state::history`).
+ */
+bool check_mirror(simulator<empty_data>& sim, uint64_t agent_id, size_t stride)
+{
+	agent_state* agent;
+	sim.get_agent_states(&agent, &agent_id, 1);
+	if (agent == nullptr) {
+		fprintf(stderr, "ERROR: Unable to get the agent state.\n");
+		return false;
+	}
+
+	bool success = true;
+	const unsigned int ring_size = history_length + 1;
+	for (unsigned int i = 0; i + 1 < history_length; i++) {
+		if (i == (agent->history_head + 1) % ring_size) continue;
+		if (memcmp(agent->history + i * stride, agent->history + (ring_size + i) * stride, sizeof(float) * stride) != 0) {
+			fprintf(stderr, "ERROR: Slot %u of the observation ring at time %llu differs from its mirror.\n",
+					i, (unsigned long long) sim.time);
+			success = false;
+		}
+	}
+	agent->lock.unlock();
+	return success;
+}
+
+int main(int argc, const char** argv)
+{
+	simulator_config config;
+	init_banana_config(config);
+	unsigned int error_count = 0;
+
+	/* a history without any observations is rejected */
+	config.history_length = 0;
+	simulator<empty_data>& invalid = *((simulator<empty_data>*) alloca(sizeof(simulator<empty_data>)));
+	status result = init(invalid, config, empty_data(), 0);
+	if (result != status::PERMISSION_ERROR) {
+		fprintf(stderr, "ERROR: A simulator was initialized with a history of length 0.\n");
+		if (result == status::OK) free(invalid);
+		error_count++;
+	}
+
+	FILE* file = tmpfile();
+	simulator_config* read_config = (simulator_config*) malloc(sizeof(simulator_config));
+	if (file == nullptr || read_config == nullptr) {
+		fprintf(stderr, "ERROR: Out of memory.\n");
+		return EXIT_FAILURE;
+	}
+	fixed_width_stream<FILE*> out(file);
+	write(config, out);
+	rewind(file);
+	fixed_width_stream<FILE*> in(file);
+	if (read(*read_config, in)) {
+		fprintf(stderr, "ERROR: A configuration with a history of length 0 was read.\n");
+		free(*read_config); error_count++;
+	}
+	free(read_config); fclose(file);
+
+	/* step more than `history_length + 1` times, so that the ring wraps around several times */
+	config.history_length = history_length;
+	simulator<empty_data> sim(config, empty_data(), 0);
+	uint64_t agent_id;
+	agent_state* agent;
+	if (sim.add_agent(agent_id, agent) != status::OK) {
+		fprintf(stderr, "ERROR: Unable to add new agent.\n");
+		return EXIT_FAILURE;
+	}
+
+	const size_t vision_size = (2*config.vision_range + 1) * (2*config.vision_range + 1) * config.color_dimension;
+	const size_t observation_size = config.scent_dimension + vision_size;
+	const size_t stride = observation_stride(config);
+	float* recorded = (float*) calloc((max_time + 1) * stride, sizeof(float));
+	float* history = (float*) malloc(sizeof(float) * history_length * stride);
+	if (recorded == nullptr || history == nullptr) {
+		fprintf(stderr, "ERROR: Out of memory.\n");
+		if (recorded != nullptr) free(recorded);
+		return EXIT_FAILURE;
+	}
+
+	for (unsigned int t = 0; t <= max_time; t++) {
+		if (t > 0 && take_action(sim, agent_id, t) != status::OK) {
+			fprintf(stderr, "ERROR: Unable to move the agent.\n");
+			error_count++; break;
+		}
+
+		/* record the current observation */
+		float* current = recorded + t * stride;
+		position location; direction orientation;
+		sim.get_observations(&agent_id, 1, &location, &orientation, current, current + config.scent_dimension, &result);
+		if (result != status::OK) {
+			fprintf(stderr, "ERROR: Unable to get the observation.\n");
+			error_count++; break;
+		}
+
+		if (!check_history(sim, agent_id, recorded, t + 1, stride, observation_size, history))
+			error_count++;
+		if (!check_pinned_history(sim, agent_id, stride, observation_size, history))
+			error_count++;
+		if (!check_mirror(sim, agent_id, stride))
+			error_count++;
+	}
+
+	/* a pinned slab is kept when adding agents moves the observations into a larger slab */
+	size_t offset;
+	const float* slab = sim.pin_observations(&agent_id, 1, &offset, &result);
+	for (unsigned int i = 0; i < 64 && error_count == 0; i++) {
+		uint64_t new_agent_id;
+		agent_state* new_agent;
+		if (sim.add_agent(new_agent_id, new_agent) != status::OK) {
+			fprintf(stderr, "ERROR: Unable to add new agent.\n");
+			error_count++;
+		}
+	}
+	if (result != status::OK || memcmp(slab + offset, history, sizeof(float) * history_length * stride) != 0) {
+		fprintf(stderr, "ERROR: The pinned observation slab changed after adding agents.\n");
+		error_count++;
+	}
+	sim.unpin_observations();
+	free(recorded); free(history);
+
+	fprintf(stderr, "Checked the observation history over %u steps (%u errors).\n", max_time, error_count);
+	return (error_count == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,520 @@
+/**
+ * Copyright 2019, The Jelly Bean World Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+
+#define _USE_MATH_DEFINES
+#include <jbw/mpi.h>
+#include "test_common.h"
+
+#include <inttypes.h>
+
+constexpr uint16_t server_port = 54354;
+constexpr unsigned int agent_count = 3;
+async_server server;
+
+void on_step(const simulator<empty_data>* sim,
+		const hash_map<uint64_t, agent_state*>& agents, uint64_t time)
+{
+	if (!send_step_response(server, agents, sim->get_config()))
+		fprintf(stderr, "on_step ERROR: send_step_response failed.\n");
+}
+
+/**
+ * The state of a test client, which records the response to its last
+ * request, and the number of step responses it has received.
+ */
+struct client_data {
+	std::mutex lock;
+	std::condition_variable condition;
+	bool waiting_for_server;
+	status response;
+	uint64_t agent_id;
+	uint64_t step_count;
+
+	/* the response to the last `send_act_batch` request */
+	uint64_t* batch_ids;
+	status* batch_results;
+	size_t batch_count;
+
+	/* the contents of the last `plan_ended` message */
+	uint64_t* ended_ids;
+	plan_status* ended_results;
+	unsigned int* ended_action_counts;
+	size_t ended_count;
+
+	/* the patches in the response to the last `send_get_map` or `send_get_map_delta` request */
+	array<array<patch_state>>* map;
+
+	client_data() : waiting_for_server(false), step_count(0),
+		batch_ids(nullptr), batch_results(nullptr), batch_count(0),
+		ended_ids(nullptr), ended_results(nullptr), ended_action_counts(nullptr), ended_count(0),
+		map(nullptr) { }
+
+	~client_data() {
+		if (batch_ids != nullptr) free(batch_ids);
+		if (batch_results != nullptr) free(batch_results);
+		free_plan_ended();
+		free_map();
+	}
+
+	inline void free_map() {
+		if (map == nullptr) return;
+		for (array<patch_state>& row : *map) {
+			for (patch_state& patch : row) free(patch);
+			free(row);
+		}
+		free(*map); free(map);
+		map = nullptr;
+	}
+
+	inline void free_plan_ended() {
+		if (ended_ids != nullptr) free(ended_ids);
+		if (ended_results != nullptr) free(ended_results);
+		if (ended_action_counts != nullptr) free(ended_action_counts);
+		ended_ids = nullptr; ended_results = nullptr;
+		ended_action_counts = nullptr; ended_count = 0;
+	}
+};
+
+inline void respond(client<client_data>& c, status response) {
+	std::unique_lock<std::mutex> lck(c.data.lock);
+	c.data.waiting_for_server = false;
+	c.data.response = response;
+	c.data.condition.notify_one();
+}
+
+void on_add_agent(client<client_data>& c, uint64_t agent_id, status response, const agent_state& state) {
+	c.data.agent_id = agent_id;
+	respond(c, response);
+}
+
+void on_remove_agent(client<client_data>& c, uint64_t agent_id, status response) { respond(c, response); }
+void on_add_semaphore(client<client_data>& c, uint64_t semaphore_id, status response) { respond(c, response); }
+void on_remove_semaphore(client<client_data>& c, uint64_t semaphore_id, status response) { respond(c, response); }
+void on_signal_semaphore(client<client_data>& c, uint64_t semaphore_id, status response) { respond(c, response); }
+void on_move(client<client_data>& c, uint64_t agent_id, status response) { respond(c, response); }
+void on_turn(client<client_data>& c, uint64_t agent_id, status response) { respond(c, response); }
+void on_do_nothing(client<client_data>& c, uint64_t agent_id, status response) { respond(c, response); }
+void on_submit_plan(client<client_data>& c, uint64_t agent_id, status response) { respond(c, response); }
+void on_set_active(client<client_data>& c, uint64_t agent_id, status response) { respond(c, response); }
+void on_is_active(client<client_data>& c, uint64_t agent_id, status response, bool active) { respond(c, response); }
+
+void on_get_semaphores(client<client_data>& c, status response,
+		uint64_t* semaphore_ids, bool* signaled, size_t semaphore_count)
+{
+	if (semaphore_ids != nullptr) free(semaphore_ids);
+	if (signaled != nullptr) free(signaled);
+	respond(c, response);
+}
+
+void on_act_batch(client<client_data>& c, status response,
+		uint64_t* agent_ids, status* results, size_t count)
+{
+	std::unique_lock<std::mutex> lck(c.data.lock);
+	if (c.data.batch_ids != nullptr) free(c.data.batch_ids);
+	if (c.data.batch_results != nullptr) free(c.data.batch_results);
+	c.data.batch_ids = agent_ids;
+	c.data.batch_results = results;
+	c.data.batch_count = count;
+	c.data.waiting_for_server = false;
+	c.data.response = response;
+	c.data.condition.notify_one();
+}
+
+void on_plan_ended(client<client_data>& c, uint64_t* agent_ids,
+		plan_status* results, unsigned int* action_counts, size_t count)
+{
+	std::unique_lock<std::mutex> lck(c.data.lock);
+	c.data.free_plan_ended();
+	c.data.ended_ids = agent_ids;
+	c.data.ended_results = results;
+	c.data.ended_action_counts = action_counts;
+	c.data.ended_count = count;
+}
+
+void on_get_stats(client<client_data>& c, status response, const step_profile& profile) { respond(c, response); }
+void on_get_map(client<client_data>& c, status response, array<array<patch_state>>* map)
+{
+	std::unique_lock<std::mutex> lck(c.data.lock);
+	c.data.free_map();
+	c.data.map = map;
+	c.data.waiting_for_server = false;
+	c.data.response = response;
+	c.data.condition.notify_one();
+}
+void on_get_agent_ids(client<client_data>& c, status response, const uint64_t* agent_ids, size_t count) { respond(c, response); }
+
+void on_get_agent_states(client<client_data>& c, status response,
+		const uint64_t* agent_ids, const agent_state* agent_states, size_t count)
+{
+	respond(c, response);
+}
+
+void on_step(client<client_data>& c, status response,
+		const array<uint64_t>& agent_ids, const agent_state* agent_states)
+{
+	std::unique_lock<std::mutex> lck(c.data.lock);
+	c.data.step_count++;
+	c.data.condition.notify_one();
+}
+
+void on_lost_connection(client<client_data>& c) {
+	fprintf(stderr, "ERROR: The client lost its connection to the server.\n");
+	std::unique_lock<std::mutex> lck(c.data.lock);
+	c.client_running = false;
+	c.data.condition.notify_one();
+}
+
+/* Waits for the response to the last request of the client `c`. */
+inline bool wait_for_server(client<client_data>& c) {
+	std::unique_lock<std::mutex> lck(c.data.lock);
+	while (c.data.waiting_for_server && c.client_running)
+		c.data.condition.wait(lck);
+	return c.client_running;
+}
+
+/**
+ * The batch of actions submitted by both tests below, for the agents with
+ * IDs `agent_ids`, which contains a valid action for every agent, a
+ * disallowed action, an invalid agent ID, and a second action for an agent
+ * that has already acted. Each entry has the expected result in `expected`.
+ */
+constexpr size_t batch_size = 6;
+void make_batch(const uint64_t* agent_ids, uint64_t* batch_ids, action* actions, status* expected)
+{
+	batch_ids[0] = agent_ids[0]; actions[0] = {action_type::MOVE, direction::UP, 1}; expected[0] = status::OK;
+	batch_ids[1] = agent_ids[1]; actions[1] = {action_type::DO_NOTHING, direction::UP, 0}; expected[1] = status::PERMISSION_ERROR;
+	batch_ids[2] = UINT64_MAX; actions[2] = {action_type::MOVE, direction::UP, 1}; expected[2] = status::INVALID_AGENT_ID;
+	batch_ids[3] = agent_ids[0]; actions[3] = {action_type::TURN, direction::LEFT, 0}; expected[3] = status::AGENT_ALREADY_ACTED;
+	batch_ids[4] = agent_ids[1]; actions[4] = {action_type::MOVE, direction::UP, 1}; expected[4] = status::OK;
+	batch_ids[5] = agent_ids[2]; actions[5] = {action_type::TURN, direction::LEFT, 0}; expected[5] = status::OK;
+}
+
+/**
+ * Returns `true` if the agents with the given `agent_ids` in `sim` were
+ * moved and turned by the batch from `make_batch`, starting from
+ * `initial_positions` and `initial_directions`.
+ */
+bool check_batch_applied(simulator<empty_data>& sim, uint64_t* agent_ids,
+		const position* initial_positions, const direction* initial_directions)
+{
+	agent_state* states[agent_count];
+	sim.get_agent_states(states, agent_ids, agent_count);
+	bool success = true;
+	for (unsigned int i = 0; i < agent_count; i++) {
+		if (states[i] == nullptr) {
+			fprintf(stderr, "ERROR: Unable to get the state of agent %u.\n", i);
+			success = false; continue;
+		}
+		const bool moved = (i < 2);
+		if ((states[i]->current_position != initial_positions[i]) != moved
+		 || (states[i]->current_direction != initial_directions[i]) == moved)
+		{
+			fprintf(stderr, "ERROR: Agent %u did not take the action in the batch.\n", i);
+			success = false;
+		}
+		states[i]->lock.unlock();
+	}
+	return success;
+}
+
+/* Records the positions and directions of the agents with the given `agent_ids` in `sim`. */
+void get_initial_states(simulator<empty_data>& sim, uint64_t* agent_ids,
+		position* positions, direction* directions)
+{
+	agent_state* states[agent_count];
+	sim.get_agent_states(states, agent_ids, agent_count);
+	for (unsigned int i = 0; i < agent_count; i++) {
+		positions[i] = states[i]->current_position;
+		directions[i] = states[i]->current_direction;
+		states[i]->lock.unlock();
+	}
+}
+
+/**
+ * Submits the batch from `make_batch` directly with `simulator::act`, and
+ * checks the result of each entry, and that the simulation advances by
+ * exactly one time step, once the last agent has acted.
+ */
+bool test_act_batch(const simulator_config& config)
+{
+	simulator<empty_data> sim(config, empty_data(), 0);
+	uint64_t agent_ids[agent_count];
+	for (unsigned int i = 0; i < agent_count; i++) {
+		agent_state* new_agent;
+		if (sim.add_agent(agent_ids[i], new_agent) != status::OK) {
+			fprintf(stderr, "ERROR: Unable to add new agent.\n");
+			return false;
+		}
+	}
+	position positions[agent_count]; direction directions[agent_count];
+	get_initial_states(sim, agent_ids, positions, directions);
+
+	uint64_t batch_ids[batch_size]; action actions[batch_size];
+	status expected[batch_size]; status results[batch_size];
+	make_batch(agent_ids, batch_ids, actions, expected);
+
+	/* the batch without the last agent doesn't advance the simulation */
+	bool success = true;
+	const uint64_t start_time = sim.time;
+	sim.act(batch_ids, actions, batch_size - 1, results);
+	if (sim.time != start_time) {
+		fprintf(stderr, "ERROR: A batch in which not every agent acted advanced the simulation.\n");
+		success = false;
+	}
+	sim.act(batch_ids + batch_size - 1, actions + batch_size - 1, 1, results + batch_size - 1);
+	for (size_t i = 0; i < batch_size; i++) {
+		if (results[i] != expected[i]) {
+			fprintf(stderr, "ERROR: Entry %zu of the batch has result %u, but expected %u.\n",
+					i, (unsigned int) results[i], (unsigned int) expected[i]);
+			success = false;
+		}
+	}
+	if (sim.time != start_time + 1) {
+		fprintf(stderr, "ERROR: The batch advanced the simulation by %llu time steps, rather than one.\n",
+				(unsigned long long) (sim.time - start_time));
+		success = false;
+	}
+	return check_batch_applied(sim, agent_ids, positions, directions) && success;
+}
+
+/**
+ * Submits a plan of `plan_length` actions for each of the agents with the
+ * given `agent_ids`, owned by the client `c`, with `SUBMIT_PLAN` messages,
+ * and checks that the server sends a single `PLAN_ENDED` message once the
+ * plans are completed, and no step responses while they are running.
+ */
+bool test_plan_messages(simulator<empty_data>& sim,
+		client<client_data>& c, const uint64_t* agent_ids)
+{
+	constexpr unsigned int plan_length = 2;
+	const action plan[] = {
+		{action_type::MOVE, direction::UP, 1},
+		{action_type::TURN, direction::LEFT, 0}
+	};
+
+	/* plans for agents that the client doesn't own are rejected */
+	c.data.waiting_for_server = true;
+	if (!send_submit_plan(c, UINT64_MAX, plan, plan_length, PLAN_ABORT_NEVER) || !wait_for_server(c)) {
+		fprintf(stderr, "ERROR: Unable to send the submit_plan request.\n");
+		return false;
+	}
+	bool success = true;
+	if (c.data.response != status::INVALID_AGENT_ID) {
+		fprintf(stderr, "ERROR: The server accepted a plan for an agent that doesn't exist.\n");
+		success = false;
+	}
+
+	/* the last plan advances the simulation until all the plans end */
+	const uint64_t start_time = sim.time;
+	const uint64_t start_step_count = c.data.step_count;
+	for (unsigned int i = 0; i < agent_count; i++) {
+		c.data.waiting_for_server = true;
+		if (!send_submit_plan(c, agent_ids[i], plan, plan_length, PLAN_ABORT_NEVER) || !wait_for_server(c)) {
+			fprintf(stderr, "ERROR: Unable to send the submit_plan request.\n");
+			return false;
+		} else if (c.data.response != status::OK) {
+			fprintf(stderr, "ERROR: The server rejected the plan of agent %u.\n", i);
+			success = false;
+		}
+	}
+
+	/* the `plan_ended` message and the step response are sent before the
+	   response to the last plan */
+	if (sim.time != start_time + plan_length || c.data.step_count != start_step_count + 1) {
+		fprintf(stderr, "ERROR: The server advanced %llu time steps and sent %llu step responses while executing the plans.\n",
+				(unsigned long long) (sim.time - start_time), (unsigned long long) (c.data.step_count - start_step_count));
+		success = false;
+	}
+	if (c.data.ended_count != agent_count) {
+		fprintf(stderr, "ERROR: The plan_ended message contains %zu plans, but expected %u.\n", c.data.ended_count, agent_count);
+		return false;
+	}
+	for (unsigned int i = 0; i < agent_count; i++) {
+		if (c.data.ended_ids[i] != agent_ids[i]
+		 || c.data.ended_results[i] != plan_status::COMPLETED
+		 || c.data.ended_action_counts[i] != plan_length)
+		{
+			fprintf(stderr, "ERROR: Entry %u of the plan_ended message is for agent %" PRIu64 " with state %u after %u actions.\n",
+					i, c.data.ended_ids[i], (unsigned int) c.data.ended_results[i], c.data.ended_action_counts[i]);
+			success = false;
+		}
+	}
+	return success;
+}
+
+/**
+ * Retrieves the map around the origin with a `GET_MAP_DELTA` message if
+ * `delta` is true, or with a `GET_MAP` message otherwise, and stores the positions and versions of the returned patches in
+ * `positions` and `versions`, which must have sufficient capacity.
+ */
+bool get_map_versions(client<client_data>& c, bool delta,
+		position* positions, uint64_t* versions, size_t& count,
+		const position* known_positions, const uint64_t* known_versions, size_t known_count)
+{
+	c.data.waiting_for_server = true;
+	bool sent = !delta
+			? send_get_map(c, {-64, -64}, {64, 64}, true, false)
+			: send_get_map_delta(c, {-64, -64}, {64, 64}, true, false, known_positions, known_versions, known_count);
+	if (!sent || !wait_for_server(c) || c.data.response != status::OK) {
+		fprintf(stderr, "ERROR: Unable to retrieve the map.\n");
+		return false;
+	}
+	count = 0;
+	for (const array<patch_state>& row : *c.data.map) {
+		for (const patch_state& patch : row) {
+			positions[count] = patch.patch_position;
+			versions[count++] = patch.version;
+		}
+	}
+	return true;
+}
+
+/**
+ * Checks that a `GET_MAP_DELTA` message omits the patches whose versions
+ * the client already has, and that a `GET_MAP` message still returns every
+ * patch, without versions.
+ */
+bool test_get_map_messages(client<client_data>& c)
+{
+	constexpr size_t max_patch_count = 64;
+	position positions[max_patch_count], known_positions[max_patch_count];
+	uint64_t versions[max_patch_count], known_versions[max_patch_count];
+	size_t count, known_count;
+	if (!get_map_versions(c, false, positions, versions, count, nullptr, nullptr, 0)
+	 || !get_map_versions(c, true, known_positions, known_versions, known_count, nullptr, nullptr, 0))
+		return false;
+
+	bool success = true;
+	if (count == 0 || count != known_count) {
+		fprintf(stderr, "ERROR: The get_map request returned %zu patches, and the get_map_delta request returned %zu.\n", count, known_count);
+		success = false;
+	}
+	for (size_t i = 0; i < count; i++) {
+		if (versions[i] != 0) {
+			fprintf(stderr, "ERROR: The get_map response contains patch versions.\n");
+			success = false; break;
+		}
+	}
+
+	/* nothing changed, so none of the known patches are returned */
+	if (!get_map_versions(c, true, positions, versions, count, known_positions, known_versions, known_count))
+		return false;
+	if (count != 0) {
+		fprintf(stderr, "ERROR: The get_map_delta request returned %zu patches whose versions are known.\n", count);
+		success = false;
+	}
+
+	/* the get_map request is unaffected by the known versions */
+	if (!get_map_versions(c, false, positions, versions, count, nullptr, nullptr, 0))
+		return false;
+	if (count != known_count) {
+		fprintf(stderr, "ERROR: The get_map request returned %zu patches, rather than %zu.\n", count, known_count);
+		success = false;
+	}
+	return success;
+}
+
+/**
+ * Submits the batch from `make_batch` with an `ACT_BATCH` message, and
+ * checks that the `ACT_BATCH_RESPONSE` echoes the agent IDs and contains
+ * the result of each entry, and that the server steps exactly once. Then
+ * tests the plan messages (see `test_plan_messages`) and the map messages
+ * (see `test_get_map_messages`).
+ */
+bool test_messages(const simulator_config& config)
+{
+	simulator<empty_data> sim(config, empty_data(), 0);
+	if (!init_server(server, sim, server_port, 16, 4, permissions::grant_all())) {
+		fprintf(stderr, "ERROR: init_server returned false.\n");
+		return false;
+	}
+
+	client<client_data> c;
+	uint64_t client_id;
+	char port[8];
+	snprintf(port, sizeof(port), "%u", (unsigned int) server_port);
+	if (connect_client(c, "localhost", port, client_id) == UINT64_MAX) {
+		fprintf(stderr, "ERROR: Unable to connect to the server.\n");
+		stop_server(server); return false;
+	}
+
+	/* the agents are added by the client, so that it may act for them */
+	uint64_t agent_ids[agent_count];
+	for (unsigned int i = 0; i < agent_count; i++) {
+		c.data.waiting_for_server = true;
+		if (!send_add_agent(c) || !wait_for_server(c) || c.data.response != status::OK) {
+			fprintf(stderr, "ERROR: Unable to add new agent.\n");
+			stop_client(c); stop_server(server); return false;
+		}
+		agent_ids[i] = c.data.agent_id;
+	}
+	position positions[agent_count]; direction directions[agent_count];
+	get_initial_states(sim, agent_ids, positions, directions);
+
+	uint64_t batch_ids[batch_size]; action actions[batch_size]; status expected[batch_size];
+	make_batch(agent_ids, batch_ids, actions, expected);
+
+	const uint64_t start_time = sim.time;
+	c.data.waiting_for_server = true;
+	if (!send_act_batch(c, batch_ids, actions, batch_size) || !wait_for_server(c)) {
+		fprintf(stderr, "ERROR: Unable to send the act_batch request.\n");
+		stop_client(c); stop_server(server); return false;
+	}
+
+	/* the step response is sent before the response to the batch */
+	bool success = true;
+	if (c.data.response != status::OK || c.data.batch_count != batch_size) {
+		fprintf(stderr, "ERROR: The server failed to process the batch.\n");
+		success = false;
+	} else {
+		for (size_t i = 0; i < batch_size; i++) {
+			if (c.data.batch_ids[i] != batch_ids[i] || c.data.batch_results[i] != expected[i]) {
+				fprintf(stderr, "ERROR: Entry %zu of the batch response is for agent %" PRIu64 " with result %u, but expected agent %" PRIu64 " with result %u.\n",
+						i, c.data.batch_ids[i], (unsigned int) c.data.batch_results[i], batch_ids[i], (unsigned int) expected[i]);
+				success = false;
+			}
+		}
+	}
+	if (sim.time != start_time + 1 || c.data.step_count != 1) {
+		fprintf(stderr, "ERROR: The server advanced %llu time steps and sent %llu step responses, rather than one.\n",
+				(unsigned long long) (sim.time - start_time), (unsigned long long) c.data.step_count);
+		success = false;
+	}
+	success &= check_batch_applied(sim, agent_ids, positions, directions);
+	success &= test_plan_messages(sim, c, agent_ids);
+	success &= test_get_map_messages(c);
+
+	stop_client(c);
+	stop_server(server);
+	return success;
+}
+
+int main(int argc, const char** argv)
+{
+	simulator_config config;
+	init_banana_config(config);
+
+	/* the agents are all added at the origin */
+	config.collision_policy = movement_conflict_policy::NO_COLLISIONS;
+
+	unsigned int error_count = 0;
+	if (!test_act_batch(config)) error_count++;
+	if (!test_messages(config)) error_count++;
+
+	fprintf(stderr, "Completed the simulator protocol tests (%u errors).\n", error_count);
+	return (error_count == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,162 @@
+/**
+ * Copyright 2019, The Jelly Bean World Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+#define _USE_MATH_DEFINES
+#include "test_common.h"
+
+#include <core/timer.h>
+#include <cmath>
+
+void on_step(const simulator<empty_data>* sim,
+		const hash_map<uint64_t, agent_state*>& agents, uint64_t time)
+{ }
+
+constexpr unsigned int agent_count = 8;
+constexpr unsigned int max_time = 200;
+constexpr uint_fast32_t seed = 0;
+
+/**
+ * Runs a simulation with the given `config` for `max_time` steps, and
+ * returns the visual fields of all agents at the end of the simulation in
+ * `visions`, which must have room for `agent_count` visual fields.
+ */
+bool run_simulation(const simulator_config& config,
+		float* visions, unsigned long long& elapsed)
+{
+	simulator<empty_data>& sim = *((simulator<empty_data>*) alloca(sizeof(simulator<empty_data>)));
+	if (init(sim, config, empty_data(), seed) != status::OK) {
+		fprintf(stderr, "ERROR: Unable to initialize simulator.\n");
+		return false;
+	}
+
+	uint64_t agent_ids[agent_count];
+	for (unsigned int i = 0; i < agent_count; i++) {
+		agent_state* new_agent;
+		if (sim.add_agent(agent_ids[i], new_agent) != status::OK) {
+			fprintf(stderr, "ERROR: Unable to add new agent.\n");
+			free(sim); return false;
+		}
+	}
+
+	/* each agent starts facing a different direction, and turns periodically */
+	timer stopwatch;
+	for (unsigned int t = 0; t < max_time; t++) {
+		for (unsigned int i = 0; i < agent_count; i++) {
+			status result;
+			if (t < i % (size_t) direction::COUNT || t % 10 == 9)
+				result = sim.turn(agent_ids[i], direction::LEFT);
+			else result = sim.move(agent_ids[i], direction::UP, 1);
+			if (result != status::OK) {
+				fprintf(stderr, "ERROR: Unable to move agent %" PRIu64 ".\n", agent_ids[i]);
+				free(sim); return false;
+			}
+		}
+	}
+	elapsed = stopwatch.milliseconds();
+
+	unsigned int vision_size = (2*config.vision_range + 1) * (2*config.vision_range + 1) * config.color_dimension;
+	agent_state* states[agent_count];
+	sim.get_agent_states(states, agent_ids, agent_count);
+	for (unsigned int i = 0; i < agent_count; i++) {
+		memcpy(visions + i * vision_size, states[i]->current_vision, sizeof(float) * vision_size);
+		states[i]->lock.unlock();
+	}
+	free(sim);
+	return true;
+}
+
+int main(int argc, const char** argv)
+{
+	simulator_config config;
+	init_test_config(config);
+	config.vision_range = 20;
+	config.agent_field_of_view = (float) (2 * M_PI);
+	config.collision_policy = movement_conflict_policy::NO_COLLISIONS;
+
+	/* configure item types */
+	unsigned int item_type_count = 2;
+	config.item_types.ensure_capacity(item_type_count);
+	config.item_types[0].name = "jellybean";
+	config.item_types[0].scent = (float*) calloc(config.scent_dimension, sizeof(float));
+	config.item_types[0].color = (float*) calloc(config.color_dimension, sizeof(float));
+	config.item_types[0].required_item_counts = (unsigned int*) calloc(item_type_count, sizeof(unsigned int));
+	config.item_types[0].required_item_costs = (unsigned int*) calloc(item_type_count, sizeof(unsigned int));
+	config.item_types[0].scent[2] = 1.0f;
+	config.item_types[0].color[2] = 1.0f;
+	config.item_types[0].blocks_movement = false;
+	config.item_types[0].visual_occlusion = 0.0;
+	config.item_types[1].name = "wall";
+	config.item_types[1].scent = (float*) calloc(config.scent_dimension, sizeof(float));
+	config.item_types[1].color = (float*) calloc(config.color_dimension, sizeof(float));
+	config.item_types[1].required_item_counts = (unsigned int*) calloc(item_type_count, sizeof(unsigned int));
+	config.item_types[1].required_item_costs = (unsigned int*) calloc(item_type_count, sizeof(unsigned int));
+	config.item_types[1].color[0] = 0.5f;
+	config.item_types[1].color[1] = 0.5f;
+	config.item_types[1].color[2] = 0.5f;
+	config.item_types[1].required_item_counts[1] = 1;
+	config.item_types[1].blocks_movement = true;
+	config.item_types[1].visual_occlusion = 1.0;
+	config.item_types.length = item_type_count;
+
+	config.item_types[0].intensity_fn.fn = constant_intensity_fn;
+	config.item_types[0].intensity_fn.arg_count = 1;
+	config.item_types[0].intensity_fn.args = (float*) malloc(sizeof(float) * 1);
+	config.item_types[0].intensity_fn.args[0] = -5.3f;
+	config.item_types[0].interaction_fns = (energy_function<interaction_function>*)
+			malloc(sizeof(energy_function<interaction_function>) * config.item_types.length);
+	config.item_types[1].intensity_fn.fn = constant_intensity_fn;
+	config.item_types[1].intensity_fn.arg_count = 1;
+	config.item_types[1].intensity_fn.args = (float*) malloc(sizeof(float) * 1);
+	config.item_types[1].intensity_fn.args[0] = 0.0f;
+	config.item_types[1].interaction_fns = (energy_function<interaction_function>*)
+			malloc(sizeof(energy_function<interaction_function>) * config.item_types.length);
+
+	set_interaction_args(config.item_types.data, 0, 0, piecewise_box_interaction_fn, {10.0f, 200.0f, 0.0f, -6.0f});
+	set_interaction_args(config.item_types.data, 0, 1, zero_interaction_fn, {});
+	set_interaction_args(config.item_types.data, 1, 0, zero_interaction_fn, {});
+	set_interaction_args(config.item_types.data, 1, 1, cross_interaction_fn, {10.0f, 15.0f, 20.0f, -200.0f, -20.0f, 1.0f});
+
+	unsigned int vision_size = (2*config.vision_range + 1) * (2*config.vision_range + 1) * config.color_dimension;
+	float* per_cell_visions = (float*) malloc(sizeof(float) * agent_count * vision_size);
+	float* shadow_casting_visions = (float*) malloc(sizeof(float) * agent_count * vision_size);
+	if (per_cell_visions == nullptr || shadow_casting_visions == nullptr) {
+		fprintf(stderr, "ERROR: Insufficient memory for visual fields.\n");
+		if (per_cell_visions != nullptr) free(per_cell_visions);
+		return EXIT_FAILURE;
+	}
+
+	unsigned long long per_cell_elapsed, shadow_casting_elapsed;
+	config.occlusion = occlusion_method::PER_CELL;
+	if (!run_simulation(config, per_cell_visions, per_cell_elapsed)) {
+		free(per_cell_visions); free(shadow_casting_visions);
+		return EXIT_FAILURE;
+	}
+	config.occlusion = occlusion_method::SHADOW_CASTING;
+	if (!run_simulation(config, shadow_casting_visions, shadow_casting_elapsed)) {
+		free(per_cell_visions); free(shadow_casting_visions);
+		return EXIT_FAILURE;
+	}
+
+	float max_difference = 0.0f;
+	for (unsigned int i = 0; i < agent_count * vision_size; i++)
+		max_difference = max(max_difference, fabs(per_cell_visions[i] - shadow_casting_visions[i]));
+	free(per_cell_visions); free(shadow_casting_visions);
+
+	fprintf(stderr, "PER_CELL: %lf simulation steps per second.\n", ((double) max_time / per_cell_elapsed) * 1000);
+	fprintf(stderr, "SHADOW_CASTING: %lf simulation steps per second.\n", ((double) max_time / shadow_casting_elapsed) * 1000);
+	fprintf(stderr, "Maximum difference in visual fields: %g\n", max_difference);
+	return (max_difference <= 1.0e-6f) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,304 @@
+/**
+ * Copyright 2019, The Jelly Bean World Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+
+#define _USE_MATH_DEFINES
+#include "test_common.h"
+
+constexpr unsigned int max_plan_length = 200;
+
+void on_step(const simulator<empty_data>* sim,
+		const hash_map<uint64_t, agent_state*>& agents, uint64_t time)
+{ }
+
+/**
+ * Checks that the plan of the agent with the given `agent_id` in `sim` is
+ * in the state `expected_state`, after `expected_position` of its actions
+ * were taken. The agent's state is stored in `agent`, and its lock is held
+ * on return, if the agent exists.
+ */
+bool check_plan(simulator<empty_data>& sim, uint64_t agent_id,
+		plan_status expected_state, unsigned int expected_position,
+		agent_state*& agent, const char* test_name)
+{
+	sim.get_agent_states(&agent, &agent_id, 1);
+	if (agent == nullptr) {
+		fprintf(stderr, "ERROR (%s): Unable to get the agent state.\n", test_name);
+		return false;
+	} else if (agent->plan_state != expected_state || agent->plan_position != expected_position) {
+		fprintf(stderr, "ERROR (%s): The plan has state %u after %u actions, but expected state %u after %u actions.\n",
+				test_name, (unsigned int) agent->plan_state, agent->plan_position,
+				(unsigned int) expected_state, expected_position);
+		return false;
+	}
+	return true;
+}
+
+inline bool check_plan(simulator<empty_data>& sim, uint64_t agent_id,
+		plan_status expected_state, unsigned int expected_position,
+		const char* test_name)
+{
+	agent_state* agent;
+	bool success = check_plan(sim, agent_id, expected_state, expected_position, agent, test_name);
+	if (agent != nullptr) agent->lock.unlock();
+	return success;
+}
+
+/**
+ * Submits a plan for a single agent, which the simulator executes to
+ * completion without waiting for the agent, and checks that invalid plans
+ * are rejected.
+ */
+bool test_completion(const simulator_config& config)
+{
+	simulator<empty_data> sim(config, empty_data(), 0);
+	uint64_t agent_id;
+	agent_state* agent;
+	if (sim.add_agent(agent_id, agent) != status::OK) {
+		fprintf(stderr, "ERROR: Unable to add new agent.\n");
+		return false;
+	}
+
+	bool success = true;
+	const action invalid_plan[] = {{action_type::DO_NOTHING, direction::UP, 0}};
+	if (sim.submit_plan(agent_id, invalid_plan, 1) != status::PERMISSION_ERROR) {
+		fprintf(stderr, "ERROR (completion): A plan with a disallowed action was submitted.\n");
+		success = false;
+	}
+	const action plan[] = {
+		{action_type::MOVE, direction::UP, 1},
+		{action_type::TURN, direction::LEFT, 0},
+		{action_type::MOVE, direction::UP, 1}
+	};
+	if (sim.submit_plan(agent_id + 1, plan, 3) != status::INVALID_AGENT_ID) {
+		fprintf(stderr, "ERROR (completion): A plan was submitted for an agent that doesn't exist.\n");
+		success = false;
+	}
+
+	/* the agent is the only one, so the whole plan is executed immediately */
+	const uint64_t start_time = sim.time;
+	const position start_position = agent->current_position;
+	const direction start_direction = agent->current_direction;
+	if (sim.submit_plan(agent_id, plan, 3) != status::OK) {
+		fprintf(stderr, "ERROR (completion): Unable to submit the plan.\n");
+		return false;
+	}
+	if (sim.time != start_time + 3) {
+		fprintf(stderr, "ERROR (completion): The plan of 3 actions advanced the simulation by %llu time steps.\n",
+				(unsigned long long) (sim.time - start_time));
+		success = false;
+	}
+	success &= check_plan(sim, agent_id, plan_status::COMPLETED, 3, agent, "completion");
+	if (agent != nullptr) {
+		if (agent->current_position == start_position || agent->current_direction == start_direction) {
+			fprintf(stderr, "ERROR (completion): The agent did not take the actions of the plan.\n");
+			success = false;
+		}
+		agent->lock.unlock();
+	}
+
+	/* the plan is reported only in the time step in which it ended */
+	if (sim.turn(agent_id, direction::LEFT) != status::OK) {
+		fprintf(stderr, "ERROR (completion): Unable to turn after the plan ended.\n");
+		success = false;
+	}
+	return check_plan(sim, agent_id, plan_status::NONE, 3, "completion") && success;
+}
+
+/**
+ * Submits a plan that moves the agent in `agent_ids[1]` into the agent in
+ * `agent_ids[0]`, which doesn't move, so that the plan is aborted by
+ * `PLAN_ABORT_BLOCKED` after its first action.
+ */
+bool test_abort_blocked(const simulator_config& config)
+{
+	simulator<empty_data> sim(config, empty_data(), 0);
+	uint64_t agent_ids[2];
+	if (!add_agents(sim, agent_ids, 2)) return false;
+
+	/* the second agent is directly below the first, and both face up */
+	const action plan[] = {
+		{action_type::MOVE, direction::UP, 1},
+		{action_type::MOVE, direction::UP, 1},
+		{action_type::MOVE, direction::UP, 1}
+	};
+	if (sim.submit_plan(agent_ids[1], plan, 3, PLAN_ABORT_BLOCKED) != status::OK) {
+		fprintf(stderr, "ERROR (blocked): Unable to submit the plan.\n");
+		return false;
+	}
+	agent_state* agent;
+	bool success = check_plan(sim, agent_ids[1], plan_status::RUNNING, 1, agent, "blocked");
+	if (agent == nullptr) return false;
+	const position start_position = agent->current_position;
+	agent->lock.unlock();
+
+	const uint64_t start_time = sim.time;
+	if (sim.turn(agent_ids[0], direction::LEFT) != status::OK || sim.time != start_time + 1) {
+		fprintf(stderr, "ERROR (blocked): Unable to advance the simulation.\n");
+		return false;
+	}
+	success &= check_plan(sim, agent_ids[1], plan_status::ABORTED_BLOCKED, 1, agent, "blocked");
+	if (agent != nullptr) {
+		if (agent->current_position != start_position) {
+			fprintf(stderr, "ERROR (blocked): The agent moved into the position of another agent.\n");
+			success = false;
+		}
+		agent->lock.unlock();
+	}
+
+	/* the aborted plan doesn't act for the agent */
+	if (sim.turn(agent_ids[0], direction::LEFT) != status::OK || sim.time != start_time + 1) {
+		fprintf(stderr, "ERROR (blocked): The simulation advanced without waiting for the agent whose plan was aborted.\n");
+		success = false;
+	}
+	return success;
+}
+
+/**
+ * Submits a long plan that moves the agent through a world full of items,
+ * so that `PLAN_ABORT_ITEM_VISIBLE` aborts the plan once more items come
+ * into view.
+ */
+bool test_abort_item_visible(const simulator_config& config)
+{
+	simulator<empty_data> sim(config, empty_data(), 0);
+	uint64_t agent_id;
+	agent_state* agent;
+	if (sim.add_agent(agent_id, agent) != status::OK) {
+		fprintf(stderr, "ERROR: Unable to add new agent.\n");
+		return false;
+	}
+
+	action* plan = (action*) malloc(sizeof(action) * max_plan_length);
+	if (plan == nullptr) {
+		fprintf(stderr, "ERROR: Out of memory.\n");
+		return false;
+	}
+	for (unsigned int i = 0; i < max_plan_length; i++)
+		plan[i] = {action_type::MOVE, direction::UP, 1};
+	const uint64_t start_time = sim.time;
+	status result = sim.submit_plan(agent_id, plan, max_plan_length, PLAN_ABORT_ITEM_VISIBLE);
+	free(plan);
+	if (result != status::OK) {
+		fprintf(stderr, "ERROR (item visible): Unable to submit the plan.\n");
+		return false;
+	}
+
+	sim.get_agent_states(&agent, &agent_id, 1);
+	if (agent == nullptr) {
+		fprintf(stderr, "ERROR (item visible): Unable to get the agent state.\n");
+		return false;
+	}
+	bool success = true;
+	if (agent->plan_state != plan_status::ABORTED_ITEM_VISIBLE
+	 || agent->plan_position == 0 || agent->plan_position == max_plan_length)
+	{
+		fprintf(stderr, "ERROR (item visible): The plan has state %u after %u of %u actions, but expected it to be aborted.\n",
+				(unsigned int) agent->plan_state, agent->plan_position, max_plan_length);
+		success = false;
+	} else if (agent->visible_item_count <= agent->plan_visible_item_count) {
+		fprintf(stderr, "ERROR (item visible): The plan was aborted although no more items are visible.\n");
+		success = false;
+	} else if (sim.time != start_time + agent->plan_position) {
+		fprintf(stderr, "ERROR (item visible): The plan of %u actions advanced the simulation by %llu time steps.\n",
+				agent->plan_position, (unsigned long long) (sim.time - start_time));
+		success = false;
+	}
+	agent->lock.unlock();
+	return success;
+}
+
+/**
+ * Replaces the plan of the agent in `agent_ids[0]` while its action for
+ * the current turn is pending, and then cancels its next plan, while the
+ * agent in `agent_ids[1]` advances the simulation.
+ */
+bool test_replace_and_cancel(const simulator_config& config)
+{
+	simulator<empty_data> sim(config, empty_data(), 0);
+	uint64_t agent_ids[2];
+	if (!add_agents(sim, agent_ids, 2)) return false;
+
+	action plan[5];
+	for (unsigned int i = 0; i < 5; i++)
+		plan[i] = {action_type::TURN, direction::LEFT, 0};
+	const uint64_t start_time = sim.time;
+	bool success = true;
+	if (sim.submit_plan(agent_ids[0], plan, 5) != status::OK
+	 || sim.turn(agent_ids[1], direction::LEFT) != status::OK)
+	{
+		fprintf(stderr, "ERROR (replace): Unable to submit the plan.\n");
+		return false;
+	}
+	success &= check_plan(sim, agent_ids[0], plan_status::RUNNING, 2, "replace");
+
+	/* the action of the replaced plan for the current turn is still taken,
+	   and the new plan starts in the next turn */
+	if (sim.submit_plan(agent_ids[0], plan, 2) != status::OK) {
+		fprintf(stderr, "ERROR (replace): Unable to replace the plan.\n");
+		return false;
+	}
+	success &= check_plan(sim, agent_ids[0], plan_status::RUNNING, 0, "replace");
+	for (unsigned int i = 0; i < 3; i++) {
+		if (sim.turn(agent_ids[1], direction::LEFT) != status::OK) {
+			fprintf(stderr, "ERROR (replace): Unable to advance the simulation.\n");
+			return false;
+		}
+		if (i < 2) success &= check_plan(sim, agent_ids[0], plan_status::RUNNING, i + 1, "replace");
+	}
+	success &= check_plan(sim, agent_ids[0], plan_status::COMPLETED, 2, "replace");
+	if (sim.time != start_time + 4) {
+		fprintf(stderr, "ERROR (replace): The simulation advanced by %llu time steps, rather than 4.\n",
+				(unsigned long long) (sim.time - start_time));
+		success = false;
+	}
+
+	/* a plan of length 0 cancels the current plan, after its pending action */
+	if (sim.submit_plan(agent_ids[0], plan, 5) != status::OK
+	 || sim.submit_plan(agent_ids[0], nullptr, 0) != status::OK)
+	{
+		fprintf(stderr, "ERROR (cancel): Unable to submit the plan.\n");
+		return false;
+	}
+	success &= check_plan(sim, agent_ids[0], plan_status::NONE, 0, "cancel");
+	const uint64_t cancel_time = sim.time;
+	for (unsigned int i = 0; i < 2; i++) {
+		if (sim.turn(agent_ids[1], direction::LEFT) != status::OK) {
+			fprintf(stderr, "ERROR (cancel): Unable to advance the simulation.\n");
+			return false;
+		}
+	}
+	if (sim.time != cancel_time + 1) {
+		fprintf(stderr, "ERROR (cancel): The cancelled plan acted for the agent.\n");
+		success = false;
+	}
+	return check_plan(sim, agent_ids[0], plan_status::NONE, 0, "cancel") && success;
+}
+
+int main(int argc, const char** argv)
+{
+	simulator_config config;
+	init_banana_config(config);
+
+	unsigned int error_count = 0;
+	if (!test_completion(config)) error_count++;
+	if (!test_abort_blocked(config)) error_count++;
+	if (!test_abort_item_visible(config)) error_count++;
+	if (!test_replace_and_cancel(config)) error_count++;
+
+	fprintf(stderr, "Completed the action plan tests (%u errors).\n", error_count);
+	return (error_count == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
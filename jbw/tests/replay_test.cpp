@@ -0,0 +1,202 @@
+/**
+ * Copyright 2019, The Jelly Bean World Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+#define _USE_MATH_DEFINES
+#include "test_common.h"
+
+#include <core/timer.h>
+#include <cmath>
+#include <thread>
+
+constexpr unsigned int agent_count = 64;
+constexpr unsigned int max_time = 500;
+constexpr unsigned int checkpoint_interval = 50;
+
+void on_step(const simulator<empty_data>* sim,
+		const hash_map<uint64_t, agent_state*>& agents, uint64_t time)
+{
+	notify_step(time);
+}
+
+/**
+ * Replays the action log in `log_file` in a new simulator with the seed of
+ * the log plus `seed_offset`. Upon success, the hash of the final state of
+ * the replayed simulator is written to `hash`.
+ */
+bool replay_log(FILE* log_file, uint_fast32_t seed_offset,
+		uint64_t& time, uint64_t& hash, unsigned int& checkpoint_count)
+{
+	rewind(log_file);
+	fixed_width_stream<FILE*> in(log_file);
+	simulator_config* replay_config = (simulator_config*) malloc(sizeof(simulator_config));
+	uint_fast32_t seed; unsigned int interval;
+	if (replay_config == nullptr) {
+		fprintf(stderr, "ERROR: Out of memory.\n");
+		return false;
+	} else if (!read_action_log_header(in, *replay_config, seed, interval)) {
+		fprintf(stderr, "ERROR: Unable to read the header of the action log.\n");
+		free(replay_config); return false;
+	}
+
+	simulator<empty_data> replayed(*replay_config, empty_data(), seed + seed_offset, std::thread::hardware_concurrency());
+	bool result = replay(replayed, in, checkpoint_count);
+	time = replayed.time;
+	hash = replayed.state_hash();
+	free(*replay_config); free(replay_config);
+	return result;
+}
+
+/**
+ * Checks that the simulation doesn't depend on the number of threads that
+ * step it: a simulator with a single thread and one with `thread_count`
+ * threads, with the same seed, receive the same actions in the same order,
+ * and must have the same state after every time step. Returns the number
+ * of errors.
+ */
+unsigned int check_thread_count(const simulator_config& config, unsigned int thread_count)
+{
+	simulator<empty_data> serial(config, empty_data(), 0, 1);
+	simulator<empty_data> parallel(config, empty_data(), 0, thread_count);
+
+	uint64_t serial_ids[agent_count], parallel_ids[agent_count];
+	if (!add_agents(serial, serial_ids, agent_count)
+	 || !add_agents(parallel, parallel_ids, agent_count))
+		return 1;
+
+	for (unsigned int t = 0; t < max_time; t++) {
+		for (unsigned int i = 0; i < agent_count; i++) {
+			if (take_action(serial, serial_ids[i], t + i) != status::OK
+			 || take_action(parallel, parallel_ids[i], t + i) != status::OK)
+			{
+				fprintf(stderr, "ERROR: Unable to submit the action of agent %u.\n", i);
+				return 1;
+			}
+		}
+		if (serial.time != parallel.time || serial.state_hash() != parallel.state_hash()) {
+			fprintf(stderr, "ERROR: The simulation with %u threads differs from the simulation with one thread at time %llu.\n",
+					thread_count, (unsigned long long) serial.time);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, const char** argv)
+{
+	simulator_config config;
+	init_banana_config(config);
+	config.collision_policy = movement_conflict_policy::RANDOM;
+
+	/* the background resampling of the patches near the agents must also be reproduced by the replay */
+	config.resample_interval = 20;
+	config.resample_radius = 1;
+	config.resample_iterations = 500;
+	config.history_length = 4;
+
+	simulator<empty_data> sim(config, empty_data(), 0, std::thread::hardware_concurrency());
+	FILE* log_file = tmpfile();
+	if (log_file == nullptr || !sim.start_action_log(log_file, checkpoint_interval)) {
+		fprintf(stderr, "ERROR: Unable to start the action log.\n");
+		return EXIT_FAILURE;
+	}
+
+	uint64_t agent_ids[agent_count];
+	if (!add_agents(sim, agent_ids, agent_count))
+		return EXIT_FAILURE;
+	sim_time = sim.time;
+
+	/* the agents act concurrently, so the order of their actions is only recorded in the log */
+	std::atomic_uint action_count(0);
+	std::atomic_uint error_count(0);
+	std::thread agents[agent_count];
+	for (unsigned int i = 0; i < agent_count; i++) {
+		agents[i] = std::thread([&,i]() {
+			run_agent(sim, agent_ids[i], action_count, error_count);
+		});
+	}
+
+	uint64_t start_time = sim_time;
+	while (true) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		std::unique_lock<std::mutex> lock(step_lock);
+		if (sim_time >= start_time + max_time) break;
+	}
+	stop_agents();
+	for (unsigned int i = 0; i < agent_count; i++)
+		agents[i].join();
+
+	/* the newest observation in the history of each agent must be its current observation */
+	const size_t vision_size = (2*config.vision_range + 1) * (2*config.vision_range + 1) * config.color_dimension;
+	const size_t stride = observation_stride(config);
+	position positions[agent_count]; direction directions[agent_count];
+	status results[agent_count]; status history_results[agent_count];
+	float* scents = (float*) malloc(sizeof(float) * agent_count * config.scent_dimension);
+	float* visions = (float*) malloc(sizeof(float) * agent_count * vision_size);
+	float* histories = (float*) malloc(sizeof(float) * agent_count * config.history_length * stride);
+	sim.get_observations(agent_ids, agent_count, positions, directions, scents, visions, results);
+	sim.get_observation_histories(agent_ids, agent_count, histories, history_results);
+	for (unsigned int i = 0; i < agent_count; i++) {
+		const float* newest = histories + ((size_t) i * config.history_length + config.history_length - 1) * stride;
+		if (results[i] != status::OK || history_results[i] != status::OK
+		 || memcmp(newest, scents + (size_t) i * config.scent_dimension, sizeof(float) * config.scent_dimension) != 0
+		 || memcmp(newest + config.scent_dimension, visions + i * vision_size, sizeof(float) * vision_size) != 0)
+		{
+			fprintf(stderr, "ERROR: The observation history of agent %u does not end with its current observation.\n", i);
+			error_count++;
+		}
+	}
+	free(scents); free(visions); free(histories);
+
+	uint64_t expected_time = sim.time;
+	uint64_t expected_hash = sim.state_hash();
+	if (!sim.stop_action_log()) {
+		fprintf(stderr, "ERROR: Unable to end the action log.\n");
+		error_count++;
+	}
+
+	/* the replayed simulation must reproduce the original exactly */
+	uint64_t replayed_time, replayed_hash;
+	unsigned int checkpoint_count;
+	timer stopwatch;
+	bool replayed = replay_log(log_file, 0, replayed_time, replayed_hash, checkpoint_count);
+	unsigned long long elapsed = stopwatch.milliseconds();
+	if (!replayed || replayed_time != expected_time || replayed_hash != expected_hash) {
+		fprintf(stderr, "ERROR: The replayed simulation differs from the original.\n");
+		error_count++;
+	} else if (checkpoint_count != expected_time / checkpoint_interval) {
+		fprintf(stderr, "ERROR: Expected %llu checkpoints, but %u were verified.\n",
+				(unsigned long long) (expected_time / checkpoint_interval), checkpoint_count);
+		error_count++;
+	}
+
+	/* a world with a different seed must diverge at the first checkpoint */
+	unsigned int diverged_checkpoint_count;
+	if (replay_log(log_file, 1, replayed_time, replayed_hash, diverged_checkpoint_count)
+	 || diverged_checkpoint_count != 0)
+	{
+		fprintf(stderr, "ERROR: The replay did not detect the divergence of a world with a different seed.\n");
+		error_count++;
+	}
+	fclose(log_file);
+
+	/* stepping with more threads must not change the simulation */
+	error_count += check_thread_count(config, max(2u, std::thread::hardware_concurrency()));
+
+	fprintf(stderr, "Replayed %llu simulation steps of %u agents and verified %u checkpoints (%u errors): %lf simulation steps per second.\n",
+			(unsigned long long) expected_time, agent_count, checkpoint_count, error_count.load(),
+			((double) expected_time / max(1ull, elapsed)) * 1000);
+	return (error_count == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
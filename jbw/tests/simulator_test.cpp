@@ -485,6 +485,38 @@ void on_do_nothing(client<client_data>& c, uint64_t agent_id, status response) {
 	c.data.condition.notify_one();
 }
 
+void on_act_batch(client<client_data>& c, status response,
+		uint64_t* agent_ids, status* results, size_t count)
+{
+	std::unique_lock<std::mutex> lck(c.data.lock);
+	c.data.waiting_for_server = false;
+	c.data.action_result = (response == status::OK);
+	for (size_t i = 0; i < count; i++)
+		c.data.action_result &= (results[i] == status::OK);
+	if (agent_ids != nullptr) free(agent_ids);
+	if (results != nullptr) free(results);
+	c.data.condition.notify_one();
+}
+
+void on_submit_plan(client<client_data>& c, uint64_t agent_id, status response) {
+	std::unique_lock<std::mutex> lck(c.data.lock);
+	c.data.waiting_for_server = false;
+	c.data.action_result = (response == status::OK);
+	c.data.condition.notify_one();
+}
+
+void on_plan_ended(client<client_data>& c, uint64_t* agent_ids,
+		plan_status* results, unsigned int* action_counts, size_t count)
+{
+	if (agent_ids != nullptr) free(agent_ids);
+	if (results != nullptr) free(results);
+	if (action_counts != nullptr) free(action_counts);
+}
+
+void on_get_stats(client<client_data>& c, status response, const step_profile& profile) {
+	fprintf(stderr, "WARNING: `on_get_stats` should not be called.\n");
+}
+
 void on_get_map(
 		client<client_data>& c, status response,
 		const array<array<patch_state>>* map)
@@ -0,0 +1,185 @@
+/**
+ * Copyright 2019, The Jelly Bean World Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+#ifndef JBW_TESTS_TEST_COMMON_H_
+#define JBW_TESTS_TEST_COMMON_H_
+
+/**
+ * The fixture shared by the simulator tests: a simulator data type with no
+ * state, and a configuration with a single item type. Each test changes
+ * only the parameters it depends on.
+ */
+
+#include <jbw/simulator.h>
+
+#include <condition_variable>
+
+using namespace core;
+using namespace jbw;
+
+struct empty_data {
+	static inline void free(empty_data& data) { }
+};
+
+constexpr bool init(empty_data& data, const empty_data& src) { return true; }
+
+inline void set_interaction_args(
+		item_properties* item_types, unsigned int first_item_type,
+		unsigned int second_item_type, interaction_function interaction,
+		std::initializer_list<float> args)
+{
+	item_types[first_item_type].interaction_fns[second_item_type].fn = interaction;
+	item_types[first_item_type].interaction_fns[second_item_type].arg_count = (unsigned int) args.size();
+	item_types[first_item_type].interaction_fns[second_item_type].args = (float*) malloc(max((size_t) 1, sizeof(float) * args.size()));
+
+	unsigned int counter = 0;
+	for (auto i = args.begin(); i != args.end(); i++)
+		item_types[first_item_type].interaction_fns[second_item_type].args[counter++] = *i;
+}
+
+/**
+ * Initializes the parameters of `config` that are shared by the tests,
+ * without adding any item types.
+ */
+inline void init_test_config(simulator_config& config)
+{
+	config.max_steps_per_movement = 1;
+	config.scent_dimension = 3;
+	config.color_dimension = 3;
+	config.vision_range = 5;
+	config.agent_field_of_view = 2.09f;
+	for (unsigned int i = 0; i < (size_t) direction::COUNT; i++)
+		config.allowed_movement_directions[i] = action_policy::ALLOWED;
+	for (unsigned int i = 0; i < (size_t) direction::COUNT; i++)
+		config.allowed_rotations[i] = action_policy::ALLOWED;
+	config.no_op_allowed = false;
+	config.patch_size = 32;
+	config.mcmc_iterations = 4000;
+	config.agent_color = (float*) calloc(config.color_dimension, sizeof(float));
+	config.agent_color[2] = 1.0f;
+	config.collision_policy = movement_conflict_policy::FIRST_COME_FIRST_SERVED;
+	config.decay_param = 0.4f;
+	config.diffusion_param = 0.14f;
+	config.deleted_item_lifetime = 2000;
+}
+
+/**
+ * Initializes `config` with the shared parameters (see `init_test_config`)
+ * and a single item type "banana", which does not block movement or vision,
+ * and whose items attract each other.
+ */
+inline void init_banana_config(simulator_config& config)
+{
+	init_test_config(config);
+
+	unsigned int item_type_count = 1;
+	config.item_types.ensure_capacity(item_type_count);
+	config.item_types[0].name = "banana";
+	config.item_types[0].scent = (float*) calloc(config.scent_dimension, sizeof(float));
+	config.item_types[0].color = (float*) calloc(config.color_dimension, sizeof(float));
+	config.item_types[0].required_item_counts = (unsigned int*) calloc(item_type_count, sizeof(unsigned int));
+	config.item_types[0].required_item_costs = (unsigned int*) calloc(item_type_count, sizeof(unsigned int));
+	config.item_types[0].scent[1] = 1.0f;
+	config.item_types[0].color[1] = 1.0f;
+	config.item_types[0].blocks_movement = false;
+	config.item_types[0].visual_occlusion = 0.0;
+	config.item_types.length = item_type_count;
+
+	config.item_types[0].intensity_fn.fn = constant_intensity_fn;
+	config.item_types[0].intensity_fn.arg_count = 1;
+	config.item_types[0].intensity_fn.args = (float*) malloc(sizeof(float) * 1);
+	config.item_types[0].intensity_fn.args[0] = -5.3f;
+	config.item_types[0].interaction_fns = (energy_function<interaction_function>*)
+			malloc(sizeof(energy_function<interaction_function>) * config.item_types.length);
+	set_interaction_args(config.item_types.data, 0, 0, piecewise_box_interaction_fn, {10.0f, 200.0f, 0.0f, -6.0f});
+}
+
+/* every fifth action is a turn, and the rest are moves */
+template<typename SimulatorData>
+inline status take_action(simulator<SimulatorData>& sim, uint64_t agent_id, uint64_t t) {
+	if (t % 5 == 0) return sim.turn(agent_id, direction::LEFT);
+	else return sim.move(agent_id, direction::UP, 1);
+}
+
+/**
+ * Adds `count` agents to `sim`, storing their IDs in `agent_ids`. Each new
+ * agent is moved away from the origin so that the next one can be added.
+ */
+template<typename SimulatorData>
+bool add_agents(simulator<SimulatorData>& sim, uint64_t* agent_ids, unsigned int count)
+{
+	for (unsigned int i = 0; i < count; i++) {
+		agent_state* new_agent;
+		if (sim.add_agent(agent_ids[i], new_agent) != status::OK) {
+			fprintf(stderr, "ERROR: Unable to add new agent.\n");
+			return false;
+		}
+		for (unsigned int j = 0; j <= i; j++)
+			sim.move(agent_ids[j], direction::UP, 1);
+	}
+	return true;
+}
+
+/**
+ * The latest simulation time, which agent threads in `run_agent` wait on
+ * before acting again. Tests that use `run_agent` call `notify_step` from
+ * their `on_step` callback.
+ */
+uint64_t sim_time = 0;
+bool simulation_running = true;
+std::mutex step_lock;
+std::condition_variable step_condition;
+
+inline void notify_step(uint64_t time) {
+	std::unique_lock<std::mutex> lock(step_lock);
+	sim_time = time;
+	step_condition.notify_all();
+}
+
+/* Stops the agent threads in `run_agent`. */
+inline void stop_agents() {
+	std::unique_lock<std::mutex> lock(step_lock);
+	simulation_running = false;
+	step_condition.notify_all();
+}
+
+/**
+ * Repeatedly submits actions for the agent with the given `agent_id`, waiting
+ * for the simulation to advance after each action, until the simulation
+ * stops. Every fifth action is a turn, and the rest are moves.
+ */
+template<typename SimulatorData>
+void run_agent(simulator<SimulatorData>& sim, uint64_t agent_id,
+		std::atomic_uint& action_count, std::atomic_uint& error_count)
+{
+	while (true) {
+		uint64_t time;
+		{
+			std::unique_lock<std::mutex> lock(step_lock);
+			if (!simulation_running) return;
+			time = sim_time;
+		}
+
+		if (take_action(sim, agent_id, time + agent_id) == status::OK) action_count++;
+		else error_count++;
+
+		std::unique_lock<std::mutex> lock(step_lock);
+		while (sim_time == time && simulation_running)
+			step_condition.wait(lock);
+	}
+}
+
+#endif /* JBW_TESTS_TEST_COMMON_H_ */
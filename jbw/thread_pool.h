@@ -0,0 +1,180 @@
+/**
+ * Copyright 2019, The Jelly Bean World Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations under
+ * the License.
+ */
+
+#ifndef JBW_THREAD_POOL_H_
+#define JBW_THREAD_POOL_H_
+
+#include <core/utility.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace jbw {
+
+using namespace core;
+
+/**
+ * A fixed set of worker threads that execute tasks in parallel. Each call to
+ * `run` executes the given task once on every thread in the pool, including
+ * the calling thread, and returns once all threads have finished. Thus, a
+ * pool with a `thread_count` of 1 has no worker threads, and runs each task
+ * on the calling thread.
+ *
+ * Since the worker threads hold a pointer to the pool, the pool must not be
+ * moved while it is initialized.
+ */
+struct thread_pool {
+	unsigned int thread_count;
+	std::thread* workers;
+
+	/* Lock and condition variables used to dispatch tasks to the workers. */
+	std::mutex lock;
+	std::condition_variable task_started;
+	std::condition_variable task_finished;
+
+	/* The current task, which is invoked as `task(task_data, thread_id)`. */
+	void (*task)(void*, unsigned int);
+	void* task_data;
+
+	/* Incremented whenever a new task is started. */
+	uint64_t task_id;
+
+	/* The number of worker threads that have yet to finish the current task. */
+	unsigned int running_count;
+
+	bool stopping;
+
+	thread_pool(unsigned int thread_count) {
+		if (!init_helper(thread_count))
+			exit(EXIT_FAILURE);
+	}
+
+	~thread_pool() { free_helper(); }
+
+	/**
+	 * Calls `f(thread_id)` on every thread in this pool, where `thread_id`
+	 * is in `[0, thread_count)`, and the calling thread has ID 0. This
+	 * function returns once every call has returned.
+	 */
+	template<typename Function>
+	inline void run(Function& f) {
+		if (thread_count == 1) {
+			f(0); return;
+		}
+
+		std::unique_lock<std::mutex> guard(lock);
+		task = invoke<Function>;
+		task_data = &f;
+		running_count = thread_count - 1;
+		task_id++;
+		task_started.notify_all();
+		guard.unlock();
+
+		f(0);
+
+		guard.lock();
+		while (running_count > 0)
+			task_finished.wait(guard);
+	}
+
+	static inline void free(thread_pool& pool) {
+		pool.free_helper();
+		pool.lock.~mutex();
+		pool.task_started.~condition_variable();
+		pool.task_finished.~condition_variable();
+	}
+
+private:
+	inline bool init_helper(unsigned int new_thread_count) {
+		thread_count = max(1u, new_thread_count);
+		workers = (std::thread*) malloc(sizeof(std::thread) * max(1u, thread_count - 1));
+		if (workers == NULL) {
+			fprintf(stderr, "thread_pool.init_helper ERROR: Insufficient memory for workers.\n");
+			return false;
+		}
+		task = NULL;
+		task_data = NULL;
+		task_id = 0;
+		running_count = 0;
+		stopping = false;
+		for (unsigned int i = 1; i < thread_count; i++)
+			new (&workers[i - 1]) std::thread(&thread_pool::work, this, i);
+		return true;
+	}
+
+	inline void free_helper() {
+		std::unique_lock<std::mutex> guard(lock);
+		stopping = true;
+		task_started.notify_all();
+		guard.unlock();
+
+		for (unsigned int i = 1; i < thread_count; i++) {
+			workers[i - 1].join();
+			workers[i - 1].~thread();
+		}
+		core::free(workers);
+	}
+
+	inline void work(unsigned int thread_id) {
+		uint64_t last_task_id = 0;
+		std::unique_lock<std::mutex> guard(lock);
+		while (true) {
+			while (!stopping && task_id == last_task_id)
+				task_started.wait(guard);
+			if (stopping) return;
+
+			last_task_id = task_id;
+			void (*current_task)(void*, unsigned int) = task;
+			void* current_task_data = task_data;
+			guard.unlock();
+
+			current_task(current_task_data, thread_id);
+
+			guard.lock();
+			running_count--;
+			if (running_count == 0)
+				task_finished.notify_one();
+		}
+	}
+
+	template<typename Function>
+	static void invoke(void* f, unsigned int thread_id) {
+		(*((Function*) f))(thread_id);
+	}
+
+	friend bool init(thread_pool&, unsigned int);
+};
+
+/**
+ * Initializes the given thread_pool `pool` with `thread_count` threads,
+ * including the calling thread, and starts the worker threads.
+ */
+inline bool init(thread_pool& pool, unsigned int thread_count) {
+	new (&pool.lock) std::mutex();
+	new (&pool.task_started) std::condition_variable();
+	new (&pool.task_finished) std::condition_variable();
+	if (!pool.init_helper(thread_count)) {
+		pool.lock.~mutex();
+		pool.task_started.~condition_variable();
+		pool.task_finished.~condition_variable();
+		return false;
+	}
+	return true;
+}
+
+} /* namespace jbw */
+
+#endif /* JBW_THREAD_POOL_H_ */
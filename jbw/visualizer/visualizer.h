@@ -2472,6 +2472,31 @@ void on_do_nothing(client<visualizer_client_data>& c, uint64_t agent_id, status
 	fprintf(stderr, "WARNING: `on_do_nothing` should not be called.\n");
 }
 
+void on_act_batch(client<visualizer_client_data>& c, status response,
+		uint64_t* agent_ids, status* results, size_t count)
+{
+	fprintf(stderr, "WARNING: `on_act_batch` should not be called.\n");
+	if (agent_ids != nullptr) free(agent_ids);
+	if (results != nullptr) free(results);
+}
+
+void on_submit_plan(client<visualizer_client_data>& c, uint64_t agent_id, status response) {
+	fprintf(stderr, "WARNING: `on_submit_plan` should not be called.\n");
+}
+
+void on_plan_ended(client<visualizer_client_data>& c, uint64_t* agent_ids,
+		plan_status* results, unsigned int* action_counts, size_t count)
+{
+	fprintf(stderr, "WARNING: `on_plan_ended` should not be called.\n");
+	if (agent_ids != nullptr) free(agent_ids);
+	if (results != nullptr) free(results);
+	if (action_counts != nullptr) free(action_counts);
+}
+
+void on_get_stats(client<visualizer_client_data>& c, status response, const step_profile& profile) {
+	fprintf(stderr, "WARNING: `on_get_stats` should not be called.\n");
+}
+
 void on_get_map(client<visualizer_client_data>& c,
 		status response, array<array<patch_state>>* map)
 {